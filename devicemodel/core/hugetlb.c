@@ -888,6 +888,31 @@ vm_find_memfd_region(struct vmctx *ctx, vm_paddr_t gpa,
 	return ret;
 }
 
+/*
+ * Copy out the memfd backed regions of the guest memory, e.g. to share
+ * them with another process.  Return the number of regions, or -1 if
+ * there are more than max.
+ */
+int
+vm_get_memfd_regions(struct vmctx *ctx, struct vm_memfd_region *regions,
+			int max)
+{
+	int i;
+
+	if (mem_idx > max)
+		return -1;
+
+	for (i = 0; i < mem_idx; i++) {
+		regions[i].gpa = mmap_mem_regions[i].gpa_start;
+		regions[i].size = mmap_mem_regions[i].gpa_end -
+			mmap_mem_regions[i].gpa_start;
+		regions[i].hva = mmap_mem_regions[i].hva_base;
+		regions[i].fd_offset = mmap_mem_regions[i].fd_offset;
+		regions[i].fd = mmap_mem_regions[i].fd;
+	}
+	return mem_idx;
+}
+
 bool vm_allow_dmabuf(struct vmctx *ctx)
 {
 	uint32_t mem_flags;
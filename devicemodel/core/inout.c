@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "dm.h"
 #include "inout.h"
 #include "log.h"
 SET_DECLARE(inout_port_set, struct inout_port);
@@ -113,8 +114,16 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct acrn_pio_request *pio_reques
 		if (!(flags & IOPORT_F_OUT))
 			return -1;
 	}
+
+	if ((flags & IOPORT_F_CONCURRENT) == 0)
+		vmexit_serial_lock();
+
 	retval = handler(ctx, *pvcpu, in, port, bytes,
 		(uint32_t *)&(pio_request->value), arg);
+
+	if ((flags & IOPORT_F_CONCURRENT) == 0)
+		vmexit_serial_unlock();
+
 	return retval;
 }
 
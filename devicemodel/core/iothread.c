@@ -11,10 +11,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/queue.h>
 #include <pthread.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 
 #include "iothread.h"
 #include "log.h"
@@ -24,23 +26,119 @@
 
 #define MEVENT_MAX 64
 
+/*
+ * The poll window starts from IOTHREAD_POLL_START_NS, grows when an event comes a bit later than the window
+ * and shrinks when an event comes later than the max window, so that the window tracks the event interval
+ * of the device and an idle device does not burn the CPU.
+ */
+#define IOTHREAD_POLL_START_NS	4000UL
+#define IOTHREAD_POLL_GROW	2UL
+#define IOTHREAD_POLL_SHRINK	2UL
+
 static struct iothread_ctx ioctxes[IOTHREAD_NUM];
 static int ioctx_active_cnt;
 /* mutex to protect the free ioctx slot allocation */
 static pthread_mutex_t ioctxes_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static inline uint64_t
+iothread_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+static bool
+iothread_poll_once(struct iothread_ctx *ioctx_x)
+{
+	struct iothread_mevent *aevp;
+	bool progress = false;
+	int i;
+
+	pthread_mutex_lock(&ioctx_x->mtx);
+	for (i = 0; i < ioctx_x->poll_num; i++) {
+		aevp = ioctx_x->poll_mevts[i];
+		if ((*aevp->poll)(aevp->arg)) {
+			progress = true;
+		}
+	}
+	pthread_mutex_unlock(&ioctx_x->mtx);
+
+	return progress;
+}
+
+/*
+ * Busy-wait on the poll handlers for at most the current poll window.
+ * Return true if any work is found.
+ */
+static bool
+iothread_poll(struct iothread_ctx *ioctx_x)
+{
+	uint64_t start = iothread_now_ns();
+
+	do {
+		if (iothread_poll_once(ioctx_x)) {
+			return true;
+		}
+	} while ((iothread_now_ns() - start) < ioctx_x->poll_ns);
+
+	return false;
+}
+
+/*
+ * Adjust the poll window by the time @block_ns that the iothread has blocked in epoll_wait.
+ */
+static void
+iothread_adjust_poll(struct iothread_ctx *ioctx_x, uint64_t block_ns)
+{
+	uint64_t poll_ns = ioctx_x->poll_ns;
+
+	if (block_ns > ioctx_x->poll_max_ns) {
+		/* the event could not be caught by polling, shrink the window */
+		poll_ns /= IOTHREAD_POLL_SHRINK;
+	} else if (block_ns > poll_ns) {
+		/* a larger window would have caught the event, grow the window */
+		poll_ns = (poll_ns == 0UL) ? IOTHREAD_POLL_START_NS : (poll_ns * IOTHREAD_POLL_GROW);
+		if (poll_ns > ioctx_x->poll_max_ns) {
+			poll_ns = ioctx_x->poll_max_ns;
+		}
+	}
+
+	ioctx_x->poll_ns = poll_ns;
+}
+
 static void *
 io_thread(void *arg)
 {
 	struct epoll_event eventlist[MEVENT_MAX];
 	struct iothread_mevent *aevp;
-	int i, n;
+	int i, n, timeout;
+	uint64_t block_start = 0UL;
 	struct iothread_ctx *ioctx_x = (struct iothread_ctx *)arg;
 
 	set_thread_priority(PRIO_IOTHREAD, true);
 
 	while(ioctx_x->started) {
-		n = epoll_wait(ioctx_x->epfd, eventlist, MEVENT_MAX, -1);
+		/*
+		 * In poll mode, the virtqueues and the completion queues are polled before going to sleep.
+		 * If any work is found, the fd events that may be pending are only collected without blocking.
+		 */
+		timeout = -1;
+		if ((ioctx_x->poll_ns != 0UL) && iothread_poll(ioctx_x)) {
+			timeout = 0;
+		}
+
+		if ((timeout != 0) && (ioctx_x->poll_max_ns != 0UL)) {
+			block_start = iothread_now_ns();
+		}
+
+		n = epoll_wait(ioctx_x->epfd, eventlist, MEVENT_MAX, timeout);
+
+		if ((timeout != 0) && (ioctx_x->poll_max_ns != 0UL)) {
+			iothread_adjust_poll(ioctx_x, iothread_now_ns() - block_start);
+		}
+
 		if (n < 0) {
 			if (errno == EINTR) {
 				/* EINTR may happen when io_uring fd is monitored, it is harmless. */
@@ -106,6 +204,16 @@ iothread_add(struct iothread_ctx *ioctx_x, int fd, struct iothread_mevent *aevt)
 		return -1;
 	}
 
+	if (aevt->poll != NULL) {
+		pthread_mutex_lock(&ioctx_x->mtx);
+		if (ioctx_x->poll_num < IOTHREAD_POLL_MEVENT_MAX) {
+			ioctx_x->poll_mevts[ioctx_x->poll_num++] = aevt;
+		} else {
+			pr_err("%s: too many poll handlers, fd %d is not polled\n", __func__, fd);
+		}
+		pthread_mutex_unlock(&ioctx_x->mtx);
+	}
+
 	/* Create a epoll instance before the first fd is added.*/
 	ee.events = EPOLLIN;
 	ee.data.ptr = aevt;
@@ -128,13 +236,23 @@ iothread_add(struct iothread_ctx *ioctx_x, int fd, struct iothread_mevent *aevt)
 int
 iothread_del(struct iothread_ctx *ioctx_x, int fd)
 {
-	int ret = 0;
+	int i, ret = 0;
 
 	if (ioctx_x == NULL) {
 		pr_err("%s: ioctx_x is NULL \n", __func__);
 		return -1;
 	}
 
+	/* the iothread does not poll a mevent any more once the mtx is released */
+	pthread_mutex_lock(&ioctx_x->mtx);
+	for (i = 0; i < ioctx_x->poll_num; i++) {
+		if (ioctx_x->poll_mevts[i]->fd == fd) {
+			ioctx_x->poll_mevts[i] = ioctx_x->poll_mevts[--ioctx_x->poll_num];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ioctx_x->mtx);
+
 	if (ioctx_x->epfd) {
 		ret = epoll_ctl(ioctx_x->epfd, EPOLL_CTL_DEL, fd, NULL);
 		if (ret < 0)
@@ -144,10 +262,50 @@ iothread_del(struct iothread_ctx *ioctx_x, int fd)
 	return ret;
 }
 
+/*
+ * Stop the iothread of @ioctx_x and close its epoll fd, e.g. when the device owning it is deinitialized.
+ * No mevent of @ioctx_x runs any more once it returns. The context slot itself is only released by
+ * iothread_deinit().
+ */
 void
-iothread_deinit(void)
+iothread_stop(struct iothread_ctx *ioctx_x)
 {
+	struct epoll_event ee;
 	void *jval;
+	int efd;
+
+	if (ioctx_x->tid > 0) {
+		pthread_mutex_lock(&ioctx_x->mtx);
+		ioctx_x->started = false;
+		pthread_mutex_unlock(&ioctx_x->mtx);
+
+		/*
+		 * SIGCONT only interrupts epoll_wait if a handler is installed, so also wake the
+		 * iothread by an event without mevent.
+		 */
+		efd = eventfd(1, EFD_NONBLOCK);
+		if (efd >= 0) {
+			ee.events = EPOLLIN;
+			ee.data.ptr = NULL;
+			if (epoll_ctl(ioctx_x->epfd, EPOLL_CTL_ADD, efd, &ee) < 0)
+				pr_err("%s: failed to add the wakeup fd, error is %d\n", __func__, errno);
+		}
+		pthread_kill(ioctx_x->tid, SIGCONT);
+		pthread_join(ioctx_x->tid, &jval);
+		if (efd >= 0)
+			close(efd);
+		ioctx_x->tid = 0;
+		pr_info("%s stop \n", ioctx_x->name);
+	}
+	if (ioctx_x->epfd > 0) {
+		close(ioctx_x->epfd);
+		ioctx_x->epfd = -1;
+	}
+}
+
+void
+iothread_deinit(void)
+{
 	int i;
 	struct iothread_ctx *ioctx_x;
 
@@ -155,19 +313,8 @@ iothread_deinit(void)
 	for (i = 0; i < ioctx_active_cnt; i++) {
 		ioctx_x = &ioctxes[i];
 
-		if (ioctx_x->tid > 0) {
-			pthread_mutex_lock(&ioctx_x->mtx);
-			ioctx_x->started = false;
-			pthread_mutex_unlock(&ioctx_x->mtx);
-			pthread_kill(ioctx_x->tid, SIGCONT);
-			pthread_join(ioctx_x->tid, &jval);
-		}
-		if (ioctx_x->epfd > 0) {
-			close(ioctx_x->epfd);
-			ioctx_x->epfd = -1;
-		}
+		iothread_stop(ioctx_x);
 		pthread_mutex_destroy(&ioctx_x->mtx);
-		pr_info("%s stop \n", ioctx_x->name);
 	}
 	ioctx_active_cnt = 0;
 	pthread_mutex_unlock(&ioctxes_mutex);
@@ -222,6 +369,10 @@ iothread_create(struct iothreads_option *iothr_opt)
 			ioctx_x->started = false;
 			ioctx_x->epfd = epoll_create1(0);
 
+			ioctx_x->poll_max_ns = (uint64_t)iothr_opt->poll_max_us * 1000UL;
+			ioctx_x->poll_ns = 0UL;
+			ioctx_x->poll_num = 0;
+
 			CPU_ZERO(&(ioctx_x->cpuset));
 			if (iothr_opt->cpusets != NULL) {
 				memcpy(&(ioctx_x->cpuset), iothr_opt->cpusets + (i - base), sizeof(cpu_set_t));
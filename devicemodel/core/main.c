@@ -72,6 +72,7 @@
 #include "vdisplay.h"
 #include "iothread.h"
 #include "vm_event.h"
+#include "block_if.h"
 
 #define	VM_MAXCPU		16	/* maximum virtual cpus */
 
@@ -109,6 +110,7 @@ static int virtio_msix = 1;
 static bool debugexit_enabled;
 static int pm_notify_channel;
 static bool cmd_monitor;
+static int ioreq_nworkers;
 
 static char *progname;
 static const int BSP;
@@ -142,6 +144,39 @@ struct mt_vmm_info {
 
 static struct vmctx *_ctx;
 
+/* Max time the dispatcher sleeps while requests are in flight on workers */
+#define IOREQ_INFLIGHT_POLL_NS	20000L
+
+/*
+ * With --ioreq_workers, vm_loop only dispatches io requests and the
+ * emulation runs on a pool of worker threads. vCPU i is always served
+ * by worker (i % ioreq_nworkers), so the requests of one vCPU stay in
+ * order while independent devices are emulated concurrently.
+ */
+struct ioreq_worker {
+	pthread_t	tid;
+	pthread_mutex_t	mtx;
+	pthread_cond_t	cond;
+	uint64_t	pending;	/* bitmap of vCPUs queued on this worker */
+	bool		stop;
+	struct vmctx	*ctx;
+	int		idx;
+};
+
+static struct ioreq_worker ioreq_workers[VM_MAXCPU];
+
+/* bitmap of vCPUs whose request is owned by a worker */
+static uint64_t ioreq_inflight;
+static pthread_mutex_t ioreq_inflight_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ioreq_inflight_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Handlers without MEM_F_CONCURRENT/IOPORT_F_CONCURRENT and PCI config
+ * space accesses are serialized by this lock when ioreq workers are
+ * enabled, to keep the legacy devices single threaded.
+ */
+static pthread_mutex_t vmexit_serial_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static void
 usage(int code)
 {
@@ -153,10 +188,10 @@ usage(int code)
 		"       %*s [--iasl iasl_compiler_path]\n"
 		"       %*s [--enable_trusty] [--intr_monitor param_setting]\n"
 		"       %*s [--acpidev_pt HID] [--mmiodev_pt MMIO_Regions]\n"
-		"       %*s [--vtpm2 sock_path] [--virtio_poll interval]\n"
+		"       %*s [--vtpm2 sock_path] [--virtio_poll interval] [--virtio_stats]\n"
 		"       %*s [--cpu_affinity lapic_id] [--lapic_pt] [--rtvm] [--windows]\n"
 		"       %*s [--debugexit] [--logger_setting param_setting]\n"
-		"       %*s [--ssram] <vm>\n"
+		"       %*s [--ssram] [--ioreq_workers num] <vm>\n"
 		"       -B: bootargs for kernel\n"
 		"       -E: elf image path\n"
 		"       -h: help\n"
@@ -178,6 +213,7 @@ usage(int code)
 		"       --cmd_monitor: enable command monitor\n"
 		"            its params: unix domain socket path\n"
 		"       --virtio_poll: enable virtio poll mode with poll interval with ns\n"
+		"       --virtio_stats: report descriptors fetched per second on each virtqueue\n"
 		"       --acpidev_pt: ACPI device ID args: HID in ACPI Table\n"
 		"       --mmiodev_pt: MMIO resources args: physical MMIO regions\n"
 		"       --vtpm2: Virtual TPM2 args: sock_path=$PATH_OF_SWTPM_SOCKET\n"
@@ -186,7 +222,8 @@ usage(int code)
 		"       --logger_setting: params like console,level=4;kmsg,level=3\n"
 		"       --windows: support Oracle virtio-blk, virtio-net and virtio-input devices\n"
 		"            for windows guest with secure boot\n"
-		"       --virtio_msi: force virtio to use single-vector MSI\n",
+		"       --virtio_msi: force virtio to use single-vector MSI\n"
+		"       --ioreq_workers: number of threads emulating io requests concurrently\n",
 		progname, (int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
@@ -398,7 +435,7 @@ vmexit_mmio_emul(struct vmctx *ctx, struct acrn_io_request *io_req, int *pvcpu)
 {
 	int err;
 
-	stats.vmexit_mmio_emul++;
+	atomic_add_fetch(&stats.vmexit_mmio_emul, 1);
 	err = emulate_mem(ctx, &io_req->reqs.mmio_request);
 
 	if (err) {
@@ -422,6 +459,7 @@ vmexit_pci_emul(struct vmctx *ctx, struct acrn_io_request *io_req, int *pvcpu)
 {
 	int err, in = (io_req->reqs.pci_request.direction == ACRN_IOREQ_DIR_READ);
 
+	vmexit_serial_lock();
 	err = emulate_pci_cfgrw(ctx, *pvcpu, in,
 			io_req->reqs.pci_request.bus,
 			io_req->reqs.pci_request.dev,
@@ -429,6 +467,7 @@ vmexit_pci_emul(struct vmctx *ctx, struct acrn_io_request *io_req, int *pvcpu)
 			io_req->reqs.pci_request.reg,
 			io_req->reqs.pci_request.size,
 			&io_req->reqs.pci_request.value);
+	vmexit_serial_unlock();
 	if (err) {
 		pr_err("Unhandled pci cfg rw at %x:%x.%x reg 0x%x\n",
 			io_req->reqs.pci_request.bus,
@@ -493,6 +532,204 @@ handle_vmexit(struct vmctx *ctx, struct acrn_io_request *io_req, int vcpu)
 	vm_notify_request_done(ctx, vcpu);
 }
 
+void
+vmexit_serial_lock(void)
+{
+	if (ioreq_nworkers > 0)
+		pthread_mutex_lock(&vmexit_serial_mtx);
+}
+
+void
+vmexit_serial_unlock(void)
+{
+	if (ioreq_nworkers > 0)
+		pthread_mutex_unlock(&vmexit_serial_mtx);
+}
+
+/* whether io requests may be emulated concurrently by ioreq workers */
+bool
+ioreq_workers_enabled(void)
+{
+	return ioreq_nworkers > 0;
+}
+
+static inline bool
+vm_loop_suspend_pending(void)
+{
+	int mode = vm_get_suspend_mode();
+
+	return (mode == VM_SUSPEND_FULL_RESET) || (mode == VM_SUSPEND_POWEROFF) ||
+		(mode == VM_SUSPEND_SYSTEM_RESET) || (mode == VM_SUSPEND_SUSPEND);
+}
+
+static void *
+ioreq_worker_thread(void *param)
+{
+	char tname[MAXCOMLEN + 1];
+	struct ioreq_worker *worker = param;
+	uint64_t pending;
+	uint16_t vcpu;
+
+	snprintf(tname, sizeof(tname), "ioreq %d", worker->idx);
+	pthread_setname_np(pthread_self(), tname);
+
+	pthread_mutex_lock(&worker->mtx);
+	while (!worker->stop) {
+		if (worker->pending == 0UL) {
+			pthread_cond_wait(&worker->cond, &worker->mtx);
+			continue;
+		}
+
+		pending = worker->pending;
+		worker->pending = 0UL;
+		pthread_mutex_unlock(&worker->mtx);
+
+		while ((vcpu = ffs64(pending)) != INVALID_BIT_INDEX) {
+			pending &= ~(1UL << vcpu);
+			handle_vmexit(worker->ctx, &ioreq_buf[vcpu], vcpu);
+
+			pthread_mutex_lock(&ioreq_inflight_mtx);
+			ioreq_inflight &= ~(1UL << vcpu);
+			pthread_cond_broadcast(&ioreq_inflight_cond);
+			pthread_mutex_unlock(&ioreq_inflight_mtx);
+		}
+
+		pthread_mutex_lock(&worker->mtx);
+	}
+	pthread_mutex_unlock(&worker->mtx);
+
+	return NULL;
+}
+
+static int
+ioreq_workers_init(struct vmctx *ctx)
+{
+	struct ioreq_worker *worker;
+	int i, error;
+
+	if (ioreq_nworkers > guest_ncpus)
+		ioreq_nworkers = guest_ncpus;
+
+	ioreq_inflight = 0UL;
+	for (i = 0; i < ioreq_nworkers; i++) {
+		worker = &ioreq_workers[i];
+		worker->ctx = ctx;
+		worker->idx = i;
+		worker->pending = 0UL;
+		worker->stop = false;
+		pthread_mutex_init(&worker->mtx, NULL);
+		pthread_cond_init(&worker->cond, NULL);
+
+		error = pthread_create(&worker->tid, NULL, ioreq_worker_thread, worker);
+		if (error) {
+			pr_err("%s, failed to create ioreq worker %d\n", __func__, i);
+			pthread_mutex_destroy(&worker->mtx);
+			pthread_cond_destroy(&worker->cond);
+			/* fall back to the workers created so far */
+			ioreq_nworkers = i;
+			break;
+		}
+	}
+
+	pr_info("%s, %d ioreq worker(s)\n", __func__, ioreq_nworkers);
+	return ioreq_nworkers;
+}
+
+static void
+ioreq_workers_deinit(void)
+{
+	struct ioreq_worker *worker;
+	int i;
+
+	for (i = 0; i < ioreq_nworkers; i++) {
+		worker = &ioreq_workers[i];
+		pthread_mutex_lock(&worker->mtx);
+		worker->stop = true;
+		pthread_cond_signal(&worker->cond);
+		pthread_mutex_unlock(&worker->mtx);
+
+		pthread_join(worker->tid, NULL);
+		pthread_mutex_destroy(&worker->mtx);
+		pthread_cond_destroy(&worker->cond);
+	}
+}
+
+/*
+ * Hand every request in PROCESSING state that is not yet owned by a
+ * worker to the worker of its vCPU. Nothing new is dispatched once a
+ * reset/suspend is pending: handle_vmexit() does not notify the
+ * completion in that case, so the request would be seen again.
+ */
+static void
+ioreq_dispatch(void)
+{
+	struct ioreq_worker *worker;
+	struct acrn_io_request *io_req;
+	int vcpu_id;
+	bool owned;
+
+	if (vm_loop_suspend_pending())
+		return;
+
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+		io_req = &ioreq_buf[vcpu_id];
+		if ((atomic_load(&io_req->processed) != ACRN_IOREQ_STATE_PROCESSING)
+			|| io_req->kernel_handled)
+			continue;
+
+		pthread_mutex_lock(&ioreq_inflight_mtx);
+		owned = ((ioreq_inflight & (1UL << vcpu_id)) != 0UL);
+		ioreq_inflight |= (1UL << vcpu_id);
+		pthread_mutex_unlock(&ioreq_inflight_mtx);
+		if (owned)
+			continue;
+
+		worker = &ioreq_workers[vcpu_id % ioreq_nworkers];
+		pthread_mutex_lock(&worker->mtx);
+		worker->pending |= (1UL << vcpu_id);
+		pthread_cond_signal(&worker->cond);
+		pthread_mutex_unlock(&worker->mtx);
+	}
+}
+
+/*
+ * The HSM keeps waking up the ioreq client as long as a request is not
+ * completed, so while workers own requests the dispatcher polls the
+ * shared ioreq page instead, woken up early by each completion.
+ *
+ * @return false if no request is in flight.
+ */
+static bool
+ioreq_wait_inflight(void)
+{
+	struct timespec ts;
+	bool inflight;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += IOREQ_INFLIGHT_POLL_NS;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&ioreq_inflight_mtx);
+	inflight = (ioreq_inflight != 0UL);
+	if (inflight)
+		pthread_cond_timedwait(&ioreq_inflight_cond, &ioreq_inflight_mtx, &ts);
+	pthread_mutex_unlock(&ioreq_inflight_mtx);
+
+	return inflight;
+}
+
+static void
+ioreq_drain(void)
+{
+	pthread_mutex_lock(&ioreq_inflight_mtx);
+	while (ioreq_inflight != 0UL)
+		pthread_cond_wait(&ioreq_inflight_cond, &ioreq_inflight_mtx);
+	pthread_mutex_unlock(&ioreq_inflight_mtx);
+}
+
 static int
 guest_pm_notify_init(struct vmctx *ctx)
 {
@@ -805,8 +1042,12 @@ vm_loop(struct vmctx *ctx)
 		return;
 	}
 
+	if (ioreq_nworkers > 0)
+		ioreq_workers_init(ctx);
+
 	if (vm_run(ctx) != 0) {
 		pr_err("%s, failed to run VM.\n", __func__);
+		ioreq_workers_deinit();
 		return;
 	}
 
@@ -814,15 +1055,25 @@ vm_loop(struct vmctx *ctx)
 		int vcpu_id;
 		struct acrn_io_request *io_req;
 
-		error = vm_attach_ioreq_client(ctx);
-		if (error)
-			break;
+		if ((ioreq_nworkers == 0) || !ioreq_wait_inflight()) {
+			error = vm_attach_ioreq_client(ctx);
+			if (error)
+				break;
+		}
 
-		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
-			io_req = &ioreq_buf[vcpu_id];
-			if ((atomic_load(&io_req->processed) == ACRN_IOREQ_STATE_PROCESSING)
-				&& !io_req->kernel_handled)
-				handle_vmexit(ctx, io_req, vcpu_id);
+		if (ioreq_nworkers > 0) {
+			ioreq_dispatch();
+
+			/* reset/suspend below must not race with the workers */
+			if (vm_loop_suspend_pending())
+				ioreq_drain();
+		} else {
+			for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+				io_req = &ioreq_buf[vcpu_id];
+				if ((atomic_load(&io_req->processed) == ACRN_IOREQ_STATE_PROCESSING)
+					&& !io_req->kernel_handled)
+					handle_vmexit(ctx, io_req, vcpu_id);
+			}
 		}
 
 		if (VM_SUSPEND_FULL_RESET == vm_get_suspend_mode() ||
@@ -838,6 +1089,9 @@ vm_loop(struct vmctx *ctx)
 			vm_suspend_resume(ctx);
 		}
 	}
+
+	ioreq_drain();
+	ioreq_workers_deinit();
 	pr_err("VM loop exit\n");
 }
 
@@ -884,6 +1138,8 @@ enum {
 	CMD_OPT_PM_BY_VUART,
 	CMD_OPT_WINDOWS,
 	CMD_OPT_FORCE_VIRTIO_MSI,
+	CMD_OPT_IOREQ_WORKERS,
+	CMD_OPT_VIRTIO_STATS,
 };
 
 static struct option long_options[] = {
@@ -927,6 +1183,8 @@ static struct option long_options[] = {
 	{"pm_by_vuart",	required_argument,	0, CMD_OPT_PM_BY_VUART},
 	{"windows",		no_argument,		0, CMD_OPT_WINDOWS},
 	{"virtio_msi",		no_argument,		0, CMD_OPT_FORCE_VIRTIO_MSI},
+	{"ioreq_workers",	required_argument,	0, CMD_OPT_IOREQ_WORKERS},
+	{"virtio_stats",	no_argument,		0, CMD_OPT_VIRTIO_STATS},
 	{0,			0,			0,  0  },
 };
 
@@ -1138,6 +1396,14 @@ main(int argc, char *argv[])
 		case CMD_OPT_FORCE_VIRTIO_MSI:
 			virtio_msix = 0;
 			break;
+		case CMD_OPT_IOREQ_WORKERS:
+			if (dm_strtoi(optarg, NULL, 10, &ioreq_nworkers) != 0 ||
+			    ioreq_nworkers < 0 || ioreq_nworkers > VM_MAXCPU)
+				errx(EX_USAGE, "invalid ioreq_workers param %s", optarg);
+			break;
+		case CMD_OPT_VIRTIO_STATS:
+			virtio_enable_ring_stats();
+			break;
 		case 'h':
 			usage(0);
 		default:
@@ -1221,6 +1487,9 @@ main(int argc, char *argv[])
 			goto fail;
 		}
 
+		/* guest memory is registered to io_uring by the blockif backends */
+		blockif_set_guest_memory(ctx);
+
 		error = mevent_init();
 		if (error) {
 			pr_err("Unable to initialize mevent (%d)\n", errno);
@@ -38,8 +38,10 @@
 #include <string.h>
 #include <pthread.h>
 
+#include "dm.h"
 #include "mem.h"
 #include "tree.h"
+#include "atomic.h"
 
 #define MEMNAMESZ (80)
 
@@ -155,6 +157,7 @@ emulate_mem(struct vmctx *ctx, struct acrn_mmio_request *mmio_req)
 	uint64_t paddr = mmio_req->address;
 	int size = mmio_req->size;
 	struct mmio_rb_range *hint, *entry = NULL;
+	struct mem_range mr;
 	int err;
 
 	pthread_rwlock_rdlock(&mmio_rwlock);
@@ -162,29 +165,45 @@ emulate_mem(struct vmctx *ctx, struct acrn_mmio_request *mmio_req)
 	/*
 	 * First check the per-VM cache
 	 */
-	hint = mmio_hint;
+	hint = atomic_load(&mmio_hint);
 
 	if (hint && paddr >= hint->mr_base && paddr <= hint->mr_end)
 		entry = hint;
 	else if (mmio_rb_lookup(&mmio_rb_root, paddr, &entry) == 0)
-		/* Update the per-VM cache */
-		mmio_hint = entry;
+		/*
+		 * Update the per-VM cache. The ioreq workers do so
+		 * concurrently under the read lock.
+		 */
+		atomic_store(&mmio_hint, entry);
 	else if (mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry)) {
 		pthread_rwlock_unlock(&mmio_rwlock);
 		return -ESRCH;
 	}
 
+	if (entry == NULL) {
+		pthread_rwlock_unlock(&mmio_rwlock);
+		return -EINVAL;
+	}
+
+	/*
+	 * Take a copy of the range while holding the lock: with ioreq
+	 * workers another thread may unregister the entry concurrently.
+	 */
+	mr = entry->mr_param;
 	pthread_rwlock_unlock(&mmio_rwlock);
 
-	if (entry == NULL)
-		return -EINVAL;
+	if ((mr.flags & MEM_F_CONCURRENT) == 0)
+		vmexit_serial_lock();
 
 	if (mmio_req->direction == ACRN_IOREQ_DIR_READ)
 		err = mem_read(ctx, 0, paddr, (uint64_t *)&mmio_req->value,
-				size, &entry->mr_param);
+				size, &mr);
 	else
 		err = mem_write(ctx, 0, paddr, mmio_req->value,
-				size, &entry->mr_param);
+				size, &mr);
+
+	if ((mr.flags & MEM_F_CONCURRENT) == 0)
+		vmexit_serial_unlock();
 
 	return err;
 }
@@ -44,6 +44,45 @@ uint32_t sbuf_get(struct shared_buf *sbuf, uint8_t *data)
 	return sbuf->ele_size;
 }
 
+/**
+ * Copy up to max_ele elements out of the sbuf with a single head update,
+ * so a consumer draining a busy ring pays one barrier per batch instead
+ * of one per element. data must hold max_ele * sbuf->ele_size bytes.
+ *
+ * return: number of elements copied, 0 if the sbuf is empty.
+ */
+uint32_t sbuf_get_many(struct shared_buf *sbuf, uint8_t *data, uint32_t max_ele)
+{
+	uint32_t head, tail, avail, span, nr = 0U;
+
+	if ((sbuf == NULL) || (data == NULL) || (sbuf->ele_size == 0U))
+		return 0U;
+
+	head = sbuf->head;
+	tail = sbuf->tail;
+	/* make sure the elements are read after the tail they belong to */
+	mb();
+
+	while ((nr < max_ele) && (head != tail)) {
+		/* contiguous bytes available before tail or the end of the ring */
+		avail = (tail > head) ? (tail - head) : (sbuf->size - head);
+		span = (max_ele - nr) * sbuf->ele_size;
+		span = (span < avail) ? span : avail;
+
+		memcpy(data + nr * sbuf->ele_size,
+			(void *)sbuf + SBUF_HEAD_SIZE + head, span);
+		nr += span / sbuf->ele_size;
+		head = sbuf_next_ptr(head, span, sbuf->size);
+	}
+
+	if (nr != 0U) {
+		mb();
+		sbuf->head = head;
+	}
+
+	return nr;
+}
+
 int sbuf_clear_buffered(struct shared_buf *sbuf)
 {
 	if (sbuf == NULL)
@@ -30,6 +30,7 @@
 #define DM_VM_EVENT_TUNNEL 1
 #define MAX_VM_EVENT_TUNNELS 2
 #define MAX_EPOLL_EVENTS MAX_VM_EVENT_TUNNELS
+#define VM_EVENT_BATCH 16U /* vm events copied out of a tunnel per sbuf access */
 
 #define THROTTLE_WINDOW	1U /* time window for throttle counter, in secs*/
 
@@ -306,7 +307,8 @@ static void rtc_chg_timer_cb(void *arg, uint64_t nexp)
 static void *vm_event_thread(void *param)
 {
 	int n, i;
-	struct vm_event ve;
+	uint32_t nr, j;
+	struct vm_event ve[VM_EVENT_BATCH];
 	eventfd_t val;
 	struct vm_event_tunnel *tunnel;
 	struct vmctx *ctx = param;
@@ -326,17 +328,17 @@ static void *vm_event_thread(void *param)
 				tunnel = eventlist[i].data.ptr;
 				eventfd_read(tunnel->kick_fd, &val);
 				if (tunnel && tunnel->enabled) {
-					while (!sbuf_is_empty(tunnel->sbuf)) {
-						struct vm_event_proc *proc;
-						sbuf_get(tunnel->sbuf, (uint8_t*)&ve);
-						pr_dbg("%ld vm event from%d %d\n", val, tunnel->type, ve.type);
-						proc = get_vm_event_proc(&ve);
-						if (proc && proc->ve_handler) {
-							(proc->ve_handler)(ctx, &ve);
-						} else {
-							pr_warn("%s: unhandled vm event type %d\n", __func__, ve.type);
+					while ((nr = sbuf_get_many(tunnel->sbuf, (uint8_t *)ve, VM_EVENT_BATCH)) != 0U) {
+						for (j = 0U; j < nr; j++) {
+							struct vm_event_proc *proc;
+							pr_dbg("%ld vm event from%d %d\n", val, tunnel->type, ve[j].type);
+							proc = get_vm_event_proc(&ve[j]);
+							if (proc && proc->ve_handler) {
+								(proc->ve_handler)(ctx, &ve[j]);
+							} else {
+								pr_warn("%s: unhandled vm event type %d\n", __func__, ve[j].type);
+							}
 						}
-
 					}
 				}
 			}
@@ -49,6 +49,7 @@
 #include "dm_string.h"
 #include "log.h"
 #include "iothread.h"
+#include "vmmapi.h"
 
 /*
  * Notes:
@@ -74,6 +75,17 @@
 /* the max number of entries for the io_uring submission/completion queue */
 #define MAX_IO_URING_ENTRIES	256
 
+/*
+ * The kernel limits the size of one io_uring fixed buffer to 1GiB, so the guest memory is registered as
+ * a set of 1GiB chunks. IOU_MAX_FIXED_BUFS is the UIO_MAXIOV limit of the older kernels.
+ */
+#define IOU_FIXED_BUF_SHIFT	30
+#define IOU_FIXED_BUF_SIZE	(1UL << IOU_FIXED_BUF_SHIFT)
+#define IOU_MAX_FIXED_BUFS	1024
+
+/* idle time (in milliseconds) before the SQPOLL kernel thread goes to sleep */
+#define IOU_SQPOLL_IDLE_MS	1000
+
 /*
  * Debug printf
  */
@@ -103,6 +115,8 @@ struct blockif_elem {
 	enum blockstat	     status;
 	pthread_t            tid;
 	off_t		     block;
+	int		     iou_pending;	/* SQEs of this request not completed yet */
+	int		     iou_err;		/* the first error of these SQEs */
 };
 
 struct blockif_queue {
@@ -120,6 +134,8 @@ struct blockif_queue {
 
 	int			in_flight;
 	struct io_uring		ring;
+	bool			fixed_bufs;	/* guest memory is registered to ring */
+	bool			fixed_file;	/* bc->fd is registered to ring as file index 0 */
 	struct iothread_mevent	iomvt;
 	struct iothread_ctx	*ioctx;
 
@@ -175,8 +191,28 @@ struct blockif_ctxt {
 	 * It indicates that consecutive requests are executed sequentially.
 	 */
 	uint8_t			bst_block;
+
+	/* whether submission queue polling is used by io_uring or not */
+	uint8_t			sqpoll;
+
+	/* whether discard is submitted to io_uring or processed synchronously */
+	uint8_t			iou_discard;
+};
+
+/*
+ * Guest memory segments (lowmem and highmem) and the fixed buffers they are split into.
+ * They are set up by blockif_set_guest_memory before any blockif is opened.
+ */
+struct guest_mem_seg {
+	char	*base;
+	size_t	len;
+	int	buf_idx;	/* index of the first fixed buffer of this segment */
 };
 
+static struct guest_mem_seg guest_mem_segs[2];
+static struct iovec guest_mem_bufs[IOU_MAX_FIXED_BUFS];
+static int guest_mem_buf_num;
+
 static pthread_once_t blockif_once = PTHREAD_ONCE_INIT;
 
 struct blockif_sig_elem {
@@ -314,17 +350,17 @@ discard_range_validate(struct blockif_ctxt *bc, off_t start, off_t size)
 	return 0;
 }
 
+/*
+ * Parse the discard ranges of br into arg. On success, the number of ranges is returned in segment.
+ */
 static int
-blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
+blockif_get_discard_ranges(struct blockif_ctxt *bc, struct blockif_req *br, off_t arg[][2], int *segment)
 {
-	int err;
 	struct discard_range *range;
-	int n_range, i, segment;
-	off_t arg[MAX_DISCARD_SEGMENT][2];
+	int n_range, i;
 
-	err = 0;
 	n_range = 0;
-	segment = 0;
+	*segment = 0;
 	if (!bc->candiscard)
 		return EOPNOTSUPP;
 
@@ -339,8 +375,8 @@ blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
 			arg[i][0] = range[i].sector * DEV_BSIZE +
 					bc->sub_file_start_lba;
 			arg[i][1] = range[i].num_sectors * DEV_BSIZE;
-			segment++;
-			if (segment > bc->max_discard_seg) {
+			(*segment)++;
+			if (*segment > bc->max_discard_seg) {
 				WPRINTF(("segment > max_discard_seg\n"));
 				return EINVAL;
 			}
@@ -353,8 +389,23 @@ blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
 		/* ahci parse discard range to br->offset and br->reside */
 		arg[0][0] = br->offset + bc->sub_file_start_lba;
 		arg[0][1] = br->resid;
-		segment = 1;
+		*segment = 1;
 	}
+
+	return 0;
+}
+
+static int
+blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
+{
+	int err;
+	int i, segment;
+	off_t arg[MAX_DISCARD_SEGMENT][2];
+
+	err = blockif_get_discard_ranges(bc, br, arg, &segment);
+	if (err)
+		return err;
+
 	for (i = 0; i < segment; i++) {
 		if (bc->isblk) {
 			err = ioctl(bc->fd, BLKDISCARD, arg[i]);
@@ -1033,28 +1084,92 @@ static struct blockif_ops blockif_ops_thread_pool = {
 };
 
 static bool
-is_io_uring_supported_op(enum blockop op)
+is_io_uring_supported_op(struct blockif_ctxt *bc, enum blockop op)
+{
+	return ((op == BOP_READ) || (op == BOP_WRITE) || (op == BOP_FLUSH) ||
+		((op == BOP_DISCARD) && bc->iou_discard));
+}
+
+/*
+ * Return the index of the fixed buffer which covers the whole iov, or -1 if there is no such buffer.
+ */
+static int
+iou_fixed_buf_index(const struct iovec *iov)
+{
+	struct guest_mem_seg *seg;
+	char *base = iov->iov_base;
+	size_t off, last;
+	int i;
+
+	if (iov->iov_len == 0) {
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		seg = &guest_mem_segs[i];
+		if ((seg->len == 0) || (base < seg->base) || (base >= seg->base + seg->len)) {
+			continue;
+		}
+
+		off = base - seg->base;
+		if (iov->iov_len > seg->len - off) {
+			return -1;
+		}
+
+		/* READ_FIXED/WRITE_FIXED could not cross the boundary of one fixed buffer */
+		last = off + iov->iov_len - 1;
+		if ((off >> IOU_FIXED_BUF_SHIFT) != (last >> IOU_FIXED_BUF_SHIFT)) {
+			return -1;
+		}
+
+		return seg->buf_idx + (int)(off >> IOU_FIXED_BUF_SHIFT);
+	}
+
+	return -1;
+}
+
+/*
+ * Fill the common fields of one SQE of the request be. The prep helpers of liburing reset the flags,
+ * so this shall be called after them.
+ */
+static void
+iou_set_sqe(struct blockif_queue *bq, struct blockif_elem *be, struct io_uring_sqe *sqe, unsigned int flags)
 {
-	return ((op == BOP_READ) || (op == BOP_WRITE) || (op == BOP_FLUSH));
+	if (bq->fixed_file) {
+		flags |= IOSQE_FIXED_FILE;
+	}
+	io_uring_sqe_set_flags(sqe, flags);
+	io_uring_sqe_set_data(sqe, be);
+	be->iou_pending++;
+	bq->in_flight++;
 }
 
+/*
+ * Submit the request be as one SQE or a chain of linked SQEs:
+ * - BOP_READ: one read.
+ * - BOP_WRITE: one write, followed by a linked fdatasync in writethru mode.
+ * - BOP_FLUSH: one fdatasync with IOSQE_IO_DRAIN, so that it starts after all the prior requests complete.
+ * - BOP_DISCARD: one fallocate(PUNCH_HOLE) for each range, followed by a linked fdatasync for regular files.
+ *
+ * Return -1 if there is not enough SQEs, a positive error code if the request is invalid, otherwise the
+ * result of io_uring_submit.
+ */
 static int
 iou_submit_sqe(struct blockif_queue *bq, struct blockif_elem *be)
 {
 	int ret;
 	struct io_uring *ring = &bq->ring;
-	struct io_uring_sqe *sqes = io_uring_get_sqe(ring);
+	struct io_uring_sqe *sqes;
 	struct blockif_req *br = be->req;
 	struct blockif_ctxt *bc = bq->bc;
 	struct br_align_info *info = &br->align_info;
 	struct iovec *iovecs;
 	size_t iovcnt;
 	off_t offset;
-
-	if (!sqes) {
-		pr_err("%s: io_uring_get_sqe fails. NO available submission queue entry. \n", __func__);
-		return -1;
-	}
+	int fd, buf_idx = -1;
+	int i, segment = 0, nr_sqes = 1;
+	unsigned int link_flag;
+	off_t discard_arg[MAX_DISCARD_SEGMENT][2];
 
 	if ((be->op == BOP_READ) || (be->op == BOP_WRITE)) {
 		if (info->need_conversion) {
@@ -1067,26 +1182,98 @@ iou_submit_sqe(struct blockif_queue *bq, struct blockif_elem *be)
 			iovecs = br->iov;
 			iovcnt = br->iovcnt;
 			offset = br->offset + bc->sub_file_start_lba;
+
+			/* a single guest segment could be transferred from/to the registered guest memory directly */
+			if ((iovcnt == 1) && bq->fixed_bufs) {
+				buf_idx = iou_fixed_buf_index(iovecs);
+			}
+		}
+
+		if ((be->op == BOP_WRITE) && !bc->wce) {
+			nr_sqes = 2;
+		}
+	} else if (be->op == BOP_DISCARD) {
+		ret = blockif_get_discard_ranges(bc, br, discard_arg, &segment);
+		if (ret != 0) {
+			return ret;
 		}
+		/* no SQE would complete a request without any range */
+		if (segment == 0) {
+			WPRINTF(("discard request without any range\n"));
+			return EINVAL;
+		}
+		nr_sqes = bc->isblk ? segment : (segment + 1);
 	}
 
+	if (io_uring_sq_space_left(ring) < (unsigned int)nr_sqes) {
+		pr_err("%s: io_uring_get_sqe fails. NO available submission queue entry. \n", __func__);
+		return -1;
+	}
+
+	be->iou_pending = 0;
+	be->iou_err = 0;
+	fd = bq->fixed_file ? 0 : bc->fd;
+
 	switch (be->op) {
 	case BOP_READ:
-		io_uring_prep_readv(sqes, bc->fd, iovecs, iovcnt, offset);
+		sqes = io_uring_get_sqe(ring);
+		if (buf_idx >= 0) {
+			io_uring_prep_read_fixed(sqes, fd, iovecs->iov_base, iovecs->iov_len, offset, buf_idx);
+		} else {
+			io_uring_prep_readv(sqes, fd, iovecs, iovcnt, offset);
+		}
+		iou_set_sqe(bq, be, sqes, 0);
 		break;
 	case BOP_WRITE:
-		io_uring_prep_writev(sqes, bc->fd, iovecs, iovcnt, offset);
+		sqes = io_uring_get_sqe(ring);
+		if (buf_idx >= 0) {
+			io_uring_prep_write_fixed(sqes, fd, iovecs->iov_base, iovecs->iov_len, offset, buf_idx);
+		} else {
+			io_uring_prep_writev(sqes, fd, iovecs, iovcnt, offset);
+		}
+		iou_set_sqe(bq, be, sqes, (nr_sqes > 1) ? IOSQE_IO_LINK : 0);
+
+		/* writethru: the data is flushed before the write is reported completed */
+		if (nr_sqes > 1) {
+			sqes = io_uring_get_sqe(ring);
+			io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
+			iou_set_sqe(bq, be, sqes, 0);
+		}
 		break;
 	case BOP_FLUSH:
-		io_uring_prep_fsync(sqes, bc->fd, IORING_FSYNC_DATASYNC);
+		sqes = io_uring_get_sqe(ring);
+		io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
+		iou_set_sqe(bq, be, sqes, IOSQE_IO_DRAIN);
+		break;
+	case BOP_DISCARD:
+		/*
+		 * FALLOC_FL_PUNCH_HOLE:
+		 *	Deallocates space in the byte range starting at offset and
+		 *	continuing for length bytes. For a block device, the range
+		 *	is discarded (or zeroed out with unmap) by the block layer.
+		 * FALLOC_FL_KEEP_SIZE:
+		 *	Do not modify the apparent length of the file.
+		 *
+		 * The ranges are linked, so that the first failure cancels the rest.
+		 */
+		for (i = 0; i < segment; i++) {
+			link_flag = (i < (nr_sqes - 1)) ? IOSQE_IO_LINK : 0;
+			sqes = io_uring_get_sqe(ring);
+			io_uring_prep_fallocate(sqes, fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+					discard_arg[i][0], discard_arg[i][1]);
+			iou_set_sqe(bq, be, sqes, link_flag);
+		}
+		if (!bc->isblk) {
+			sqes = io_uring_get_sqe(ring);
+			io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
+			iou_set_sqe(bq, be, sqes, 0);
+		}
 		break;
 	default:
 		/* is_io_uring_supported_op guarantees that this case will not occur */
 		break;
 	}
 
-	io_uring_sqe_set_data(sqes, be);
-	bq->in_flight++;
 	ret = io_uring_submit(ring);
 	if (ret < 0) {
 		pr_err("%s: io_uring_submit fails, error %s \n", __func__, strerror(-ret));
@@ -1104,7 +1291,7 @@ iou_submit(struct blockif_queue *bq)
 	struct blockif_ctxt *bc = bq->bc;
 
 	while (blockif_dequeue(bq, 0, &be)) {
-		if (is_io_uring_supported_op(be->op)) {
+		if (is_io_uring_supported_op(bc, be->op)) {
 			err = iou_submit_sqe(bq, be);
 
 			/*
@@ -1114,6 +1301,14 @@ iou_submit(struct blockif_queue *bq)
 			if (err == -1) {
 				break;
 			}
+
+			/* a positive value means that the request is rejected before submission */
+			if (err > 0) {
+				br = be->req;
+				be->status = BST_DONE;
+				(*br->callback)(br, err);
+				blockif_complete(bq, be);
+			}
 		} else {
 			br = be->req;
 			if (be->op == BOP_DISCARD) {
@@ -1137,7 +1332,8 @@ iou_process_completions(struct blockif_queue *bq)
 	struct blockif_elem *be;
 	struct blockif_req *br;
 	struct io_uring *ring = &bq->ring;
-	int err = 0;
+	struct blockif_ctxt *bc = bq->bc;
+	int err = 0, res;
 
 	while (io_uring_peek_cqe(ring, &cqes) == 0) {
 		if (!cqes) {
@@ -1146,6 +1342,7 @@ iou_process_completions(struct blockif_queue *bq)
 		}
 
 		be = io_uring_cqe_get_data(cqes);
+		res = cqes->res;
 		bq->in_flight--;
 		io_uring_cqe_seen(ring, cqes);
 		cqes = NULL;
@@ -1160,6 +1357,28 @@ iou_process_completions(struct blockif_queue *bq)
 			break;
 		}
 
+		/* the SQEs after a failed one in a linked chain complete with -ECANCELED, keep the first error */
+		if ((res < 0) && (be->iou_err == 0)) {
+			be->iou_err = -res;
+		}
+
+		/* wait until all the SQEs of this request complete */
+		if (--be->iou_pending > 0) {
+			continue;
+		}
+		err = be->iou_err;
+
+		if (be->op == BOP_DISCARD) {
+			if ((err == EOPNOTSUPP) && bc->isblk) {
+				/* the device does not support fallocate, fall back to the synchronous BLKDISCARD */
+				WPRINTF(("fallocate is not supported, use BLKDISCARD for discard\n"));
+				bc->iou_discard = 0;
+				err = blockif_process_discard(bc, br);
+			} else if (err == 0) {
+				br->resid = 0;
+			}
+		}
+
 		/* when a misaligned request is converted to an aligned one, need to do some post-work */
 		if (br->align_info.need_conversion) {
 			if (be->op == BOP_READ) {
@@ -1168,10 +1387,6 @@ iou_process_completions(struct blockif_queue *bq)
 			blockif_deinit_bounce_iov(br);
 		}
 
-		if (be->op == BOP_WRITE) {
-			err = blockif_flush_cache(bq->bc);
-		}
-
 		be->status = BST_DONE;
 		(*br->callback)(br, err);
 		blockif_complete(bq, be);
@@ -1211,6 +1426,22 @@ iou_completion_cb(void *arg)
 	iou_reap_and_submit(bq);
 }
 
+/*
+ * Poll handler of the iothread: reap the completions without waiting for the io_uring fd event.
+ */
+static bool
+iou_poll_cb(void *arg)
+{
+	struct blockif_queue *bq = arg;
+
+	if (io_uring_cq_ready(&bq->ring) == 0) {
+		return false;
+	}
+
+	iou_reap_and_submit(bq);
+	return true;
+}
+
 static int
 iou_set_iothread(struct blockif_queue *bq)
 {
@@ -1219,6 +1450,7 @@ iou_set_iothread(struct blockif_queue *bq)
 
 	bq->iomvt.arg = bq;
 	bq->iomvt.run = iou_completion_cb;
+	bq->iomvt.poll = iou_poll_cb;
 	bq->iomvt.fd = fd;
 
 	ret = iothread_add(bq->ioctx, fd, &bq->iomvt);
@@ -1246,24 +1478,51 @@ iou_init(struct blockif_queue *bq, char *tag __attribute__((unused)))
 {
 	int ret = 0;
 	struct io_uring *ring = &bq->ring;
+	struct io_uring_params params;
 
 	/*
 	 * - When Service VM owns more dedicated cores, IORING_SETUP_SQPOLL and IORING_SETUP_IOPOLL, along with NVMe
 	 *   polling mechanism could benefit the performance.
 	 * - When Service VM owns limited cores, the benefit of polling is also limited.
 	 * As in most of the use cases, Service VM does not own much dedicated cores, IORING_SETUP_SQPOLL and
-	 * IORING_SETUP_IOPOLL are not enabled by default.
+	 * IORING_SETUP_IOPOLL are not enabled by default. IORING_SETUP_SQPOLL could be enabled by the "sqpoll" option.
 	 */
-	ret = io_uring_queue_init(MAX_IO_URING_ENTRIES, ring, 0);
+	memset(&params, 0, sizeof(params));
+	if (bq->bc->sqpoll) {
+		params.flags |= IORING_SETUP_SQPOLL;
+		params.sq_thread_idle = IOU_SQPOLL_IDLE_MS;
+	}
+
+	ret = io_uring_queue_init_params(MAX_IO_URING_ENTRIES, ring, &params);
 	if (ret < 0) {
 		pr_err("%s: io_uring_queue_init fails, error %d \n", __func__, ret);
-	} else {
-		ret = iou_set_iothread(bq);
+		return ret;
+	}
+
+	/*
+	 * Registering the file and the guest memory saves the fget/fput and the page pinning of each request.
+	 * They are optimizations only, so the failures are not fatal.
+	 */
+	bq->fixed_file = (io_uring_register_files(ring, &bq->bc->fd, 1) == 0);
+	if (!bq->fixed_file) {
+		pr_warn("%s: fails to register file to io_uring \n", __func__);
+	}
+
+	bq->fixed_bufs = false;
+	if (guest_mem_buf_num > 0) {
+		ret = io_uring_register_buffers(ring, guest_mem_bufs, guest_mem_buf_num);
 		if (ret < 0) {
-			pr_err("%s: iou_set_iothread fails \n", __func__);
+			pr_warn("%s: fails to register guest memory to io_uring, error %s \n", __func__, strerror(-ret));
+		} else {
+			bq->fixed_bufs = true;
 		}
 	}
 
+	ret = iou_set_iothread(bq);
+	if (ret < 0) {
+		pr_err("%s: iou_set_iothread fails \n", __func__);
+	}
+
 	return ret;
 }
 
@@ -1291,6 +1550,36 @@ static struct blockif_ops blockif_ops_iou = {
 	.request	= iou_submit_and_reap,
 };
 
+void
+blockif_set_guest_memory(struct vmctx *ctx)
+{
+	struct guest_mem_seg *seg;
+	size_t off;
+	int i;
+
+	guest_mem_segs[0].base = ctx->baseaddr;
+	guest_mem_segs[0].len = ctx->lowmem;
+	guest_mem_segs[1].base = ctx->baseaddr + ctx->highmem_gpa_base;
+	guest_mem_segs[1].len = ctx->highmem;
+
+	guest_mem_buf_num = 0;
+	for (i = 0; i < 2; i++) {
+		seg = &guest_mem_segs[i];
+		seg->buf_idx = guest_mem_buf_num;
+		for (off = 0; off < seg->len; off += IOU_FIXED_BUF_SIZE) {
+			if (guest_mem_buf_num >= IOU_MAX_FIXED_BUFS) {
+				pr_warn("%s: guest memory is too large to be registered to io_uring\n", __func__);
+				memset(guest_mem_segs, 0, sizeof(guest_mem_segs));
+				guest_mem_buf_num = 0;
+				return;
+			}
+			guest_mem_bufs[guest_mem_buf_num].iov_base = seg->base + off;
+			guest_mem_bufs[guest_mem_buf_num].iov_len = MIN(IOU_FIXED_BUF_SIZE, seg->len - off);
+			guest_mem_buf_num++;
+		}
+	}
+}
+
 struct blockif_ctxt *
 blockif_open(const char *optstr, const char *ident, int queue_num, struct iothreads_info *iothrds_info)
 {
@@ -1310,7 +1599,7 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	int max_discard_sectors, max_discard_seg, discard_sector_alignment;
 	off_t probe_arg[] = {0, 0};
 	int aio_mode;
-	int bypass_host_cache, open_flag, bst_block;
+	int bypass_host_cache, open_flag, bst_block, sqpoll;
 
 	pthread_once(&blockif_once, blockif_init);
 
@@ -1338,6 +1627,9 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	/* By default, bst_block is 1, meaning that the BST_BLOCK logic in blockif_dequeue is enabled. */
 	bst_block = 1;
 
+	/* By default, submission queue polling is not used. */
+	sqpoll = 0;
+
 	candiscard = 0;
 
 	if (queue_num <= 0)
@@ -1366,6 +1658,8 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 			bypass_host_cache = 1;
 		else if (!strcmp(cp, "no_bst_block"))
 			bst_block = 0;
+		else if (!strcmp(cp, "sqpoll"))
+			sqpoll = 1;
 		else if (!strncmp(cp, "discard", strlen("discard"))) {
 			strsep(&cp, "=");
 			if (cp != NULL) {
@@ -1581,6 +1875,10 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	if (bc->aio_mode == AIO_MODE_IO_URING) {
 		bc->ops = &blockif_ops_iou;
 		bc->bst_block = 0;
+		bc->sqpoll = sqpoll;
+
+		/* a discard request with all its ranges shall fit in the submission queue */
+		bc->iou_discard = (bc->candiscard && !bc->rdonly && (bc->max_discard_seg < MAX_IO_URING_ENTRIES));
 	} else {
 		bc->ops = &blockif_ops_thread_pool;
 		bc->bst_block = bst_block;
@@ -48,6 +48,7 @@
 #include "sw_load.h"
 #include "log.h"
 #include "vdisplay.h"
+#include "virtio.h"
 
 #define CONF1_ADDR_PORT    0x0cf8
 #define CONF1_DATA_PORT    0x0cfc
@@ -493,6 +494,25 @@ bar_value(int size, uint64_t val)
 	return val & mask;
 }
 
+/*
+ * The BAR and config space accesses of a device are serialized by its
+ * io_mtx when ioreq workers may emulate them concurrently.  Without
+ * workers, they all run on the vm_loop thread.
+ */
+static inline void
+pci_vdev_io_lock(struct pci_vdev *dev)
+{
+	if (ioreq_workers_enabled())
+		pthread_mutex_lock(&dev->io_mtx);
+}
+
+static inline void
+pci_vdev_io_unlock(struct pci_vdev *dev)
+{
+	if (ioreq_workers_enabled())
+		pthread_mutex_unlock(&dev->io_mtx);
+}
+
 static int
 pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		    uint32_t *eax, void *arg)
@@ -500,8 +520,9 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	struct pci_vdev *pdi = arg;
 	struct pci_vdev_ops *ops = pdi->dev_ops;
 	uint64_t offset;
-	int i;
+	int i, ret = -1;
 
+	pci_vdev_io_lock(pdi);
 	for (i = 0; i <= PCI_BARMAX; i++) {
 		if (pdi->bar[i].type == PCIBAR_IO &&
 		    port >= pdi->bar[i].addr &&
@@ -514,10 +535,13 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 			} else
 				(*ops->vdev_barwrite)(ctx, vcpu, pdi, i, offset,
 				                      bytes, bar_value(bytes, *eax));
-			return 0;
+			ret = 0;
+			break;
 		}
 	}
-	return -1;
+	pci_vdev_io_unlock(pdi);
+
+	return ret;
 }
 
 static int
@@ -529,7 +553,9 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 	uint64_t offset;
 	int bidx = (int) arg2;
 
+	pci_vdev_io_lock(pdi);
 	if (addr + size > pdi->bar[bidx].addr + pdi->bar[bidx].size) {
+		pci_vdev_io_unlock(pdi);
 		pr_err("%s, Out of emulated memory range\n", __func__);
 		return -ESRCH;
 	}
@@ -564,6 +590,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 			*val = bar_value(size, *val);
 		}
 	}
+	pci_vdev_io_unlock(pdi);
 
 	return 0;
 }
@@ -628,7 +655,7 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 		iop.port = dev->bar[idx].addr;
 		iop.size = dev->bar[idx].size;
 		if (registration) {
-			iop.flags = IOPORT_F_INOUT;
+			iop.flags = IOPORT_F_INOUT | IOPORT_F_CONCURRENT;
 			iop.handler = pci_emul_io_handler;
 			iop.arg = dev;
 			error = register_inout(&iop);
@@ -642,7 +669,7 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 		mr.base = dev->bar[idx].addr;
 		mr.size = dev->bar[idx].size;
 		if (registration) {
-			mr.flags = MEM_F_RW;
+			mr.flags = MEM_F_RW | MEM_F_CONCURRENT;
 			mr.handler = pci_emul_mem_handler;
 			mr.arg1 = dev;
 			mr.arg2 = idx;
@@ -1045,6 +1072,7 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	pdi->slot = slot;
 	pdi->func = func;
 	pthread_mutex_init(&pdi->lintr.lock, NULL);
+	pthread_mutex_init(&pdi->io_mtx, NULL);
 	pdi->lintr.pin = 0;
 	pdi->lintr.state = IDLE;
 	pdi->lintr.pirq_pin = 0;
@@ -1066,8 +1094,10 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	err = (*ops->vdev_init)(ctx, pdi, fi->fi_param);
 	if (err == 0)
 		fi->fi_devi = pdi;
-	else
+	else {
+		pthread_mutex_destroy(&pdi->io_mtx);
 		free(pdi);
+	}
 
 	return err;
 }
@@ -1082,9 +1112,12 @@ pci_emul_deinit(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 		free(fi->fi_param);
 
 	if (fi->fi_devi) {
+		/* the irqfds of the virtqueues outlive the device state */
+		virtio_irqfd_release_dev(fi->fi_devi);
 		pci_lintr_release(fi->fi_devi);
 		pci_emul_free_bars(fi->fi_devi);
 		pci_emul_free_msixcap(fi->fi_devi);
+		pthread_mutex_destroy(&fi->fi_devi->io_mtx);
 		free(fi->fi_devi);
 	}
 }
@@ -2404,6 +2437,7 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 	}
 
 	ops = dev->dev_ops;
+	pci_vdev_io_lock(dev);
 
 	/*
 	 * For non-passthru device, extended config space is NOT supported.
@@ -2427,7 +2461,7 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 				if (coff <= PCI_REGMAX + 4)
 					*eax = 0x00000000;
 			}
-			return;
+			goto out;
 		}
 	}
 
@@ -2452,7 +2486,7 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 		if (ops->vdev_cfgwrite != NULL &&
 		    (*ops->vdev_cfgwrite)(ctx, vcpu, dev,
 					  coff, bytes, *eax) == 0)
-			return;
+			goto out;
 
 		/*
 		 * Special handling for write to BAR registers
@@ -2463,7 +2497,7 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 			 * 4-byte aligned.
 			 */
 			if (bytes != 4 || (coff & 0x3) != 0)
-				return;
+				goto out;
 			idx = (coff - PCIR_BAR(0)) / 4;
 			mask = ~(dev->bar[idx].size - 1);
 
@@ -2544,7 +2578,7 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 				break;
 			default:
 				pr_err("%s: invalid bar type %d\n", __func__, dev->bar[idx].type);
-				return;
+				goto out;
 			}
 			pci_set_cfgdata32(dev, coff, bar);
 
@@ -2558,6 +2592,9 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 			CFGWRITE(dev, coff, *eax, bytes);
 		}
 	}
+
+out:
+	pci_vdev_io_unlock(dev);
 }
 
 int
@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * vhost-user transport: the vhost requests are sent as messages over a
+ * UNIX socket to a userspace backend, which maps the guest memory from
+ * the memfd of the hugetlb backed guest memory and serves the rings
+ * without the device model on the data path.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "vmmapi.h"
+#include "vhost.h"
+
+static int vhost_user_debug;
+#define LOG_TAG "vhost-user: "
+#define DPRINTF(fmt, args...) \
+	do { if (vhost_user_debug) pr_dbg(LOG_TAG fmt, ##args); } while (0)
+#define WPRINTF(fmt, args...) pr_err(LOG_TAG fmt, ##args)
+
+enum vhost_user_request {
+	VHOST_USER_GET_FEATURES = 1,
+	VHOST_USER_SET_FEATURES = 2,
+	VHOST_USER_SET_OWNER = 3,
+	VHOST_USER_RESET_OWNER = 4,
+	VHOST_USER_SET_MEM_TABLE = 5,
+	VHOST_USER_SET_VRING_NUM = 8,
+	VHOST_USER_SET_VRING_ADDR = 9,
+	VHOST_USER_SET_VRING_BASE = 10,
+	VHOST_USER_GET_VRING_BASE = 11,
+	VHOST_USER_SET_VRING_KICK = 12,
+	VHOST_USER_SET_VRING_CALL = 13,
+	VHOST_USER_GET_PROTOCOL_FEATURES = 15,
+	VHOST_USER_SET_PROTOCOL_FEATURES = 16,
+	VHOST_USER_SET_VRING_ENABLE = 18,
+	VHOST_USER_GET_CONFIG = 24,
+};
+
+#define VHOST_USER_VERSION		0x1
+#define VHOST_USER_REPLY_MASK		(0x1 << 2)
+#define VHOST_USER_VRING_IDX_MASK	0xff
+#define VHOST_USER_VRING_NOFD_MASK	(0x1 << 8)
+
+#define VHOST_USER_F_PROTOCOL_FEATURES	30
+#define VHOST_USER_PROTOCOL_F_CONFIG	9
+#define VHOST_USER_PROTOCOL_FEATURES	(1UL << VHOST_USER_PROTOCOL_F_CONFIG)
+
+#define VHOST_USER_MAX_REGIONS		8
+#define VHOST_USER_MAX_CONFIG_SIZE	256
+
+struct vhost_user_region {
+	uint64_t guest_phys_addr;
+	uint64_t memory_size;
+	uint64_t userspace_addr;
+	uint64_t mmap_offset;
+};
+
+struct vhost_user_memory {
+	uint32_t nregions;
+	uint32_t padding;
+	struct vhost_user_region regions[VHOST_USER_MAX_REGIONS];
+};
+
+struct vhost_user_config {
+	uint32_t offset;
+	uint32_t size;
+	uint32_t flags;
+	uint8_t region[VHOST_USER_MAX_CONFIG_SIZE];
+};
+
+struct vhost_user_msg {
+	uint32_t request;
+	uint32_t flags;
+	uint32_t size;		/* size of the payload */
+	union {
+		uint64_t u64;
+		struct vhost_vring_state state;
+		struct vhost_vring_addr addr;
+		struct vhost_user_memory memory;
+		struct vhost_user_config config;
+	} payload;
+} __attribute__((packed));
+
+#define VHOST_USER_HDR_SIZE	offsetof(struct vhost_user_msg, payload)
+
+static int
+vhost_user_send(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		int *fds, int nfds)
+{
+	char control[CMSG_SPACE(VHOST_USER_MAX_REGIONS * sizeof(int))];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t rc;
+
+	msg->flags = VHOST_USER_VERSION;
+	iov.iov_base = msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE + msg->size;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if (nfds > 0) {
+		memset(control, 0, sizeof(control));
+		mh.msg_control = control;
+		mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+
+	do {
+		rc = sendmsg(vdev->fd, &mh, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc != iov.iov_len) {
+		WPRINTF("send request %u failed, errno = %d\n",
+			msg->request, errno);
+		return -1;
+	}
+	DPRINTF("request %u, size %u\n", msg->request, msg->size);
+	return 0;
+}
+
+static int
+vhost_user_recv(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		uint32_t request)
+{
+	ssize_t rc;
+
+	rc = recv(vdev->fd, msg, VHOST_USER_HDR_SIZE, MSG_WAITALL);
+	if (rc != VHOST_USER_HDR_SIZE)
+		goto fail;
+
+	if ((msg->request != request) ||
+	    !(msg->flags & VHOST_USER_REPLY_MASK) ||
+	    (msg->size > sizeof(msg->payload))) {
+		WPRINTF("bad reply to request %u: request %u, flags 0x%x, size %u\n",
+			request, msg->request, msg->flags, msg->size);
+		return -1;
+	}
+
+	if (msg->size > 0) {
+		rc = recv(vdev->fd, &msg->payload, msg->size, MSG_WAITALL);
+		if (rc != msg->size)
+			goto fail;
+	}
+	return 0;
+
+fail:
+	WPRINTF("recv reply to request %u failed, rc = %ld, errno = %d\n",
+		request, rc, errno);
+	return -1;
+}
+
+static int
+vhost_user_set_u64(struct vhost_dev *vdev, uint32_t request, uint64_t val)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.u64);
+	msg.payload.u64 = val;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_get_u64(struct vhost_dev *vdev, uint32_t request, uint64_t *val)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = 0;
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, request) < 0 ||
+	    msg.size != sizeof(msg.payload.u64))
+		return -1;
+
+	*val = msg.payload.u64;
+	return 0;
+}
+
+static int
+vhost_user_set_owner(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = VHOST_USER_SET_OWNER;
+	msg.size = 0;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_reset_device(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = VHOST_USER_RESET_OWNER;
+	msg.size = 0;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+/*
+ * The protocol features are negotiated along with the first feature
+ * query, as the backend expects them before any ring is set up.
+ */
+static int
+vhost_user_get_features(struct vhost_dev *vdev, uint64_t *features)
+{
+	uint64_t protocol_features;
+
+	if (vhost_user_get_u64(vdev, VHOST_USER_GET_FEATURES, features) < 0)
+		return -1;
+	vdev->user_features = *features;
+
+	if (!(*features & (1UL << VHOST_USER_F_PROTOCOL_FEATURES)) ||
+	    vdev->protocol_features)
+		return 0;
+
+	if (vhost_user_get_u64(vdev, VHOST_USER_GET_PROTOCOL_FEATURES,
+			       &protocol_features) < 0)
+		return -1;
+
+	protocol_features &= VHOST_USER_PROTOCOL_FEATURES;
+	if (vhost_user_set_u64(vdev, VHOST_USER_SET_PROTOCOL_FEATURES,
+			       protocol_features) < 0)
+		return -1;
+	vdev->protocol_features = protocol_features;
+	return 0;
+}
+
+static int
+vhost_user_set_features(struct vhost_dev *vdev, uint64_t features)
+{
+	/* the rings then start disabled, see vhost_user_set_vring_kick */
+	features |= vdev->user_features &
+		(1UL << VHOST_USER_F_PROTOCOL_FEATURES);
+	return vhost_user_set_u64(vdev, VHOST_USER_SET_FEATURES, features);
+}
+
+/*
+ * Share the guest memory with the backend: one region for each memfd
+ * mapping of the guest memory.
+ */
+static int
+vhost_user_set_mem_table(struct vhost_dev *vdev)
+{
+	struct vm_memfd_region regions[VHOST_USER_MAX_REGIONS];
+	struct vhost_user_msg msg;
+	int fds[VHOST_USER_MAX_REGIONS];
+	int i, n;
+
+	n = vm_get_memfd_regions(vdev->base->dev->vmctx, regions,
+				 VHOST_USER_MAX_REGIONS);
+	if (n <= 0) {
+		WPRINTF("no shareable guest memory, hugetlb is required\n");
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request = VHOST_USER_SET_MEM_TABLE;
+	msg.size = sizeof(msg.payload.memory);
+	msg.payload.memory.nregions = n;
+	for (i = 0; i < n; i++) {
+		msg.payload.memory.regions[i].guest_phys_addr = regions[i].gpa;
+		msg.payload.memory.regions[i].memory_size = regions[i].size;
+		msg.payload.memory.regions[i].userspace_addr =
+			(uintptr_t)regions[i].hva;
+		msg.payload.memory.regions[i].mmap_offset = regions[i].fd_offset;
+		fds[i] = regions[i].fd;
+		DPRINTF("[%d][0x%lx -> %p, 0x%lx]\n", i, regions[i].gpa,
+			regions[i].hva, regions[i].size);
+	}
+	return vhost_user_send(vdev, &msg, fds, n);
+}
+
+static int
+vhost_user_set_vring_state(struct vhost_dev *vdev, uint32_t request,
+			   struct vhost_vring_state *ring)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.state);
+	msg.payload.state = *ring;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_vring_num(struct vhost_dev *vdev,
+			 struct vhost_vring_state *ring)
+{
+	return vhost_user_set_vring_state(vdev, VHOST_USER_SET_VRING_NUM, ring);
+}
+
+static int
+vhost_user_set_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	return vhost_user_set_vring_state(vdev, VHOST_USER_SET_VRING_BASE, ring);
+}
+
+/* stops the ring and returns its last available index */
+static int
+vhost_user_get_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	struct vhost_user_msg msg;
+
+	if (vhost_user_set_vring_state(vdev, VHOST_USER_GET_VRING_BASE,
+				       ring) < 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_VRING_BASE) < 0 ||
+	    msg.size != sizeof(msg.payload.state))
+		return -1;
+
+	ring->num = msg.payload.state.num;
+	return 0;
+}
+
+static int
+vhost_user_set_vring_addr(struct vhost_dev *vdev,
+			  struct vhost_vring_addr *addr)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = VHOST_USER_SET_VRING_ADDR;
+	msg.size = sizeof(msg.payload.addr);
+	msg.payload.addr = *addr;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_vring_file(struct vhost_dev *vdev, uint32_t request,
+			  struct vhost_vring_file *file)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.u64);
+	msg.payload.u64 = file->index & VHOST_USER_VRING_IDX_MASK;
+	if (file->fd < 0) {
+		msg.payload.u64 |= VHOST_USER_VRING_NOFD_MASK;
+		return vhost_user_send(vdev, &msg, NULL, 0);
+	}
+	return vhost_user_send(vdev, &msg, &file->fd, 1);
+}
+
+static int
+vhost_user_set_vring_enable(struct vhost_dev *vdev, unsigned int idx,
+			    bool enable)
+{
+	struct vhost_vring_state ring;
+
+	if (!(vdev->user_features & (1UL << VHOST_USER_F_PROTOCOL_FEATURES)))
+		return 0;
+
+	ring.index = idx;
+	ring.num = enable;
+	return vhost_user_set_vring_state(vdev, VHOST_USER_SET_VRING_ENABLE,
+					  &ring);
+}
+
+/*
+ * The kick fd is the last piece of a ring set up by vhost_vq_start, so
+ * the ring is enabled along with it, and disabled before it is removed.
+ */
+static int
+vhost_user_set_vring_kick(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	if (file->fd < 0)
+		vhost_user_set_vring_enable(vdev, file->index, false);
+
+	if (vhost_user_set_vring_file(vdev, VHOST_USER_SET_VRING_KICK,
+				      file) < 0)
+		return -1;
+
+	if (file->fd >= 0)
+		return vhost_user_set_vring_enable(vdev, file->index, true);
+	return 0;
+}
+
+static int
+vhost_user_set_vring_call(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	return vhost_user_set_vring_file(vdev, VHOST_USER_SET_VRING_CALL, file);
+}
+
+static int
+vhost_user_set_vring_busyloop_timeout(struct vhost_dev *vdev,
+				      struct vhost_vring_state *s)
+{
+	/* the backend polls the rings as it sees fit */
+	return 0;
+}
+
+const struct vhost_ops vhost_user_ops = {
+	.set_owner = vhost_user_set_owner,
+	.reset_device = vhost_user_reset_device,
+	.get_features = vhost_user_get_features,
+	.set_features = vhost_user_set_features,
+	.set_mem_table = vhost_user_set_mem_table,
+	.set_vring_num = vhost_user_set_vring_num,
+	.set_vring_base = vhost_user_set_vring_base,
+	.get_vring_base = vhost_user_get_vring_base,
+	.set_vring_addr = vhost_user_set_vring_addr,
+	.set_vring_kick = vhost_user_set_vring_kick,
+	.set_vring_call = vhost_user_set_vring_call,
+	.set_vring_busyloop_timeout = vhost_user_set_vring_busyloop_timeout,
+};
+
+/**
+ * @brief Read the device config space of a vhost-user backend.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param config Buffer receiving the config space.
+ * @param size Number of bytes read from offset 0.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t size)
+{
+	struct vhost_user_msg msg;
+
+	if (!(vdev->protocol_features & (1UL << VHOST_USER_PROTOCOL_F_CONFIG)) ||
+	    (size > VHOST_USER_MAX_CONFIG_SIZE))
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request = VHOST_USER_GET_CONFIG;
+	msg.size = offsetof(struct vhost_user_config, region) + size;
+	msg.payload.config.offset = 0;
+	msg.payload.config.size = size;
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_CONFIG) < 0 ||
+	    msg.payload.config.size != size)
+		return -1;
+
+	memcpy(config, msg.payload.config.region, size);
+	return 0;
+}
+
+/**
+ * @brief Connect to a vhost-user backend.
+ *
+ * @param path Path of the UNIX socket the backend listens on.
+ *
+ * @return fd of the connection on success and -1 on failure.
+ */
+int
+vhost_user_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strnlen(path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path)) {
+		WPRINTF("socket path %s is too long\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		WPRINTF("socket failed, errno = %d\n", errno);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		WPRINTF("connect to %s failed, errno = %d\n", path, errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
@@ -32,7 +32,9 @@
 #include <stdlib.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/queue.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "dm.h"
 #include "pci_core.h"
@@ -42,6 +44,8 @@
 #include "hsm_ioctl_defs.h"
 #include "iothread.h"
 #include "vmmapi.h"
+#include "dm_string.h"
+#include "monitor.h"
 #include <errno.h>
 
 /*
@@ -58,6 +62,25 @@
 
 static uint8_t virtio_poll_enabled;
 static size_t virtio_poll_interval;
+static bool virtio_ring_stats;
+static bool virtio_irqfd_disabled;
+static pthread_mutex_t virtio_irqfd_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The assigned irqfds, so that virtio_irqfd_release_dev() can release
+ * those of a device after its virtqueues are freed.
+ */
+struct virtio_irqfd {
+	struct pci_vdev *dev;
+	int fd;
+	uint64_t addr;
+	uint32_t data;
+	LIST_ENTRY(virtio_irqfd) list;
+};
+static LIST_HEAD(, virtio_irqfd) virtio_irqfds = LIST_HEAD_INITIALIZER(virtio_irqfds);
+
+static void vq_irqfd_release(struct virtio_base *base,
+			     struct virtio_vq_info *vq);
 
 static
 void iothread_handler(void *arg)
@@ -82,6 +105,26 @@ void iothread_handler(void *arg)
 	}
 }
 
+/*
+ * Poll handler of the iothread: process the available descriptors without waiting for the kick.
+ */
+static bool
+iothread_poll_handler(void *arg)
+{
+	struct virtio_iothread *viothrd = arg;
+	struct virtio_vq_info *vq = &viothrd->base->queues[viothrd->idx];
+
+	if ((viothrd->iothread_run == NULL) || !vq_has_descs(vq)) {
+		return false;
+	}
+
+	pthread_mutex_lock(&vq->mtx);
+	(*viothrd->iothread_run)(viothrd->base, vq);
+	pthread_mutex_unlock(&vq->mtx);
+
+	return true;
+}
+
 void
 virtio_set_iothread(struct virtio_base *base,
 			  bool is_register, bool ioevent_poll)
@@ -110,6 +153,7 @@ virtio_set_iothread(struct virtio_base *base,
 			vq->viothrd.idx = idx;
 			vq->viothrd.iomvt.arg = &vq->viothrd;
 			vq->viothrd.iomvt.run = iothread_handler;
+			vq->viothrd.iomvt.poll = iothread_poll_handler;
 			vq->viothrd.iomvt.fd = vq->viothrd.kick_fd;
 
 			if (!iothread_add(vq->viothrd.ioctx, vq->viothrd.kick_fd, &vq->viothrd.iomvt))
@@ -170,7 +214,7 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 		vq = &base->queues[i];
 		if(!vq_ring_ready(vq))
 			continue;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(vq);
 		/* TODO: call notify when necessary */
 		if (vq->viothrd.ioevent_started){
 			if (eventfd_write(vq->viothrd.iomvt.fd, val) == -1){
@@ -287,6 +331,14 @@ virtio_reset_dev(struct virtio_base *base)
 		vq->gpa_used[0] = 0;
 		vq->gpa_used[1] = 0;
 		vq->enabled = 0;
+		vq->used_idx = 0;
+		vq->avail_wrap = false;
+		vq->used_wrap = false;
+		/* the staged chains are dropped, the timer finds none */
+		vq->batch_pending = 0;
+		vq->mod_pending = false;
+		vq->mod_count = 0;
+		vq_irqfd_release(base, vq);
 	}
 	base->negotiated_caps = 0;
 	base->curq = 0;
@@ -428,6 +480,81 @@ error:
 	pr_err("%s: vq enable failed\n", __func__);
 }
 
+/*
+ * Initialize a packed virtqueue. The gpa of desc array, avail ring
+ * and used ring are those of the descriptor ring, the driver event
+ * suppression area and the device event suppression area.
+ */
+static void
+virtio_vq_enable_packed(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	uint16_t qsz, *ndesc;
+	uint64_t phys;
+	char *vb;
+
+	qsz = vq->qsize;
+	if (qsz == 0)
+		goto error;
+
+	/* descriptor ring */
+	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+		qsz * sizeof(struct vring_packed_desc));
+	if (!vb)
+		goto error;
+	vq->packed_desc = (struct vring_packed_desc *)vb;
+
+	/* driver area */
+	phys = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+		sizeof(struct vring_packed_desc_event));
+	if (!vb)
+		goto error;
+	vq->driver_event = (struct vring_packed_desc_event *)vb;
+
+	/* device area */
+	phys = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+		sizeof(struct vring_packed_desc_event));
+	if (!vb)
+		goto error;
+	vq->device_event = (struct vring_packed_desc_event *)vb;
+
+	/*
+	 * The slots taken by each buffer are needed to advance the used
+	 * slot, as buffers may be used out of order.
+	 */
+	if (vq->ndesc_size < qsz) {
+		ndesc = realloc(vq->buf_ndesc, 2 * qsz * sizeof(uint16_t));
+		if (!ndesc)
+			goto error;
+		vq->buf_ndesc = ndesc;
+		vq->chain_ndesc = ndesc + qsz;
+		vq->ndesc_size = qsz;
+	}
+	memset(vq->buf_ndesc, 0, 2 * vq->ndesc_size * sizeof(uint16_t));
+
+	/* Start at slot 0, with the wrap counters set. */
+	vq->last_avail = 0;
+	vq->used_idx = 0;
+	vq->avail_wrap = true;
+	vq->used_wrap = true;
+	vq->save_used = 1 << VRING_PACKED_EVENT_F_WRAP_CTR;
+	vq->desc = NULL;
+	vq->avail = NULL;
+	vq->used = NULL;
+
+	vq->enabled = true;
+
+	/* Mark queue as allocated after initialization is complete. */
+	mb();
+	vq->flags = VQ_ALLOC | VQ_PACKED;
+	return;
+ error:
+	vq->flags = 0;
+	pr_err("%s: packed vq enable failed\n", __func__);
+}
+
 /*
  * Initialize the currently-selected virtio queue (base->curq).
  * The guest just gave us the gpa of desc array, avail ring and
@@ -446,6 +573,11 @@ virtio_vq_enable(struct virtio_base *base)
 	vq = &base->queues[base->curq];
 	qsz = vq->qsize;
 
+	if (base->negotiated_caps & (1UL << VIRTIO_F_RING_PACKED)) {
+		virtio_vq_enable_packed(base, vq);
+		return;
+	}
+
 	/* descriptors */
 	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
 	size = qsz * sizeof(struct vring_desc);
@@ -494,24 +626,154 @@ virtio_vq_enable(struct virtio_base *base)
  *        fails.
  */
 static inline int
-_vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
-	   struct iovec *iov, int n_iov, uint16_t *flags) {
+_vq_record(int i, uint64_t addr, uint32_t len, uint16_t dflags,
+	   struct vmctx *ctx, struct iovec *iov, int n_iov, uint16_t *flags) {
 
 	void *host_addr;
 
 	if (i >= n_iov)
 		return -1;
-	host_addr = paddr_guest2host(ctx, vd->addr, vd->len);
+	host_addr = paddr_guest2host(ctx, addr, len);
 	if (!host_addr)
 		return -1;
 	iov[i].iov_base = host_addr;
-	iov[i].iov_len = vd->len;
+	iov[i].iov_len = len;
 	if (flags != NULL)
-		flags[i] = vd->flags;
+		flags[i] = dflags;
 	return 0;
 }
+
+/*
+ * Helper inline for vq_getchain(): account a fetched chain for
+ * --virtio_stats.
+ */
+static inline int
+_vq_stat(struct virtio_vq_info *vq, int n)
+{
+	if (virtio_ring_stats) {
+		vq->stat_chains++;
+		vq->stat_descs += n;
+	}
+	return n;
+}
 #define	VQ_MAX_DESCRIPTORS	512	/* see below */
 
+/*
+ * vq_getchain() for a packed ring: the chain is made of the
+ * consecutive ring slots up to the first one without the NEXT flag,
+ * which carries the buffer id.  An INDIRECT slot points to a table of
+ * packed descriptors which are used in sequence.
+ *
+ * The slots are consumed once the end of the chain is found, so the
+ * errors found afterwards still return the buffer id in *pidx, as
+ * with the split ring.
+ */
+static int
+vq_getchain_packed(struct virtio_vq_info *vq, uint16_t *pidx,
+		   struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	volatile struct vring_packed_desc *vd, *vindir;
+	struct vmctx *ctx;
+	struct virtio_base *base;
+	const char *name;
+	u_int head, slot, ndesc, n_indir, j;
+	uint16_t id;
+	bool wrap;
+	int i;
+
+	base = vq->base;
+	name = base->vops->name;
+
+	if (!vq_packed_desc_avail(vq->packed_desc[vq->last_avail].flags,
+	    vq->avail_wrap))
+		return 0;
+	/* read the descriptors only after their flags */
+	atomic_thread_fence();
+
+	/*
+	 * Find the end of the chain first.  The guest makes the head
+	 * available last, so all the slots of the chain are valid now.
+	 */
+	head = slot = vq->last_avail;
+	wrap = vq->avail_wrap;
+	for (ndesc = 1; ; ndesc++) {
+		vd = &vq->packed_desc[slot];
+		if (++slot == vq->qsize) {
+			slot = 0;
+			wrap = !wrap;
+		}
+		if ((vd->flags & VRING_DESC_F_NEXT) == 0)
+			break;
+		if (ndesc == vq->qsize) {
+			pr_err("%s: descriptor chain longer than the ring, "
+			    "driver confused?\r\n", name);
+			vq->last_avail = slot;
+			vq->avail_wrap = wrap;
+			return -1;
+		}
+	}
+
+	vq->last_avail = slot;
+	vq->avail_wrap = wrap;
+	vq->chain_ndesc[slot] = ndesc;
+
+	id = vd->id;
+	if (id >= vq->qsize) {
+		pr_err("%s: buffer id %u out of range, driver confused?\r\n",
+		    name, id);
+		return -1;
+	}
+	*pidx = id;
+	vq->buf_ndesc[id] = ndesc;
+
+	ctx = base->dev->vmctx;
+	for (i = 0, slot = head; ndesc-- > 0; slot = (slot + 1) % vq->qsize) {
+		vd = &vq->packed_desc[slot];
+		if ((vd->flags & VRING_DESC_F_INDIRECT) == 0) {
+			if (_vq_record(i, vd->addr, vd->len, vd->flags,
+			    ctx, iov, n_iov, flags)) {
+				pr_err("%s: mapping to host failed\r\n", name);
+				return -1;
+			}
+			if (++i > VQ_MAX_DESCRIPTORS)
+				goto loopy;
+			continue;
+		}
+		if ((base->device_caps &
+		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0) {
+			pr_err("%s: descriptor has forbidden INDIRECT flag, "
+			    "driver confused?\r\n", name);
+			return -1;
+		}
+		n_indir = vd->len / 16;
+		if ((vd->len & 0xf) || n_indir == 0) {
+			pr_err("%s: invalid indir len 0x%x, "
+			    "driver confused?\r\n", name, (u_int)vd->len);
+			return -1;
+		}
+		vindir = paddr_guest2host(ctx, vd->addr, vd->len);
+		if (!vindir) {
+			pr_err("%s cannot get host memory\r\n", name);
+			return -1;
+		}
+		for (j = 0; j < n_indir; j++) {
+			if (_vq_record(i, vindir[j].addr, vindir[j].len,
+			    vindir[j].flags, ctx, iov, n_iov, flags)) {
+				pr_err("%s: mapping to host failed\r\n", name);
+				return -1;
+			}
+			if (++i > VQ_MAX_DESCRIPTORS)
+				goto loopy;
+		}
+	}
+	return _vq_stat(vq, i);
+
+loopy:
+	pr_err("%s: descriptor count > %d - driver confused?\r\n",
+	    name, VQ_MAX_DESCRIPTORS);
+	return -1;
+}
+
 /*
  * Examine the chain of descriptors starting at the "next one" to
  * make sure that they describe a sensible request.  If so, return
@@ -564,6 +826,9 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	struct virtio_base *base;
 	const char *name;
 
+	if (vq_is_packed(vq))
+		return vq_getchain_packed(vq, pidx, iov, n_iov, flags);
+
 	base = vq->base;
 	name = base->vops->name;
 
@@ -611,7 +876,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 		}
 		vdir = &vq->desc[next];
 		if ((vdir->flags & VRING_DESC_F_INDIRECT) == 0) {
-			if (_vq_record(i, vdir, ctx, iov, n_iov, flags)) {
+			if (_vq_record(i, vdir->addr, vdir->len, vdir->flags,
+			    ctx, iov, n_iov, flags)) {
 				pr_err("%s: mapping to host failed\r\n", name);
 				return -1;
 			}
@@ -653,7 +919,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 					    name);
 					return -1;
 				}
-				if (_vq_record(i, vp, ctx, iov, n_iov, flags)) {
+				if (_vq_record(i, vp->addr, vp->len, vp->flags,
+				    ctx, iov, n_iov, flags)) {
 					pr_err("%s: mapping to host failed\r\n", name);
 					return -1;
 				}
@@ -671,7 +938,7 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 			}
 		}
 		if ((vdir->flags & VRING_DESC_F_NEXT) == 0)
-			return i;
+			return _vq_stat(vq, i);
 	}
 loopy:
 	pr_err("%s: descriptor loop? count > %d - driver confused?\r\n",
@@ -688,7 +955,98 @@ loopy:
 void
 vq_retchain(struct virtio_vq_info *vq)
 {
-	vq->last_avail--;
+	uint16_t ndesc;
+
+	if (!vq_is_packed(vq)) {
+		vq->last_avail--;
+		return;
+	}
+
+	/* step back over the slots of the chain ending at last_avail */
+	ndesc = vq->chain_ndesc[vq->last_avail];
+	if (vq->last_avail < ndesc) {
+		vq->last_avail += vq->qsize;
+		vq->avail_wrap = !vq->avail_wrap;
+	}
+	vq->last_avail -= ndesc;
+}
+
+/*
+ * Helper for the packed ring: fill the next used slot with the buffer
+ * id and length, and step over the slots the buffer took.  Return the
+ * used slot; its flags, which hand it to the guest, are returned in
+ * *flags and left to the caller to write.
+ */
+static volatile struct vring_packed_desc *
+vq_packed_used(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen,
+	       uint16_t *flags)
+{
+	volatile struct vring_packed_desc *vd;
+	uint16_t ndesc;
+
+	vd = &vq->packed_desc[vq->used_idx];
+	vd->id = idx;
+	vd->len = iolen;
+	*flags = vq->used_wrap ? ((1 << VRING_PACKED_DESC_F_AVAIL) |
+		(1 << VRING_PACKED_DESC_F_USED)) : 0;
+
+	ndesc = (idx < vq->qsize && vq->buf_ndesc[idx]) ? vq->buf_ndesc[idx] : 1;
+	vq->used_idx += ndesc;
+	if (vq->used_idx >= vq->qsize) {
+		vq->used_idx -= vq->qsize;
+		vq->used_wrap = !vq->used_wrap;
+	}
+	return vd;
+}
+
+/*
+ * Stage a request chain to be returned to the guest: the used entry is
+ * written, but the guest only sees it once published, together with
+ * the other staged chains, by vq_endchains() (or vq_relchain()).
+ *
+ * A split ring is published with one used index update, a packed ring
+ * by writing the flags of the first staged slot last.
+ */
+void
+vq_relchain_batch(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
+{
+	volatile struct vring_packed_desc *vd;
+	volatile struct vring_used_elem *vue;
+	uint16_t flags;
+
+	if (vq_is_packed(vq)) {
+		vd = vq_packed_used(vq, idx, iolen, &flags);
+		if (vq->batch_pending == 0) {
+			vq->batch_desc = vd;
+			vq->batch_flags = flags;
+		} else {
+			vd->flags = flags;
+		}
+	} else {
+		vue = &vq->used->ring[(uint16_t)(vq->used->idx +
+			vq->batch_pending) & (vq->qsize - 1)];
+		vue->id = idx;
+		vue->len = iolen;
+	}
+	vq->batch_pending++;
+}
+
+/*
+ * Make the staged chains visible to the guest, with one barrier.
+ */
+static void
+vq_publish_used(struct virtio_vq_info *vq)
+{
+	if (vq->batch_pending == 0)
+		return;
+
+	mb();
+	if (vq_is_packed(vq))
+		vq->batch_desc->flags = vq->batch_flags;
+	else
+		vq->used->idx += vq->batch_pending;
+	vq->mod_count += vq->batch_pending;
+	vq->batch_pending = 0;
 }
 
 /*
@@ -701,9 +1059,10 @@ vq_retchain(struct virtio_vq_info *vq)
 void
 vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 {
-	uint16_t uidx, mask;
+	uint16_t uidx, mask, flags;
 	volatile struct vring_used *vuh;
 	volatile struct vring_used_elem *vue;
+	volatile struct vring_packed_desc *vd;
 
 	/*
 	 * Notes:
@@ -715,6 +1074,21 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	 * (I apologize for the two fields named idx; the
 	 * virtio spec calls the one that vue points to, "id"...)
 	 */
+	if (vq->batch_pending) {
+		/* keep the order with the chains staged before */
+		vq_relchain_batch(vq, idx, iolen);
+		vq_publish_used(vq);
+		return;
+	}
+
+	if (vq_is_packed(vq)) {
+		vd = vq_packed_used(vq, idx, iolen, &flags);
+		mb();
+		vd->flags = flags;
+		vq->mod_count++;
+		return;
+	}
+
 	mask = vq->qsize - 1;
 	vuh = vq->used;
 
@@ -723,6 +1097,196 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	vue->id = idx;
 	vue->len = iolen;
 	vuh->idx = uidx;
+	vq->mod_count++;
+}
+
+/*
+ * Return several request chains to the guest at once, e.g. all the
+ * buffers of a merged rx frame.
+ */
+void
+vq_relchains(struct virtio_vq_info *vq, uint16_t *idx, uint32_t *iolen, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		vq_relchain_batch(vq, idx[i], iolen[i]);
+	vq_publish_used(vq);
+}
+
+static void vq_signal_used(struct virtio_vq_info *vq, int used_all_avail);
+
+/*
+ * Max latency timer of the staged chains: publish them, and interrupt
+ * the guest if needed, however few of them are staged.
+ */
+static void
+vq_coalesce_timer(void *arg, uint64_t nexp)
+{
+	struct virtio_vq_info *vq = arg;
+
+	pthread_mutex_lock(&vq->mtx);
+	vq->coalesce_armed = false;
+	if (vq->batch_pending && vq_ring_ready(vq))
+		vq_signal_used(vq, !vq_has_descs(vq));
+	pthread_mutex_unlock(&vq->mtx);
+}
+
+/**
+ * @brief Coalesce the chains staged by vq_relchain_batch().
+ *
+ * vq_endchains() holds the staged chains back, and so the interrupt,
+ * until max_pending of them are staged or the oldest one waited for
+ * max_usec.  The callers of vq_relchain_batch() and vq_endchains() on
+ * the queue shall hold vq->mtx, which the timer takes as well.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param max_pending Number of staged chains published at once.
+ * @param max_usec Max time a staged chain is held back, in microseconds.
+ *
+ * @return 0 on success and -1 on fail.
+ */
+int
+vq_set_coalesce(struct virtio_vq_info *vq, int max_pending, int max_usec)
+{
+	if (max_pending <= 1 || max_usec <= 0)
+		return -1;
+
+	if (vq->coalesce_max == 0) {
+		vq->coalesce_timer.clockid = CLOCK_MONOTONIC;
+		if (acrn_timer_init(&vq->coalesce_timer, vq_coalesce_timer, vq))
+			return -1;
+	}
+	vq->coalesce_max = max_pending;
+	vq->coalesce_usec = max_usec;
+	return 0;
+}
+
+/*
+ * Report the chains and descriptors fetched per second on the queue,
+ * for --virtio_stats.
+ */
+static void
+vq_report_stats(struct virtio_vq_info *vq)
+{
+	struct timespec ts;
+	uint64_t now, elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+	if (vq->stat_start == 0)
+		vq->stat_start = now;
+	elapsed = now - vq->stat_start;
+	if (elapsed < 1000000000UL)
+		return;
+
+	pr_info("%s: vq %d (%s ring): %lu chains/s, %lu descriptors/s\n",
+		vq->base->vops->name, vq->num,
+		vq_is_packed(vq) ? "packed" : "split",
+		vq->stat_chains * 1000000000UL / elapsed,
+		vq->stat_descs * 1000000000UL / elapsed);
+	vq->stat_chains = 0;
+	vq->stat_descs = 0;
+	vq->stat_start = now;
+}
+
+/*
+ * vq_endchains() for a packed ring: save_used holds the used slot and
+ * its wrap counter, encoded as the off_wrap of an event suppression
+ * structure.
+ */
+static int
+vq_endchains_packed(struct virtio_vq_info *vq, int used_all_avail)
+{
+	struct virtio_base *base;
+	uint16_t event_idx, new_idx, old_idx, off_wrap, flags;
+	const uint16_t wrap_bit = 1 << VRING_PACKED_EVENT_F_WRAP_CTR;
+
+	base = vq->base;
+	old_idx = vq->save_used;
+	new_idx = vq->used_idx | (vq->used_wrap ? wrap_bit : 0);
+	vq->save_used = new_idx;
+
+	if (used_all_avail &&
+	    (base->negotiated_caps & (1 << VIRTIO_F_NOTIFY_ON_EMPTY)))
+		return 1;
+	if (new_idx == old_idx)
+		return 0;
+
+	flags = vq->driver_event->flags;
+	if (flags == VRING_PACKED_EVENT_FLAG_DISABLE)
+		return 0;
+	if (flags != VRING_PACKED_EVENT_FLAG_DESC ||
+	    !(base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX)))
+		return 1;
+
+	/*
+	 * Compare the slots in the current wrap: the ones saved or
+	 * requested in the previous wrap are one ring size behind.
+	 */
+	new_idx = vq->used_idx;
+	if ((old_idx & wrap_bit) != (vq->used_wrap ? wrap_bit : 0))
+		old_idx = (old_idx & ~wrap_bit) - vq->qsize;
+	else
+		old_idx &= ~wrap_bit;
+	off_wrap = vq->driver_event->off_wrap;
+	event_idx = off_wrap & ~wrap_bit;
+	if ((off_wrap & wrap_bit) != (vq->used_wrap ? wrap_bit : 0))
+		event_idx -= vq->qsize;
+
+	return (uint16_t)(new_idx - event_idx - 1) <
+		(uint16_t)(new_idx - old_idx);
+}
+
+/*
+ * Raise the interrupt held back by the moderation, if any.  The timer
+ * and the queue threads may race here: an interrupt is never lost, at
+ * worst one is raised twice.
+ */
+static void
+vq_moderation_fire(struct virtio_vq_info *vq)
+{
+	if (atomic_xchg(&vq->mod_pending, false)) {
+		vq->mod_count = 0;
+		vq_interrupt(vq->base, vq);
+	}
+}
+
+static void
+vq_moderation_timer(void *arg, uint64_t nexp)
+{
+	struct virtio_vq_info *vq = arg;
+
+	atomic_store(&vq->mod_armed, false);
+	vq_moderation_fire(vq);
+}
+
+/*
+ * Interrupt moderation: an interrupt the ring asks for (intr) is held
+ * back until mod_frames chains were returned since the last one, or
+ * until mod_timer expires.
+ */
+static void
+vq_moderate(struct virtio_vq_info *vq, int intr)
+{
+	if (vq->mod_usec == 0) {
+		if (intr) {
+			vq->mod_count = 0;
+			vq_interrupt(vq->base, vq);
+		}
+		return;
+	}
+
+	if (intr)
+		atomic_store(&vq->mod_pending, true);
+	else if (!atomic_load(&vq->mod_pending))
+		return;
+
+	if (vq->mod_frames && vq->mod_count >= vq->mod_frames)
+		vq_moderation_fire(vq);
+	else if (!atomic_xchg(&vq->mod_armed, true))
+		virtio_start_timer(&vq->mod_timer, vq->mod_usec / 1000000U,
+			(vq->mod_usec % 1000000U) * 1000L);
 }
 
 /*
@@ -742,13 +1306,38 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
  */
 void
 vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
+{
+	if (!vq || !vq_ring_ready(vq))
+		return;
+
+	/*
+	 * With coalescing, the staged chains are held back until there
+	 * are enough of them or the oldest one waited long enough.
+	 */
+	if (vq->coalesce_max && vq->batch_pending &&
+	    vq->batch_pending < vq->coalesce_max) {
+		if (!vq->coalesce_armed) {
+			virtio_start_timer(&vq->coalesce_timer,
+				vq->coalesce_usec / 1000000U,
+				(vq->coalesce_usec % 1000000U) * 1000L);
+			vq->coalesce_armed = true;
+		}
+		return;
+	}
+	vq_signal_used(vq, used_all_avail);
+}
+
+/*
+ * Publish the staged chains and interrupt the guest if needed.
+ */
+static void
+vq_signal_used(struct virtio_vq_info *vq, int used_all_avail)
 {
 	struct virtio_base *base;
 	uint16_t event_idx, new_idx, old_idx;
 	int intr;
 
-	if (!vq || !vq->used)
-		return;
+	vq_publish_used(vq);
 
 	/*
 	 * Interrupt generation: if we're using EVENT_IDX,
@@ -762,7 +1351,15 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 
 	atomic_thread_fence();
 
+	if (virtio_ring_stats)
+		vq_report_stats(vq);
+
 	base = vq->base;
+	if (vq_is_packed(vq)) {
+		vq_moderate(vq, vq_endchains_packed(vq, used_all_avail));
+		return;
+	}
+
 	old_idx = vq->save_used;
 	vq->save_used = new_idx = vq->used->idx;
 	if (used_all_avail &&
@@ -780,8 +1377,7 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 		intr = new_idx != old_idx &&
 		    !(vq->avail->flags & VRING_AVAIL_F_NO_INTERRUPT);
 	}
-	if (intr)
-		vq_interrupt(base, vq);
+	vq_moderate(vq, intr);
 }
 
 /**
@@ -803,7 +1399,26 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1)
 		return;
 
-	vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (vq_is_packed(vq))
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	else
+		vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+}
+
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Ask the guest not to notify the queue, with VRING_USED_F_NO_NOTIFY on
+ * a split ring or by disabling the device event of a packed ring.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_set_used_ring_flags(struct virtio_vq_info *vq)
+{
+	if (vq_is_packed(vq))
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	else
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 }
 
 struct config_reg {
@@ -1121,7 +1736,7 @@ bad:
 			goto done;
 		}
 		vq = &base->queues[value];
-		if (virtio_poll_enabled && vq->viothrd.ioevent_started){
+		if (vq->viothrd.ioevent_started){
 			if (eventfd_write(vq->viothrd.iomvt.fd, val) == -1)
 				pr_err("%s: qnotify queue %llu: eventfd_write failed\r\n", name, value);
 		}
@@ -1729,7 +2344,7 @@ virtio_notify_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 	}
 
 	vq = &base->queues[idx];
-	if (virtio_poll_enabled && vq->viothrd.ioevent_started){
+	if (vq->viothrd.ioevent_started){
 		if (eventfd_write(vq->viothrd.iomvt.fd, val) == -1)
 			pr_err("%s: qnotify queue %llu: eventfd_write failed\r\n", name, idx);
 	}
@@ -1887,7 +2502,7 @@ virtio_pci_modern_pio_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		pthread_mutex_lock(base->mtx);
 
 	vq = &base->queues[idx];
-	if (virtio_poll_enabled && vq->viothrd.ioevent_started){
+	if (vq->viothrd.ioevent_started){
 		if (eventfd_write(vq->viothrd.iomvt.fd, val) == -1)
 			pr_err("%s: qnotify queue %llu: eventfd_write failed\r\n", name, idx);
 	}
@@ -2021,6 +2636,339 @@ acrn_parse_virtio_poll_interval(const char *optarg)
 	return 0;
 }
 
+/**
+ * @brief Report the chains and descriptors fetched per second on each
+ * virtqueue, to compare the ring layouts.
+ */
+void
+virtio_enable_ring_stats(void)
+{
+	virtio_ring_stats = true;
+}
+
+/**
+ * @brief Free the per-queue state of packed virtqueues, coalescing,
+ * interrupt moderation and irqfd.
+ *
+ * Call it when the device is deinitialized, after no request can
+ * complete anymore.
+ *
+ * @param base Pointer to struct virtio_base.
+ */
+void
+virtio_release_queues(struct virtio_base *base)
+{
+	struct virtio_vq_info *vq;
+	int i;
+
+	for (vq = base->queues, i = 0; i < base->vops->nvq; vq++, i++) {
+		if (vq->coalesce_max) {
+			acrn_timer_deinit(&vq->coalesce_timer);
+			vq->coalesce_max = 0;
+		}
+		if (vq->mod_timer_init) {
+			acrn_timer_deinit(&vq->mod_timer);
+			vq->mod_timer_init = false;
+			vq->mod_usec = 0;
+		}
+		vq_irqfd_release(base, vq);
+		free(vq->buf_ndesc);
+		vq->buf_ndesc = NULL;
+		vq->chain_ndesc = NULL;
+		vq->ndesc_size = 0;
+	}
+}
+
+/*
+ * Deassign and close an irqfd and forget it.  Called with
+ * virtio_irqfd_mtx held.
+ */
+static void
+virtio_irqfd_free(struct virtio_irqfd *ent)
+{
+	struct acrn_irqfd irqfd = {0};
+
+	irqfd.fd = ent->fd;
+	irqfd.flags = ACRN_IRQFD_FLAG_DEASSIGN;
+	irqfd.msi.msi_addr = ent->addr;
+	irqfd.msi.msi_data = ent->data;
+	vm_irqfd(ent->dev->vmctx, &irqfd);
+	close(ent->fd);
+	LIST_REMOVE(ent, list);
+	free(ent);
+}
+
+static struct virtio_irqfd *
+virtio_irqfd_find(int fd)
+{
+	struct virtio_irqfd *ent;
+
+	LIST_FOREACH(ent, &virtio_irqfds, list) {
+		if (ent->fd == fd)
+			return ent;
+	}
+	return NULL;
+}
+
+/*
+ * Only the virtio devices which call virtio_release_queues() release
+ * their irqfds themselves, so the PCI core calls this for every device
+ * once it is deinitialized.  Nothing is done for non-virtio devices.
+ */
+void
+virtio_irqfd_release_dev(struct pci_vdev *dev)
+{
+	struct virtio_irqfd *ent, *next;
+
+	pthread_mutex_lock(&virtio_irqfd_mtx);
+	for (ent = LIST_FIRST(&virtio_irqfds); ent != NULL; ent = next) {
+		next = LIST_NEXT(ent, list);
+		if (ent->dev == dev)
+			virtio_irqfd_free(ent);
+	}
+	pthread_mutex_unlock(&virtio_irqfd_mtx);
+}
+
+/*
+ * Bind the irqfd of the queue to an MSI-X vector, creating the irqfd
+ * the first time.  Called with virtio_irqfd_mtx held.
+ */
+static int
+vq_irqfd_assign(struct virtio_base *base, struct virtio_vq_info *vq,
+		uint64_t addr, uint32_t data)
+{
+	struct acrn_irqfd irqfd = {0};
+	struct virtio_irqfd *ent;
+
+	if (vq->irqfd_assigned) {
+		irqfd.fd = vq->irqfd;
+		irqfd.flags = ACRN_IRQFD_FLAG_DEASSIGN;
+		irqfd.msi.msi_addr = vq->irqfd_addr;
+		irqfd.msi.msi_data = vq->irqfd_data;
+		vm_irqfd(base->dev->vmctx, &irqfd);
+		vq->irqfd_assigned = false;
+		ent = virtio_irqfd_find(vq->irqfd);
+	} else {
+		ent = calloc(1, sizeof(*ent));
+		if (!ent)
+			return -1;
+		vq->irqfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (vq->irqfd < 0) {
+			free(ent);
+			return -1;
+		}
+		ent->dev = base->dev;
+		ent->fd = vq->irqfd;
+		LIST_INSERT_HEAD(&virtio_irqfds, ent, list);
+	}
+
+	irqfd.fd = vq->irqfd;
+	irqfd.flags = 0;
+	irqfd.msi.msi_addr = addr;
+	irqfd.msi.msi_data = data;
+	if (vm_irqfd(base->dev->vmctx, &irqfd) < 0) {
+		pr_warn("%s: irqfd unavailable, falling back to the MSI ioctl\n",
+			base->vops->name);
+		virtio_irqfd_disabled = true;
+		close(vq->irqfd);
+		if (ent) {
+			LIST_REMOVE(ent, list);
+			free(ent);
+		}
+		return -1;
+	}
+	vq->irqfd_addr = addr;
+	vq->irqfd_data = data;
+	vq->irqfd_assigned = true;
+	if (ent) {
+		ent->addr = addr;
+		ent->data = data;
+	}
+	return 0;
+}
+
+static void
+vq_irqfd_release(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	struct virtio_irqfd *ent;
+
+	pthread_mutex_lock(&virtio_irqfd_mtx);
+	if (vq->irqfd_assigned) {
+		ent = virtio_irqfd_find(vq->irqfd);
+		if (ent)
+			virtio_irqfd_free(ent);
+		vq->irqfd_assigned = false;
+	}
+	pthread_mutex_unlock(&virtio_irqfd_mtx);
+}
+
+/**
+ * @brief Deliver an MSI-X interrupt to guest on the given virtqueue.
+ *
+ * The userspace backends signal an irqfd bound to the MSI-X vector of
+ * the queue, which costs no ioctl round trip.  The irqfd is rebound
+ * when the guest reprograms the vector.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void
+vq_msix_interrupt(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	struct pci_vdev *dev = base->dev;
+	struct msix_table_entry *mte;
+	int rc = 0;
+
+	if (virtio_irqfd_disabled || base->backend_type != BACKEND_VBSU ||
+	    dev->msix.function_mask || vq->msix_idx >= dev->msix.table_count) {
+		pci_generate_msix(dev, vq->msix_idx);
+		return;
+	}
+
+	mte = &dev->msix.table[vq->msix_idx];
+	if (mte->vector_control & PCIM_MSIX_VCTRL_MASK)
+		return;
+
+	/* the irqfd may be rebound or released by another thread */
+	pthread_mutex_lock(&virtio_irqfd_mtx);
+	if (!vq->irqfd_assigned || vq->irqfd_addr != mte->addr ||
+	    vq->irqfd_data != mte->msg_data)
+		rc = vq_irqfd_assign(base, vq, mte->addr, mte->msg_data);
+	if (rc == 0)
+		eventfd_write(vq->irqfd, 1);
+	pthread_mutex_unlock(&virtio_irqfd_mtx);
+
+	if (rc)
+		pci_generate_msix(dev, vq->msix_idx);
+}
+
+/**
+ * @brief Moderate the interrupts of a virtqueue.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param max_usec Max interrupt delay in microseconds, 0 to disable.
+ * @param max_frames Chains returned per interrupt, 0 for no limit.
+ *
+ * @return 0 on success and -1 on fail.
+ */
+int
+vq_set_moderation(struct virtio_vq_info *vq, int max_usec, int max_frames)
+{
+	if (!(vq->base->flags & VIRTIO_MODERATION) || (max_usec < 0) ||
+	    (max_frames < 0) || (max_frames > UINT16_MAX))
+		return -1;
+
+	if (max_usec && !vq->mod_timer_init) {
+		vq->mod_timer.clockid = CLOCK_MONOTONIC;
+		if (acrn_timer_init(&vq->mod_timer, vq_moderation_timer, vq))
+			return -1;
+		vq->mod_timer_init = true;
+	}
+	vq->mod_frames = max_frames;
+	atomic_store(&vq->mod_usec, max_usec);
+
+	/* do not leave an interrupt held back by the previous setting */
+	if (max_usec == 0)
+		vq_moderation_fire(vq);
+	return 0;
+}
+
+/**
+ * @brief Enable interrupt moderation on the queues of a device.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param max_usec Max interrupt delay in microseconds, 0 to disable.
+ * @param max_frames Chains returned per interrupt, 0 for no limit.
+ *
+ * @return 0 on success and -1 on fail.
+ */
+int
+virtio_set_moderation(struct virtio_base *base, int max_usec, int max_frames)
+{
+	int i;
+
+	base->flags |= VIRTIO_MODERATION;
+	for (i = 0; i < base->vops->nvq; i++) {
+		if (vq_set_moderation(&base->queues[i], max_usec, max_frames))
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Parse an interrupt moderation setting.
+ *
+ * @param opt String "<max usec>[/<max frames>]".
+ * @param max_usec Pointer to the max interrupt delay in microseconds.
+ * @param max_frames Pointer to the chains returned per interrupt.
+ *
+ * @return 0 on success and -1 on fail.
+ */
+int
+virtio_parse_moderation(char *opt, int *max_usec, int *max_frames)
+{
+	*max_frames = 0;
+	if ((opt == NULL) || dm_strtoi(opt, &opt, 10, max_usec) ||
+	    (*max_usec < 0))
+		return -1;
+	if ((*opt == '/') && (dm_strtoi(opt + 1, &opt, 10, max_frames) ||
+	    (*max_frames < 0) || (*max_frames > UINT16_MAX)))
+		return -1;
+	return (*opt == '\0') ? 0 : -1;
+}
+
+/*
+ * Monitor command "virtio_moderation", with the arguments
+ * "<slot>,<max usec>[/<max frames>][,<queue>]": set the interrupt
+ * moderation of a queue, or of all the queues of the device.
+ */
+int
+vm_monitor_virtio_moderation(void *arg, char *devargs)
+{
+	char *str, *cp, *str_slot, *str_mod;
+	struct pci_vdev *dev;
+	struct virtio_base *base;
+	int slot, max_usec, max_frames, queue;
+	int error = -1;
+
+	str = cp = strdup(devargs);
+	if (str == NULL)
+		return -1;
+
+	str_slot = strsep(&cp, ",");
+	str_mod = strsep(&cp, ",");
+	if (dm_strtoi(str_slot, &str_slot, 10, &slot) ||
+	    virtio_parse_moderation(str_mod, &max_usec, &max_frames)) {
+		pr_err("%s: incorrect arguments %s\n", __func__, devargs);
+		goto end;
+	}
+
+	dev = pci_get_vdev_info(slot);
+	if ((dev == NULL) || (dev->dev_ops->vdev_barwrite != virtio_pci_write)) {
+		pr_err("%s: no virtio device at slot %d\n", __func__, slot);
+		goto end;
+	}
+	base = dev->arg;
+	if (!(base->flags & VIRTIO_MODERATION)) {
+		pr_err("%s: %s does not support interrupt moderation\n",
+			__func__, base->vops->name);
+		goto end;
+	}
+
+	if (cp == NULL) {
+		error = virtio_set_moderation(base, max_usec, max_frames);
+	} else if (dm_strtoi(cp, &cp, 10, &queue) || (queue < 0) ||
+		   (queue >= base->vops->nvq)) {
+		pr_err("%s: incorrect queue %s\n", __func__, cp);
+	} else {
+		error = vq_set_moderation(&base->queues[queue], max_usec,
+					  max_frames);
+	}
+end:
+	free(str);
+	return error;
+}
+
 int virtio_register_ioeventfd(struct virtio_base *base, int idx, bool is_register, int fd)
 {
 	struct acrn_ioeventfd ioeventfd = {0};
@@ -2034,8 +2982,13 @@ int virtio_register_ioeventfd(struct virtio_base *base, int idx, bool is_registe
 		 * or hyperviosr, this flag will be ignored.
 		 */
 		ioeventfd.flags |= ACRN_IOEVENTFD_FLAG_ASYNCIO;
-	/* register ioeventfd for kick */
-	if (base->device_caps & (1UL << VIRTIO_F_VERSION_1)) {
+	/*
+	 * register ioeventfd for kick; a legacy driver of a transitional
+	 * device kicks the legacy register
+	 */
+	if ((base->device_caps & (1UL << VIRTIO_F_VERSION_1)) &&
+	    ((base->negotiated_caps & (1UL << VIRTIO_F_VERSION_1)) ||
+	     base->dev->bar[base->legacy_pio_bar_idx].type != PCIBAR_IO)) {
 		/*
 		 * in the current implementation, if virtio 1.0 with pio
 		 * notity, its bar idx should be set to non-zero
@@ -40,10 +40,15 @@
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
+#include "vhost.h"
 #include "block_if.h"
 #include "monitor.h"
 
 #define VIRTIO_BLK_RINGSZ	64
+/* default number of completions coalesced into one interrupt */
+#define VIRTIO_BLK_COALESCE_MAX	(VIRTIO_BLK_RINGSZ / 4)
+/* max latency of a coalesced completion, in microseconds */
+#define VIRTIO_BLK_COALESCE_MAX_USEC	1000000
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
 
 #define VIRTIO_BLK_S_OK	0
@@ -80,6 +85,20 @@
 	(VIRTIO_BLK_F_FLUSH |	\
 	VIRTIO_BLK_F_CONFIG_WCE)
 
+/*
+ * Capabilities offered with a vhost-user backend, as far as the backend
+ * offers them too. The cache mode is left to the backend, as config
+ * space writes are not forwarded to it.
+ */
+#define VIRTIO_BLK_S_VHOSTCAPS		\
+	(VIRTIO_BLK_S_HOSTCAPS |	\
+	VIRTIO_BLK_F_RO |		\
+	VIRTIO_BLK_F_FLUSH |		\
+	VIRTIO_BLK_F_MQ |		\
+	VIRTIO_BLK_F_DISCARD |		\
+	(1 << VIRTIO_RING_F_EVENT_IDX) |	\
+	(1UL << VIRTIO_F_VERSION_1))
+
 /*
  * Config space "registers"
  */
@@ -143,6 +162,15 @@ static struct monitor_vm_ops virtio_blk_rescan_ops = {
 	.rescan	= vm_monitor_blkrescan,
 };
 
+/*
+ * vhost-user backend serving the virtqueues
+ */
+struct vhost_blk {
+	struct vhost_dev vdev;
+	struct vhost_vq *vqs;
+	bool vhost_started;
+};
+
 struct virtio_blk_ioreq {
 	struct blockif_req req;
 	struct virtio_blk *blk;
@@ -164,6 +192,10 @@ struct virtio_blk {
 	struct virtio_blk_ioreq *ios;
 	uint8_t original_wce;
 	int num_vqs;
+	bool packed;	/* offer packed virtqueues */
+	int coalesce_usec;	/* max latency of a coalesced completion */
+	int coalesce_max;	/* completions coalesced into one interrupt */
+	struct vhost_blk *vhost_blk;	/* NULL unless vhost_user= is given */
 	struct iothreads_info iothrds_info;
 	struct virtio_ops ops;
 };
@@ -206,9 +238,11 @@ virtio_blk_done(struct blockif_req *br, int err)
 	/*
 	 * Return the descriptor back to the host.
 	 * We wrote 1 byte (our status) to host.
+	 * The completions are published, and the guest interrupted, once
+	 * per batch with the coalesce option.
 	 */
 	pthread_mutex_lock(&vq->mtx);
-	vq_relchain(vq, io->idx, 1);
+	vq_relchain_batch(vq, io->idx, 1);
 	vq_endchains(vq, !vq_has_descs(vq));
 	pthread_mutex_unlock(&vq->mtx);
 }
@@ -252,6 +286,13 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		return;
 	}
 
+	/* a modern driver sets the queue size, and so the range of the ids */
+	if (idx >= VIRTIO_BLK_RINGSZ) {
+		WPRINTF(("%s: request id %d out of range\n", __func__, idx));
+		virtio_blk_abort(vq, idx);
+		return;
+	}
+
 	io = &blk->ios[qidx * VIRTIO_BLK_RINGSZ + idx];
 	if ((flags[0] & VRING_DESC_F_WRITE) != 0) {
 		WPRINTF(("%s: the type for hdr should not be VRING_DESC_F_WRITE\n", __func__));
@@ -387,7 +428,7 @@ virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 	 * requests in virtqueue.
 	 * */
 	do {
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(vq);
 		mb();
 		do {
 			virtio_blk_proc(blk, vq);
@@ -416,6 +457,9 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 	if (blk->num_vqs > 1)
 		caps |= VIRTIO_BLK_F_MQ;
 
+	if (blk->packed)
+		caps |= VIRTIO_PACKED_RING_CAPS;
+
 	return caps;
 }
 
@@ -454,6 +498,99 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
 }
 
+static struct vhost_blk *
+vhost_blk_init(struct virtio_blk *blk, char *path)
+{
+	struct vhost_blk *vhost_blk;
+	int fd, rc;
+
+	vhost_blk = calloc(1, sizeof(struct vhost_blk));
+	if (!vhost_blk) {
+		WPRINTF(("vhost_blk: calloc returns NULL\n"));
+		return NULL;
+	}
+	vhost_blk->vqs = calloc(blk->num_vqs, sizeof(struct vhost_vq));
+	if (!vhost_blk->vqs) {
+		WPRINTF(("vhost_blk: calloc vqs returns NULL\n"));
+		free(vhost_blk);
+		return NULL;
+	}
+
+	fd = vhost_user_connect(path);
+	if (fd < 0) {
+		WPRINTF(("vhost_blk: connect to %s failed\n", path));
+		goto fail;
+	}
+
+	/* pre-init before calling vhost_dev_init */
+	vhost_blk->vdev.nvqs = blk->num_vqs;
+	vhost_blk->vdev.vqs = vhost_blk->vqs;
+	vhost_blk->vdev.vhost_user = true;
+
+	blk->base.device_caps = VIRTIO_BLK_S_VHOSTCAPS;
+
+	/* the socket is closed by vhost_dev_init on failure */
+	rc = vhost_dev_init(&vhost_blk->vdev, &blk->base, fd, 0,
+		VIRTIO_BLK_S_VHOSTCAPS, 0, 0);
+	if (rc < 0) {
+		WPRINTF(("vhost_blk: vhost_dev_init failed\n"));
+		goto fail;
+	}
+
+	/* the disk geometry is only known to the backend */
+	if (vhost_user_get_config(&vhost_blk->vdev, &blk->cfg,
+			sizeof(blk->cfg)) < 0) {
+		WPRINTF(("vhost_blk: backend config space is not available\n"));
+		vhost_dev_deinit(&vhost_blk->vdev);
+		goto fail;
+	}
+	if (!(blk->base.device_caps & VIRTIO_BLK_F_MQ) && blk->num_vqs > 1) {
+		WPRINTF(("vhost_blk: backend does not support mq\n"));
+		vhost_dev_deinit(&vhost_blk->vdev);
+		goto fail;
+	}
+	blk->cfg.num_queues = (uint16_t)blk->num_vqs;
+
+	return vhost_blk;
+
+fail:
+	free(vhost_blk->vqs);
+	free(vhost_blk);
+	return NULL;
+}
+
+static void
+vhost_blk_deinit(struct vhost_blk *vhost_blk)
+{
+	if (vhost_blk->vhost_started)
+		vhost_dev_stop(&vhost_blk->vdev);
+	vhost_dev_deinit(&vhost_blk->vdev);
+	free(vhost_blk->vqs);
+	free(vhost_blk);
+}
+
+static void
+virtio_blk_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_blk *blk = vdev;
+	struct vhost_blk *vhost_blk = blk->vhost_blk;
+
+	if (!vhost_blk)
+		return;
+
+	if (!vhost_blk->vhost_started && (status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+		if (vhost_dev_start(&vhost_blk->vdev) < 0)
+			WPRINTF(("vhost_blk: vhost_dev_start failed\n"));
+		else
+			vhost_blk->vhost_started = true;
+	} else if (vhost_blk->vhost_started &&
+			!(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+		if (vhost_dev_stop(&vhost_blk->vdev) < 0)
+			WPRINTF(("vhost_blk: vhost_dev_stop failed\n"));
+		vhost_blk->vhost_started = false;
+	}
+}
+
 static void
 virtio_blk_init_ops(struct virtio_blk *blk, int num_vqs)
 {
@@ -463,6 +600,7 @@ virtio_blk_init_ops(struct virtio_blk *blk, int num_vqs)
 	blk->ops.reset = virtio_blk_reset;
 	blk->ops.cfgread = virtio_blk_cfgread;
 	blk->ops.cfgwrite = virtio_blk_cfgwrite;
+	blk->ops.set_status = virtio_blk_set_status;
 }
 
 static int
@@ -476,10 +614,12 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt = NULL;
 	u_char digest[16];
 	struct virtio_blk *blk;
-	bool use_iothread;
+	bool use_iothread, packed;
 	struct iothread_ctx *ioctx_base = NULL;
 	struct iothreads_info iothrds_info;
-	int num_vqs;
+	int num_vqs, poll_max_us, coalesce_usec, coalesce_max;
+	int mod_usec, mod_frames;
+	char *vhost_user_path = NULL;
 	int i, j;
 	pthread_mutexattr_t attr;
 	int rc;
@@ -491,6 +631,10 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	/* Assume the bctxt is valid, until identified otherwise */
 	dummy_bctxt = false;
 	use_iothread = false;
+	packed = false;
+	coalesce_usec = 0;
+	coalesce_max = VIRTIO_BLK_COALESCE_MAX;
+	mod_usec = mod_frames = 0;
 	num_vqs = 1;
 
 	if (opts == NULL) {
@@ -518,15 +662,29 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	}
 	if (strstr(opts, "nodisk") == NULL) {
 		/*
-		 * both ",iothread" and ",mq=int" are consumed by virtio-blk
-		 * and must be specified before any other opts which will
-		 * be used by blockif_open.
+		 * ",iothread", ",iopoll=int", ",mq=int", ",packed",
+		 * ",coalesce=int[/int]", ",moderation=int[/int]" and
+		 * ",vhost_user=path" are consumed by virtio-blk and must be
+		 * specified before any other opts which will be used by
+		 * blockif_open.
 		 */
 		char *p = opts_start;
 		while (opts_tmp != NULL) {
 			opt = strsep(&opts_tmp, ",");
 
-			if (!strncmp(opt, "iothread", strlen("iothread"))) {
+			if (!strncmp(opt, "iopoll", strlen("iopoll"))) {
+				/* iopoll=<max poll time of the iothreads in microseconds> */
+				strsep(&opt, "=");
+				if ((opt == NULL) || dm_strtoi(opt, &opt, 10, &poll_max_us) ||
+					(poll_max_us <= 0)) {
+					WPRINTF(("%s: incorrect iopoll time %s\n",
+						__func__, opt));
+					free(opts_start);
+					return -1;
+				}
+				iot_opt.poll_max_us = poll_max_us;
+				p = opts_tmp;
+			} else if (!strncmp(opt, "iothread", strlen("iothread"))) {
 				use_iothread = true;
 				strsep(&opt, "=");
 
@@ -551,6 +709,45 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 						num_vqs = guest_cpu_num();
 				}
 				p = opts_tmp;
+			} else if (!strcmp(opt, "packed")) {
+				packed = true;
+				p = opts_tmp;
+			} else if (!strncmp(opt, "coalesce", strlen("coalesce"))) {
+				/* coalesce=<max latency in microseconds>[/<max completions>] */
+				strsep(&opt, "=");
+				if ((opt == NULL) || dm_strtoi(opt, &opt, 10, &coalesce_usec) ||
+					(coalesce_usec <= 0) ||
+					(coalesce_usec > VIRTIO_BLK_COALESCE_MAX_USEC) || ((*opt == '/') &&
+					(dm_strtoi(opt + 1, &opt, 10, &coalesce_max) ||
+					(coalesce_max <= 1)))) {
+					WPRINTF(("%s: incorrect coalesce option %s\n",
+						__func__, opt));
+					free(opts_start);
+					return -1;
+				}
+				if (coalesce_max > VIRTIO_BLK_RINGSZ)
+					coalesce_max = VIRTIO_BLK_RINGSZ;
+				p = opts_tmp;
+			} else if (!strncmp(opt, "moderation", strlen("moderation"))) {
+				/* moderation=<max usec>[/<max frames>] */
+				strsep(&opt, "=");
+				if (virtio_parse_moderation(opt, &mod_usec, &mod_frames)) {
+					WPRINTF(("%s: incorrect moderation %s\n",
+						__func__, opt));
+					free(opts_start);
+					return -1;
+				}
+				p = opts_tmp;
+			} else if (!strncmp(opt, "vhost_user=", strlen("vhost_user="))) {
+				/* vhost_user=<socket of the backend serving the disk> */
+				free(vhost_user_path);
+				vhost_user_path = strdup(opt + strlen("vhost_user="));
+				if (!vhost_user_path) {
+					WPRINTF(("%s: strdup failed\n", __func__));
+					free(opts_start);
+					return -1;
+				}
+				p = opts_tmp;
 			} else {
 				/* The opts_start is truncated by strsep, opts_tmp is also
 				 * changed by strsetp, so use opts which points to the
@@ -585,11 +782,16 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		iothrds_info.ioctx_base = ioctx_base;
 		iothrds_info.num = iot_opt.num;
 
-		bctxt = blockif_open(p, bident, num_vqs, &iothrds_info);
-		if (bctxt == NULL) {
-			pr_err("Could not open backing file");
-			free(opts_start);
-			return -1;
+		if (vhost_user_path) {
+			/* the backend owns the disk, there is no blockif */
+			dummy_bctxt = true;
+		} else {
+			bctxt = blockif_open(p, bident, num_vqs, &iothrds_info);
+			if (bctxt == NULL) {
+				pr_err("Could not open backing file");
+				free(opts_start);
+				return -1;
+			}
 		}
 	} else {
 		dummy_bctxt = true;
@@ -601,6 +803,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	blk = calloc(1, sizeof(struct virtio_blk));
 	if (!blk) {
 		WPRINTF(("virtio_blk: calloc returns NULL\n"));
+		free(vhost_user_path);
 		return -1;
 	}
 
@@ -612,9 +815,26 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	blk->dummy_bctxt = dummy_bctxt;
 
 	blk->num_vqs = num_vqs;
+	/* vhost_vq_start() only hands split rings to the backend */
+	if (vhost_user_path && packed) {
+		WPRINTF(("virtio_blk: packed is not supported with vhost_user, use split rings\n"));
+		packed = false;
+	}
+	blk->packed = packed;
+	/*
+	 * The staged completions are guarded by vq->mtx, which the request
+	 * processing only holds on the iothreads.
+	 */
+	if (coalesce_usec && !use_iothread) {
+		WPRINTF(("virtio_blk: coalesce is only supported with iothread\n"));
+		coalesce_usec = 0;
+	}
+	blk->coalesce_usec = coalesce_usec;
+	blk->coalesce_max = coalesce_max;
 	blk->vqs = calloc(blk->num_vqs, sizeof(struct virtio_vq_info));
 	if (!blk->vqs) {
 		WPRINTF(("virtio_blk: calloc vqs returns NULL\n"));
+		free(vhost_user_path);
 		free(blk);
 		return -1;
 	}
@@ -622,6 +842,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		sizeof(struct virtio_blk_ioreq));
 	if (!blk->ios) {
 		WPRINTF(("virtio_blk: calloc ios returns NULL\n"));
+		free(vhost_user_path);
 		free(blk->vqs);
 		free(blk);
 		return -1;
@@ -656,7 +877,8 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	virtio_blk_init_ops(blk, num_vqs);
 
 	/* init virtio struct and virtqueues */
-	virtio_linkup(&blk->base, &(blk->ops), blk, dev, blk->vqs, BACKEND_VBSU);
+	virtio_linkup(&blk->base, &(blk->ops), blk, dev, blk->vqs,
+		      vhost_user_path ? BACKEND_VHOST : BACKEND_VBSU);
 	blk->base.iothread = use_iothread;
 	blk->base.mtx = &blk->mtx;
 
@@ -666,6 +888,25 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		if (use_iothread) {
 			blk->vqs[j].viothrd.ioctx = ioctx_base + j % (iot_opt.num);
 		}
+		if (blk->coalesce_usec && vq_set_coalesce(&blk->vqs[j],
+				blk->coalesce_max, blk->coalesce_usec))
+			WPRINTF(("virtio_blk: coalesce setup of vq %d failed\n", j));
+	}
+	/* the queues of vhost are signaled by the backend */
+	if (!vhost_user_path &&
+	    virtio_set_moderation(&blk->base, mod_usec, mod_frames))
+		WPRINTF(("virtio_blk: interrupt moderation setup failed\n"));
+
+	if (vhost_user_path) {
+		blk->vhost_blk = vhost_blk_init(blk, vhost_user_path);
+		free(vhost_user_path);
+		if (!blk->vhost_blk) {
+			virtio_release_queues(&blk->base);
+			free(blk->ios);
+			free(blk->vqs);
+			free(blk);
+			return -1;
+		}
 	}
 
 	/*
@@ -712,11 +953,28 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		/* call close only for valid bctxt */
 		if (!blk->dummy_bctxt)
 			blockif_close(blk->bc);
+		if (blk->vhost_blk)
+			vhost_blk_deinit(blk->vhost_blk);
+		virtio_release_queues(&blk->base);
 		free(blk);
 		return -1;
 	}
 	virtio_set_io_bar(&blk->base, 0);
 
+	/* packed virtqueues are only negotiable on the modern interface */
+	if (blk->packed && virtio_set_modern_bar(&blk->base, true)) {
+		WPRINTF(("virtio_blk: modern bar setup failed\n"));
+		if (!blk->dummy_bctxt)
+			blockif_close(blk->bc);
+		if (blk->vhost_blk)
+			vhost_blk_deinit(blk->vhost_blk);
+		virtio_release_queues(&blk->base);
+		free(blk->ios);
+		free(blk->vqs);
+		free(blk);
+		return -1;
+	}
+
 	/*
 	 * Register ops for virtio-blk Rescan
 	 */
@@ -747,7 +1005,10 @@ virtio_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 				WPRINTF(("vrito_blk: Failed to flush before close\n"));
 			blockif_close(bctxt);
 		}
+		if (blk->vhost_blk)
+			vhost_blk_deinit(blk->vhost_blk);
 		virtio_reset_dev(&blk->base);
+		virtio_release_queues(&blk->base);
 		if (blk->ios)
 			free(blk->ios);
 		if (blk->vqs)
@@ -849,6 +1110,11 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 		goto end;
 	}
 
+	if (blk->vhost_blk) {
+		pr_err("The disk of a vhost-user backend cannot be replaced!\n");
+		goto end;
+	}
+
 	pr_err("name=%s, Path=%s, ident=%s\n", dev->name, newpath, bident);
 	/* update the bctxt for the virtio-blk device */
 	bctxt = blockif_open(newpath, bident, blk->num_vqs, &blk->iothrds_info);
@@ -131,6 +131,7 @@ struct virtio_console {
 	struct virtio_console_port	ports[VIRTIO_CONSOLE_MAXPORTS];
 	struct virtio_console_config	*config;
 	int				ref_count;
+	bool				packed;	/* offer packed virtqueues */
 };
 
 struct virtio_console_config {
@@ -419,7 +420,7 @@ virtio_console_notify_rx(void *vdev, struct virtio_vq_info *vq)
 	if (!port->rx_ready) {
 		port->rx_ready = 1;
 		if (vq_has_descs(vq)) {
-			vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+			vq_set_used_ring_flags(vq);
 		}
 	}
 }
@@ -970,8 +971,13 @@ virtio_console_add_backends(struct virtio_console *console, char *opts)
 
 	/* virtio-console,[@]stdio|tty|pty|file:portname[=portpath]
 	 * [,[@]stdio|tty|pty|file:portname[=portpath][:socket_type]]
+	 * [,packed]
 	 */
 	while ((opt = strsep(&opts, ",")) != NULL) {
+		if (!strcmp(opt, "packed")) {
+			console->packed = true;
+			continue;
+		}
 		if (virtio_console_add_backend(console, opt))
 			return -1;
 	}
@@ -1021,6 +1027,7 @@ virtio_console_destroy(struct virtio_console *console)
 {
 	if (console) {
 		virtio_console_reset(console);
+		virtio_release_queues(&console->base);
 		if (console->config)
 			free(console->config);
 		free(console);
@@ -1182,6 +1189,15 @@ virtio_console_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return -1;
 	}
 
+	/* packed virtqueues are only negotiable on the modern interface */
+	if (console->packed) {
+		console->base.device_caps |= VIRTIO_PACKED_RING_CAPS;
+		if (virtio_set_modern_bar(&console->base, true)) {
+			WPRINTF(("vtcon: modern bar setup failed\n"));
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
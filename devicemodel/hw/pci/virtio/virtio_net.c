@@ -26,13 +26,16 @@
  * $FreeBSD$
  */
 
+#include <sys/param.h>
 #include <sys/uio.h>
 #include <net/ethernet.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <liburing.h>
 #include <openssl/md5.h>
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
 #include <openssl/evp.h>
@@ -51,10 +54,18 @@
 #include "virtio.h"
 #include "vhost.h"
 #include "dm_string.h"
+#include "iothread.h"
 
 #define VIRTIO_NET_RINGSZ	1024
 #define VIRTIO_NET_MAXSEGS	256
 
+/*
+ * Batched tap I/O: up to VIRTIO_NET_MAX_BATCH chains are submitted to the
+ * tap in one io_uring submission.
+ */
+#define VIRTIO_NET_DEF_BATCH	32
+#define VIRTIO_NET_MAX_BATCH	64
+
 /*
  * Host capabilities.  Note that we only offer a few of these.
  */
@@ -77,11 +88,28 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ		(1 << 22) /* multiple queue pairs */
 
 #define VIRTIO_NET_S_HOSTCAPS      \
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
 	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC))
 
+/*
+ * Offloads offered when the tap device passes the virtio-net header through
+ * (IFF_VNET_HDR), so that partially checksummed and GSO frames of up to 64KiB
+ * cross the tap boundary without being segmented or checksummed.
+ */
+#define VIRTIO_NET_S_OFFLOADCAPS	\
+	(VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | \
+	VIRTIO_NET_F_HOST_TSO4 | VIRTIO_NET_F_HOST_TSO6 | \
+	VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6)
+
+/*
+ * Offered with more than one queue pair, the number of active queue pairs
+ * is set by the guest through the control queue.
+ */
+#define VIRTIO_NET_S_MQCAPS	(VIRTIO_NET_F_MQ | VIRTIO_NET_F_CTRL_VQ)
+
 #define VIRTIO_NET_S_VHOSTCAPS      \
 	((1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
 	(1 << VIRTIO_RING_F_EVENT_IDX) | VIRTIO_NET_F_MRG_RXBUF | \
@@ -96,16 +124,44 @@
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 /*
  * Queue definitions.
+ * Queue pair i uses rx queue 2 * i and tx queue 2 * i + 1. With more than
+ * one queue pair, the control queue follows the last queue pair.
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_MAX_QPAIRS	8
+#define VIRTIO_NET_MAXQ	(VIRTIO_NET_MAX_QPAIRS * 2 + 1)
+
+#define VIRTIO_NET_RXQ_IDX(qp)	((qp) * 2 + VIRTIO_NET_RXQ)
+#define VIRTIO_NET_TXQ_IDX(qp)	((qp) * 2 + VIRTIO_NET_TXQ)
+
+/*
+ * Control queue commands
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK	0
+#define VIRTIO_NET_ERR	1
+
+#define VIRTIO_NET_CTRL_MQ			4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET		0
+
+#define VIRTIO_NET_CTRL_MAXSEGS	8
+
+/*
+ * Max size of a received frame, without and with guest TSO
+ */
+#define VIRTIO_NET_MAX_FRAME_LEN	(ETHER_MAX_LEN + 4)	/* with a VLAN tag */
+#define VIRTIO_NET_MAX_GSO_LEN		(65535 + ETHER_HDR_LEN + 4)
 
 /*
  * Fixed network header size
@@ -127,26 +183,87 @@ static int virtio_net_debug;
 #define DPRINTF(params) do { if (virtio_net_debug) pr_dbg params; } while (0)
 #define WPRINTF(params) (pr_err params)
 
+/*
+ * Packets per second statistics of one direction of a queue pair
+ */
+struct virtio_net_pps {
+	uint64_t	pkts;		/* packets in the current period */
+	uint64_t	calls;		/* tap syscalls or io_uring submissions */
+	uint64_t	start_ns;	/* start of the current period */
+};
+
+/*
+ * io_uring and chains of one direction of a queue pair for batched tap I/O.
+ * Only used by the thread serving that direction, so not locked.
+ */
+struct virtio_net_batch {
+	struct io_uring	ring;
+	uint16_t	idx[VIRTIO_NET_MAX_BATCH];
+	struct iovec	iov[VIRTIO_NET_MAX_BATCH][VIRTIO_NET_MAXSEGS + 1];
+	struct iovec	*tap_iov[VIRTIO_NET_MAX_BATCH];	/* segments passed to the tap */
+	int		tap_iovcnt[VIRTIO_NET_MAX_BATCH];
+	void		*vrx[VIRTIO_NET_MAX_BATCH];	/* rx header without IFF_VNET_HDR */
+	uint32_t	len[VIRTIO_NET_MAX_BATCH];	/* tx: chain length, rx: capacity */
+	int		res[VIRTIO_NET_MAX_BATCH];	/* tap read/write result */
+};
+
 /*
  * vhost device struct
  */
 struct vhost_net {
 	struct vhost_dev vdev;
-	struct vhost_vq vqs[VIRTIO_NET_MAXQ - 1];
+	struct vhost_vq vqs[2];		/* vhost-net supports one queue pair */
 	int tapfd;
 	bool vhost_started;
 };
 
+/*
+ * Per-queue-pair struct. Each queue pair is backed by one queue of the tap
+ * device. The rx side is served by the mevent thread with one queue pair,
+ * or by a dedicated iothread per queue pair otherwise. The tx side is served
+ * by a tx thread per queue pair.
+ */
+struct virtio_net_qpair {
+	struct virtio_net *net;
+	int		idx;
+
+	int		tapfd;
+	struct mevent	*mevp;
+	struct iothread_ctx *ioctx;
+	struct iothread_mevent iomvt;
+
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+	pthread_t	tx_tid;
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+
+	struct virtio_net_batch *rx_batch;	/* NULL without batched tap I/O */
+	struct virtio_net_batch *tx_batch;
+	struct virtio_net_pps rx_pps;
+	struct virtio_net_pps tx_pps;
+};
+
 /*
  * Per-device struct
  */
 struct virtio_net {
 	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
+	struct virtio_ops ops;
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
 	pthread_mutex_t mtx;
-	struct mevent	*mevp;
 
-	int		tapfd;
+	struct virtio_net_qpair qpairs[VIRTIO_NET_MAX_QPAIRS];
+	int		qpair_num;	/* queue pairs created */
+	int		active_qpairs;	/* queue pairs enabled by the guest */
+
+	bool		tap_vnet_hdr;	/* the tap passes the virtio-net header through */
+	int		batch;		/* max chains per tap submission, 1 to disable */
+	bool		pps;		/* report packets per second */
+	bool		packed;		/* offer packed virtqueues */
+	int		mod_usec;	/* max interrupt delay, 0 to disable */
+	int		mod_frames;	/* packets per interrupt, 0 for no limit */
 
 	int		rx_ready;
 
@@ -157,25 +274,20 @@ struct virtio_net {
 
 	struct virtio_net_config config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
+	void (*virtio_net_rx)(struct virtio_net_qpair *qp);
+	void (*virtio_net_tx)(struct virtio_net_qpair *qp, struct iovec *iov,
 			     int iovcnt, int len);
 
 	struct vhost_net *vhost_net;
 	bool		use_vhost;
+	bool		vhost_user;	/* vhost backend behind a vhost-user socket */
 };
 
 static void virtio_net_reset(void *vdev);
-static void virtio_net_tx_stop(struct virtio_net *net);
+static void virtio_net_tx_stop(struct virtio_net_qpair *qp);
 static int virtio_net_cfgread(void *vdev, int offset, int size,
 	uint32_t *retval);
 static int virtio_net_cfgwrite(void *vdev, int offset, int size,
@@ -184,14 +296,14 @@ static void virtio_net_neg_features(void *vdev, uint64_t negotiated_features);
 static void virtio_net_set_status(void *vdev, uint64_t status);
 static void virtio_net_teardown(void *param);
 static struct vhost_net *vhost_net_init(struct virtio_base *base, int vhostfd,
-	int tapfd, int vq_idx);
+	int tapfd, int vq_idx, bool vhost_user);
 static int vhost_net_deinit(struct vhost_net *vhost_net);
 static int vhost_net_start(struct vhost_net *vhost_net);
 static int vhost_net_stop(struct vhost_net *vhost_net);
 
 static struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	2,				/* 2 virtqueues, or 2 per queue pair + 1 with mq */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
 	NULL,				/* device-wide qnotify -- not used */
@@ -270,13 +382,19 @@ ether_aton(const char *a, struct ether_addr *e)
 static void
 virtio_net_txwait(struct virtio_net *net)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
-		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+	struct virtio_net_qpair *qp;
+	int i;
+
+	for (i = 0; i < net->qpair_num; i++) {
+		qp = &net->qpairs[i];
+		pthread_mutex_lock(&qp->tx_mtx);
+		while (qp->tx_in_progress) {
+			pthread_mutex_unlock(&qp->tx_mtx);
+			usleep(10000);
+			pthread_mutex_lock(&qp->tx_mtx);
+		}
+		pthread_mutex_unlock(&qp->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
 }
 
 /*
@@ -285,13 +403,80 @@ virtio_net_txwait(struct virtio_net *net)
 static void
 virtio_net_rxwait(struct virtio_net *net)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
-		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+	struct virtio_net_qpair *qp;
+	int i;
+
+	for (i = 0; i < net->qpair_num; i++) {
+		qp = &net->qpairs[i];
+		pthread_mutex_lock(&qp->rx_mtx);
+		while (qp->rx_in_progress) {
+			pthread_mutex_unlock(&qp->rx_mtx);
+			usleep(10000);
+			pthread_mutex_lock(&qp->rx_mtx);
+		}
+		pthread_mutex_unlock(&qp->rx_mtx);
+	}
+}
+
+/*
+ * Tell the tap the virtio-net header size and which offloads the guest could
+ * receive, according to the negotiated features.
+ */
+static void
+virtio_net_tap_set_offload(struct virtio_net *net, uint64_t features)
+{
+	unsigned int offload = 0;
+	int hdrsz = net->rx_vhdrlen;
+	int i, tapfd;
+
+	if (!net->tap_vnet_hdr)
+		return;
+
+	if (features & VIRTIO_NET_F_GUEST_CSUM) {
+		offload |= TUN_F_CSUM;
+		if (features & VIRTIO_NET_F_GUEST_TSO4)
+			offload |= TUN_F_TSO4;
+		if (features & VIRTIO_NET_F_GUEST_TSO6)
+			offload |= TUN_F_TSO6;
+	}
+
+	for (i = 0; i < net->qpair_num; i++) {
+		tapfd = net->qpairs[i].tapfd;
+		if (tapfd < 0)
+			continue;
+		if (ioctl(tapfd, TUNSETVNETHDRSZ, &hdrsz) < 0)
+			WPRINTF(("vtnet: TUNSETVNETHDRSZ %d failed, errno %d\n", hdrsz, errno));
+		if (ioctl(tapfd, TUNSETOFFLOAD, offload) < 0)
+			WPRINTF(("vtnet: TUNSETOFFLOAD 0x%x failed, errno %d\n", offload, errno));
+	}
+}
+
+/*
+ * Enable the first @num queue pairs. The tap queues of the other queue pairs
+ * are detached, so that the tap only steers the flows to the enabled ones.
+ */
+static int
+virtio_net_set_qpairs(struct virtio_net *net, int num)
+{
+	struct ifreq ifr;
+	int i;
+
+	if (num < 1 || num > net->qpair_num)
+		return -1;
+
+	for (i = 0; i < net->qpair_num; i++) {
+		if (net->qpairs[i].tapfd < 0 || net->qpair_num == 1)
+			continue;
+		memset(&ifr, 0, sizeof(ifr));
+		ifr.ifr_flags = (i < num) ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+		if (ioctl(net->qpairs[i].tapfd, TUNSETQUEUE, &ifr) < 0 && (i < num)) {
+			WPRINTF(("vtnet: fails to attach tap queue %d, errno %d\n", i, errno));
+			return -1;
+		}
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
+	net->active_qpairs = num;
+
+	return 0;
 }
 
 static void
@@ -313,6 +498,8 @@ virtio_net_reset(void *vdev)
 	net->rx_ready = 0;
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	virtio_net_tap_set_offload(net, 0);
+	virtio_net_set_qpairs(net, 1);
 
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
@@ -325,29 +512,29 @@ virtio_net_reset(void *vdev)
  * Send signal to tx I/O thread and wait till it exits
  */
 static void
-virtio_net_tx_stop(struct virtio_net *net)
+virtio_net_tx_stop(struct virtio_net_qpair *qp)
 {
 	void *jval;
 
-	pthread_mutex_lock(&net->tx_mtx);
-	net->closing = 1;
-	pthread_cond_broadcast(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	qp->net->closing = 1;
+	pthread_cond_broadcast(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 
-	pthread_join(net->tx_tid, &jval);
+	pthread_join(qp->tx_tid, &jval);
 }
 
 /*
  * Called to send a buffer chain out to the tap device
  */
 static void
-virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
+virtio_net_tap_tx(struct virtio_net_qpair *qp, struct iovec *iov, int iovcnt,
 		  int len)
 {
 	static char pad[60]; /* all zero bytes */
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (qp->tapfd == -1)
 		return;
 
 	/*
@@ -360,7 +547,7 @@ virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
 		iov[iovcnt].iov_len = 60 - len;
 		iovcnt++;
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
+	ret = writev(qp->tapfd, iov, iovcnt);
 	(void)ret; /*avoid compiler warning*/
 }
 
@@ -400,20 +587,419 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 	return riov;
 }
 
+/*
+ * Account @pkts packets moved by one tap syscall or io_uring submission, and
+ * report the packet rate and the packets per call every second.
+ */
+static void
+virtio_net_pps_update(struct virtio_net_qpair *qp, struct virtio_net_pps *pps,
+		      const char *dir, int pkts)
+{
+	struct timespec ts;
+	uint64_t now, delta;
+
+	if (!qp->net->pps || pkts <= 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+	if (pps->start_ns == 0)
+		pps->start_ns = now;
+
+	pps->pkts += pkts;
+	pps->calls++;
+	delta = now - pps->start_ns;
+	if (delta >= 1000000000UL) {
+		pr_info("vtnet: queue pair %d %s: %lu pps, %lu.%02lu packets per call\n",
+			qp->idx, dir, pps->pkts * 1000000000UL / delta,
+			pps->pkts / pps->calls, (pps->pkts * 100 / pps->calls) % 100);
+		pps->pkts = 0;
+		pps->calls = 0;
+		pps->start_ns = now;
+	}
+}
+
+static struct virtio_net_batch *
+virtio_net_batch_init(struct virtio_net *net)
+{
+	struct virtio_net_batch *b;
+	int rc;
+
+	b = calloc(1, sizeof(*b));
+	if (b == NULL)
+		return NULL;
+
+	rc = io_uring_queue_init(net->batch, &b->ring, 0);
+	if (rc < 0) {
+		WPRINTF(("vtnet: io_uring_queue_init failed, error %d, no batched tap I/O\n", rc));
+		free(b);
+		return NULL;
+	}
+
+	return b;
+}
+
 static void
-virtio_net_tap_rx(struct virtio_net *net)
+virtio_net_batch_deinit(struct virtio_net_batch **pb)
+{
+	if (*pb != NULL) {
+		io_uring_queue_exit(&(*pb)->ring);
+		free(*pb);
+		*pb = NULL;
+	}
+}
+
+/*
+ * Submit the @n prepared requests and wait for all of them, each result is
+ * stored in the int the request data points to. Return -1 if not all requests
+ * are submitted and completed; the results of the others are left untouched.
+ */
+static int
+virtio_net_batch_submit(struct virtio_net_batch *b, int n)
+{
+	struct io_uring_cqe *cqe;
+	int i, ret, submitted;
+
+	do {
+		submitted = io_uring_submit_and_wait(&b->ring, n);
+	} while (submitted == -EINTR);
+
+	for (i = 0; i < submitted; i++) {
+		do {
+			ret = io_uring_wait_cqe(&b->ring, &cqe);
+		} while (ret == -EINTR);
+		if (ret < 0)
+			return -1;
+
+		*(int *)io_uring_cqe_get_data(cqe) = cqe->res;
+		io_uring_cqe_seen(&b->ring, cqe);
+	}
+
+	return (submitted == n) ? 0 : -1;
+}
+
+/*
+ * Copy @len bytes between the segments of two chains
+ */
+static size_t
+virtio_net_iov_copy(const struct iovec *dst, int dcnt, const struct iovec *src,
+		    int scnt, size_t len)
+{
+	size_t doff = 0, soff = 0, copied = 0, n;
+	int d = 0, s = 0;
+
+	while (copied < len && d < dcnt && s < scnt) {
+		n = MIN(dst[d].iov_len - doff, src[s].iov_len - soff);
+		n = MIN(n, len - copied);
+		memcpy((uint8_t *)dst[d].iov_base + doff, (uint8_t *)src[s].iov_base + soff, n);
+		copied += n;
+		doff += n;
+		soff += n;
+		if (doff == dst[d].iov_len) {
+			d++;
+			doff = 0;
+		}
+		if (soff == src[s].iov_len) {
+			s++;
+			soff = 0;
+		}
+	}
+
+	return copied;
+}
+
+/*
+ * Send up to net->batch chains to the tap with one io_uring submission.
+ * Return the number of chains sent, or -1 if no chain is gathered.
+ */
+static int
+virtio_net_tap_tx_batch(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
+{
+	static char pad[60]; /* all zero bytes */
+	struct virtio_net *net = qp->net;
+	struct virtio_net_batch *b = qp->tx_batch;
+	struct io_uring_sqe *sqe;
+	struct iovec *iov;
+	int i, n, cnt, plen, failed;
+	ssize_t ret;
+
+	for (n = 0; n < net->batch && vq_has_descs(vq); n++) {
+		iov = b->iov[n];
+		cnt = vq_getchain(vq, &b->idx[n], iov, VIRTIO_NET_MAXSEGS, NULL);
+		if (cnt < 1 || cnt > VIRTIO_NET_MAXSEGS) {
+			WPRINTF(("vtnet: virtio_net_tap_tx_batch: vq_getchain = %d\n", cnt));
+			break;
+		}
+
+		b->len[n] = 0;
+		for (i = 0; i < cnt; i++)
+			b->len[n] += iov[i].iov_len;
+		plen = b->len[n] - net->rx_vhdrlen;
+
+		/* the virtio-net header carries the csum/gso info to the tap */
+		if (!net->tap_vnet_hdr) {
+			iov = rx_iov_trim(iov, &cnt, net->rx_vhdrlen);
+			if (iov == NULL) {
+				/* a chain without the header is dropped */
+				vq_relchain(vq, b->idx[n], b->len[n]);
+				n--;
+				continue;
+			}
+		}
+		if (plen < 60) {
+			iov[cnt].iov_base = pad;
+			iov[cnt].iov_len = 60 - plen;
+			cnt++;
+		}
+		b->tap_iov[n] = iov;
+		b->tap_iovcnt[n] = cnt;
+		b->res[n] = -ECANCELED;
+
+		/* the ring has at least net->batch entries */
+		sqe = io_uring_get_sqe(&b->ring);
+		io_uring_prep_writev(sqe, qp->tapfd, iov, cnt, 0);
+		io_uring_sqe_set_data(sqe, &b->res[n]);
+	}
+
+	if (n == 0)
+		return -1;
+
+	failed = virtio_net_batch_submit(b, n);
+	for (i = 0; i < n; i++) {
+		if (b->res[i] == -ECANCELED) {
+			ret = writev(qp->tapfd, b->tap_iov[i], b->tap_iovcnt[i]);
+			(void)ret; /*avoid compiler warning*/
+		}
+		vq_relchain(vq, b->idx[i], b->len[i]);
+	}
+	virtio_net_pps_update(qp, &qp->tx_pps, "tx", n);
+
+	if (failed) {
+		WPRINTF(("vtnet: queue pair %d tx io_uring failed, no batched tap I/O\n", qp->idx));
+		virtio_net_batch_deinit(&qp->tx_batch);
+	}
+
+	return n;
+}
+
+/*
+ * Receive up to net->batch frames, each into a single chain, with one io_uring
+ * submission. Return the number of frames received and set @drained if the
+ * tap ran out of frames, or return -1 if the next chain is to be filled by the
+ * one frame at a time path.
+ */
+static int
+virtio_net_tap_rx_batch(struct virtio_net_qpair *qp, struct virtio_vq_info *vq,
+			bool *drained)
 {
+	struct virtio_net *net = qp->net;
+	struct virtio_net_batch *b = qp->rx_batch;
+	struct virtio_net_rxhdr *vrxh;
+	struct io_uring_sqe *sqe;
+	struct iovec *iov;
+	size_t maxlen;
+	int i, k, n, cnt, failed;
+
+	*drained = false;
+	maxlen = net->rx_vhdrlen + ((net->features & (VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6)) ?
+		VIRTIO_NET_MAX_GSO_LEN : VIRTIO_NET_MAX_FRAME_LEN);
+
+	for (n = 0; n < net->batch && vq_has_descs(vq); n++) {
+		iov = b->iov[n];
+		cnt = vq_getchain(vq, &b->idx[n], iov, VIRTIO_NET_MAXSEGS, NULL);
+		if (cnt < 1 || cnt > VIRTIO_NET_MAXSEGS) {
+			WPRINTF(("vtnet: virtio_net_tap_rx_batch: vq_getchain = %d\n", cnt));
+			break;
+		}
+
+		b->vrx[n] = NULL;
+		if (!net->tap_vnet_hdr) {
+			/* the frame follows the rx header */
+			b->vrx[n] = iov[0].iov_base;
+			iov = rx_iov_trim(iov, &cnt, net->rx_vhdrlen);
+			if (iov == NULL) {
+				vq_retchain(vq);
+				break;
+			}
+		} else if (iov[0].iov_len < net->rx_vhdrlen) {
+			vq_retchain(vq);
+			break;
+		}
+
+		b->len[n] = 0;
+		for (i = 0; i < cnt; i++)
+			b->len[n] += iov[i].iov_len;
+
+		/* with merged rx buffers, a frame that may span chains is not batched */
+		if (net->tap_vnet_hdr && net->rx_merge && (b->len[n] < maxlen)) {
+			vq_retchain(vq);
+			break;
+		}
+
+		b->tap_iov[n] = iov;
+		b->tap_iovcnt[n] = cnt;
+		b->res[n] = -ECANCELED;
+
+		/* never wait in the kernel for a frame to arrive */
+		sqe = io_uring_get_sqe(&b->ring);
+		io_uring_prep_readv(sqe, qp->tapfd, iov, cnt, 0);
+		sqe->rw_flags = RWF_NOWAIT;
+		io_uring_sqe_set_data(sqe, &b->res[n]);
+	}
+
+	if (n == 0)
+		return -1;
+
+	failed = virtio_net_batch_submit(b, n);
+
+	/*
+	 * The reads are served in order, but a frame arriving after a read found
+	 * the tap empty could be received by a later read. Move such frames down
+	 * so that the chains filled are the first ones, and the others can be
+	 * returned to the avail ring.
+	 */
+	for (i = 0, k = 0; i < n; i++) {
+		if (b->res[i] <= 0) {
+			if (b->res[i] == -EOPNOTSUPP)
+				failed = -1;
+			else
+				*drained = true;
+			continue;
+		}
+		if (i != k) {
+			if (b->res[i] > b->len[k]) {
+				WPRINTF(("vtnet: drop rx frame of %d bytes\n", b->res[i]));
+				continue;
+			}
+			virtio_net_iov_copy(b->tap_iov[k], b->tap_iovcnt[k],
+					    b->tap_iov[i], b->tap_iovcnt[i], b->res[i]);
+			b->res[k] = b->res[i];
+		}
+		k++;
+	}
+	for (i = k; i < n; i++)
+		vq_retchain(vq);
+
+	for (i = 0; i < k; i++) {
+		if (net->tap_vnet_hdr) {
+			vrxh = b->tap_iov[i][0].iov_base;
+		} else {
+			/*
+			 * The only valid field in the rx packet header is the
+			 * number of buffers if merged rx bufs were negotiated.
+			 */
+			vrxh = b->vrx[i];
+			memset(vrxh, 0, net->rx_vhdrlen);
+			b->res[i] += net->rx_vhdrlen;
+		}
+		if (net->rx_vhdrlen == sizeof(struct virtio_net_rxhdr))
+			vrxh->vrh_bufs = 1;
+
+		vq_relchain(vq, b->idx[i], b->res[i]);
+	}
+	virtio_net_pps_update(qp, &qp->rx_pps, "rx", k);
+
+	if (failed) {
+		WPRINTF(("vtnet: queue pair %d rx io_uring failed, no batched tap I/O\n", qp->idx));
+		virtio_net_batch_deinit(&qp->rx_batch);
+		*drained = false;
+	}
+
+	return k;
+}
+
+/*
+ * Receive one frame, including its virtio-net header, from a tap with
+ * IFF_VNET_HDR. With merged rx buffers, the frame could span several chains,
+ * so chains are collected until the largest possible frame fits.
+ * Return false if there is no more frame.
+ */
+static bool
+virtio_net_tap_rx_vnet_hdr(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
+{
+	struct virtio_net *net = qp->net;
+	struct iovec iov[VIRTIO_NET_MAXSEGS];
+	uint16_t idx[VIRTIO_NET_MAXSEGS];
+	uint32_t chain_len[VIRTIO_NET_MAXSEGS];
+	struct virtio_net_rxhdr *vrxh;
+	size_t maxlen, space;
+	ssize_t len;
+	int i, n, niov, nchain, nused;
+
+	maxlen = net->rx_vhdrlen + ((net->features & (VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6)) ?
+		VIRTIO_NET_MAX_GSO_LEN : VIRTIO_NET_MAX_FRAME_LEN);
+	space = 0;
+	niov = 0;
+	nchain = 0;
+	do {
+		n = vq_getchain(vq, &idx[nchain], &iov[niov], VIRTIO_NET_MAXSEGS - niov, NULL);
+		if (n < 1 || n > VIRTIO_NET_MAXSEGS - niov) {
+			WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", n));
+			if (n > 0)
+				nchain++;
+			break;
+		}
+		chain_len[nchain] = 0;
+		for (i = 0; i < n; i++)
+			chain_len[nchain] += iov[niov + i].iov_len;
+		space += chain_len[nchain];
+		niov += n;
+		nchain++;
+	} while (net->rx_merge && space < maxlen && niov < VIRTIO_NET_MAXSEGS && vq_has_descs(vq));
+
+	if (niov == 0 || iov[0].iov_len < net->rx_vhdrlen) {
+		/* the header shall fit in the first segment */
+		while (nchain-- > 0)
+			vq_retchain(vq);
+		return false;
+	}
+
+	len = readv(qp->tapfd, iov, niov);
+	if (len <= 0) {
+		/* No more packets, return all the chains */
+		while (nchain-- > 0)
+			vq_retchain(vq);
+		return false;
+	}
+
+	/* the chains not filled by this frame are returned to the avail ring */
+	space = len;
+	for (nused = 0; nused < nchain && space > 0; nused++) {
+		if (chain_len[nused] > space)
+			chain_len[nused] = space;
+		space -= chain_len[nused];
+	}
+	for (i = nused; i < nchain; i++)
+		vq_retchain(vq);
+
+	if (net->rx_vhdrlen == sizeof(struct virtio_net_rxhdr)) {
+		vrxh = iov[0].iov_base;
+		vrxh->vrh_bufs = nused;
+	}
+
+	/* the guest never sees a partial merged frame */
+	vq_relchains(vq, idx, chain_len, nused);
+	virtio_net_pps_update(qp, &qp->rx_pps, "rx", 1);
+
+	return true;
+}
+
+static void
+virtio_net_tap_rx(struct virtio_net_qpair *qp)
+{
+	struct virtio_net *net = qp->net;
 	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
 	struct virtio_vq_info *vq;
 	void *vrx;
 	int len, n;
 	uint16_t idx;
 	ssize_t ret;
+	bool drained = false;
 
 	/*
 	 * Should never be called without a valid tap fd
 	 */
-	if (net->tapfd == -1) {
+	if (qp->tapfd == -1) {
 		WPRINTF(("vtnet: tapfd == -1\n"));
 		return;
 	}
@@ -426,7 +1012,7 @@ virtio_net_tap_rx(struct virtio_net *net)
 		/*
 		 * Drop the packet and try later.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		return;
@@ -435,19 +1021,41 @@ virtio_net_tap_rx(struct virtio_net *net)
 	/*
 	 * Check for available rx buffers
 	 */
-	vq = &net->queues[VIRTIO_NET_RXQ];
+	vq = &net->queues[VIRTIO_NET_RXQ_IDX(qp->idx)];
 	if (!vq_has_descs(vq)) {
 		/*
 		 * Drop the packet and try later.  Interrupt on
 		 * empty, if that's negotiated.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		vq_endchains(vq, 1);
 		return;
 	}
 
+	if (qp->rx_batch != NULL) {
+		do {
+			n = virtio_net_tap_rx_batch(qp, vq, &drained);
+		} while (n >= 0 && !drained && vq_has_descs(vq) && qp->rx_batch != NULL);
+
+		if (drained || !vq_has_descs(vq)) {
+			/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
+			vq_endchains(vq, !vq_has_descs(vq));
+			return;
+		}
+		/* the remaining chains are filled one frame at a time */
+	}
+
+	if (net->tap_vnet_hdr) {
+		while (virtio_net_tap_rx_vnet_hdr(qp, vq) && vq_has_descs(vq))
+			;
+
+		/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
+		vq_endchains(vq, !vq_has_descs(vq));
+		return;
+	}
+
 	do {
 		/*
 		 * Get descriptor chain.
@@ -466,7 +1074,7 @@ virtio_net_tap_rx(struct virtio_net *net)
 		if (riov == NULL)
 			return;
 
-		len = readv(net->tapfd, riov, n);
+		len = readv(qp->tapfd, riov, n);
 
 		if (len < 0 && errno == EWOULDBLOCK) {
 			/*
@@ -484,7 +1092,7 @@ virtio_net_tap_rx(struct virtio_net *net)
 		 */
 		memset(vrx, 0, net->rx_vhdrlen);
 
-		if (net->rx_merge) {
+		if (net->rx_vhdrlen == sizeof(struct virtio_net_rxhdr)) {
 			struct virtio_net_rxhdr *vrxh;
 
 			vrxh = vrx;
@@ -495,6 +1103,7 @@ virtio_net_tap_rx(struct virtio_net *net)
 		 * Release this chain and handle more chains.
 		 */
 		vq_relchain(vq, idx, len + net->rx_vhdrlen);
+		virtio_net_pps_update(qp, &qp->rx_pps, "rx", 1);
 	} while (vq_has_descs(vq));
 
 	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
@@ -504,14 +1113,22 @@ virtio_net_tap_rx(struct virtio_net *net)
 static void
 virtio_net_rx_callback(int fd, enum ev_type type, void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_qpair *qp = param;
+
+	pthread_mutex_lock(&qp->rx_mtx);
+	qp->rx_in_progress = 1;
+	qp->net->virtio_net_rx(qp);
+	qp->rx_in_progress = 0;
+	pthread_mutex_unlock(&qp->rx_mtx);
 
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
+}
+
+static void
+virtio_net_rx_iothread_callback(void *param)
+{
+	struct virtio_net_qpair *qp = param;
 
+	virtio_net_rx_callback(qp->tapfd, EVF_READ, qp);
 }
 
 static void
@@ -524,48 +1141,57 @@ virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
 	 */
 	if (net->rx_ready == 0) {
 		net->rx_ready = 1;
-		if (vq->used != NULL) {
-			vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		if (vq_ring_ready(vq)) {
+			vq_set_used_ring_flags(vq);
 		}
 	}
 }
 
 static void
-virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
+virtio_net_proctx(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
+	struct virtio_net *net = qp->net;
+	struct iovec iov[VIRTIO_NET_MAXSEGS + 1], *riov;
 	int i, n;
 	int plen, tlen;
 	uint16_t idx;
 
 	/*
-	 * Obtain chain of descriptors.  The first one is
-	 * really the header descriptor, so we need to sum
-	 * up two lengths: packet length and transfer length.
+	 * Obtain chain of descriptors.  The chain starts with the
+	 * header, which a virtio 1.0 driver may put in the same
+	 * descriptor as the packet, so we need to sum up two
+	 * lengths: packet length and transfer length.
 	 */
 	n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
 	if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
 		WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", n));
 		return;
 	}
-	plen = 0;
-	tlen = iov[0].iov_len;
-	for (i = 1; i < n; i++) {
-		plen += iov[i].iov_len;
+	tlen = 0;
+	for (i = 0; i < n; i++)
 		tlen += iov[i].iov_len;
-	}
+	plen = tlen - net->rx_vhdrlen;
 
 	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+	if (net->tap_vnet_hdr) {
+		/* the virtio-net header carries the csum/gso info to the tap */
+		net->virtio_net_tx(qp, iov, n, plen);
+	} else {
+		riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
+		if (riov != NULL)
+			net->virtio_net_tx(qp, riov, n, plen);
+	}
 
 	/* chain is processed, release it and set tlen */
 	vq_relchain(vq, idx, tlen);
+	virtio_net_pps_update(qp, &qp->tx_pps, "tx", 1);
 }
 
 static void
 virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = &net->qpairs[(vq - net->queues) / 2];
 
 	/*
 	 * Any ring entries to process?
@@ -574,11 +1200,11 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 		return;
 
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
-	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	vq_set_used_ring_flags(vq);
+	if (qp->tx_in_progress == 0)
+		pthread_cond_signal(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
@@ -587,27 +1213,28 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
-	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ];
+	struct virtio_net_qpair *qp = param;
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ_IDX(qp->idx)];
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 
 	while (!net->closing && !vq_ring_ready(vq))
-		pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+		pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 	if (net->closing) {
 		WPRINTF(("vtnet tx thread closing...\n"));
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&qp->tx_mtx);
 		return NULL;
 	}
 
 	for (;;) {
 		/* note - tx mutex is locked here */
-		net->tx_in_progress = 0;
+		qp->tx_in_progress = 0;
 
 		/*
 		 * Checking the avail ring here serves two purposes:
@@ -621,26 +1248,27 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && vq_has_descs(vq))
 				break;
 
-			pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 			if (net->closing) {
 				WPRINTF(("vtnet tx thread closing...\n"));
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&qp->tx_mtx);
 				return NULL;
 			}
 		}
 
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		vq_set_used_ring_flags(vq);
+		qp->tx_in_progress = 1;
+		pthread_mutex_unlock(&qp->tx_mtx);
 
 		do {
 			/*
 			 * Run through entries, placing them into
 			 * iovecs and sending when an end-of-packet
-			 * is found
+			 * is found, in batches when possible
 			 */
-			virtio_net_proctx(net, vq);
+			if (qp->tx_batch == NULL || virtio_net_tap_tx_batch(qp, vq) < 0)
+				virtio_net_proctx(qp, vq);
 		} while (vq_has_descs(vq));
 
 		/*
@@ -648,17 +1276,83 @@ virtio_net_tx_thread(void *param)
 		 */
 		vq_endchains(vq, 1);
 
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
 }
 
-#ifdef notyet
+static uint8_t
+virtio_net_ctrl_mq(struct virtio_net *net, uint8_t cmd, uint8_t *data, size_t len)
+{
+	uint16_t pairs;
+
+	if (cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET || len < sizeof(pairs))
+		return VIRTIO_NET_ERR;
+
+	memcpy(&pairs, data, sizeof(pairs));
+	DPRINTF(("vtnet: set %d queue pairs\n\r", pairs));
+	if (virtio_net_set_qpairs(net, pairs) < 0)
+		return VIRTIO_NET_ERR;
+
+	return VIRTIO_NET_OK;
+}
+
 static void
 virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net *net = vdev;
+	struct iovec iov[VIRTIO_NET_CTRL_MAXSEGS];
+	uint16_t flags[VIRTIO_NET_CTRL_MAXSEGS];
+	struct virtio_net_ctrl_hdr *hdr;
+	uint8_t buf[64], *ack;
+	size_t len, seg_len;
+	uint16_t idx;
+	int i, n;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_CTRL_MAXSEGS, flags);
+		if (n <= 0) {
+			WPRINTF(("vtnet: virtio_net_ping_ctlq: vq_getchain = %d\n", n));
+			break;
+		}
+		if (n < 2 || n > VIRTIO_NET_CTRL_MAXSEGS) {
+			WPRINTF(("vtnet: virtio_net_ping_ctlq: vq_getchain = %d\n", n));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		if (iov[n - 1].iov_len < sizeof(*ack) ||
+		    (flags[n - 1] & VRING_DESC_F_WRITE) == 0) {
+			WPRINTF(("vtnet: invalid control queue ack descriptor\n"));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		/* the header and the command data are followed by the ack byte */
+		len = 0;
+		for (i = 0; i < n - 1; i++) {
+			seg_len = iov[i].iov_len;
+			if (len + seg_len > sizeof(buf))
+				seg_len = sizeof(buf) - len;
+			memcpy(buf + len, iov[i].iov_base, seg_len);
+			len += seg_len;
+		}
+		ack = iov[n - 1].iov_base;
+
+		hdr = (struct virtio_net_ctrl_hdr *)buf;
+		if (len < sizeof(*hdr))
+			*ack = VIRTIO_NET_ERR;
+		else if (hdr->class == VIRTIO_NET_CTRL_MQ)
+			*ack = virtio_net_ctrl_mq(net, hdr->cmd, buf + sizeof(*hdr), len - sizeof(*hdr));
+		else {
+			DPRINTF(("vtnet: unsupported control class %d\n\r", hdr->class));
+			*ack = VIRTIO_NET_ERR;
+		}
+
+		vq_relchain(vq, idx, sizeof(*ack));
+	}
+
+	vq_endchains(vq, 1);
 }
-#endif
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -738,10 +1432,11 @@ virtio_net_is_macvtap(char *devname, int *ifindex)
 }
 
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, bool *vnet_hdr, bool multi_queue)
 {
 	char tbuf[IFNAMSIZ];
 	int tunfd, rc, macvtap_index;
+	unsigned int features;
 	struct ifreq ifr;
 
 	/*Check if tun/tap or macvtap interface is used */
@@ -764,6 +1459,16 @@ virtio_net_tap_open(char *devname)
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	if (multi_queue)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+
+	/* pass the virtio-net header through if the caller wants and the tap supports it */
+	if (*vnet_hdr) {
+		if ((ioctl(tunfd, TUNGETFEATURES, &features) == 0) && (features & IFF_VNET_HDR))
+			ifr.ifr_flags |= IFF_VNET_HDR;
+		else
+			*vnet_hdr = false;
+	}
 
 	if (*devname) {
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
@@ -786,8 +1491,11 @@ static void
 virtio_net_tap_setup(struct virtio_net *net, char *devname)
 {
 	char tbuf[IFNAMSIZ];
+	struct virtio_net_qpair *qp;
+	struct iothreads_option iot_opt;
+	struct iothread_ctx *ioctx_base = NULL;
 	int vhost_fd = -1;
-	int rc;
+	int i, rc;
 
 	rc = snprintf(tbuf, IFNAMSIZ, "%s", devname);
 	if (rc < 0 || rc >= IFNAMSIZ) /* give warning if error or truncation happens */
@@ -796,24 +1504,30 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	net->virtio_net_rx = virtio_net_tap_rx;
 	net->virtio_net_tx = virtio_net_tap_tx;
 
-	net->tapfd = virtio_net_tap_open(tbuf);
-	if (net->tapfd == -1) {
-		WPRINTF(("open of tap device %s failed\n", tbuf));
-		return;
-	}
-	DPRINTF(("open of tap device %s success!\n", tbuf));
+	/* vhost-net handles the virtio-net header by itself */
+	net->tap_vnet_hdr = !net->use_vhost;
 
-	/*
-	 * Set non-blocking and register for read
-	 * notifications with the event loop
-	 */
-	int opt = 1;
+	/* one tap queue for each queue pair */
+	for (i = 0; i < net->qpair_num; i++) {
+		qp = &net->qpairs[i];
+		qp->tapfd = virtio_net_tap_open(tbuf, &net->tap_vnet_hdr, net->qpair_num > 1);
+		if (qp->tapfd == -1) {
+			WPRINTF(("open of tap device %s queue %d failed\n", tbuf, i));
+			goto fail;
+		}
 
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
-		WPRINTF(("tap device O_NONBLOCK failed\n"));
-		close(net->tapfd);
-		net->tapfd = -1;
+		/*
+		 * Set non-blocking and register for read
+		 * notifications with the event loop
+		 */
+		int opt = 1;
+
+		if (ioctl(qp->tapfd, FIONBIO, &opt) < 0) {
+			WPRINTF(("tap device O_NONBLOCK failed\n"));
+			goto fail;
+		}
 	}
+	DPRINTF(("open of tap device %s success!\n", tbuf));
 
 	if (net->use_vhost) {
 		vhost_fd = open("/dev/vhost-net", O_RDWR);
@@ -821,8 +1535,9 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 			WPRINTF(("open of vhost-net failed\n"));
 		else {
 			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
+				net->qpairs[0].tapfd, 0, false);
 			if (!net->vhost_net) {
+				/* offloads are not available as the tap is opened without IFF_VNET_HDR */
 				WPRINTF(("vhost_net_init failed, fallback "
 					"to userspace virtio\n"));
 				close(vhost_fd);
@@ -831,18 +1546,103 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 		}
 	}
 
-	if (vhost_fd < 0) {
-		net->mevp = mevent_add(net->tapfd, EVF_READ,
-				       virtio_net_rx_callback, net,
+	if (vhost_fd >= 0)
+		return;
+
+	/* batched tap I/O, one io_uring for each direction of each queue pair */
+	for (i = 0; (net->batch > 1) && (i < net->qpair_num); i++) {
+		qp = &net->qpairs[i];
+		qp->rx_batch = virtio_net_batch_init(net);
+		qp->tx_batch = virtio_net_batch_init(net);
+		if (qp->rx_batch == NULL || qp->tx_batch == NULL) {
+			virtio_net_batch_deinit(&qp->rx_batch);
+			virtio_net_batch_deinit(&qp->tx_batch);
+		}
+	}
+
+	if (net->qpair_num == 1) {
+		qp = &net->qpairs[0];
+		qp->mevp = mevent_add(qp->tapfd, EVF_READ,
+				       virtio_net_rx_callback, qp,
 				       virtio_net_teardown, net);
-		if (net->mevp == NULL) {
+		if (qp->mevp == NULL) {
 			WPRINTF(("Could not register event\n"));
-			close(net->tapfd);
-			net->tapfd = -1;
+			goto fail;
+		}
+		return;
+	}
+
+	/* with multiple queue pairs, the rx of each queue pair runs in its own iothread */
+	memset(&iot_opt, 0, sizeof(iot_opt));
+	iot_opt.num = net->qpair_num;
+	if (snprintf(iot_opt.tag, sizeof(iot_opt.tag), "net%s", tbuf) >= sizeof(iot_opt.tag))
+		DPRINTF(("vtnet: iothread tag truncated\n"));
+	ioctx_base = iothread_create(&iot_opt);
+	if (ioctx_base == NULL) {
+		WPRINTF(("vtnet: fails to create iothreads\n"));
+		goto fail;
+	}
+
+	for (i = 0; i < net->qpair_num; i++) {
+		qp = &net->qpairs[i];
+		qp->ioctx = ioctx_base + i;
+		qp->iomvt.run = virtio_net_rx_iothread_callback;
+		qp->iomvt.arg = qp;
+		qp->iomvt.fd = qp->tapfd;
+		if (iothread_add(qp->ioctx, qp->tapfd, &qp->iomvt) < 0) {
+			WPRINTF(("vtnet: fails to add tap queue %d to iothread\n", i));
+			qp->ioctx = NULL;
+			goto fail;
+		}
+	}
+
+	/* only the first queue pair is used until the guest enables more */
+	virtio_net_set_qpairs(net, 1);
+	return;
+
+fail:
+	for (i = 0; i < net->qpair_num; i++) {
+		qp = &net->qpairs[i];
+		virtio_net_batch_deinit(&qp->rx_batch);
+		virtio_net_batch_deinit(&qp->tx_batch);
+		if (qp->ioctx != NULL) {
+			iothread_del(qp->ioctx, qp->tapfd);
+			qp->ioctx = NULL;
+		}
+		if (ioctx_base != NULL)
+			iothread_stop(ioctx_base + i);
+		if (qp->tapfd >= 0) {
+			close(qp->tapfd);
+			qp->tapfd = -1;
 		}
 	}
 }
 
+/*
+ * The vhost-user backend owns the data path, so there is no tap and the
+ * tap callbacks only drop what the guest queues before DRIVER_OK.
+ */
+static void
+virtio_net_vhost_user_setup(struct virtio_net *net, char *path)
+{
+	int fd;
+
+	net->virtio_net_rx = virtio_net_tap_rx;
+	net->virtio_net_tx = virtio_net_tap_tx;
+
+	fd = vhost_user_connect(path);
+	if (fd < 0) {
+		WPRINTF(("connect to vhost-user backend %s failed\n", path));
+		return;
+	}
+
+	/* the socket is closed by vhost_dev_init on failure */
+	net->vhost_net = vhost_net_init(&net->base, fd, -1, 0, true);
+	if (!net->vhost_net)
+		WPRINTF(("vhost_net_init failed for vhost-user backend %s\n",
+			path));
+}
+
 static int
 virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -860,7 +1660,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt = NULL;
 	int mac_provided;
 	pthread_mutexattr_t attr;
-	int rc;
+	struct virtio_net_qpair *qp;
+	int rc, i, nqp, batch;
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -887,6 +1688,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 */
 	mac_provided = 0;
 	net->vhost_net = NULL;
+	net->qpair_num = 1;
+	net->batch = VIRTIO_NET_DEF_BATCH;
 	if (opts != NULL) {
 		int err;
 
@@ -897,6 +1700,12 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			return -1;
 		}
 
+		/* vhost_user=<socket> replaces tap=<name> as the backend */
+		if (strncmp(devopts, "vhost_user=", 11) == 0) {
+			net->use_vhost = true;
+			net->vhost_user = true;
+		}
+
 		(void) strsep(&vtopts, ",");
 
 		while ((opt = strsep(&vtopts, ",")) != NULL) {
@@ -911,28 +1720,97 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 					return err;
 				}
 				mac_provided = 1;
+			} else if (!strncmp(opt, "mq=", 3)) {
+				/* mq=<number of queue pairs> */
+				if (dm_strtoi(opt + 3, &tmp, 10, &nqp) ||
+					(nqp <= 0) || (nqp > VIRTIO_NET_MAX_QPAIRS)) {
+					WPRINTF(("virtio_net: invalid mq %s, max %d\n",
+						opt + 3, VIRTIO_NET_MAX_QPAIRS));
+					free(devopts);
+					free(net);
+					return -1;
+				}
+				/* more queue pairs than guest CPUs do not help */
+				net->qpair_num = (nqp > guest_cpu_num()) ? guest_cpu_num() : nqp;
+			} else if (!strncmp(opt, "batch=", 6)) {
+				/* batch=<max packets per tap submission> */
+				if (dm_strtoi(opt + 6, &tmp, 10, &batch) ||
+					(batch <= 0) || (batch > VIRTIO_NET_MAX_BATCH)) {
+					WPRINTF(("virtio_net: invalid batch %s, max %d\n",
+						opt + 6, VIRTIO_NET_MAX_BATCH));
+					free(devopts);
+					free(net);
+					return -1;
+				}
+				net->batch = batch;
+			} else if (strcmp("pps", opt) == 0)
+				net->pps = true;
+			else if (strcmp("packed", opt) == 0)
+				net->packed = true;
+			else if (!strncmp(opt, "moderation=", 11)) {
+				/* moderation=<max usec>[/<max frames>] */
+				if (virtio_parse_moderation(opt + 11, &net->mod_usec,
+						&net->mod_frames)) {
+					WPRINTF(("virtio_net: invalid moderation %s\n",
+						opt + 11));
+					free(devopts);
+					free(net);
+					return -1;
+				}
 			}
 		}
+		tmp = NULL;
 	}
 
-	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
+	if (net->use_vhost && (net->qpair_num > 1)) {
+		WPRINTF(("virtio_net: mq is not supported with vhost, use 1 queue pair\n"));
+		net->qpair_num = 1;
+	}
+
+	if (net->use_vhost && net->packed) {
+		WPRINTF(("virtio_net: packed is not supported with vhost, use split rings\n"));
+		net->packed = false;
+	}
+
+	/* 2 virtqueues for each queue pair, plus the control queue with mq */
+	net->ops = virtio_net_ops;
+	net->ops.nvq = (net->qpair_num > 1) ? (net->qpair_num * 2 + 1) : 2;
+	net->config.max_virtqueue_pairs = net->qpair_num;
+
+	virtio_linkup(&net->base, &net->ops, net, dev, net->queues,
 		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
 	net->base.mtx = &net->mtx;
 	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
-
-	net->queues[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
-	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
-	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
+	if (net->qpair_num > 1)
+		net->base.device_caps |= VIRTIO_NET_S_MQCAPS;
+	if (net->packed)
+		net->base.device_caps |= VIRTIO_PACKED_RING_CAPS;
+
+	for (i = 0; i < net->qpair_num; i++) {
+		net->queues[VIRTIO_NET_RXQ_IDX(i)].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[VIRTIO_NET_RXQ_IDX(i)].notify = virtio_net_ping_rxq;
+		net->queues[VIRTIO_NET_TXQ_IDX(i)].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[VIRTIO_NET_TXQ_IDX(i)].notify = virtio_net_ping_txq;
+
+		qp = &net->qpairs[i];
+		qp->net = net;
+		qp->idx = i;
+		qp->tapfd = -1;
+		qp->rx_in_progress = 0;
+		pthread_mutex_init(&qp->rx_mtx, NULL);
+		qp->tx_in_progress = 0;
+		pthread_mutex_init(&qp->tx_mtx, NULL);
+		pthread_cond_init(&qp->tx_cond, NULL);
+	}
+	if (net->qpair_num > 1) {
+		net->queues[net->ops.nvq - 1].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[net->ops.nvq - 1].notify = virtio_net_ping_ctlq;
+	}
+	net->active_qpairs = 1;
 
 	/*
 	 * Attempt to open the tap device
 	 */
-	net->tapfd = -1;
 
 	if (!devopts) {
 		WPRINTF(("virtio_net: invalid optional argument\n"));
@@ -944,7 +1822,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		vtopts = tmp = strdup(opts);
 	}
 
-	if ((tmp != NULL) && (strncmp(tmp, "tap", 3) == 0)) {
+	if ((tmp != NULL) && ((strncmp(tmp, "tap", 3) == 0) || net->vhost_user)) {
 		type = strsep(&tmp, "=");
 		name = strsep(&tmp, ",");
 	}
@@ -958,9 +1836,14 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 		if (strcmp(type, "tap") == 0) {
 			virtio_net_tap_setup(net, name);
+		} else if (strcmp(type, "vhost_user") == 0) {
+			virtio_net_vhost_user_setup(net, name);
 		}
 	}
 
+	if (net->tap_vnet_hdr && (net->qpairs[0].tapfd >= 0))
+		net->base.device_caps |= VIRTIO_NET_S_OFFLOADCAPS;
+
 	/*
 	 * The default MAC address is the standard NetApp OUI of 00-a0-98,
 	 * followed by an MD5 of the PCI slot/func number and dev name
@@ -1007,8 +1890,9 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	else
 		pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
-	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	/* Link is up if we managed to open tap device or reach the backend */
+	net->config.status = (opts == NULL || net->qpairs[0].tapfd >= 0 ||
+		(net->vhost_user && net->vhost_net));
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -1020,27 +1904,39 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	/* use BAR 0 to map config regs in IO space */
 	virtio_set_io_bar(&net->base, 0);
 
+	/* packed virtqueues are only negotiable on the modern interface */
+	if (net->packed && virtio_set_modern_bar(&net->base, true)) {
+		WPRINTF(("virtio_net: modern bar setup failed\n"));
+		free(net);
+		return -1;
+	}
+
+	/* the queues of vhost are signaled by the kernel */
+	if (!net->use_vhost && virtio_set_moderation(&net->base, net->mod_usec,
+			net->mod_frames))
+		WPRINTF(("virtio_net: interrupt moderation setup failed\n"));
+
 	net->resetting = 0;
 	net->closing = 0;
 
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
 
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Spawn one TX processing thread for each queue pair.
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
-		 dev->func);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->qpair_num; i++) {
+		qp = &net->qpairs[i];
+		pthread_create(&qp->tx_tid, NULL, virtio_net_tx_thread,
+			       (void *)qp);
+		if (net->qpair_num > 1)
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx%d", dev->slot,
+				 dev->func, i);
+		else
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
+				 dev->func);
+		pthread_setname_np(qp->tx_tid, tname);
+	}
 
 	return 0;
 }
@@ -1087,11 +1983,18 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 
 	net->features = negotiated_features;
 
-	if (!(net->features & VIRTIO_NET_F_MRG_RXBUF)) {
-		net->rx_merge = 0;
-		/* non-merge rx header is 2 bytes shorter */
+	/*
+	 * The features may be written in two halves by a virtio 1.0 driver,
+	 * so the header is derived from all of them each time.
+	 */
+	net->rx_merge = !!(net->features & VIRTIO_NET_F_MRG_RXBUF);
+	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	if (!net->rx_merge && !(net->features & (1UL << VIRTIO_F_VERSION_1))) {
+		/* legacy non-merge rx header is 2 bytes shorter */
 		net->rx_vhdrlen -= 2;
 	}
+
+	virtio_net_tap_set_offload(net, net->features);
 }
 
 static void
@@ -1105,8 +2008,8 @@ virtio_net_set_status(void *vdev, uint64_t status)
 
 	if (!net->vhost_net->vhost_started &&
 		(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
-		if (net->mevp)
-			mevent_disable(net->mevp);
+		if (net->qpairs[0].mevp)
+			mevent_disable(net->qpairs[0].mevp);
 
 		rc = vhost_net_start(net->vhost_net);
 		if (rc < 0) {
@@ -1125,16 +2028,21 @@ static void
 virtio_net_teardown(void *param)
 {
 	struct virtio_net *net;
+	int i;
 
 	net = (struct virtio_net *)param;
 	if (!net)
 		return;
 
-	if (net->tapfd >= 0) {
-		close(net->tapfd);
-		net->tapfd = -1;
-	} else
-		pr_err("net->tapfd is -1!\n");
+	for (i = 0; i < net->qpair_num; i++) {
+		virtio_net_batch_deinit(&net->qpairs[i].rx_batch);
+		virtio_net_batch_deinit(&net->qpairs[i].tx_batch);
+		if (net->qpairs[i].tapfd >= 0) {
+			close(net->qpairs[i].tapfd);
+			net->qpairs[i].tapfd = -1;
+		} else
+			pr_err("net->tapfd of queue pair %d is -1!\n", i);
+	}
 
 	virtio_reset_dev(&net->base);
 	free(net);
@@ -1144,11 +2052,22 @@ static void
 virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_net *net;
+	struct virtio_net_qpair *qp;
+	int i;
 
 	if (dev->arg) {
 		net = (struct virtio_net *) dev->arg;
 
-		virtio_net_tx_stop(net);
+		for (i = 0; i < net->qpair_num; i++) {
+			qp = &net->qpairs[i];
+			virtio_net_tx_stop(qp);
+			if (qp->ioctx != NULL) {
+				/* the iothread of the queue pair must not run the rx callback during teardown */
+				iothread_del(qp->ioctx, qp->tapfd);
+				iothread_stop(qp->ioctx);
+				qp->ioctx = NULL;
+			}
+		}
 
 		if (net->vhost_net) {
 			vhost_net_stop(net->vhost_net);
@@ -1157,8 +2076,10 @@ virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			net->vhost_net = NULL;
 		}
 
-		if (net->mevp != NULL)
-			mevent_delete(net->mevp);
+		virtio_release_queues(&net->base);
+
+		if (net->qpairs[0].mevp != NULL)
+			mevent_delete(net->qpairs[0].mevp);
 		else
 			virtio_net_teardown(net);
 
@@ -1168,11 +2089,14 @@ virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 }
 
 static struct vhost_net *
-vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
+vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx,
+	bool vhost_user)
 {
 	struct vhost_net *vhost_net = NULL;
 	uint64_t vhost_features = VIRTIO_NET_S_VHOSTCAPS;
-	uint64_t vhost_ext_features =  1 << VHOST_NET_F_VIRTIO_NET_HDR;
+	/* a vhost-user backend always handles the virtio-net header */
+	uint64_t vhost_ext_features = vhost_user ? 0 :
+		1 << VHOST_NET_F_VIRTIO_NET_HDR;
 	uint32_t busyloop_timeout = 0;
 	int rc;
 
@@ -1185,6 +2109,7 @@ vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
 	/* pre-init before calling vhost_dev_init */
 	vhost_net->vdev.nvqs = ARRAY_SIZE(vhost_net->vqs);
 	vhost_net->vdev.vqs = vhost_net->vqs;
+	vhost_net->vdev.vhost_user = vhost_user;
 	vhost_net->tapfd = tapfd;
 
 	rc = vhost_dev_init(&vhost_net->vdev, base, vhostfd, vq_idx,
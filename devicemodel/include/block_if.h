@@ -99,6 +99,8 @@ struct blockif_req {
 };
 
 struct blockif_ctxt;
+struct vmctx;
+void	blockif_set_guest_memory(struct vmctx *ctx);
 struct blockif_ctxt *blockif_open(const char *optstr, const char *ident, int queue_num,
 	struct iothreads_info *iothrds_info);
 off_t	blockif_size(struct blockif_ctxt *bc);
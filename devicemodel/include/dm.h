@@ -79,4 +79,7 @@ size_t high_bios_size(void);
 void init_debugexit(void);
 void deinit_debugexit(void);
 void set_thread_priority(int priority, bool reset_on_fork);
+void vmexit_serial_lock(void);
+void vmexit_serial_unlock(void);
+bool ioreq_workers_enabled(void);
 #endif
@@ -50,6 +50,7 @@ struct inout_port {
 #define	IOPORT_F_IN		0x1
 #define	IOPORT_F_OUT		0x2
 #define	IOPORT_F_INOUT		(IOPORT_F_IN | IOPORT_F_OUT)
+#define	IOPORT_F_CONCURRENT	0x4	/* handler does its own locking */
 
 /*
  * The following flags are used internally and must not be used by
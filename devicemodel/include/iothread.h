@@ -17,8 +17,16 @@
  */
 #define PTHREAD_NAME_MAX_LEN		16
 
+/* max number of iothread_mevent with a poll handler in one iothread */
+#define IOTHREAD_POLL_MEVENT_MAX	64
+
 struct iothread_mevent {
 	void (*run)(void *);
+	/*
+	 * Optional. Check and process the pending work without waiting for the fd event.
+	 * Return true if any work is processed. It is called when the iothread is in poll mode.
+	 */
+	bool (*poll)(void *);
 	void *arg;
 	int fd;
 };
@@ -31,12 +39,19 @@ struct iothread_ctx {
 	int idx;
 	cpu_set_t cpuset;
 	char name[PTHREAD_NAME_MAX_LEN];
+
+	/* adaptive polling, enabled if poll_max_ns is not 0 */
+	uint64_t poll_max_ns;
+	uint64_t poll_ns;	/* current poll window */
+	int poll_num;
+	struct iothread_mevent *poll_mevts[IOTHREAD_POLL_MEVENT_MAX];
 };
 
 struct iothreads_option {
 	char tag[PTHREAD_NAME_MAX_LEN];
 	int num;
 	cpu_set_t *cpusets;
+	uint32_t poll_max_us;	/* max poll window, 0 means that polling is disabled */
 };
 
 struct iothreads_info {
@@ -46,6 +61,7 @@ struct iothreads_info {
 
 int iothread_add(struct iothread_ctx *ioctx_x, int fd, struct iothread_mevent *aevt);
 int iothread_del(struct iothread_ctx *ioctx_x, int fd);
+void iothread_stop(struct iothread_ctx *ioctx_x);
 void iothread_deinit(void);
 struct iothread_ctx *iothread_create(struct iothreads_option *iothr_opt);
 int iothread_parse_options(char *str, struct iothreads_option *iothr_opt);
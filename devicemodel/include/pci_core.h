@@ -178,6 +178,9 @@ struct pci_vdev {
 
 	void	*arg;		/* devemu-private data */
 
+	/* serializes BAR and config space emulation of this device */
+	pthread_mutex_t	io_mtx;
+
 	uint8_t	cfgdata[PCI_REGMAX + 1];
 	/* 0..5 is used for PCI MMIO/IO bar. 6 is used for PCI ROMbar */
 	struct pcibar bar[PCI_BARMAX + 2];
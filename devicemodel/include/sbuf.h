@@ -32,6 +32,7 @@ static inline void sbuf_add_flags(struct shared_buf *sbuf, uint64_t flags)
 }
 
 uint32_t sbuf_get(struct shared_buf *sbuf, uint8_t *data);
+uint32_t sbuf_get_many(struct shared_buf *sbuf, uint8_t *data, uint32_t max_ele);
 uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data, uint32_t max_len);
 int sbuf_clear_buffered(struct shared_buf *sbuf);
 void sbuf_init(struct shared_buf *sbuf, uint32_t total_size, uint32_t ele_size);
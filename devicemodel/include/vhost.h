@@ -14,6 +14,7 @@
 #ifndef __VHOST_H__
 #define __VHOST_H__
 
+#include <linux/vhost.h>
 #include "virtio.h"
 
 /**
@@ -30,12 +31,63 @@ struct vhost_vq {
 	struct vhost_dev *dev;	/**< pointer to vhost_dev */
 };
 
+struct vhost_dev;
+
+/**
+ * @brief Transport of the vhost requests: vhost kernel ioctls or
+ * vhost-user messages.
+ */
+struct vhost_ops {
+	int (*set_owner)(struct vhost_dev *vdev);
+	int (*reset_device)(struct vhost_dev *vdev);
+	int (*get_features)(struct vhost_dev *vdev, uint64_t *features);
+	int (*set_features)(struct vhost_dev *vdev, uint64_t features);
+	int (*set_mem_table)(struct vhost_dev *vdev);
+	int (*set_vring_num)(struct vhost_dev *vdev,
+			     struct vhost_vring_state *ring);
+	int (*set_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*get_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*set_vring_addr)(struct vhost_dev *vdev,
+			      struct vhost_vring_addr *addr);
+	int (*set_vring_kick)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_call)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_busyloop_timeout)(struct vhost_dev *vdev,
+					  struct vhost_vring_state *s);
+};
+
+extern const struct vhost_ops vhost_user_ops;
+
 struct vhost_dev {
 	/**
 	 * backpointer to virtio_base
 	 */
 	struct virtio_base *base;
 
+	/**
+	 * transport of the vhost requests, selected by vhost_dev_init
+	 */
+	const struct vhost_ops *ops;
+
+	/**
+	 * whether fd is a vhost-user socket instead of a vhost chardev,
+	 * set before calling vhost_dev_init
+	 */
+	bool vhost_user;
+
+	/**
+	 * vhost-user: features offered by the backend
+	 */
+	uint64_t user_features;
+
+	/**
+	 * vhost-user: protocol features negotiated with the backend
+	 */
+	uint64_t protocol_features;
+
 	/**
 	 * pointer to vhost_vq array
 	 */
@@ -47,7 +99,7 @@ struct vhost_dev {
 	int nvqs;
 
 	/**
-	 * vhost chardev fd
+	 * vhost chardev fd, or vhost-user socket
 	 */
 	int fd;
 
@@ -86,7 +138,8 @@ struct vhost_dev {
  *
  * @param vdev Pointer to struct vhost_dev.
  * @param base Pointer to struct virtio_base.
- * @param fd fd of the vhost chardev.
+ * @param fd fd of the vhost chardev, or of the vhost-user socket if
+ *           vdev->vhost_user is set.
  * @param vq_idx The first virtqueue which would be used by this vhost dev.
  * @param vhost_features Subset of vhost features which would be enabled.
  * @param vhost_ext_features Specific vhost internal features to be enabled.
@@ -143,4 +196,26 @@ int vhost_dev_stop(struct vhost_dev *vdev);
  * @return 0 on success and -1 on failure.
  */
 int vhost_kernel_ioctl(struct vhost_dev *vdev, unsigned long int request, void *arg);
+
+/**
+ * @brief Connect to a vhost-user backend.
+ *
+ * @param path Path of the UNIX socket the backend listens on.
+ *
+ * @return fd of the connection on success and -1 on failure.
+ */
+int vhost_user_connect(const char *path);
+
+/**
+ * @brief Read the device config space of a vhost-user backend.
+ *
+ * Only available if the backend supports VHOST_USER_PROTOCOL_F_CONFIG.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param config Buffer receiving the config space.
+ * @param size Number of bytes read from offset 0.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t size);
 #endif /* __VHOST_H__ */
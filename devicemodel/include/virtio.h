@@ -290,6 +290,7 @@ struct virtio_vq_info;
  */
 #define	VIRTIO_USE_MSIX		0x01
 #define	VIRTIO_EVENT_IDX	0x02	/* use the event-index values */
+#define	VIRTIO_MODERATION	0x04	/* queues support interrupt moderation */
 #define	VIRTIO_BROKED		0x08	/* ??? */
 
 /*
@@ -329,6 +330,14 @@ struct virtio_vq_info;
 /* 4-byte notify register for one virtqueue */
 #define VIRTIO_MODERN_NOTIFY_OFF_MULT	4
 
+/*
+ * Features to offer for packed virtqueues. The packed layout is only
+ * negotiable through the modern interface, so such a device is
+ * transitional and needs virtio_set_modern_bar().
+ */
+#define VIRTIO_PACKED_RING_CAPS	((1UL << VIRTIO_F_VERSION_1) | \
+				 (1UL << VIRTIO_F_RING_PACKED))
+
 /* Common configuration */
 #define VIRTIO_PCI_CAP_COMMON_CFG	1
 /* Notifications */
@@ -403,6 +412,7 @@ struct virtio_ops {
 
 #define	VQ_ALLOC	0x01	/* set once we have a pfn */
 #define	VQ_BROKED	0x02	/* ??? */
+#define	VQ_PACKED	0x04	/* the queue uses the packed ring layout */
 /**
  * @brief Virtqueue data structure
  *
@@ -421,6 +431,12 @@ struct virtio_ops {
  * keep a pointer to each one.  The event indices are similarly
  * (but more easily) computable, and this time we'll compute them:
  * they're just XX_ring[N].
+ *
+ * When VIRTIO_F_RING_PACKED is negotiated, the queue is a single
+ * descriptor ring (packed_desc) plus the driver and device event
+ * suppression areas, and VQ_PACKED is set.  last_avail is then the
+ * next ring slot to fetch, used_idx the next slot to mark used, and
+ * the wrap counters of both are kept in avail_wrap and used_wrap.
  */
 struct virtio_iothread {
 	struct virtio_base *base;
@@ -461,6 +477,47 @@ struct virtio_vq_info {
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
 	bool enabled;		/**< whether the virtqueue is enabled */
+
+	volatile struct vring_packed_desc *packed_desc;
+				/**< packed descriptor ring */
+	volatile struct vring_packed_desc_event *driver_event;
+				/**< driver event suppression (packed) */
+	volatile struct vring_packed_desc_event *device_event;
+				/**< device event suppression (packed) */
+	uint16_t used_idx;	/**< next slot to mark used (packed) */
+	bool avail_wrap;	/**< wrap counter of last_avail (packed) */
+	bool used_wrap;		/**< wrap counter of used_idx (packed) */
+	uint16_t ndesc_size;	/**< entries in buf_ndesc and chain_ndesc */
+	uint16_t *buf_ndesc;	/**< ring slots taken by each buffer id */
+	uint16_t *chain_ndesc;	/**< ring slots of the chain ending at a slot */
+
+	uint16_t batch_pending;	/**< chains staged by vq_relchain_batch() */
+	uint16_t batch_flags;	/**< flags of the first staged slot (packed) */
+	volatile struct vring_packed_desc *batch_desc;
+				/**< first staged slot (packed) */
+	uint16_t coalesce_max;	/**< staged chains published at once, or 0 */
+	bool coalesce_armed;	/**< coalesce_timer is running */
+	uint32_t coalesce_usec;	/**< max latency of a staged chain, in us */
+	struct acrn_timer coalesce_timer;
+				/**< publishes the staged chains in time */
+
+	uint32_t mod_usec;	/**< max interrupt delay in us, or 0 */
+	uint16_t mod_frames;	/**< chains returned per interrupt, or 0 */
+	uint16_t mod_count;	/**< chains returned since last interrupt */
+	bool mod_pending;	/**< an interrupt is held back */
+	bool mod_armed;		/**< mod_timer is running */
+	bool mod_timer_init;	/**< mod_timer is initialized */
+	struct acrn_timer mod_timer;
+				/**< raises the held back interrupt in time */
+
+	int irqfd;		/**< eventfd injecting the MSI-X interrupt */
+	bool irqfd_assigned;	/**< irqfd is assigned to irqfd_addr/data */
+	uint64_t irqfd_addr;	/**< MSI-X address irqfd is assigned to */
+	uint32_t irqfd_data;	/**< MSI-X data irqfd is assigned to */
+
+	uint64_t stat_chains;	/**< chains fetched, for --virtio_stats */
+	uint64_t stat_descs;	/**< descriptors fetched, for --virtio_stats */
+	uint64_t stat_start;	/**< start of the stats period, in ns */
 };
 
 /* as noted above, these are sort of backwards, name-wise */
@@ -482,6 +539,34 @@ vq_ring_ready(struct virtio_vq_info *vq)
 	return ((vq->flags & VQ_ALLOC) == VQ_ALLOC);
 }
 
+/**
+ * @brief Does this ring use the packed layout?
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return true if VIRTIO_F_RING_PACKED is in use on the ring.
+ */
+static inline bool
+vq_is_packed(struct virtio_vq_info *vq)
+{
+	return ((vq->flags & VQ_PACKED) == VQ_PACKED);
+}
+
+/**
+ * @brief Is a packed descriptor made available by the driver?
+ *
+ * @param flags Flags of the packed descriptor.
+ * @param wrap Wrap counter of the device at that descriptor.
+ *
+ * @return true if the descriptor is available to the device.
+ */
+static inline bool
+vq_packed_desc_avail(uint16_t flags, bool wrap)
+{
+	return !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) == wrap &&
+		!!(flags & (1 << VRING_PACKED_DESC_F_USED)) != wrap;
+}
+
 /**
  * @brief Are there "available" descriptors?
  *
@@ -495,6 +580,10 @@ static inline bool
 vq_has_descs(struct virtio_vq_info *vq)
 {
 	bool ret = false;
+
+	if (vq_ring_ready(vq) && vq_is_packed(vq))
+		return vq_packed_desc_avail(vq->packed_desc[vq->last_avail].flags,
+			vq->avail_wrap);
 	if (vq_ring_ready(vq) && vq->last_avail != vq->avail->idx) {
 		if ((uint16_t)((u_int)vq->avail->idx - vq->last_avail) > vq->qsize)
 			pr_err ("%s: no valid descriptor\n", vq->base->vops->name);
@@ -505,6 +594,17 @@ vq_has_descs(struct virtio_vq_info *vq)
 
 }
 
+/**
+ * @brief Deliver an MSI-X interrupt to guest on the given virtqueue.
+ *
+ * The userspace backends signal an irqfd bound to the MSI-X vector of
+ * the queue, the others inject the interrupt with an ioctl.
+ *
+ * @param vb Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_msix_interrupt(struct virtio_base *vb, struct virtio_vq_info *vq);
+
 /**
  * @brief Deliver an interrupt to guest on the given virtqueue.
  *
@@ -517,7 +617,7 @@ static inline void
 vq_interrupt(struct virtio_base *vb, struct virtio_vq_info *vq)
 {
 	if (pci_msix_enabled(vb->dev))
-		pci_generate_msix(vb->dev, vq->msix_idx);
+		vq_msix_interrupt(vb, vq);
 	else {
 		VIRTIO_BASE_LOCK(vb);
 		vb->isr |= VIRTIO_PCI_ISR_QUEUES;
@@ -580,6 +680,32 @@ void virtio_linkup(struct virtio_base *base, struct virtio_ops *vops,
  */
 int acrn_parse_virtio_poll_interval(const char *optarg);
 
+/**
+ * @brief Report the chains and descriptors fetched per second on each
+ * virtqueue, to compare the ring layouts.
+ */
+void virtio_enable_ring_stats(void);
+
+/**
+ * @brief Free the per-queue state of packed virtqueues and coalescing.
+ *
+ * Call it when the device is deinitialized, after no request can
+ * complete anymore.
+ *
+ * @param base Pointer to struct virtio_base.
+ */
+void virtio_release_queues(struct virtio_base *base);
+
+/**
+ * @brief Release the irqfds still assigned to the queues of a device.
+ *
+ * Called by the PCI core after the device is deinitialized, whether or
+ * not the device called virtio_release_queues().
+ *
+ * @param dev Pointer to struct pci_vdev.
+ */
+void virtio_irqfd_release_dev(struct pci_vdev *dev);
+
 /**
  * @brief Initialize MSI-X vector capabilities if we're to use MSI-X,
  * or MSI capabilities if not.
@@ -665,6 +791,92 @@ void vq_retchain(struct virtio_vq_info *vq);
  */
 void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
 
+/**
+ * @brief Return several request chains to the guest at once.
+ *
+ * The guest sees either none or all of the chains, e.g. for all the
+ * buffers of one merged rx frame.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param idx Array of the chain heads, returned by vq_getchain().
+ * @param iolen Array of the data bytes returned in each chain.
+ * @param n Number of chains.
+ */
+void vq_relchains(struct virtio_vq_info *vq, uint16_t *idx, uint32_t *iolen,
+		  int n);
+
+/**
+ * @brief Stage a request chain to be returned to the guest.
+ *
+ * The chain is published, with the other staged chains and a single
+ * barrier and used index update, by the next vq_endchains() or
+ * vq_relchain().
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param idx Pointer to available ring position, returned by vq_getchain().
+ * @param iolen Number of data bytes to be returned to frontend.
+ */
+void vq_relchain_batch(struct virtio_vq_info *vq, uint16_t idx,
+		       uint32_t iolen);
+
+/**
+ * @brief Coalesce the chains staged by vq_relchain_batch().
+ *
+ * vq_endchains() holds the staged chains back, and so the interrupt,
+ * until max_pending of them are staged or the oldest one waited for
+ * max_usec.  The callers of vq_relchain_batch() and vq_endchains() on
+ * the queue shall hold vq->mtx, which the timer takes as well.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param max_pending Number of staged chains published at once.
+ * @param max_usec Max time a staged chain is held back, in microseconds.
+ *
+ * @return 0 on success and -1 on fail.
+ */
+int vq_set_coalesce(struct virtio_vq_info *vq, int max_pending, int max_usec);
+
+/**
+ * @brief Moderate the interrupts of a virtqueue.
+ *
+ * vq_endchains() holds an interrupt back until max_frames chains were
+ * returned since the last one, or for at most max_usec.  The device
+ * shall have called virtio_set_moderation().
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param max_usec Max interrupt delay in microseconds, 0 to disable.
+ * @param max_frames Chains returned per interrupt, 0 for no limit.
+ *
+ * @return 0 on success and -1 on fail.
+ */
+int vq_set_moderation(struct virtio_vq_info *vq, int max_usec, int max_frames);
+
+/**
+ * @brief Enable interrupt moderation on the queues of a device.
+ *
+ * Allows vq_set_moderation() on the queues, also at runtime from the
+ * monitor, and applies the given setting to all of them.  The device
+ * shall call virtio_release_queues() when it is deinitialized.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param max_usec Max interrupt delay in microseconds, 0 to disable.
+ * @param max_frames Chains returned per interrupt, 0 for no limit.
+ *
+ * @return 0 on success and -1 on fail.
+ */
+int virtio_set_moderation(struct virtio_base *base, int max_usec,
+			  int max_frames);
+
+/**
+ * @brief Parse an interrupt moderation setting.
+ *
+ * @param opt String "<max usec>[/<max frames>]".
+ * @param max_usec Pointer to the max interrupt delay in microseconds.
+ * @param max_frames Pointer to the chains returned per interrupt.
+ *
+ * @return 0 on success and -1 on fail.
+ */
+int virtio_parse_moderation(char *opt, int *max_usec, int *max_frames);
+
 /**
  * @brief Driver has finished processing "available" chains and calling
  * vq_relchain on each one.
@@ -688,6 +900,16 @@ void vq_endchains(struct virtio_vq_info *vq, int used_all_avail);
  */
 void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
 
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Ask the guest not to notify the queue, with VRING_USED_F_NO_NOTIFY on
+ * a split ring or by disabling the device event of a packed ring.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_set_used_ring_flags(struct virtio_vq_info *vq);
+
 /**
  * @brief Handle PCI configuration space reads.
  *
@@ -94,6 +94,16 @@ struct vm_mem_region {
 };
 bool	vm_find_memfd_region(struct vmctx *ctx, vm_paddr_t gpa,
 			     struct vm_mem_region *ret_region);
+
+struct vm_memfd_region {
+	vm_paddr_t gpa;		/* guest physical start */
+	uint64_t size;
+	char *hva;		/* mapping in the device model */
+	uint64_t fd_offset;
+	int fd;
+};
+int	vm_get_memfd_regions(struct vmctx *ctx,
+			     struct vm_memfd_region *regions, int max);
 bool    vm_allow_dmabuf(struct vmctx *ctx);
 /*
  * Create a device memory segment identified by 'segid'.
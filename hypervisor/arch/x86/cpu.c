@@ -249,11 +249,11 @@ void init_pcpu_post(uint16_t pcpu_id)
 		/* Calibrate TSC Frequency */
 		calibrate_tsc();
 
-		pr_acrnlog("HV: %s-%s-%s %s%s%s%s %s@%s build by %s, start time %luus",
+		pr_acrnlog("HV: %s-%s-%s %s%s%s%s %s@%s build by %s, start time %luus, TSC calibration %uus",
 				HV_BRANCH_VERSION, HV_COMMIT_TIME, HV_COMMIT_DIRTY, HV_BUILD_TYPE,
 				(sizeof(HV_COMMIT_TAGS) > 1) ? "(tag: " : "", HV_COMMIT_TAGS,
 				(sizeof(HV_COMMIT_TAGS) > 1) ? ")" : "", HV_BUILD_SCENARIO,
-				HV_BUILD_BOARD, HV_BUILD_USER, ticks_to_us(start_tick));
+				HV_BUILD_BOARD, HV_BUILD_USER, ticks_to_us(start_tick), get_tsc_calibration_us());
 
 		pr_acrnlog("Detect processor: %s", (get_pcpu_info())->model_name);
 
@@ -499,6 +499,8 @@ void cpu_dead(void)
 
 	deinit_sched(pcpu_id);
 	if (bitmap_test(pcpu_id, &pcpu_active_bitmap)) {
+		flush_xsave_owner();
+
 		/* clean up native stuff */
 		vmx_off();
 
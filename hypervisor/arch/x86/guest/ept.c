@@ -14,6 +14,7 @@
 #include <asm/vmx.h>
 #include <asm/vtd.h>
 #include <logmsg.h>
+#include <sprintf.h>
 #include <trace.h>
 #include <asm/rtct.h>
 
@@ -71,7 +72,9 @@ uint64_t get_total_ept_4k_pages_size(void)
 
 static struct page *ept_pages[CONFIG_MAX_VM_NUM];
 static uint64_t *ept_page_bitmap[CONFIG_MAX_VM_NUM];
+static uint64_t *ept_page_summary[CONFIG_MAX_VM_NUM];
 static struct page ept_dummy_pages[CONFIG_MAX_VM_NUM];
+static char ept_page_pool_name[CONFIG_MAX_VM_NUM][8];
 
 /* ept: extended page pool*/
 static struct page_pool ept_page_pool[CONFIG_MAX_VM_NUM];
@@ -82,15 +85,19 @@ static void reserve_ept_bitmap(void)
 	uint64_t bitmap_base;
 	uint64_t bitmap_size;
 	uint64_t bitmap_offset;
+	uint64_t summary_offset;
 
-	bitmap_size = (get_ept_page_num() * CONFIG_MAX_VM_NUM) / 8;
-	bitmap_offset = get_ept_page_num() / 8;
+	/* each VM has its bitmap followed by the summary of the bitmap */
+	summary_offset = get_ept_page_num() / 8;
+	bitmap_offset = summary_offset + PAGE_POOL_SUMMARY_SIZE(get_ept_page_num() / 64) * sizeof(uint64_t);
+	bitmap_size = bitmap_offset * CONFIG_MAX_VM_NUM;
 
 	bitmap_base = e820_alloc_memory(bitmap_size, MEM_SIZE_MAX);
 	set_paging_supervisor(bitmap_base, bitmap_size);
 
 	for(i = 0; i < CONFIG_MAX_VM_NUM; i++){
 		ept_page_bitmap[i] = (uint64_t *)(void *)(bitmap_base + bitmap_offset * i);
+		ept_page_summary[i] = (uint64_t *)(void *)(bitmap_base + bitmap_offset * i + summary_offset);
 	}
 }
 
@@ -175,17 +182,22 @@ void init_ept_pgtable(struct pgtable *table, uint16_t vm_id)
 	ept_page_pool[vm_id].start_page = ept_pages[vm_id];
 	ept_page_pool[vm_id].bitmap_size = get_ept_page_num() / 64;
 	ept_page_pool[vm_id].bitmap = ept_page_bitmap[vm_id];
+	ept_page_pool[vm_id].summary = ept_page_summary[vm_id];
 	ept_page_pool[vm_id].dummy_page = &ept_dummy_pages[vm_id];
-
-	spinlock_init(&ept_page_pool[vm_id].lock);
-	memset((void *)ept_page_pool[vm_id].bitmap, 0, ept_page_pool[vm_id].bitmap_size * sizeof(uint64_t));
-	ept_page_pool[vm_id].last_hint_id = 0UL;
+	(void)snprintf(ept_page_pool_name[vm_id], sizeof(ept_page_pool_name[vm_id]), "ept%hu", vm_id);
+	ept_page_pool[vm_id].name = ept_page_pool_name[vm_id];
+	ept_page_pool[vm_id].use_magazine = true;
+	init_page_pool(&ept_page_pool[vm_id]);
 
 	table->pool = &ept_page_pool[vm_id];
 	table->default_access_right = EPT_RWX;
 	table->pgentry_present_mask = EPT_RWX;
 	table->clflush_pagewalk = ept_clflush_pagewalk;
 	table->large_page_support = ept_large_page_support;
+	/* Re-merge page tables split by write protection or BAR remapping once they are uniform again */
+	table->merge_large_page = true;
+	(void)memset(&vm->arch_vm.ept_stats, 0U, sizeof(struct pgtable_stats));
+	table->stats = &vm->arch_vm.ept_stats;
 
 	/* Mitigation for issue "Machine Check Error on Page Size Change" */
 	if (is_ept_force_4k_ipage()) {
@@ -304,13 +316,47 @@ int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 	return status;
 }
 
+/* EPT flush deferred by ept_flush_batch_begin(), per pCPU */
+struct ept_flush_batch {
+	struct acrn_vm *vm;
+	bool pending;
+};
+
+static struct ept_flush_batch ept_flush_batches[MAX_PCPU_NUM];
+
 static inline void ept_flush_guest(struct acrn_vm *vm)
 {
 	uint16_t i;
 	struct acrn_vcpu *vcpu;
-	/* Here doesn't do the real flush, just makes the request which will be handled before vcpu vmenter */
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	struct ept_flush_batch *batch = &ept_flush_batches[get_pcpu_id()];
+
+	if (batch->vm == vm) {
+		batch->pending = true;
+	} else {
+		/* Here doesn't do the real flush, just makes the request which will be handled before vcpu vmenter */
+		foreach_vcpu(i, vm, vcpu) {
+			vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+		}
+	}
+}
+
+void ept_flush_batch_begin(struct acrn_vm *vm)
+{
+	struct ept_flush_batch *batch = &ept_flush_batches[get_pcpu_id()];
+
+	batch->vm = vm;
+	batch->pending = false;
+}
+
+void ept_flush_batch_end(struct acrn_vm *vm)
+{
+	struct ept_flush_batch *batch = &ept_flush_batches[get_pcpu_id()];
+	bool pending = batch->pending;
+
+	batch->vm = NULL;
+	batch->pending = false;
+	if (pending) {
+		ept_flush_guest(vm);
 	}
 }
 
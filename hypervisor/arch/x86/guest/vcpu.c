@@ -249,6 +249,8 @@ static void vcpu_reset_internal(struct acrn_vcpu *vcpu, enum reset_mode mode)
 	vcpu->arch.lapic_pt_enabled = false;
 	vcpu->arch.irq_window_enabled = false;
 	vcpu->arch.emulating_lock = false;
+	vcpu->arch.vmcs_cleared = false;
+	vcpu->arch.vtimer_migrated = false;
 	(void)memset((void *)vcpu->arch.vmcs, 0U, PAGE_SIZE);
 
 	for (i = 0; i < NR_WORLD; i++) {
@@ -608,8 +610,9 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 		 */
 		vcpu->arch.pid.control.bits.nv = POSTED_INTR_VECTOR + vm->vm_id;
 
-		/* ACRN does not support vCPU migration, one vCPU always runs on
-		 * the same pCPU, so PI's ndst is never changed after startup.
+		/* A vCPU always runs on the same pCPU, so PI's ndst is never
+		 * changed after startup, unless the VM opts in to vCPU balancing,
+		 * see vcpu_migrate().
 		 */
 		vcpu->arch.pid.control.bits.ndst = per_cpu(lapic_id, pcpu_id);
 
@@ -768,8 +771,13 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 				exec_vmwrite(VMX_GUEST_RIP, vcpu_get_rip(vcpu) + vcpu->arch.inst_len);
 			}
 
-			/* Resume the VM */
-			status = exec_vmentry(ctx, VM_RESUME, ibrs_type);
+			/* Resume the VM, or launch it again if the VMCS was cleared to migrate the vCPU */
+			if (vcpu->arch.vmcs_cleared) {
+				vcpu->arch.vmcs_cleared = false;
+				status = exec_vmentry(ctx, VM_LAUNCH, ibrs_type);
+			} else {
+				status = exec_vmentry(ctx, VM_RESUME, ibrs_type);
+			}
 		}
 
 		cs_attr = exec_vmread32(VMX_GUEST_CS_ATTR);
@@ -806,6 +814,15 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
  */
 void offline_vcpu(struct acrn_vcpu *vcpu)
 {
+	uint16_t pcpu_id;
+
+	/* its XSAVE state, if left in some pCPU's registers, is dropped */
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		if (per_cpu(xsave_owner, pcpu_id) == vcpu) {
+			per_cpu(xsave_owner, pcpu_id) = NULL;
+		}
+	}
+
 	vlapic_free(vcpu);
 	per_cpu(ever_run_vcpu, pcpuid_from_vcpu(vcpu)) = NULL;
 
@@ -916,15 +933,40 @@ void rstore_xsave_area(const struct acrn_vcpu *vcpu, const struct ext_context *e
 	}
 }
 
-/* TODO:
- * Now we have switch_out and switch_in callbacks for each thread_object, and schedule
- * will call them every thread switch. We can implement lazy context swtich , which
- * only do context swtich when really need.
+/*
+ * The XSAVE managed state is switched lazily: it stays in the registers when its vCPU is
+ * switched out, and is only saved when another vCPU needs the registers, when the vCPU
+ * stops running or migrates, or when the pCPU goes down. Switching to the idle thread, or
+ * to a thread without extended state, and back costs neither XSAVES nor XRSTORS.
+ *
+ * @pre per_cpu(xsave_owner, get_pcpu_id()) == vcpu
+ */
+static void save_xsave_owner(struct acrn_vcpu *vcpu)
+{
+	save_xsave_area(vcpu, &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx));
+	get_cpu_var(xsave_owner) = NULL;
+	get_cpu_var(ctx_switch_stats).nr_xsave++;
+}
+
+/**
+ * @brief Save the XSAVE state left in this pCPU's registers, unless it belongs to the running vCPU
+ *
+ * Called before this pCPU loses its register state (offline or S3).
  */
+void flush_xsave_owner(void)
+{
+	struct acrn_vcpu *owner = get_cpu_var(xsave_owner);
+
+	if ((owner != NULL) && (owner != get_running_vcpu(get_pcpu_id()))) {
+		save_xsave_owner(owner);
+	}
+}
+
 static void context_switch_out(struct thread_object *prev)
 {
 	struct acrn_vcpu *vcpu = container_of(prev, struct acrn_vcpu, thread_obj);
 	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
+	uint64_t start = cpu_ticks();
 
 	/* We don't flush TLB as we assume each vcpu has different vpid */
 	ectx->ia32_star = msr_read(MSR_IA32_STAR);
@@ -934,17 +976,34 @@ static void context_switch_out(struct thread_object *prev)
 	ectx->ia32_kernel_gs_base = msr_read(MSR_IA32_KERNEL_GS_BASE);
 	ectx->tsc_aux = msr_read(MSR_IA32_TSC_AUX);
 
-	save_xsave_area(vcpu, ectx);
+	/* a vCPU that is paused, reset or shut down may be changed or freed before running again */
+	if ((vcpu->state != VCPU_RUNNING) && (get_cpu_var(xsave_owner) == vcpu)) {
+		save_xsave_owner(vcpu);
+	}
+
+	get_cpu_var(ctx_switch_stats).cycles += cpu_ticks() - start;
 }
 
 static void context_switch_in(struct thread_object *next)
 {
 	struct acrn_vcpu *vcpu = container_of(next, struct acrn_vcpu, thread_obj);
 	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
+	struct ctx_switch_stats *stats = &get_cpu_var(ctx_switch_stats);
+	struct acrn_vcpu *owner = get_cpu_var(xsave_owner);
+	uint64_t start = cpu_ticks();
 	uint64_t vmsr_val;
 
 	load_vmcs(vcpu);
 
+	if (vcpu->arch.vmcs_cleared) {
+		/* migrated from another pCPU: the host state points to that pCPU's GDT and TSS */
+		init_host_state();
+	}
+	if (vcpu->arch.vtimer_migrated) {
+		vcpu->arch.vtimer_migrated = false;
+		(void)add_timer(&vcpu_vlapic(vcpu)->vtimer.timer);
+	}
+
 	msr_write(MSR_IA32_STAR, ectx->ia32_star);
 	msr_write(MSR_IA32_CSTAR, ectx->ia32_cstar);
 	msr_write(MSR_IA32_LSTAR, ectx->ia32_lstar);
@@ -961,10 +1020,82 @@ static void context_switch_in(struct thread_object *next)
 
 	load_iwkey(vcpu);
 
-	rstore_xsave_area(vcpu, ectx);
+	if (owner != vcpu) {
+		if (owner != NULL) {
+			save_xsave_owner(owner);
+		}
+		rstore_xsave_area(vcpu, ectx);
+		get_cpu_var(xsave_owner) = vcpu;
+		stats->nr_xrstor++;
+	} else {
+		/* still in the registers, so are XCR0 and IA32_XSS */
+		stats->nr_xstate_live++;
+	}
+
+	stats->nr_switch++;
+	stats->cycles += cpu_ticks() - start;
 }
 
 
+/*
+ * @brief Release the per-pCPU state of a runnable vCPU so that it can run on dest_pcpu_id
+ *
+ * Runs on the vCPU's current pCPU, which is the only one that can VMCLEAR its VMCS and
+ * disarm its vLAPIC timer. The vCPU picks both up again in context_switch_in().
+ *
+ * @pre obj != NULL && obj->pcpu_id == get_pcpu_id()
+ * @pre the schedule locks of obj->pcpu_id and dest_pcpu_id are held
+ */
+static bool vcpu_migrate(struct thread_object *obj, uint16_t dest_pcpu_id)
+{
+	struct acrn_vcpu *vcpu = container_of(obj, struct acrn_vcpu, thread_obj);
+	struct hv_timer *timer = &vcpu_vlapic(vcpu)->vtimer.timer;
+	uint16_t vm_id = vcpu->vm->vm_id;
+	bool ret = false;
+
+	/* a pCPU runs at most one vCPU of a VM, see create_vcpu() */
+	if (vcpu->launched && (vcpu->state == VCPU_RUNNING)
+			&& (per_cpu(vcpu_array, dest_pcpu_id)[vm_id] == NULL)) {
+		clear_va_vmcs(vcpu->arch.vmcs);
+		if (get_cpu_var(vmcs_run) == (void *)vcpu->arch.vmcs) {
+			get_cpu_var(vmcs_run) = NULL;
+		}
+		vcpu->arch.vmcs_cleared = true;
+
+		if (get_cpu_var(xsave_owner) == vcpu) {
+			save_xsave_owner(vcpu);
+		}
+
+		if (timer_is_started(timer)) {
+			del_timer(timer);
+			vcpu->arch.vtimer_migrated = true;
+		}
+
+		per_cpu(vcpu_array, dest_pcpu_id)[vm_id] = vcpu;
+		vcpu->arch.pid.control.bits.ndst = per_cpu(lapic_id, dest_pcpu_id);
+		per_cpu(vcpu_array, obj->pcpu_id)[vm_id] = NULL;
+		per_cpu(ever_run_vcpu, dest_pcpu_id) = vcpu;
+		if (per_cpu(ever_run_vcpu, obj->pcpu_id) == vcpu) {
+			per_cpu(ever_run_vcpu, obj->pcpu_id) = NULL;
+		}
+
+		/*
+		 * The destination may still cache translations from an earlier stint of the vCPU
+		 * there, which missed the guest TLB and EPT flushes done here since.
+		 */
+		vcpu_make_request(vcpu, ACRN_REQUEST_VPID_FLUSH);
+		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+
+		/* a notification may have been sent to this pCPU before ndst changed */
+		if (bitmap_test(POSTED_INTR_ON, &(vcpu->arch.pid.control.value))) {
+			vcpu_make_request(vcpu, ACRN_REQUEST_EVENT);
+		}
+		ret = true;
+	}
+
+	return ret;
+}
+
 /**
  * @pre vcpu != NULL
  * @pre vcpu->state == VCPU_INIT
@@ -996,6 +1127,9 @@ int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id)
 		vcpu->thread_obj.host_sp = build_stack_frame(vcpu);
 		vcpu->thread_obj.switch_out = context_switch_out;
 		vcpu->thread_obj.switch_in = context_switch_in;
+		if (is_vcpu_balance_configured(vm)) {
+			vcpu->thread_obj.migrate = vcpu_migrate;
+		}
 		init_thread_data(&vcpu->thread_obj, &get_vm_config(vm->vm_id)->sched_params);
 		for (i = 0; i < VCPU_EVENT_NUM; i++) {
 			init_event(&vcpu->events[i]);
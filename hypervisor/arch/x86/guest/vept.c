@@ -42,6 +42,7 @@ static uint64_t calc_sept_page_num(void)
 static struct page_pool sept_page_pool;
 static struct page *sept_pages;
 static uint64_t *sept_page_bitmap;
+static uint64_t *sept_page_summary;
 
 /*
  * @brief Reserve space for SEPT pages from platform E820 table
@@ -56,7 +57,9 @@ static void init_vept_pool(void)
 	set_paging_supervisor(page_base, calc_sept_size());
 
 	sept_pages = (struct page *)page_base;
-	sept_page_bitmap = (uint64_t *)e820_alloc_memory((calc_sept_page_num() / 64U), MEM_SIZE_MAX);
+	sept_page_bitmap = (uint64_t *)e820_alloc_memory((calc_sept_page_num() / 64U) * sizeof(uint64_t), MEM_SIZE_MAX);
+	sept_page_summary = (uint64_t *)e820_alloc_memory(PAGE_POOL_SUMMARY_SIZE(calc_sept_page_num() / 64U) * sizeof(uint64_t),
+		MEM_SIZE_MAX);
 }
 
 static bool is_present_ept_entry(uint64_t ept_entry)
@@ -548,10 +551,12 @@ void init_vept(void)
 	sept_page_pool.start_page = sept_pages;
 	sept_page_pool.bitmap_size = calc_sept_page_num() / 64U;
 	sept_page_pool.bitmap = sept_page_bitmap;
+	sept_page_pool.summary = sept_page_summary;
         sept_page_pool.dummy_page = NULL;
-	spinlock_init(&sept_page_pool.lock);
-	memset((void *)sept_page_pool.bitmap, 0, sept_page_pool.bitmap_size * sizeof(uint64_t));
-	sept_page_pool.last_hint_id = 0UL;
+	sept_page_pool.name = "sept";
+	/* shadow EPT faults of all L1 vCPUs allocate from this pool concurrently */
+	sept_page_pool.use_magazine = true;
+	init_page_pool(&sept_page_pool);
 
 	spinlock_init(&vept_desc_bucket_lock);
 }
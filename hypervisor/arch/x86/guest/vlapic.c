@@ -196,6 +196,7 @@ vlapic_write_dfr(struct acrn_vlapic *vlapic)
 	} else {
 		dev_dbg(DBG_LEVEL_VLAPIC, "DFR in Unknown Model %#x", lapic->dfr);
 	}
+	vioapic_flush_dest_cache(vlapic2vcpu(vlapic)->vm);
 }
 
 static void
@@ -206,6 +207,7 @@ vlapic_write_ldr(struct acrn_vlapic *vlapic)
 	lapic = &(vlapic->apic_page);
 	lapic->ldr.v &= ~APIC_LDR_RESERVED;
 	dev_dbg(DBG_LEVEL_VLAPIC, "vlapic LDR set to %#x", lapic->ldr);
+	vioapic_flush_dest_cache(vlapic2vcpu(vlapic)->vm);
 }
 
 static inline uint32_t
@@ -1585,6 +1587,7 @@ vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops, enum
 	lapic->version.v = VLAPIC_VERSION;
 	lapic->version.v |= (VLAPIC_MAXLVT_INDEX << MAXLVTSHIFT);
 	lapic->dfr.v = 0xffffffffU;
+	vioapic_flush_dest_cache(vlapic2vcpu(vlapic)->vm);
 	lapic->svr.v = APIC_SVR_VECTOR;
 	vlapic_mask_lvts(vlapic);
 	vlapic_reset_tmr(vlapic);
@@ -1613,6 +1616,7 @@ void vlapic_restore(struct acrn_vlapic *vlapic, const struct lapic_regs *regs)
 	lapic->ppr = regs->ppr;
 	lapic->ldr = regs->ldr;
 	lapic->dfr = regs->dfr;
+	vioapic_flush_dest_cache(vlapic2vcpu(vlapic)->vm);
 	for (i = 0; i < 8; i++) {
 		lapic->tmr[i].v = regs->tmr[i].v;
 	}
@@ -1700,6 +1704,7 @@ int32_t vlapic_set_apicbase(struct acrn_vlapic *vlapic, uint64_t new)
 				}
 				vlapic->msr_apicbase = new;
 				vlapic_build_x2apic_id(vlapic);
+				vioapic_flush_dest_cache(vcpu->vm);
 				switch_apicv_mode_x2apic(vcpu);
 				update_vm_vlapic_state(vcpu->vm);
 			} else {
@@ -1724,9 +1729,7 @@ vlapic_receive_intr(struct acrn_vm *vm, bool level, uint32_t dest, bool phys,
 		uint32_t delmode, uint32_t vec, bool rh)
 {
 	bool lowprio;
-	uint16_t vcpu_id;
 	uint64_t dmask;
-	struct acrn_vcpu *target_vcpu;
 
 	if ((delmode != IOAPIC_RTE_DELMODE_FIXED) &&
 			(delmode != IOAPIC_RTE_DELMODE_LOPRI) &&
@@ -1742,21 +1745,36 @@ vlapic_receive_intr(struct acrn_vm *vm, bool level, uint32_t dest, bool phys,
 		 * 'dest' in the legacy xAPIC format.
 		 */
 		dmask = vlapic_calc_dest_noshort(vm, false, dest, phys, lowprio);
+		vlapic_deliver_intr(vm, level, dmask, delmode, vec);
+	}
+}
 
-		for (vcpu_id = 0U; vcpu_id < vm->hw.created_vcpus; vcpu_id++) {
-			struct acrn_vlapic *vlapic;
-			if ((dmask & (1UL << vcpu_id)) != 0UL) {
-				target_vcpu = vcpu_from_vid(vm, vcpu_id);
-
-				/* only make request when vlapic enabled */
-				vlapic = vcpu_vlapic(target_vcpu);
-				if (vlapic_enabled(vlapic)) {
-					if (delmode == IOAPIC_RTE_DELMODE_EXINT) {
-						vcpu_inject_extint(target_vcpu);
-					} else {
-						vlapic_set_intr(target_vcpu, vec, level);
-					}
-				}
+/*
+ * Deliver the interrupt to the vCPUs of an already decoded destination.
+ *
+ * @pre vm != NULL
+ * @pre delmode is IOAPIC_RTE_DELMODE_FIXED, IOAPIC_RTE_DELMODE_LOPRI or IOAPIC_RTE_DELMODE_EXINT
+ * @pre dmask only contains created vCPUs of vm
+ */
+void
+vlapic_deliver_intr(struct acrn_vm *vm, bool level, uint64_t dmask, uint32_t delmode, uint32_t vec)
+{
+	uint16_t vcpu_id;
+	uint64_t mask = dmask;
+	struct acrn_vcpu *target_vcpu;
+	struct acrn_vlapic *vlapic;
+
+	for (vcpu_id = ffs64(mask); vcpu_id != INVALID_BIT_INDEX; vcpu_id = ffs64(mask)) {
+		bitmap_clear_nolock(vcpu_id, &mask);
+		target_vcpu = vcpu_from_vid(vm, vcpu_id);
+
+		/* only make request when vlapic enabled */
+		vlapic = vcpu_vlapic(target_vcpu);
+		if (vlapic_enabled(vlapic)) {
+			if (delmode == IOAPIC_RTE_DELMODE_EXINT) {
+				vcpu_inject_extint(target_vcpu);
+			} else {
+				vlapic_set_intr(target_vcpu, vec, level);
 			}
 		}
 	}
@@ -231,6 +231,23 @@ bool is_vtm_configured(const struct acrn_vm *vm)
 	return ((vm_config->guest_flags & GUEST_FLAG_VTM) != 0U);
 }
 
+/**
+ * @brief Whether the vCPUs of this VM may be migrated between the pCPUs of its cpu_affinity
+ *
+ * Only honoured for best-effort VMs: RT VMs and VMs owning per-pCPU resources (LAPIC, HWP,
+ * nested VMX) stay pinned, and so do all VMs when vCPUs are kicked by INIT.
+ *
+ * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
+ */
+bool is_vcpu_balance_configured(const struct acrn_vm *vm)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+
+	return (((vm_config->guest_flags & GUEST_FLAG_VCPU_BALANCE) != 0U) && !is_rt_vm(vm)
+		&& !is_lapic_pt_configured(vm) && !is_vhwp_configured(vm) && !is_nvmx_configured(vm)
+		&& !is_using_init_ipi());
+}
+
 /**
  * @brief VT-d PI posted mode can possibly be used for PTDEVs assigned
  * to this VM if platform supports VT-d PI AND lapic passthru is not configured
@@ -756,6 +773,7 @@ int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *v
 		vm->arch_vm.vlapic_mode = VM_VLAPIC_XAPIC;
 		vm->intr_inject_delay_delta = 0UL;
 		vm->nr_emul_mmio_regions = 0U;
+		(void)memset(&vm->emul_mmio_index, 0U, sizeof(vm->emul_mmio_index));
 		vm->vcpuid_entry_nr = 0U;
 
 		/* Set up IO bit-mask such that VM exit occurs on
@@ -1099,6 +1117,7 @@ int32_t prepare_vm(uint16_t vm_id, struct acrn_vm_config *vm_config)
 	int32_t err = -1;
 	struct acrn_vm *vm = NULL;
 
+	record_vm_boot_phase(vm_id, VM_BOOT_PREPARE);
 #ifdef CONFIG_SECURITY_VM_FIXUP
 	security_vm_fixup(vm_id);
 #endif
@@ -1108,24 +1127,71 @@ int32_t prepare_vm(uint16_t vm_id, struct acrn_vm_config *vm_config)
 		/* Service VM and pre-launched VMs launch on all pCPUs defined in vm_config->cpu_affinity */
 		err = create_vm(vm_id, vm_config->cpu_affinity, vm_config, &vm);
 		if (err == 0) {
+			record_vm_boot_phase(vm_id, VM_BOOT_CREATED);
 			if (is_prelaunched_vm(vm)) {
 				build_vrsdp(vm);
 			}
 
 			err = prepare_os_image(vm);
+			if (err == 0) {
+				record_vm_boot_phase(vm_id, VM_BOOT_LOADED);
+			}
 		}
 	}
 
 	return err;
 }
 
+static inline bool is_boot_launched_vm(const struct acrn_vm_config *vm_config)
+{
+	return ((vm_config->load_order == SERVICE_VM) || (vm_config->load_order == PRE_LAUNCHED_VM));
+}
+
+/*
+ * A pCPU launching a VM itself must not wait for the images of another VM.
+ */
+static bool is_configured_bsp_pcpu(uint16_t pcpu_id)
+{
+	uint16_t vm_id;
+	bool ret = false;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		if (is_boot_launched_vm(get_vm_config(vm_id))
+				&& (get_configured_bsp_pcpu_id(get_vm_config(vm_id)) == pcpu_id)) {
+			ret = true;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * @pre vm_id < CONFIG_MAX_VM_NUM
+ */
+static void print_vm_boot_timeline(uint16_t vm_id)
+{
+	const struct vm_boot_timeline *timeline = get_vm_boot_timeline(vm_id);
+	uint64_t prepare = timeline->tsc[VM_BOOT_PREPARE];
+
+	pr_acrnlog("VM%hu boot timeline: prepare at %luus, created +%luus, loaded %luKB with %hu helpers +%luus, "
+		"started +%luus", vm_id, ticks_to_us(prepare),
+		ticks_to_us(timeline->tsc[VM_BOOT_CREATED] - prepare), timeline->load_bytes >> 10U,
+		timeline->nr_helpers, ticks_to_us(timeline->tsc[VM_BOOT_LOADED] - timeline->tsc[VM_BOOT_CREATED]),
+		ticks_to_us(timeline->tsc[VM_BOOT_STARTED] - timeline->tsc[VM_BOOT_LOADED]));
+}
+
 /**
  * @pre vm_config != NULL
  * @Application constraint: The validity of vm_config->cpu_affinity should be guaranteed before run-time.
+ *
+ * Each Service VM or pre-launched VM is created, loaded and started by its configured BSP pCPU, so VMs
+ * with different BSP pCPUs are launched concurrently. The other pCPUs of a VM help to copy its images.
  */
 void launch_vms(uint16_t pcpu_id)
 {
 	uint16_t vm_id;
+	int32_t err;
 	struct acrn_vm_config *vm_config;
 
 	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
@@ -1137,7 +1203,7 @@ void launch_vms(uint16_t pcpu_id)
 				__func__, vm_id);
 		}
 
-		if ((vm_config->load_order == SERVICE_VM) || (vm_config->load_order == PRE_LAUNCHED_VM)) {
+		if (is_boot_launched_vm(vm_config)) {
 			if (pcpu_id == get_configured_bsp_pcpu_id(vm_config)) {
 				if (vm_config->load_order == SERVICE_VM) {
 					service_vm_ptr = &vm_array[vm_id];
@@ -1151,14 +1217,23 @@ void launch_vms(uint16_t pcpu_id)
 				 * so skip "start_vm" here for REE, and start it in TEE hypercall
 				 * HC_TEE_VCPU_BOOT_DONE.
 				 */
-				if (prepare_vm(vm_id, vm_config) == 0) {
+				err = prepare_vm(vm_id, vm_config);
+				/* release the helpers, even if the VM could not be prepared */
+				finish_load_vm_images(vm_id);
+				if (err == 0) {
 					if ((vm_config->guest_flags & GUEST_FLAG_REE) != 0U) {
 						/* Nothing need to do here, REE will start in TEE hypercall */
 					} else {
 						start_vm(get_vm_from_vmid(vm_id));
+						record_vm_boot_phase(vm_id, VM_BOOT_STARTED);
 						pr_acrnlog("Start VM id: %x name: %s", vm_id, vm_config->name);
+						print_vm_boot_timeline(vm_id);
 					}
 				}
+			} else if (((vm_config->cpu_affinity & (1UL << pcpu_id)) != 0UL) && !is_configured_bsp_pcpu(pcpu_id)) {
+				help_load_vm_images(vm_id);
+			} else {
+				/* not a pCPU of this VM */
 			}
 		}
 	}
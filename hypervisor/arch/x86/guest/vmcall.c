@@ -50,6 +50,8 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_pause_vm},
 	[HC_IDX(HC_SET_VCPU_REGS)] = {
 		.handler = hcall_set_vcpu_regs},
+	[HC_IDX(HC_GET_VMEXIT_LATENCY)] = {
+		.handler = hcall_get_vmexit_latency},
 	[HC_IDX(HC_CREATE_VCPU)] = {
 		.handler = hcall_create_vcpu},
 	[HC_IDX(HC_SET_IRQLINE)] = {
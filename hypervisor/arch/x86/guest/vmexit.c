@@ -23,12 +23,7 @@
 #include <trace.h>
 #include <asm/rtcm.h>
 #include <debug/console.h>
-
-/*
- * According to "SDM APPENDIX C VMX BASIC EXIT REASONS",
- * there are 65 Basic Exit Reasons.
- */
-#define NR_VMX_EXIT_REASONS	70U
+#include <ticks.h>
 
 static int32_t triple_fault_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t unhandled_vmexit_handler(struct acrn_vcpu *vcpu);
@@ -210,6 +205,37 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 		.handler = loadiwkey_vmexit_handler}
 };
 
+/*
+ * Called right after the VM exit, before it is handled.
+ */
+void vmexit_latency_start(struct acrn_vcpu *vcpu)
+{
+	vcpu->exit_lat.exit_tsc = cpu_ticks();
+}
+
+/*
+ * Called right before the VM entry: account the time spent since the last VM exit, including the I/O request
+ * round trip to the DM and any time the vCPU was descheduled, to the log2 bucket of its basic exit reason.
+ */
+void vmexit_latency_end(struct acrn_vcpu *vcpu)
+{
+	uint16_t basic_exit_reason = (uint16_t)(vcpu->arch.exit_reason & 0xFFFFU);
+	uint64_t delta;
+	uint16_t bucket;
+
+	if ((vcpu->exit_lat.exit_tsc != 0UL) && (basic_exit_reason < NR_VMX_EXIT_REASONS)) {
+		delta = cpu_ticks() - vcpu->exit_lat.exit_tsc;
+		bucket = fls64(delta);
+		if ((bucket == INVALID_BIT_INDEX) || (bucket < ACRN_VMEXIT_LAT_MIN_SHIFT)) {
+			bucket = 0U;
+		} else {
+			bucket = min(bucket - ACRN_VMEXIT_LAT_MIN_SHIFT + 1U, ACRN_VMEXIT_LAT_BUCKETS - 1U);
+		}
+		vcpu->exit_lat.count[basic_exit_reason][bucket]++;
+		vcpu->exit_lat.exit_tsc = 0UL;
+	}
+}
+
 int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	struct vm_exit_dispatch *dispatch = NULL;
@@ -241,8 +241,10 @@ void allocate_ppt_pages(void)
 	ppt_page_pool.start_page = (struct page *)(void *)page_base;
 	ppt_page_pool.bitmap_size = bitmap_size / sizeof(uint64_t);
 	ppt_page_pool.dummy_page = NULL;
+	ppt_page_pool.name = "ppt";
 
-	memset(ppt_page_pool.bitmap, 0, bitmap_size);
+	/* MMU page-table pages are only allocated during boot, no need for a summary or magazines */
+	init_page_pool(&ppt_page_pool);
 }
 
 void init_paging(void)
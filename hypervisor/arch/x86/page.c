@@ -5,7 +5,9 @@
  */
 #include <types.h>
 #include <asm/lib/bits.h>
+#include <asm/lib/atomic.h>
 #include <asm/page.h>
+#include <asm/cpu.h>
 #include <logmsg.h>
 
 /**
@@ -22,25 +24,193 @@
  * support to manage memory resources.
  */
 
-struct page *alloc_page(struct page_pool *pool)
+static struct page_pool *page_pools[MAX_PAGE_POOL_NUM];
+static spinlock_t page_pools_lock = { .head = 0U, .tail = 0U, };
+
+/*
+ * Mark page idx/bit as allocated in the bitmap, updating the summary when the bitmap word gets full.
+ *
+ * @pre pool->lock is held
+ */
+static inline struct page *take_bitmap_page(struct page_pool *pool, uint64_t idx)
+{
+	uint64_t bit = ffz64(pool->bitmap[idx]);
+
+	bitmap_set_nolock((uint16_t)bit, pool->bitmap + idx);
+	if ((pool->summary != NULL) && (pool->bitmap[idx] == ~0UL)) {
+		bitmap_set_nolock((uint16_t)(idx & 0x3fUL), pool->summary + (idx >> 6U));
+	}
+	pool->last_hint_id = idx;
+
+	return pool->start_page + ((idx << 6U) + bit);
+}
+
+/*
+ * @pre pool->lock is held
+ */
+static struct page *alloc_bitmap_page(struct page_pool *pool)
 {
 	struct page *page = NULL;
-	uint64_t loop_idx, idx, bit;
+	uint64_t loop_idx, idx, sidx, summary_size;
 
-	spinlock_obtain(&pool->lock);
-	for (loop_idx = pool->last_hint_id;
-		loop_idx < (pool->last_hint_id + pool->bitmap_size); loop_idx++) {
-		idx = loop_idx % pool->bitmap_size;
-		if (*(pool->bitmap + idx) != ~0UL) {
-			bit = ffz64(*(pool->bitmap + idx));
-			bitmap_set_nolock(bit, pool->bitmap + idx);
-			page = pool->start_page + ((idx << 6U) + bit);
-
-			pool->last_hint_id = idx;
+	if (pool->summary != NULL) {
+		/* Bits of the last summary word beyond bitmap_size are kept set by init_page_pool(). */
+		summary_size = PAGE_POOL_SUMMARY_SIZE(pool->bitmap_size);
+		for (loop_idx = (pool->last_hint_id >> 6U);
+			loop_idx < ((pool->last_hint_id >> 6U) + summary_size); loop_idx++) {
+			sidx = loop_idx % summary_size;
+			if (pool->summary[sidx] != ~0UL) {
+				idx = (sidx << 6U) + ffz64(pool->summary[sidx]);
+				page = take_bitmap_page(pool, idx);
+				break;
+			}
+		}
+	} else {
+		for (loop_idx = pool->last_hint_id;
+			loop_idx < (pool->last_hint_id + pool->bitmap_size); loop_idx++) {
+			idx = loop_idx % pool->bitmap_size;
+			if (*(pool->bitmap + idx) != ~0UL) {
+				page = take_bitmap_page(pool, idx);
+				break;
+			}
+		}
+	}
+
+	return page;
+}
+
+/*
+ * @pre pool->lock is held
+ * @pre ((page - pool->start_page) >> 6U) < pool->bitmap_size
+ */
+static void free_bitmap_page(struct page_pool *pool, struct page *page)
+{
+	uint64_t idx, bit;
+
+	idx = (page - pool->start_page) >> 6U;
+	bit = (page - pool->start_page) & 0x3fUL;
+	bitmap_clear_nolock((uint16_t)bit, pool->bitmap + idx);
+	if (pool->summary != NULL) {
+		bitmap_clear_nolock((uint16_t)(idx & 0x3fUL), pool->summary + (idx >> 6U));
+	}
+}
+
+/*
+ * Take a page from the current pCPU's magazine, refilling it from the bitmap when it is empty.
+ */
+static struct page *alloc_magazine_page(struct page_pool *pool)
+{
+	struct page_magazine *mag = &pool->magazine[get_pcpu_id()];
+	struct page *page = NULL;
+
+	spinlock_obtain(&mag->lock);
+	if (mag->nr == 0U) {
+		spinlock_obtain(&pool->lock);
+		while (mag->nr < (PAGE_MAGAZINE_SIZE / 2U)) {
+			page = alloc_bitmap_page(pool);
+			if (page == NULL) {
+				break;
+			}
+			mag->pages[mag->nr] = page;
+			mag->nr++;
+		}
+		spinlock_release(&pool->lock);
+	}
+	if (mag->nr > 0U) {
+		mag->nr--;
+		page = mag->pages[mag->nr];
+	}
+	spinlock_release(&mag->lock);
+
+	return page;
+}
+
+/*
+ * The pool bitmap is exhausted: take a page cached by any pCPU rather than fail the allocation.
+ */
+static struct page *steal_magazine_page(struct page_pool *pool)
+{
+	struct page_magazine *mag;
+	struct page *page = NULL;
+	uint16_t i;
+
+	for (i = 0U; (i < MAX_PCPU_NUM) && (page == NULL); i++) {
+		mag = &pool->magazine[i];
+		spinlock_obtain(&mag->lock);
+		if (mag->nr > 0U) {
+			mag->nr--;
+			page = mag->pages[mag->nr];
+		}
+		spinlock_release(&mag->lock);
+	}
+
+	return page;
+}
+
+/*
+ * Mirror nr_used into the high water mark. A racing update can only be lost to a larger value.
+ */
+static void update_page_pool_high_water(struct page_pool *pool, uint64_t used)
+{
+	uint64_t old = pool->high_water;
+
+	while (used > old) {
+		old = atomic_cmpxchg64(&pool->high_water, old, used);
+	}
+}
+
+void init_page_pool(struct page_pool *pool)
+{
+	uint64_t summary_size, nr_valid;
+	uint16_t i;
+
+	spinlock_init(&pool->lock);
+	(void)memset((void *)pool->bitmap, 0U, pool->bitmap_size * sizeof(uint64_t));
+	if (pool->summary != NULL) {
+		summary_size = PAGE_POOL_SUMMARY_SIZE(pool->bitmap_size);
+		(void)memset((void *)pool->summary, 0U, summary_size * sizeof(uint64_t));
+		/* Mark the summary bits without a backing bitmap word as full so they are never picked. */
+		nr_valid = pool->bitmap_size & 0x3fUL;
+		if (nr_valid != 0UL) {
+			pool->summary[summary_size - 1UL] = ~((1UL << nr_valid) - 1UL);
+		}
+	}
+	pool->last_hint_id = 0UL;
+	for (i = 0U; i < MAX_PCPU_NUM; i++) {
+		spinlock_init(&pool->magazine[i].lock);
+		pool->magazine[i].nr = 0U;
+	}
+	pool->nr_used = 0L;
+	pool->high_water = 0UL;
+
+	spinlock_obtain(&page_pools_lock);
+	for (i = 0U; i < MAX_PAGE_POOL_NUM; i++) {
+		if ((page_pools[i] == pool) || (page_pools[i] == NULL)) {
+			page_pools[i] = pool;
 			break;
 		}
 	}
-	spinlock_release(&pool->lock);
+	spinlock_release(&page_pools_lock);
+}
+
+struct page *alloc_page(struct page_pool *pool)
+{
+	struct page *page = NULL;
+
+	if (pool->use_magazine) {
+		page = alloc_magazine_page(pool);
+	} else {
+		spinlock_obtain(&pool->lock);
+		page = alloc_bitmap_page(pool);
+		spinlock_release(&pool->lock);
+	}
+	if ((page == NULL) && pool->use_magazine) {
+		page = steal_magazine_page(pool);
+	}
+
+	if (page != NULL) {
+		update_page_pool_high_water(pool, (uint64_t)atomic_inc64_return(&pool->nr_used));
+	}
 
 	ASSERT(page != NULL, "no page aviable!");
 	page = (page != NULL) ? page : pool->dummy_page;
@@ -62,13 +232,74 @@ struct page *alloc_page(struct page_pool *pool)
  */
 void free_page(struct page_pool *pool, struct page *page)
 {
-	uint64_t idx, bit;
+	struct page_magazine *mag;
+
+	/* The dummy page is shared by every failed allocation and never enters the bitmap. */
+	if (page != pool->dummy_page) {
+		if (pool->use_magazine) {
+			mag = &pool->magazine[get_pcpu_id()];
+			spinlock_obtain(&mag->lock);
+			if (mag->nr == PAGE_MAGAZINE_SIZE) {
+				/* Flush the older half of the magazine back to the bitmap in one go. */
+				spinlock_obtain(&pool->lock);
+				while (mag->nr > (PAGE_MAGAZINE_SIZE / 2U)) {
+					mag->nr--;
+					free_bitmap_page(pool, mag->pages[mag->nr - (PAGE_MAGAZINE_SIZE / 2U)]);
+				}
+				spinlock_release(&pool->lock);
+				(void)memcpy_s((void *)mag->pages, sizeof(mag->pages), (void *)&mag->pages[PAGE_MAGAZINE_SIZE / 2U],
+					(PAGE_MAGAZINE_SIZE / 2U) * sizeof(struct page *));
+			}
+			mag->pages[mag->nr] = page;
+			mag->nr++;
+			spinlock_release(&mag->lock);
+		} else {
+			spinlock_obtain(&pool->lock);
+			free_bitmap_page(pool, page);
+			spinlock_release(&pool->lock);
+		}
+		(void)atomic_dec64_return(&pool->nr_used);
+	}
+}
+
+/**
+ * @brief Get a registered page pool.
+ *
+ * @param[in] idx The index of the page pool, in order of the first init_page_pool() call.
+ *
+ * @return A pointer to the page pool, or NULL if there is no page pool with this index.
+ */
+struct page_pool *get_page_pool(uint16_t idx)
+{
+	return (idx < MAX_PAGE_POOL_NUM) ? page_pools[idx] : NULL;
+}
+
+/**
+ * @brief Get a snapshot of the statistics of a page pool.
+ *
+ * @param[in] pool The page pool to query.
+ * @param[out] stats The statistics of the page pool.
+ */
+void get_page_pool_stats(struct page_pool *pool, struct page_pool_stats *stats)
+{
+	uint64_t idx, nr_alloc = 0UL;
+	uint16_t i;
+
+	stats->cached = 0UL;
+	for (i = 0U; i < MAX_PCPU_NUM; i++) {
+		stats->cached += pool->magazine[i].nr;
+	}
 
 	spinlock_obtain(&pool->lock);
-	idx = (page - pool->start_page) >> 6U;
-	bit = (page - pool->start_page) & 0x3fUL;
-	bitmap_clear_nolock(bit, pool->bitmap + idx);
+	for (idx = 0UL; idx < pool->bitmap_size; idx++) {
+		nr_alloc += bitmap_weight(pool->bitmap[idx]);
+	}
 	spinlock_release(&pool->lock);
+
+	stats->total = pool->bitmap_size << 6U;
+	stats->used = (pool->nr_used > 0L) ? (uint64_t)pool->nr_used : 0UL;
+	stats->free = stats->total - nr_alloc;
+	stats->high_water = pool->high_water;
 }
 
 /**
@@ -80,6 +80,20 @@ void init_sanitized_page(uint64_t *sanitized_page, uint64_t hpa)
 	}
 }
 
+static inline void inc_leaf_count(const struct pgtable *table, enum _page_table_level level, uint64_t nr)
+{
+	if (table->stats != NULL) {
+		table->stats->nr_leaf[level] += nr;
+	}
+}
+
+static inline void dec_leaf_count(const struct pgtable *table, enum _page_table_level level, uint64_t nr)
+{
+	if (table->stats != NULL) {
+		table->stats->nr_leaf[level] -= nr;
+	}
+}
+
 static void try_to_free_pgtable_page(const struct pgtable *table,
 			uint64_t *pde, uint64_t *pt_page, uint32_t type)
 {
@@ -111,12 +125,14 @@ static void split_large_page(uint64_t *pte, enum _page_table_level level,
 	uint64_t *pbase;
 	uint64_t ref_paddr, paddr, paddrinc;
 	uint64_t i, ref_prot;
+	enum _page_table_level next_level;
 
 	switch (level) {
 	case IA32E_PDPT:
 		ref_paddr = (*pte) & PDPTE_PFN_MASK;
 		paddrinc = PDE_SIZE;
 		ref_prot = (*pte) & ~PDPTE_PFN_MASK;
+		next_level = IA32E_PD;
 		break;
 	default:	/* IA32E_PD */
 		ref_paddr = (*pte) & PDE_PFN_MASK;
@@ -124,6 +140,7 @@ static void split_large_page(uint64_t *pte, enum _page_table_level level,
 		ref_prot = (*pte) & ~PDE_PFN_MASK;
 		ref_prot &= ~PAGE_PSE;
 		table->recover_exe_right(&ref_prot);
+		next_level = IA32E_PT;
 		break;
 	}
 
@@ -139,9 +156,59 @@ static void split_large_page(uint64_t *pte, enum _page_table_level level,
 	ref_prot = table->default_access_right;
 	set_pgentry(pte, hva2hpa((void *)pbase) | ref_prot, table);
 
+	dec_leaf_count(table, level, 1UL);
+	inc_leaf_count(table, next_level, PTRS_PER_PTE);
+	if (table->stats != NULL) {
+		table->stats->nr_split++;
+	}
+
 	/* TODO: flush the TLB */
 }
 
+/*
+ * Collapse the page table referenced by pde back into a 2MB page if its 512 entries map a contiguous, 2MB aligned
+ * physical range with identical properties, i.e. undo an earlier split_large_page() once the sub-range that caused
+ * it has been restored.
+ *
+ * Only the PD level is merged: the PD pages are shared between the Normal World and Secure World EPT, while the
+ * PDPTEs are copied, so collapsing a PD into a 1GB page would leave the Secure World referencing a freed page.
+ */
+static void try_to_merge_large_page(uint64_t *pde, const struct pgtable *table)
+{
+	uint64_t *pt_page = pde_page_vaddr(*pde);
+	uint64_t ref_paddr = (*pt_page) & PDE_PFN_MASK;
+	uint64_t ref_prot = (*pt_page) & ~PDE_PFN_MASK;
+	uint64_t large_prot = ref_prot;
+	uint64_t i;
+
+	/*
+	 * A large page may not keep the properties of its small pages, e.g. the execute right with the iTLB multihit
+	 * mitigation, which split it to grant them. Merging would drop them again and fault forever.
+	 */
+	table->tweak_exe_right(&large_prot);
+
+	if (pgentry_present(table, ref_prot) && ((ref_prot & PAGE_PSE) == 0UL) && (large_prot == ref_prot) &&
+			mem_aligned_check(ref_paddr, PDE_SIZE) && table->large_page_support(IA32E_PD, ref_prot)) {
+		for (i = 1UL; i < PTRS_PER_PTE; i++) {
+			if (*(pt_page + i) != ((ref_paddr + (i << PTE_SHIFT)) | ref_prot)) {
+				break;
+			}
+		}
+
+		if (i == PTRS_PER_PTE) {
+			dev_dbg(DBG_LEVEL_MMU, "%s, paddr: 0x%lx, pbase: 0x%lx\n", __func__, ref_paddr, pt_page);
+			set_pgentry(pde, ref_paddr | ref_prot | PAGE_PSE, table);
+			free_page(table->pool, (void *)pt_page);
+
+			dec_leaf_count(table, IA32E_PT, PTRS_PER_PTE);
+			inc_leaf_count(table, IA32E_PD, 1UL);
+			if (table->stats != NULL) {
+				table->stats->nr_merge++;
+			}
+		}
+	}
+}
+
 static inline void local_modify_or_del_pte(uint64_t *pte,
 		uint64_t prot_set, uint64_t prot_clr, uint32_t type, const struct pgtable *table)
 {
@@ -193,6 +260,9 @@ static void modify_or_del_pte(uint64_t *pde, uint64_t vaddr_start, uint64_t vadd
 			}
 		} else {
 			local_modify_or_del_pte(pte, prot_set, prot_clr, type, table);
+			if (type == MR_DEL) {
+				dec_leaf_count(table, IA32E_PT, 1UL);
+			}
 		}
 
 		vaddr += PTE_SIZE;
@@ -233,6 +303,9 @@ static void modify_or_del_pde(uint64_t *pdpte, uint64_t vaddr_start, uint64_t va
 					split_large_page(pde, IA32E_PD, vaddr, table);
 				} else {
 					local_modify_or_del_pte(pde, prot_set, prot_clr, type, table);
+					if (type == MR_DEL) {
+						dec_leaf_count(table, IA32E_PD, 1UL);
+					}
 					if (vaddr_next < vaddr_end) {
 						vaddr = vaddr_next;
 						continue;
@@ -241,6 +314,9 @@ static void modify_or_del_pde(uint64_t *pdpte, uint64_t vaddr_start, uint64_t va
 				}
 			}
 			modify_or_del_pte(pde, vaddr, vaddr_end, prot_set, prot_clr, table, type);
+			if ((type == MR_MODIFY) && table->merge_large_page) {
+				try_to_merge_large_page(pde, table);
+			}
 		}
 		if (vaddr_next >= vaddr_end) {
 			break;	/* done */
@@ -281,6 +357,9 @@ static void modify_or_del_pdpte(const uint64_t *pml4e, uint64_t vaddr_start, uin
 					split_large_page(pdpte, IA32E_PDPT, vaddr, table);
 				} else {
 					local_modify_or_del_pte(pdpte, prot_set, prot_clr, type, table);
+					if (type == MR_DEL) {
+						dec_leaf_count(table, IA32E_PDPT, 1UL);
+					}
 					if (vaddr_next < vaddr_end) {
 						vaddr = vaddr_next;
 						continue;
@@ -317,6 +396,9 @@ static void modify_or_del_pdpte(const uint64_t *pml4e, uint64_t vaddr_start, uin
  * page is split to 4KB pages.
  * - If the 'type' is MR_MODIFY, the function modifies the properties of the existing mapping to match the specified
  * properties.
+ * - If the 'type' is MR_MODIFY and table->merge_large_page is true, a page table whose 512 PTEs end up mapping a
+ * contiguous, 2MB aligned physical range with identical properties is freed and replaced by a 2MB page, with the
+ * execute right tweaked by the callback function table->tweak_exe_right().
  * - If the 'type' is MR_DEL, the function will set corresponding page table entries to point to the sanitized page.
  *
  * @param[inout] pml4_page A pointer to the specified PML4 table.
@@ -398,6 +480,7 @@ static void add_pte(const uint64_t *pde, uint64_t paddr_start, uint64_t vaddr_st
 			pr_fatal("%s, pte 0x%lx is already present!\n", __func__, vaddr);
 		} else {
 			set_pgentry(pte, paddr | prot, table);
+			inc_leaf_count(table, IA32E_PT, 1UL);
 		}
 		paddr += PTE_SIZE;
 		vaddr += PTE_SIZE;
@@ -437,6 +520,7 @@ static void add_pde(const uint64_t *pdpte, uint64_t paddr_start, uint64_t vaddr_
 					(vaddr_next <= vaddr_end)) {
 					table->tweak_exe_right(&local_prot);
 					set_pgentry(pde, paddr | (local_prot | PAGE_PSE), table);
+					inc_leaf_count(table, IA32E_PD, 1UL);
 					if (vaddr_next < vaddr_end) {
 						paddr += (vaddr_next - vaddr);
 						vaddr = vaddr_next;
@@ -486,6 +570,7 @@ static void add_pdpte(const uint64_t *pml4e, uint64_t paddr_start, uint64_t vadd
 					(vaddr_next <= vaddr_end)) {
 					table->tweak_exe_right(&local_prot);
 					set_pgentry(pdpte, paddr | (local_prot | PAGE_PSE), table);
+					inc_leaf_count(table, IA32E_PDPT, 1UL);
 					if (vaddr_next < vaddr_end) {
 						paddr += (vaddr_next - vaddr);
 						vaddr = vaddr_next;
@@ -204,6 +204,7 @@ void host_enter_s3(const struct pm_s_state_data *sstate_data, uint32_t pm1a_cnt_
 	clac();
 
 	CPU_IRQ_DISABLE_ON_CONFIG();
+	flush_xsave_owner();
 	vmx_off();
 
 	suspend_console();
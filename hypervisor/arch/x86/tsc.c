@@ -13,8 +13,15 @@
 #include <asm/cpu.h>
 #include <logmsg.h>
 #include <acpi.h>
+#include <rtl.h>
+#include <boot.h>
 
 #define CAL_MS	10U
+/* the frequency given by tsc_khz= is only checked against a short calibration */
+#define CHECK_CAL_MS	1U
+#define CHECK_TOLERANCE_PERCENT	1UL
+
+#define TSC_KHZ_PARAM	"tsc_khz="
 
 #define HPET_PERIOD	0x004U
 #define HPET_CFG	0x010U
@@ -23,6 +30,7 @@
 #define HPET_CFG_ENABLE	0x001UL
 
 static uint32_t tsc_khz;
+static uint32_t tsc_cal_us;
 static void *hpet_hva;
 
 static uint64_t pit_calibrate_tsc(uint32_t cal_ms_arg)
@@ -200,16 +208,78 @@ static uint64_t native_calculate_tsc_cpuid_0x16(void)
 	return tsc_hz;
 }
 
+/*
+ * Get the TSC frequency given by the "tsc_khz=<decimal kHz>" hypervisor parameter,
+ * e.g. the value logged by calibrate_tsc() on a previous boot of the same platform.
+ *
+ * @return the frequency in Hz, or 0 if the parameter is absent or malformed
+ */
+static uint64_t get_tsc_khz_param(void)
+{
+	const char *cmdline = get_acrn_boot_info()->cmdline;
+	const char *arg;
+	uint64_t khz = 0UL;
+	uint32_t digits = 0U;
+
+	arg = strstr_s(cmdline, MAX_BOOTARGS_SIZE, TSC_KHZ_PARAM, sizeof(TSC_KHZ_PARAM) - 1U);
+	if (arg != NULL) {
+		arg += sizeof(TSC_KHZ_PARAM) - 1U;
+		/* at most 9 digits, that is below 1000 GHz */
+		while ((*arg >= '0') && (*arg <= '9') && (digits < 9U)) {
+			khz = (khz * 10UL) + (uint64_t)(*arg - '0');
+			arg++;
+			digits++;
+		}
+		if ((*arg != '\0') && (*arg != ' ')) {
+			pr_err("%s: invalid %s parameter", __func__, TSC_KHZ_PARAM);
+			khz = 0UL;
+		}
+	}
+
+	return khz * 1000UL;
+}
+
+/*
+ * Accept the given TSC frequency if a CHECK_CAL_MS calibration agrees with it within
+ * CHECK_TOLERANCE_PERCENT, which is much shorter than a full CAL_MS calibration.
+ */
+static bool is_tsc_hz_sane(uint64_t tsc_hz)
+{
+	uint64_t measured_hz = pit_hpet_calibrate_tsc(CHECK_CAL_MS, 0UL);
+	uint64_t delta = (measured_hz > tsc_hz) ? (measured_hz - tsc_hz) : (tsc_hz - measured_hz);
+	bool sane = ((delta * 100UL) <= (tsc_hz * CHECK_TOLERANCE_PERCENT));
+
+	if (!sane) {
+		pr_err("%s: %lu kHz from %s rejected, measured %lu kHz", __func__, tsc_hz / 1000UL,
+			TSC_KHZ_PARAM, measured_hz / 1000UL);
+	}
+
+	return sane;
+}
+
 void calibrate_tsc(void)
 {
-	uint64_t tsc_hz;
+	uint64_t tsc_hz, start = rdtsc();
+	const char *source = "CPUID 0x15";
 
 	tsc_hz = native_calculate_tsc_cpuid_0x15();
 	if (tsc_hz == 0UL) {
-		tsc_hz = pit_hpet_calibrate_tsc(CAL_MS, native_calculate_tsc_cpuid_0x16());
+		tsc_hz = get_tsc_khz_param();
+		source = TSC_KHZ_PARAM;
+		if ((tsc_hz == 0UL) || !is_tsc_hz_sane(tsc_hz)) {
+			tsc_hz = pit_hpet_calibrate_tsc(CAL_MS, native_calculate_tsc_cpuid_0x16());
+			source = is_hpet_capable() ? "HPET" : "PIT";
+		}
 	}
 	tsc_khz = (uint32_t)(tsc_hz / 1000UL);
-	pr_acrnlog("%s: tsc_khz = %ld", __func__, tsc_khz);
+	tsc_cal_us = (uint32_t)(((rdtsc() - start) * 1000UL) / tsc_khz);
+	/* the logged value can be given back with tsc_khz= to skip the calibration on next boots */
+	pr_acrnlog("%s: tsc_khz = %ld from %s in %uus", __func__, tsc_khz, source, tsc_cal_us);
+}
+
+uint32_t get_tsc_calibration_us(void)
+{
+	return tsc_cal_us;
 }
 
 uint32_t get_tsc_khz(void)
@@ -8,8 +8,28 @@
 
 #define VBOOT_H
 
+/* boot phases of a Service VM or pre-launched VM launched by launch_vms() */
+enum vm_boot_phase {
+	VM_BOOT_PREPARE = 0,	/* prepare_vm() entered */
+	VM_BOOT_CREATED,	/* create_vm() done */
+	VM_BOOT_LOADED,		/* prepare_os_image() done */
+	VM_BOOT_STARTED,	/* start_vm() done */
+	VM_BOOT_PHASE_NUM
+};
+
+struct vm_boot_timeline {
+	uint64_t tsc[VM_BOOT_PHASE_NUM];	/* 0 if the phase was not reached */
+	uint64_t load_bytes;			/* bytes copied by copy_image_to_gpa() */
+	uint16_t nr_helpers;			/* pCPUs which helped the BSP pCPU to copy them */
+};
+
 int32_t init_vm_boot_info(struct acrn_vm *vm);
 void load_sw_module(struct acrn_vm *vm, struct sw_module_info *sw_module);
+void copy_image_to_gpa(struct acrn_vm *vm, void *src, uint64_t gpa, uint64_t size);
+void help_load_vm_images(uint16_t vm_id);
+void finish_load_vm_images(uint16_t vm_id);
+void record_vm_boot_phase(uint16_t vm_id, enum vm_boot_phase phase);
+const struct vm_boot_timeline *get_vm_boot_timeline(uint16_t vm_id);
 
 #ifdef CONFIG_GUEST_KERNEL_BZIMAGE
 int32_t bzimage_loader(struct acrn_vm *vm);
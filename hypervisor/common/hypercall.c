@@ -26,6 +26,7 @@
 #include <asm/rtcm.h>
 #include <asm/irq.h>
 #include <ticks.h>
+#include <asm/tsc.h>
 #include <asm/cpuid.h>
 #include <vroot_port.h>
 
@@ -391,6 +392,40 @@ int32_t hcall_set_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
 	return ret;
 }
 
+/**
+ * @brief Get the VM exit latency histogram of a vCPU
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vmexit_latency
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_vmexit_latency(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_vmexit_latency lat;
+	struct acrn_vcpu *target_vcpu;
+	int32_t ret = -1;
+
+	if ((!is_poweroff_vm(target_vm)) && (copy_from_gpa(vm, &lat, param2, sizeof(lat)) == 0)) {
+		if ((lat.vcpu_id < target_vm->hw.created_vcpus) && (lat.exit_reason < NR_VMX_EXIT_REASONS)) {
+			target_vcpu = vcpu_from_vid(target_vm, lat.vcpu_id);
+			(void)memcpy_s((void *)lat.count, sizeof(lat.count),
+				(void *)target_vcpu->exit_lat.count[lat.exit_reason], sizeof(lat.count));
+			lat.tsc_khz = get_tsc_khz();
+			ret = copy_to_gpa(vm, &lat, param2, sizeof(lat));
+		} else {
+			pr_err("%s: invalid vcpu_id %hu or exit_reason %hu\n", __func__, lat.vcpu_id, lat.exit_reason);
+		}
+	}
+
+	return ret;
+}
+
 int32_t hcall_create_vcpu(__unused struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
 		__unused uint64_t param1, __unused uint64_t param2)
 {
@@ -711,11 +746,15 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vcpu *vcpu, struct acrn_vm *targ
 	struct vm_memory_region mr;
 	uint32_t idx;
 	int32_t ret = -1;
+	uint64_t start_tsc;
 
 	if (copy_from_gpa(vm, &regions, param1, sizeof(regions)) == 0) {
 
 		if (!is_poweroff_vm(target_vm) &&
 		    (is_severity_pass(target_vm->vm_id) || (target_vm->state != VM_RUNNING))) {
+			start_tsc = cpu_ticks();
+			/* One EPT flush request per vCPU for the whole batch rather than one per region */
+			ept_flush_batch_begin(target_vm);
 			idx = 0U;
 			while (idx < regions.mr_num) {
 				if (copy_from_gpa(vm, &mr, regions.regions_gpa + idx * sizeof(mr), sizeof(mr)) != 0) {
@@ -729,6 +768,9 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vcpu *vcpu, struct acrn_vm *targ
 				}
 				idx++;
 			}
+			ept_flush_batch_end(target_vm);
+			dev_dbg(DBG_LEVEL_HYCALL, "[vm%d] %u memory regions set in %lu us", target_vm->vm_id, idx,
+					ticks_to_us(cpu_ticks() - start_tsc));
 		} else {
 			pr_err("%p %s:target_vm is invalid or Targeting to service vm", target_vm, __func__);
 		}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <asm/per_cpu.h>
+#include <asm/lapic.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/vcpu.h>
+#include <schedule.h>
+#include <ticks.h>
+
+/*
+ * Pull based vCPU balancing for the VMs with GUEST_FLAG_VCPU_BALANCE.
+ *
+ * A pCPU about to idle looks for a vCPU that is runnable but waiting behind another thread on
+ * its pCPU, and asks that pCPU to hand it over. Sources sharing the last level cache with the
+ * idle pCPU are preferred, so that the vCPU keeps its cache footprint when possible. When such
+ * a vCPU is woken up on a busy pCPU, one idle pCPU of the VM's cpu_affinity is kicked to pull it.
+ * Otherwise an idle pCPU looks at most once per SCHED_BALANCE_INTERVAL_MS, as the scan reads the
+ * vCPUs of all the VMs.
+ */
+
+#define SCHED_BALANCE_INTERVAL_MS	1U
+
+void get_cache_shift(uint32_t *l2_shift, uint32_t *l3_shift);
+
+static uint32_t llc_shift = UINT32_MAX;
+
+/*
+ * Same cache topology as vCAT: the pCPUs sharing a cache have the same APIC ID above its shift.
+ */
+static uint32_t get_llc_id(uint16_t pcpu_id)
+{
+	uint32_t l2_shift, l3_shift;
+
+	if (llc_shift == UINT32_MAX) {
+		get_cache_shift(&l2_shift, &l3_shift);
+		llc_shift = (l3_shift != 0U) ? l3_shift : l2_shift;
+	}
+
+	return per_cpu(lapic_id, pcpu_id) >> llc_shift;
+}
+
+static bool is_pcpu_idle(uint16_t pcpu_id)
+{
+	struct thread_object *curr = sched_get_current(pcpu_id);
+
+	return ((curr != NULL) && is_idle_thread(curr));
+}
+
+/*
+ * @pre vm != NULL
+ */
+static bool can_pull_vm(const struct acrn_vm *vm, uint16_t pcpu_id)
+{
+	return ((vm->state == VM_RUNNING) && is_vcpu_balance_configured(vm)
+		&& ((get_vm_config(vm->vm_id)->cpu_affinity & (1UL << pcpu_id)) != 0UL)
+		&& (per_cpu(vcpu_array, pcpu_id)[vm->vm_id] == NULL));
+}
+
+/**
+ * @brief Whether this idle pCPU shall look for a vCPU to pull
+ *
+ * True if it was kicked by sched_balance_kick(), or if it did not look for
+ * SCHED_BALANCE_INTERVAL_MS.
+ *
+ * @pre pcpu_id == get_pcpu_id()
+ */
+bool need_balance(uint16_t pcpu_id)
+{
+	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
+	uint64_t now = cpu_ticks();
+	bool ret = false;
+
+	if (bitmap_test_and_clear_lock(NEED_BALANCE, &ctl->flags)
+			|| ((now - ctl->balance_tsc) >= (SCHED_BALANCE_INTERVAL_MS * TICKS_PER_MS))) {
+		ctl->balance_tsc = now;
+		ret = true;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Pull a waiting vCPU to this idle pCPU
+ *
+ * Only queues the request, the vCPU is moved by the next schedule() on its pCPU, which then
+ * kicks this pCPU.
+ *
+ * @pre pcpu_id == get_pcpu_id()
+ */
+void sched_balance_pull(uint16_t pcpu_id)
+{
+	struct thread_object *obj, *curr, *near = NULL, *far = NULL;
+	struct acrn_vcpu *vcpu;
+	struct acrn_vm *vm;
+	uint32_t llc_id = get_llc_id(pcpu_id);
+	uint16_t vm_id, i, src;
+
+	for (vm_id = 0U; (vm_id < CONFIG_MAX_VM_NUM) && (near == NULL); vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!can_pull_vm(vm, pcpu_id)) {
+			continue;
+		}
+
+		foreach_vcpu(i, vm, vcpu) {
+			obj = &vcpu->thread_obj;
+			src = obj->pcpu_id;
+			curr = sched_get_current(src);
+			/* waiting: runnable while another thread runs on its pCPU */
+			if ((src != pcpu_id) && (obj->status == THREAD_STS_RUNNABLE) && (curr != obj)
+					&& (curr != NULL) && !is_idle_thread(curr)) {
+				if (get_llc_id(src) == llc_id) {
+					near = obj;
+					break;
+				} else if (far == NULL) {
+					far = obj;
+				} else {
+					/* keep the first candidate out of the LLC */
+				}
+			}
+		}
+	}
+
+	obj = (near != NULL) ? near : far;
+	if (obj != NULL) {
+		(void)request_thread_migration(obj, pcpu_id);
+	}
+}
+
+/**
+ * @brief Kick an idle pCPU that could pull a migratable thread just woken up on a busy pCPU
+ *
+ * @pre obj != NULL && obj->migrate != NULL
+ */
+void sched_balance_kick(const struct thread_object *obj)
+{
+	const struct acrn_vcpu *vcpu = container_of(obj, struct acrn_vcpu, thread_obj);
+	uint64_t affinity = get_vm_config(vcpu->vm->vm_id)->cpu_affinity & get_active_pcpu_bitmap();
+	uint16_t src = obj->pcpu_id, pcpu_id, target = INVALID_CPU_ID;
+	uint32_t llc_id = get_llc_id(src);
+
+	for (pcpu_id = ffs64(affinity); pcpu_id != INVALID_BIT_INDEX; pcpu_id = ffs64(affinity)) {
+		bitmap_clear_nolock(pcpu_id, &affinity);
+		if ((pcpu_id != src) && is_pcpu_idle(pcpu_id)
+				&& (per_cpu(vcpu_array, pcpu_id)[vcpu->vm->vm_id] == NULL)) {
+			target = pcpu_id;
+			if (get_llc_id(pcpu_id) == llc_id) {
+				break;
+			}
+		}
+	}
+
+	if (target != INVALID_CPU_ID) {
+		bitmap_set_lock(NEED_BALANCE, &per_cpu(sched_ctl, target).flags);
+		if (get_pcpu_id() != target) {
+			kick_pcpu(target);
+		}
+	}
+}
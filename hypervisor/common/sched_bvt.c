@@ -9,7 +9,6 @@
 #include <schedule.h>
 #include <ticks.h>
 
-#define BVT_MCU_MS		1U
 /* context switch allowance */
 #define BVT_CSA_MCU		5U
 
@@ -159,6 +158,7 @@ static void sched_tick_handler(void *param)
 	uint64_t rflags;
 
 	obtain_schedule_lock(pcpu_id, &rflags);
+	bvt_ctl->nr_timer_fired++;
 	current = ctl->curr_obj;
 
 	if (current != NULL ) {
@@ -187,8 +187,11 @@ static int sched_bvt_init(struct sched_control *ctl)
 	ctl->priv = bvt_ctl;
 	INIT_LIST_HEAD(&bvt_ctl->runqueue);
 
-	/* The tick_timer is periodically */
+	/* The tick_timer is one-shot, armed by pick_next only when a preemption is due */
 	initialize_timer(&bvt_ctl->tick_timer, sched_tick_handler, ctl, 0, 0);
+	bvt_ctl->stats_start_tsc = cpu_ticks();
+	bvt_ctl->last_pick_tsc = bvt_ctl->stats_start_tsc;
+	bvt_ctl->preempt_armed = false;
 
 	return ret;
 }
@@ -254,6 +257,24 @@ static void update_vt(struct thread_object *obj)
 	}
 }
 
+/*
+ * @brief Get the number of cycles the first thread can run before its EVT passes
+ * the EVT of the second thread by the context switch allowance.
+ *
+ * The gap is converted back from virtual time at cycle granularity, taking the
+ * virtual time already accumulated in the residual into account, so the
+ * preemption lands on the exact TSC deadline instead of a whole number of MCUs.
+ */
+static uint64_t get_run_cycles(const struct sched_bvt_data *first_data,
+		const struct sched_bvt_data *second_data)
+{
+	uint64_t v_delta = (uint64_t)(second_data->evt - first_data->evt) * first_data->mcu;
+
+	v_delta = (v_delta > first_data->residual) ? (v_delta - first_data->residual) : 0UL;
+
+	return v2p(v_delta, first_data->vt_ratio) + (BVT_CSA_MCU * first_data->mcu);
+}
+
 static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 {
 	struct sched_bvt_control *bvt_ctl = (struct sched_bvt_control *)ctl->priv;
@@ -263,9 +284,7 @@ static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 	struct thread_object *next = NULL;
 	struct thread_object *current = ctl->curr_obj;
 	uint64_t now_tsc = cpu_ticks();
-	uint64_t delta_mcu = 0U;
-	uint64_t tick_period = BVT_MCU_MS * TICKS_PER_MS;
-	uint64_t run_countdown;
+	uint64_t deadline;
 
 	if (!is_idle_thread(current)) {
 		update_vt(current);
@@ -273,7 +292,12 @@ static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 	/* always align the svt with the avt of the first thread object in runqueue.*/
 	update_svt(bvt_ctl);
 
-	del_timer(&bvt_ctl->tick_timer);
+	/* account the time since the last pick as contended if a preemption was armed for it */
+	if (bvt_ctl->preempt_armed) {
+		bvt_ctl->contended_tsc += now_tsc - bvt_ctl->last_pick_tsc;
+	}
+	bvt_ctl->last_pick_tsc = now_tsc;
+	bvt_ctl->preempt_armed = false;
 
 	if (!list_empty(&bvt_ctl->runqueue)) {
 		first = bvt_ctl->runqueue.next;
@@ -282,27 +306,29 @@ static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 		first_obj = container_of(first, struct thread_object, data);
 		first_data = (struct sched_bvt_data *)first_obj->data;
 
-		/* The run_countdown is used to describe how may mcu the next thread
-		 * can run for. A one-shot timer is set to expire at
-		 * current time + run_countdown. The next thread can run until the
-		 * timer interrupts. But when there is only one object
-		 * in runqueue, it can run forever. so, no timer is set.
+		/* The next thread can run until its EVT catches up with the second
+		 * thread's. A one-shot timer is set to expire at that TSC deadline
+		 * and the next thread runs until the timer interrupts. But when
+		 * there is only one object in runqueue, it can run forever, so no
+		 * timer is set and the pCPU stays tickless.
 		 */
+		first_data->start_tsc = now_tsc;
+		next = first_obj;
 		if (sec != NULL) {
 			second_obj = container_of(sec, struct thread_object, data);
 			second_data = (struct sched_bvt_data *)second_obj->data;
-			delta_mcu = second_data->evt - first_data->evt;
-			run_countdown = v2p(delta_mcu, first_data->vt_ratio) + BVT_CSA_MCU;
-		} else {
-			run_countdown = UINT64_MAX;
-		}
-		first_data->start_tsc = now_tsc;
-		next = first_obj;
-		if (run_countdown != UINT64_MAX) {
-			update_timer(&bvt_ctl->tick_timer, cpu_ticks() + run_countdown * tick_period, 0);
+			deadline = now_tsc + get_run_cycles(first_data, second_data);
+
+			del_timer(&bvt_ctl->tick_timer);
+			update_timer(&bvt_ctl->tick_timer, deadline, 0UL);
 			(void)add_timer(&bvt_ctl->tick_timer);
+			bvt_ctl->preempt_armed = true;
+			bvt_ctl->nr_timer_armed++;
+		} else {
+			del_timer(&bvt_ctl->tick_timer);
 		}
 	} else {
+		del_timer(&bvt_ctl->tick_timer);
 		next = &get_cpu_var(idle);
 	}
 
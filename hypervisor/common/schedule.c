@@ -48,6 +48,27 @@ void release_schedule_lock(uint16_t pcpu_id, uint64_t rflag)
 	spinlock_irqrestore_release(&ctl->scheduler_lock, rflag);
 }
 
+/*
+ * @brief Obtain the schedule lock of the pCPU a thread belongs to
+ *
+ * The pCPU of a migratable thread may change until its current pCPU's lock is held.
+ *
+ * @return the pCPU ID whose schedule lock is held
+ */
+static uint16_t obtain_thread_lock(const struct thread_object *obj, uint64_t *rflag)
+{
+	uint16_t pcpu_id = obj->pcpu_id;
+
+	obtain_schedule_lock(pcpu_id, rflag);
+	while (pcpu_id != obj->pcpu_id) {
+		release_schedule_lock(pcpu_id, *rflag);
+		pcpu_id = obj->pcpu_id;
+		obtain_schedule_lock(pcpu_id, rflag);
+	}
+
+	return pcpu_id;
+}
+
 static struct acrn_scheduler *get_scheduler(uint16_t pcpu_id)
 {
 	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
@@ -73,6 +94,7 @@ void init_sched(uint16_t pcpu_id)
 	ctl->flags = 0UL;
 	ctl->curr_obj = NULL;
 	ctl->pcpu_id = pcpu_id;
+	ctl->migrate_obj = NULL;
 #ifdef CONFIG_SCHED_NOOP
 	ctl->scheduler = &sched_noop;
 #endif
@@ -166,6 +188,84 @@ bool need_reschedule(uint16_t pcpu_id)
 	return bitmap_test(NEED_RESCHEDULE, &ctl->flags);
 }
 
+/**
+ * @brief Ask the pCPU of a runnable, not running thread to hand it over to dest_pcpu_id
+ *
+ * The thread is moved by the next schedule() on its pCPU, which is the only place its
+ * per-pCPU state (such as a loaded VMCS or armed timers) can be released.
+ *
+ * @return true if the request is queued, false if the thread can't be migrated now
+ */
+bool request_thread_migration(struct thread_object *obj, uint16_t dest_pcpu_id)
+{
+	struct sched_control *ctl;
+	uint16_t pcpu_id;
+	uint64_t rflag;
+	bool ret = false;
+
+	pcpu_id = obtain_thread_lock(obj, &rflag);
+	ctl = &per_cpu(sched_ctl, pcpu_id);
+	if ((obj->migrate != NULL) && (pcpu_id != dest_pcpu_id) && (ctl->migrate_obj == NULL)
+			&& (obj->status == THREAD_STS_RUNNABLE) && (ctl->curr_obj != obj)) {
+		ctl->migrate_obj = obj;
+		ctl->migrate_dest = dest_pcpu_id;
+		make_reschedule_request(pcpu_id);
+		ret = true;
+	}
+	release_schedule_lock(pcpu_id, rflag);
+
+	return ret;
+}
+
+/*
+ * @brief Move the thread requested by request_thread_migration() to its destination pCPU
+ *
+ * Both schedule locks are taken in pCPU ID order. The request is dropped if the thread
+ * started running or blocked in the meantime, or if its migrate callback refuses.
+ *
+ * @pre pcpu_id == get_pcpu_id()
+ */
+static void do_thread_migration(uint16_t pcpu_id)
+{
+	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
+	struct sched_control *dest_ctl;
+	struct thread_object *obj;
+	uint16_t dest_pcpu_id = ctl->migrate_dest;
+	uint64_t rflag, dest_rflag;
+
+	if (pcpu_id < dest_pcpu_id) {
+		obtain_schedule_lock(pcpu_id, &rflag);
+		obtain_schedule_lock(dest_pcpu_id, &dest_rflag);
+	} else {
+		obtain_schedule_lock(dest_pcpu_id, &dest_rflag);
+		obtain_schedule_lock(pcpu_id, &rflag);
+	}
+
+	obj = ctl->migrate_obj;
+	ctl->migrate_obj = NULL;
+	if ((obj != NULL) && (obj->pcpu_id == pcpu_id) && (obj->status == THREAD_STS_RUNNABLE)
+			&& (ctl->curr_obj != obj) && obj->migrate(obj, dest_pcpu_id)) {
+		dest_ctl = &per_cpu(sched_ctl, dest_pcpu_id);
+		if (ctl->scheduler->sleep != NULL) {
+			ctl->scheduler->sleep(obj);
+		}
+		obj->pcpu_id = dest_pcpu_id;
+		obj->sched_ctl = dest_ctl;
+		if (dest_ctl->scheduler->wake != NULL) {
+			dest_ctl->scheduler->wake(obj);
+		}
+		make_reschedule_request(dest_pcpu_id);
+	}
+
+	if (pcpu_id < dest_pcpu_id) {
+		release_schedule_lock(dest_pcpu_id, dest_rflag);
+		release_schedule_lock(pcpu_id, rflag);
+	} else {
+		release_schedule_lock(pcpu_id, rflag);
+		release_schedule_lock(dest_pcpu_id, dest_rflag);
+	}
+}
+
 void schedule(void)
 {
 	uint16_t pcpu_id = get_pcpu_id();
@@ -175,6 +275,10 @@ void schedule(void)
 	uint64_t rflag;
 	char name[16];
 
+	if (ctl->migrate_obj != NULL) {
+		do_thread_migration(pcpu_id);
+	}
+
 	obtain_schedule_lock(pcpu_id, &rflag);
 	if (ctl->scheduler->pick_next != NULL) {
 		next = ctl->scheduler->pick_next(ctl);
@@ -210,11 +314,12 @@ void schedule(void)
 
 void sleep_thread(struct thread_object *obj)
 {
-	uint16_t pcpu_id = obj->pcpu_id;
-	struct acrn_scheduler *scheduler = get_scheduler(pcpu_id);
+	struct acrn_scheduler *scheduler;
+	uint16_t pcpu_id;
 	uint64_t rflag;
 
-	obtain_schedule_lock(pcpu_id, &rflag);
+	pcpu_id = obtain_thread_lock(obj, &rflag);
+	scheduler = get_scheduler(pcpu_id);
 	if (scheduler->sleep != NULL) {
 		scheduler->sleep(obj);
 	}
@@ -237,11 +342,12 @@ void sleep_thread_sync(struct thread_object *obj)
 
 void wake_thread(struct thread_object *obj)
 {
-	uint16_t pcpu_id = obj->pcpu_id;
 	struct acrn_scheduler *scheduler;
+	uint16_t pcpu_id;
 	uint64_t rflag;
+	bool busy = false;
 
-	obtain_schedule_lock(pcpu_id, &rflag);
+	pcpu_id = obtain_thread_lock(obj, &rflag);
 	if (is_blocked(obj) || obj->be_blocking) {
 		scheduler = get_scheduler(pcpu_id);
 		if (scheduler->wake != NULL) {
@@ -250,10 +356,17 @@ void wake_thread(struct thread_object *obj)
 		if (is_blocked(obj)) {
 			set_thread_status(obj, THREAD_STS_RUNNABLE);
 			make_reschedule_request(pcpu_id);
+			busy = (per_cpu(sched_ctl, pcpu_id).curr_obj != NULL)
+				&& !is_idle_thread(per_cpu(sched_ctl, pcpu_id).curr_obj);
 		}
 		obj->be_blocking = false;
 	}
 	release_schedule_lock(pcpu_id, rflag);
+
+	/* let an idle pCPU pull it rather than wait behind the running thread */
+	if (busy && (obj->migrate != NULL)) {
+		sched_balance_kick(obj);
+	}
 }
 
 void yield_current(void)
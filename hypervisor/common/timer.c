@@ -12,6 +12,7 @@
 #include <asm/cpuid.h>
 #include <asm/cpu_caps.h>
 #include <softirq.h>
+#include <asm/lib/bits.h>
 #include <trace.h>
 #include <asm/irq.h>
 #include <ticks.h>
@@ -52,43 +53,162 @@ static void run_timer(const struct hv_timer *timer)
 	TRACE_2L(TRACE_TIMER_ACTION_PCKUP, timer->timeout, 0UL);
 }
 
-static inline void update_physical_timer(struct per_cpu_timers *cpu_timer)
+/*
+ * Return the slot of a timer expiring at the given wheel clock: the lowest level on which the expiry shares
+ * the slots above with the wheel clock, so the timers of a level all expire before those of the levels above.
+ */
+static struct list_head *timer_wheel_slot(struct per_cpu_timers *cpu_timer, uint64_t expires)
 {
-	struct hv_timer *timer = NULL;
+	struct list_head *head = &cpu_timer->overflow;
+	uint32_t level, shift;
+	uint64_t slot;
+
+	for (level = 0U; level < TIMER_WHEEL_LEVELS; level++) {
+		shift = level * TIMER_WHEEL_SLOT_SHIFT;
+		if ((expires >> (shift + TIMER_WHEEL_SLOT_SHIFT)) == (cpu_timer->clk >> (shift + TIMER_WHEEL_SLOT_SHIFT))) {
+			slot = (expires >> shift) & (TIMER_WHEEL_SLOTS - 1U);
+			cpu_timer->pending[level] |= (1UL << slot);
+			head = &cpu_timer->wheel[level][slot];
+			break;
+		}
+	}
 
-	/* find the next event timer */
-	if (!list_empty(&cpu_timer->timer_list)) {
-		timer = container_of((&cpu_timer->timer_list)->next,
-			struct hv_timer, node);
+	return head;
+}
 
-		/* it is okay to program a expired time */
-		msr_write(MSR_IA32_TSC_DEADLINE, timer->timeout);
+static void local_add_timer(struct per_cpu_timers *cpu_timer, struct hv_timer *timer)
+{
+	uint64_t expires = timer->timeout >> TIMER_WHEEL_TICK_SHIFT;
+
+	/* a passed timer goes to the current slot */
+	if (expires < cpu_timer->clk) {
+		expires = cpu_timer->clk;
+	}
+
+	list_add_tail(&timer->node, timer_wheel_slot(cpu_timer, expires));
+}
+
+/*
+ * Find the slot of the nearest timers, which is the first non-empty slot of the lowest level in use, and
+ * the wheel clock it starts at. Return NULL if the wheel is empty, the overflow list aside.
+ */
+static struct list_head *timer_wheel_first(struct per_cpu_timers *cpu_timer, uint32_t *level_ret,
+		uint64_t *start)
+{
+	struct list_head *head = NULL;
+	uint32_t level, shift;
+	uint16_t slot;
+
+	for (level = 0U; (level < TIMER_WHEEL_LEVELS) && (head == NULL); level++) {
+		while (cpu_timer->pending[level] != 0UL) {
+			slot = ffs64(cpu_timer->pending[level]);
+			if (!list_empty(&cpu_timer->wheel[level][slot])) {
+				shift = level * TIMER_WHEEL_SLOT_SHIFT;
+				head = &cpu_timer->wheel[level][slot];
+				*level_ret = level;
+				*start = ((cpu_timer->clk >> (shift + TIMER_WHEEL_SLOT_SHIFT)) <<
+						(shift + TIMER_WHEEL_SLOT_SHIFT)) | ((uint64_t)slot << shift);
+				break;
+			}
+			/* del_timer leaves the bit of the slot it empties */
+			cpu_timer->pending[level] &= ~(1UL << slot);
+		}
+	}
+
+	return head;
+}
+
+/* the slots of the nearest timers are small and not sorted, so look for the nearest deadline */
+static uint64_t local_next_deadline(struct per_cpu_timers *cpu_timer)
+{
+	const struct list_head *head, *pos;
+	const struct hv_timer *timer;
+	uint64_t start, deadline = 0UL;
+	uint32_t level;
+
+	head = timer_wheel_first(cpu_timer, &level, &start);
+	if (head == NULL) {
+		head = &cpu_timer->overflow;
+	}
+
+	list_for_each(pos, head) {
+		timer = container_of(pos, struct hv_timer, node);
+		if ((deadline == 0UL) || (timer->timeout < deadline)) {
+			deadline = timer->timeout;
+		}
+	}
+
+	return deadline;
+}
+
+static void timer_wheel_cascade(struct per_cpu_timers *cpu_timer, struct list_head *head)
+{
+	struct list_head cascade, *pos, *n;
+
+	INIT_LIST_HEAD(&cascade);
+	list_splice_init(head, &cascade);
+	list_for_each_safe(pos, n, &cascade) {
+		local_add_timer(cpu_timer, container_of(pos, struct hv_timer, node));
 	}
 }
 
 /*
- * return true if we add the timer on the timer_list head
+ * Move the wheel clock to now, cascading the slots it reaches to the lower levels, and move the timers
+ * which expire by now to the expired list.
  */
-static bool local_add_timer(struct per_cpu_timers *cpu_timer,
-			struct hv_timer *timer)
-{
-	struct list_head *pos, *prev;
-	struct hv_timer *tmp;
-	uint64_t tsc = timer->timeout;
-
-	prev = &cpu_timer->timer_list;
-	list_for_each(pos, &cpu_timer->timer_list) {
-		tmp = container_of(pos, struct hv_timer, node);
-		if (tmp->timeout < tsc) {
-			prev = &tmp->node;
+static void timer_wheel_advance(struct per_cpu_timers *cpu_timer, uint64_t now, struct list_head *expired)
+{
+	const uint32_t top_shift = TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_SHIFT;
+	uint64_t now_clk = now >> TIMER_WHEEL_TICK_SHIFT;
+	uint64_t start, old_clk;
+	struct list_head *head, *pos, *n;
+	struct hv_timer *timer;
+	uint32_t level;
+
+	while (true) {
+		head = timer_wheel_first(cpu_timer, &level, &start);
+		if ((head == NULL) || (start > now_clk)) {
+			if (cpu_timer->clk >= now_clk) {
+				break;
+			}
+
+			/* nothing is due before now, the overflow timers may come in range of the wheel */
+			old_clk = cpu_timer->clk;
+			cpu_timer->clk = now_clk;
+			if ((old_clk >> top_shift) != (now_clk >> top_shift)) {
+				timer_wheel_cascade(cpu_timer, &cpu_timer->overflow);
+			}
 		} else {
-			break;
+			cpu_timer->clk = start;
+			if (level == 0U) {
+				list_for_each_safe(pos, n, head) {
+					timer = container_of(pos, struct hv_timer, node);
+					if (timer->timeout <= now) {
+						list_del(pos);
+						list_add_tail(pos, expired);
+					}
+				}
+
+				/* the timers left expire later in the current slot */
+				if (!list_empty(head)) {
+					break;
+				}
+			} else {
+				timer_wheel_cascade(cpu_timer, head);
+			}
 		}
 	}
+}
 
-	list_add(&timer->node, prev);
+static void update_physical_timer(struct per_cpu_timers *cpu_timer)
+{
+	uint64_t deadline = local_next_deadline(cpu_timer);
 
-	return (prev == &cpu_timer->timer_list);
+	if (deadline != 0UL) {
+		/* it is okay to program a expired time */
+		msr_write(MSR_IA32_TSC_DEADLINE, deadline);
+	}
+	cpu_timer->deadline = deadline;
 }
 
 int32_t add_timer(struct hv_timer *timer)
@@ -112,9 +232,11 @@ int32_t add_timer(struct hv_timer *timer)
 		cpu_timer = &per_cpu(cpu_timers, pcpu_id);
 
 		CPU_INT_ALL_DISABLE(&rflags);
-		/* update the physical timer if we're on the timer_list head */
-		if (local_add_timer(cpu_timer, timer)) {
-			update_physical_timer(cpu_timer);
+		local_add_timer(cpu_timer, timer);
+		/* update the physical timer if the timer is the nearest one */
+		if ((cpu_timer->deadline == 0UL) || (timer->timeout < cpu_timer->deadline)) {
+			msr_write(MSR_IA32_TSC_DEADLINE, timer->timeout);
+			cpu_timer->deadline = timer->timeout;
 		}
 		CPU_INT_ALL_RESTORE(rflags);
 
@@ -169,24 +291,49 @@ void del_timer(struct hv_timer *timer)
 	CPU_INT_ALL_RESTORE(rflags);
 }
 
+uint64_t next_timer_deadline(void)
+{
+	uint64_t rflags, deadline;
+
+	CPU_INT_ALL_DISABLE(&rflags);
+	deadline = local_next_deadline(&per_cpu(cpu_timers, get_pcpu_id()));
+	CPU_INT_ALL_RESTORE(rflags);
+
+	return deadline;
+}
+
 static void init_percpu_timer(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
+	uint32_t level, slot;
 
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
-	INIT_LIST_HEAD(&cpu_timer->timer_list);
+	for (level = 0U; level < TIMER_WHEEL_LEVELS; level++) {
+		for (slot = 0U; slot < TIMER_WHEEL_SLOTS; slot++) {
+			INIT_LIST_HEAD(&cpu_timer->wheel[level][slot]);
+		}
+		cpu_timer->pending[level] = 0UL;
+	}
+	INIT_LIST_HEAD(&cpu_timer->overflow);
+	cpu_timer->clk = cpu_ticks() >> TIMER_WHEEL_TICK_SHIFT;
+	cpu_timer->deadline = 0UL;
 }
 
 static void timer_softirq(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 	struct hv_timer *timer;
-	const struct list_head *pos, *n;
+	struct list_head expired;
 	uint32_t tries = MAX_TIMER_ACTIONS;
-	uint64_t current_tsc = cpu_ticks();
+	uint64_t rflags;
 
 	/* handle passed timer */
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
+	INIT_LIST_HEAD(&expired);
+
+	CPU_INT_ALL_DISABLE(&rflags);
+	timer_wheel_advance(cpu_timer, cpu_ticks(), &expired);
+	CPU_INT_ALL_RESTORE(rflags);
 
 	/* This is to make sure we are not blocked due to delay inside func()
 	 * force to exit irq handler after we serviced >31 timers
@@ -194,29 +341,39 @@ static void timer_softirq(uint16_t pcpu_id)
 	 * inside func(), it will infinitely loop here, because new added timer
 	 * already passed due to previously func()'s delay.
 	 */
-	list_for_each_safe(pos, n, &cpu_timer->timer_list) {
-		timer = container_of(pos, struct hv_timer, node);
-		/* timer expried */
+	while (!list_empty(&expired)) {
 		tries--;
-		if ((timer->timeout <= current_tsc) && (tries != 0U)) {
-			del_timer(timer);
+		if (tries == 0U) {
+			break;
+		}
 
-			run_timer(timer);
+		timer = container_of(expired.next, struct hv_timer, node);
+		del_timer(timer);
 
-			if (timer->mode == TICK_MODE_PERIODIC) {
-				/* update periodic timer fire tsc */
-				timer->timeout += timer->period_in_cycle;
-				(void)local_add_timer(cpu_timer, timer);
-			} else {
-				timer->timeout = 0UL;
-			}
+		run_timer(timer);
+
+		if (timer->mode == TICK_MODE_PERIODIC) {
+			/* update periodic timer fire tsc */
+			timer->timeout += timer->period_in_cycle;
+			CPU_INT_ALL_DISABLE(&rflags);
+			local_add_timer(cpu_timer, timer);
+			CPU_INT_ALL_RESTORE(rflags);
 		} else {
-			break;
+			timer->timeout = 0UL;
 		}
 	}
 
+	CPU_INT_ALL_DISABLE(&rflags);
+	/* the timers left are due, they are run on the next timer interrupt */
+	while (!list_empty(&expired)) {
+		timer = container_of(expired.next, struct hv_timer, node);
+		list_del_init(&timer->node);
+		local_add_timer(cpu_timer, timer);
+	}
+
 	/* update nearest timer */
 	update_physical_timer(cpu_timer);
+	CPU_INT_ALL_RESTORE(rflags);
 }
 
 void timer_init(void)
@@ -5,17 +5,151 @@
  */
 
 #include <asm/guest/vm.h>
+#include <asm/mmu.h>
+#include <asm/cpu.h>
+#include <asm/lib/atomic.h>
+#include <ticks.h>
 #include <vboot.h>
 #include <errno.h>
 #include <logmsg.h>
 
+#define LOAD_CHUNK_SIZE		MEM_2M
+
+/*
+ * The images of a Service VM or pre-launched VM are copied by the configured BSP pCPU of the VM,
+ * which splits each copy in LOAD_CHUNK_SIZE chunks. The other pCPUs of its cpu_affinity have
+ * nothing else to run at boot, so they claim chunks as well until the VM is launched.
+ */
+struct vm_load_ctx {
+	spinlock_t lock;
+	/* the copy in progress */
+	void *src;
+	uint64_t gpa;
+	uint64_t size;
+	uint64_t next;			/* offset of the next chunk to claim */
+	volatile uint32_t nr_inflight;	/* chunks claimed but not copied yet */
+	volatile bool finished;		/* the helpers can leave */
+};
+
+static struct vm_load_ctx load_ctx[CONFIG_MAX_VM_NUM];
+static struct vm_boot_timeline boot_timeline[CONFIG_MAX_VM_NUM];
+
+static bool claim_chunk(struct vm_load_ctx *ctx, void **src, uint64_t *gpa, uint32_t *size)
+{
+	bool claimed = false;
+
+	spinlock_obtain(&ctx->lock);
+	if (ctx->next < ctx->size) {
+		*src = (void *)((uint8_t *)ctx->src + ctx->next);
+		*gpa = ctx->gpa + ctx->next;
+		*size = (uint32_t)min(LOAD_CHUNK_SIZE, ctx->size - ctx->next);
+		ctx->next += *size;
+		ctx->nr_inflight++;
+		claimed = true;
+	}
+	spinlock_release(&ctx->lock);
+
+	return claimed;
+}
+
+/**
+ * @pre vm != NULL
+ */
+static void copy_chunks(struct acrn_vm *vm, struct vm_load_ctx *ctx)
+{
+	void *src;
+	uint64_t gpa;
+	uint32_t size;
+
+	while (claim_chunk(ctx, &src, &gpa, &size)) {
+		(void)copy_to_gpa(vm, src, gpa, size);
+
+		spinlock_obtain(&ctx->lock);
+		ctx->nr_inflight--;
+		spinlock_release(&ctx->lock);
+	}
+}
+
+/**
+ * @brief Copy an image to the guest memory, with the help of the pCPUs in help_load_vm_images()
+ *
+ * Returns when the whole image is copied, so it can replace copy_to_gpa() anywhere in the image
+ * loading. Without helpers, e.g. when the VM is reset, the caller copies all the chunks itself.
+ *
+ * @pre vm != NULL
+ */
+void copy_image_to_gpa(struct acrn_vm *vm, void *src, uint64_t gpa, uint64_t size)
+{
+	struct vm_load_ctx *ctx = &load_ctx[vm->vm_id];
+
+	spinlock_obtain(&ctx->lock);
+	ctx->src = src;
+	ctx->gpa = gpa;
+	ctx->size = size;
+	ctx->next = 0UL;
+	spinlock_release(&ctx->lock);
+
+	copy_chunks(vm, ctx);
+
+	/* wait for the chunks still copied by the helpers */
+	while (ctx->nr_inflight != 0U) {
+		asm_pause();
+	}
+
+	/* a reload after a VM reset is not part of the boot timeline */
+	if (!ctx->finished) {
+		boot_timeline[vm->vm_id].load_bytes += size;
+	}
+}
+
+/**
+ * @brief Copy chunks of the images of a VM until its BSP pCPU calls finish_load_vm_images()
+ *
+ * @pre vm_id < CONFIG_MAX_VM_NUM
+ */
+void help_load_vm_images(uint16_t vm_id)
+{
+	struct vm_load_ctx *ctx = &load_ctx[vm_id];
+	struct acrn_vm *vm = get_vm_from_vmid(vm_id);
+
+	atomic_inc16(&boot_timeline[vm_id].nr_helpers);
+	while (!ctx->finished) {
+		copy_chunks(vm, ctx);
+		asm_pause();
+	}
+}
+
+/**
+ * @pre vm_id < CONFIG_MAX_VM_NUM
+ */
+void finish_load_vm_images(uint16_t vm_id)
+{
+	load_ctx[vm_id].finished = true;
+}
+
+/**
+ * @pre vm_id < CONFIG_MAX_VM_NUM
+ */
+void record_vm_boot_phase(uint16_t vm_id, enum vm_boot_phase phase)
+{
+	boot_timeline[vm_id].tsc[phase] = cpu_ticks();
+}
+
+/**
+ * @pre vm_id < CONFIG_MAX_VM_NUM
+ */
+const struct vm_boot_timeline *get_vm_boot_timeline(uint16_t vm_id)
+{
+	return &boot_timeline[vm_id];
+}
+
 /**
  * @pre sw_module != NULL
  */
 void load_sw_module(struct acrn_vm *vm, struct sw_module_info *sw_module)
 {
 	if ((sw_module->size != 0) && (sw_module->load_addr != NULL)) {
-		(void)copy_to_gpa(vm, sw_module->src_addr, (uint64_t)sw_module->load_addr, sw_module->size);
+		copy_image_to_gpa(vm, sw_module->src_addr, (uint64_t)sw_module->load_addr, sw_module->size);
 	}
 }
 
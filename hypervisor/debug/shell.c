@@ -22,6 +22,7 @@
 #include <shell.h>
 #include <asm/guest/vmcs.h>
 #include <asm/host_pm.h>
+#include <vboot.h>
 
 #define TEMP_STR_SIZE		60U
 #define MAX_STR_SIZE		256U
@@ -51,6 +52,15 @@ static int32_t shell_cpuid(int32_t argc, char **argv);
 static int32_t shell_reboot(int32_t argc, char **argv);
 static int32_t shell_rdmsr(int32_t argc, char **argv);
 static int32_t shell_wrmsr(int32_t argc, char **argv);
+static int32_t shell_show_vm_mmio(int32_t argc, char **argv);
+static int32_t shell_show_page_pool(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_ept_stats(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_vmexit_lat(int32_t argc, char **argv);
+static int32_t shell_timer_stress(int32_t argc, char **argv);
+static int32_t shell_show_bvt_stats(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_ctx_switch(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_boot_timeline(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_asyncio(__unused int32_t argc, __unused char **argv);
 
 static struct shell_cmd shell_cmds[] = {
 	{
@@ -155,6 +165,60 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_WRMSR_HELP,
 		.fcn		= shell_wrmsr,
 	},
+	{
+		.str		= SHELL_CMD_VM_MMIO,
+		.cmd_param	= SHELL_CMD_VM_MMIO_PARAM,
+		.help_str	= SHELL_CMD_VM_MMIO_HELP,
+		.fcn		= shell_show_vm_mmio,
+	},
+	{
+		.str		= SHELL_CMD_PAGE_POOL,
+		.cmd_param	= SHELL_CMD_PAGE_POOL_PARAM,
+		.help_str	= SHELL_CMD_PAGE_POOL_HELP,
+		.fcn		= shell_show_page_pool,
+	},
+	{
+		.str		= SHELL_CMD_EPT_STATS,
+		.cmd_param	= SHELL_CMD_EPT_STATS_PARAM,
+		.help_str	= SHELL_CMD_EPT_STATS_HELP,
+		.fcn		= shell_show_ept_stats,
+	},
+	{
+		.str		= SHELL_CMD_VMEXIT_LAT,
+		.cmd_param	= SHELL_CMD_VMEXIT_LAT_PARAM,
+		.help_str	= SHELL_CMD_VMEXIT_LAT_HELP,
+		.fcn		= shell_show_vmexit_lat,
+	},
+	{
+		.str		= SHELL_CMD_TIMER_STRESS,
+		.cmd_param	= SHELL_CMD_TIMER_STRESS_PARAM,
+		.help_str	= SHELL_CMD_TIMER_STRESS_HELP,
+		.fcn		= shell_timer_stress,
+	},
+	{
+		.str		= SHELL_CMD_BVT_STATS,
+		.cmd_param	= SHELL_CMD_BVT_STATS_PARAM,
+		.help_str	= SHELL_CMD_BVT_STATS_HELP,
+		.fcn		= shell_show_bvt_stats,
+	},
+	{
+		.str		= SHELL_CMD_CTX_SWITCH,
+		.cmd_param	= SHELL_CMD_CTX_SWITCH_PARAM,
+		.help_str	= SHELL_CMD_CTX_SWITCH_HELP,
+		.fcn		= shell_show_ctx_switch,
+	},
+	{
+		.str		= SHELL_CMD_BOOT_TIMELINE,
+		.cmd_param	= SHELL_CMD_BOOT_TIMELINE_PARAM,
+		.help_str	= SHELL_CMD_BOOT_TIMELINE_HELP,
+		.fcn		= shell_show_boot_timeline,
+	},
+	{
+		.str		= SHELL_CMD_ASYNCIO,
+		.cmd_param	= SHELL_CMD_ASYNCIO_PARAM,
+		.help_str	= SHELL_CMD_ASYNCIO_HELP,
+		.fcn		= shell_show_asyncio,
+	},
 };
 
 /* for function key: up/down/right/left/home/end and delete key */
@@ -1615,3 +1679,577 @@ static int32_t shell_wrmsr(int32_t argc, char **argv)
 
 	return ret;
 }
+
+static void get_vm_mmio_info(char *str_arg, size_t str_max, uint16_t vmid)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vm *vm = get_vm_from_vmid(vmid);
+	struct mem_io_index *index;
+	struct mem_io_node *node;
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
+
+	if (is_poweroff_vm(vm)) {
+		len = snprintf(str, size, "\r\nvm is not exist for vmid %hu", vmid);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+		goto END;
+	}
+
+	len = snprintf(str, size, "\r\nSLOT\tSTART\t\t\tEND\t\t\tHOLD_LOCK");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	spinlock_obtain(&vm->emul_mmio_lock);
+	index = &vm->emul_mmio_index;
+	for (i = 0U; i < index->nr; i++) {
+		node = &vm->emul_mmio[index->slot[i]];
+		len = snprintf(str, size, "\r\n%hu\t0x%016lx\t0x%016lx\t%d",
+				index->slot[i], node->range_start, node->range_end, node->hold_lock);
+		if (len >= size) {
+			spinlock_release(&vm->emul_mmio_lock);
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+	len = snprintf(str, size, "\r\n%hu region(s)%s\r\n\r\nVCPU\tLOOKUPS\t\tCACHE HITS\tPROBES",
+			index->nr, index->overlap ? ", overlapping" : "");
+	spinlock_release(&vm->emul_mmio_lock);
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	foreach_vcpu(i, vm, vcpu) {
+		len = snprintf(str, size, "\r\n%hu\t%-16lu%-16lu%lu", vcpu->vcpu_id,
+				vcpu->mmio_cache.nr_lookup, vcpu->mmio_cache.nr_hit, vcpu->mmio_cache.nr_probe);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+END:
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_vm_mmio(int32_t argc, char **argv)
+{
+	uint16_t vmid;
+	int32_t ret;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+	ret = strtol_deci(argv[1]);
+	if (ret >= 0) {
+		vmid = sanitize_vmid((uint16_t) ret);
+		get_vm_mmio_info(shell_log_buf, SHELL_LOG_BUF_SIZE, vmid);
+		shell_puts(shell_log_buf);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static void get_page_pool_info(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct page_pool *pool;
+	struct page_pool_stats stats;
+	uint16_t i;
+
+	len = snprintf(str, size, "\r\nPOOL\tTOTAL\t\tUSED\t\tCACHED\t\tFREE\t\tHIGH_WATER");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < MAX_PAGE_POOL_NUM; i++) {
+		pool = get_page_pool(i);
+		if (pool == NULL) {
+			break;
+		}
+		get_page_pool_stats(pool, &stats);
+		len = snprintf(str, size, "\r\n%s\t%-16lu%-16lu%-16lu%-16lu%lu", pool->name,
+				stats.total, stats.used, stats.cached, stats.free, stats.high_water);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_page_pool(__unused int32_t argc, __unused char **argv)
+{
+	get_page_pool_info(shell_log_buf, SHELL_LOG_BUF_SIZE);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+/*
+ * Return the upper bound, in us, of the latency bucket holding the given fraction (in per mille) of the exits.
+ */
+static uint64_t vmexit_lat_percentile(const uint64_t *count, uint64_t total, uint64_t permille)
+{
+	uint64_t sum = 0UL;
+	uint16_t i;
+
+	for (i = 0U; i < (ACRN_VMEXIT_LAT_BUCKETS - 1U); i++) {
+		sum += count[i];
+		if ((sum * 1000UL) >= (total * permille)) {
+			break;
+		}
+	}
+
+	return ticks_to_us(1UL << (i + ACRN_VMEXIT_LAT_MIN_SHIFT));
+}
+
+static void get_vmexit_lat_info(char *str_arg, size_t str_max, uint16_t vmid)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vm *vm = get_vm_from_vmid(vmid);
+	struct acrn_vcpu *vcpu;
+	const uint64_t *count;
+	uint64_t total;
+	uint16_t i, reason, bucket;
+
+	if (is_poweroff_vm(vm)) {
+		len = snprintf(str, size, "\r\nvm is not exist for vmid %hu", vmid);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+		goto END;
+	}
+
+	len = snprintf(str, size, "\r\nVCPU\tREASON\tEXITS\t\tP50(us)\tP99(us)\tMAX(us)");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	foreach_vcpu(i, vm, vcpu) {
+		for (reason = 0U; reason < NR_VMX_EXIT_REASONS; reason++) {
+			count = vcpu->exit_lat.count[reason];
+			total = 0UL;
+			for (bucket = 0U; bucket < ACRN_VMEXIT_LAT_BUCKETS; bucket++) {
+				total += count[bucket];
+			}
+			if (total == 0UL) {
+				continue;
+			}
+
+			len = snprintf(str, size, "\r\n%hu\t0x%02hx\t%-16lu%lu\t%lu\t%lu", vcpu->vcpu_id, reason, total,
+					vmexit_lat_percentile(count, total, 500UL),
+					vmexit_lat_percentile(count, total, 990UL),
+					vmexit_lat_percentile(count, total, 1000UL));
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+END:
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_vmexit_lat(int32_t argc, char **argv)
+{
+	uint16_t vmid;
+	int32_t ret;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+	ret = strtol_deci(argv[1]);
+	if (ret >= 0) {
+		vmid = sanitize_vmid((uint16_t) ret);
+		get_vmexit_lat_info(shell_log_buf, SHELL_LOG_BUF_SIZE, vmid);
+		shell_puts(shell_log_buf);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+#define TIMER_STRESS_MAX	256U
+#define TIMER_STRESS_ROUNDS	64U
+/* the expiring timers are due within 2^32 cycles, which spans all the levels of the timer wheel */
+#define TIMER_STRESS_EXPIRE_SHIFT	32U
+
+struct stress_timer {
+	struct hv_timer timer;
+	uint64_t deadline;
+	uint64_t fired_tsc;
+	uint32_t nr_fired;
+};
+
+static struct stress_timer stress_timers[TIMER_STRESS_MAX];
+static uint32_t stress_timers_count;
+static struct hv_timer stress_check_timer;
+static bool stress_expiring;
+
+static void stress_timer_fn(void *data)
+{
+	struct stress_timer *st = (struct stress_timer *)data;
+
+	st->fired_tsc = cpu_ticks();
+	st->nr_fired++;
+}
+
+/* Runs once all the expiring timers are due: each of them must have fired once, on or after its deadline */
+static void stress_check_fn(__unused void *data)
+{
+	char temp_str[MAX_STR_SIZE];
+	uint32_t i, missed = 0U, repeated = 0U, early = 0U;
+	uint64_t late, max_late = 0UL;
+	struct stress_timer *st;
+
+	for (i = 0U; i < stress_timers_count; i++) {
+		st = &stress_timers[i];
+		if (st->nr_fired == 0U) {
+			missed++;
+			del_timer(&st->timer);
+		} else {
+			if (st->nr_fired > 1U) {
+				repeated++;
+			}
+			if (st->fired_tsc < st->deadline) {
+				early++;
+			} else {
+				late = st->fired_tsc - st->deadline;
+				max_late = max(max_late, late);
+			}
+		}
+	}
+
+	snprintf(temp_str, MAX_STR_SIZE, "\r\ntimer_stress %s: %u timers expired, %u missed, %u fired more than once, "
+		"%u fired early, %lu us max lateness\r\n", ((missed == 0U) && (repeated == 0U) && (early == 0U)) ?
+		"PASS" : "FAIL", stress_timers_count - missed, missed, repeated, early, ticks_to_us(max_late));
+	shell_puts(temp_str);
+	stress_expiring = false;
+}
+
+/*
+ * Arm the timers with random deadlines, nearer ones being more likely, and let them expire. The timer
+ * interrupts run once the shell returns, so the result is shown by a check timer due after the last one.
+ */
+static void timer_stress_expire(uint32_t count)
+{
+	char temp_str[MAX_STR_SIZE];
+	uint64_t now = cpu_ticks(), last = now;
+	struct stress_timer *st;
+	uint32_t i;
+
+	stress_expiring = true;
+	stress_timers_count = count;
+	for (i = 0U; i < count; i++) {
+		st = &stress_timers[i];
+		st->deadline = now + ((get_random_value() & ((1UL << TIMER_STRESS_EXPIRE_SHIFT) - 1UL)) >>
+				(get_random_value() % TIMER_STRESS_EXPIRE_SHIFT)) + 1UL;
+		st->fired_tsc = 0UL;
+		st->nr_fired = 0U;
+		last = max(last, st->deadline);
+		initialize_timer(&st->timer, stress_timer_fn, st, st->deadline, 0UL);
+		(void)add_timer(&st->timer);
+	}
+
+	initialize_timer(&stress_check_timer, stress_check_fn, NULL, last + us_to_ticks(10000U), 0UL);
+	(void)add_timer(&stress_check_timer);
+
+	snprintf(temp_str, MAX_STR_SIZE, "\r\n%u timers armed, the last one is due in %lu us\r\n", count,
+		ticks_to_us(last - now));
+	shell_puts(temp_str);
+}
+
+/*
+ * Re-arm the timers in a random order with deadlines 1s to 1s + 2^40 cycles ahead, spread over all the
+ * levels of the timer wheel, so none of them fires during the test.
+ */
+static int32_t shell_timer_stress(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	uint64_t now, begin, min_deadline, deadline;
+	uint64_t add_cycles = 0UL, del_cycles = 0UL, nr_del = 0UL;
+	uint32_t count = TIMER_STRESS_MAX, round, i, errors = 0U, fired = 0U;
+	bool expire = false;
+	struct hv_timer *timer;
+	int32_t ret;
+
+	if ((argc == 2) || (argc == 3)) {
+		ret = strtol_deci(argv[1]);
+		if ((ret <= 0) || (ret > (int32_t)TIMER_STRESS_MAX)) {
+			return -EINVAL;
+		}
+		count = (uint32_t)ret;
+		if (argc == 3) {
+			if (strcmp(argv[2], "expire") != 0) {
+				return -EINVAL;
+			}
+			expire = true;
+		}
+	} else if (argc != 1) {
+		return -EINVAL;
+	}
+
+	/* the timers of an expiry test still belong to it */
+	if (stress_expiring) {
+		shell_puts("\r\nAn expiry test is still running\r\n");
+		return -EBUSY;
+	}
+
+	if (expire) {
+		timer_stress_expire(count);
+		return 0;
+	}
+
+	for (i = 0U; i < count; i++) {
+		stress_timers[i].nr_fired = 0U;
+		initialize_timer(&stress_timers[i].timer, stress_timer_fn, &stress_timers[i], 0UL, 0UL);
+	}
+
+	for (round = 0U; round < TIMER_STRESS_ROUNDS; round++) {
+		now = cpu_ticks();
+		min_deadline = ~0UL;
+		for (i = 0U; i < count; i++) {
+			timer = &stress_timers[(get_random_value() % count)].timer;
+			if (timer_is_started(timer)) {
+				begin = cpu_ticks();
+				del_timer(timer);
+				del_cycles += cpu_ticks() - begin;
+				nr_del++;
+			}
+
+			deadline = now + us_to_ticks(1000000U) +
+				((get_random_value() & ((1UL << 40U) - 1UL)) >> (get_random_value() % 40UL));
+			update_timer(timer, deadline, 0UL);
+			begin = cpu_ticks();
+			(void)add_timer(timer);
+			add_cycles += cpu_ticks() - begin;
+		}
+
+		for (i = 0U; i < count; i++) {
+			if (timer_is_started(&stress_timers[i].timer)) {
+				min_deadline = min(min_deadline, stress_timers[i].timer.timeout);
+			}
+		}
+		/* the other timers of this pCPU may only be nearer */
+		deadline = next_timer_deadline();
+		if ((deadline == 0UL) || (deadline > min_deadline)) {
+			errors++;
+		}
+	}
+
+	for (i = 0U; i < count; i++) {
+		del_timer(&stress_timers[i].timer);
+		fired += stress_timers[i].nr_fired;
+	}
+
+	snprintf(temp_str, MAX_STR_SIZE, "\r\n%u timers, %u rounds: %lu adds, %lu cycles per add, "
+		"%lu deletes, %lu cycles per delete\r\n", count, TIMER_STRESS_ROUNDS,
+		(uint64_t)count * TIMER_STRESS_ROUNDS, add_cycles / ((uint64_t)count * TIMER_STRESS_ROUNDS),
+		nr_del, (nr_del != 0UL) ? (del_cycles / nr_del) : 0UL);
+	shell_puts(temp_str);
+	snprintf(temp_str, MAX_STR_SIZE, "%s: %u wrong nearest deadlines, %u timers fired early\r\n",
+		((errors == 0U) && (fired == 0U)) ? "PASS" : "FAIL", errors, fired);
+	shell_puts(temp_str);
+
+	return 0;
+}
+
+/*
+ * A periodic tick of one MCU would interrupt the pCPU, and cause a VM exit if a vCPU is running, once per
+ * MCU. The BVT scheduler only arms a one-shot timer while more than one thread is runnable, so every tick
+ * of the uncontended time is saved and, of the contended time, all but the preemptions that fired.
+ */
+static int32_t shell_show_bvt_stats(__unused int32_t argc, __unused char **argv)
+{
+#ifdef CONFIG_SCHED_BVT
+	char temp_str[MAX_STR_SIZE];
+	struct sched_bvt_control *bvt_ctl;
+	uint64_t rflags, now, elapsed, contended, armed, fired, ticks, saved_idle, saved_busy;
+	uint64_t tick = BVT_MCU_MS * TICKS_PER_MS;
+	uint16_t pcpu_id;
+
+	shell_puts("\r\nCPU ELAPSED(ms) CONTENDED(ms) ARMED      FIRED      SAVED_IDLE SAVED_BUSY SAVED/s"
+		   "\r\n=== =========== ============= ========== ========== ========== ========== ==========\r\n");
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		if (per_cpu(sched_ctl, pcpu_id).scheduler != &sched_bvt) {
+			continue;
+		}
+
+		bvt_ctl = &per_cpu(sched_bvt_ctl, pcpu_id);
+		obtain_schedule_lock(pcpu_id, &rflags);
+		now = cpu_ticks();
+		elapsed = now - bvt_ctl->stats_start_tsc;
+		contended = bvt_ctl->contended_tsc;
+		/* the running slice is contended if its preemption is armed */
+		if (bvt_ctl->preempt_armed) {
+			contended += now - bvt_ctl->last_pick_tsc;
+		}
+		armed = bvt_ctl->nr_timer_armed;
+		fired = bvt_ctl->nr_timer_fired;
+		release_schedule_lock(pcpu_id, rflags);
+
+		saved_idle = (elapsed - contended) / tick;
+		ticks = contended / tick;
+		saved_busy = (ticks > fired) ? (ticks - fired) : 0UL;
+
+		snprintf(temp_str, MAX_STR_SIZE, "%-3hu %-11lu %-13lu %-10lu %-10lu %-10lu %-10lu %-10lu\r\n",
+			pcpu_id, ticks_to_ms(elapsed), ticks_to_ms(contended), armed, fired, saved_idle, saved_busy,
+			((saved_idle + saved_busy) * 1000UL) / max(ticks_to_ms(elapsed), 1UL));
+		shell_puts(temp_str);
+	}
+#else
+	shell_puts("\r\nThe BVT scheduler is not enabled\r\n");
+#endif
+
+	return 0;
+}
+
+static int32_t shell_show_ctx_switch(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct ctx_switch_stats stats;
+	uint16_t pcpu_id;
+
+	shell_puts("\r\nCPU SWITCHES   CYCLES/SW  XSAVES     XRSTORS    XSTATE_LIVE"
+		   "\r\n=== ========== ========== ========== ========== ===========\r\n");
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		/* counters of another pCPU may be mid-update, good enough for statistics */
+		stats = per_cpu(ctx_switch_stats, pcpu_id);
+		snprintf(temp_str, MAX_STR_SIZE, "%-3hu %-10lu %-10lu %-10lu %-10lu %-10lu\r\n", pcpu_id,
+			stats.nr_switch, (stats.nr_switch != 0UL) ? (stats.cycles / stats.nr_switch) : 0UL,
+			stats.nr_xsave, stats.nr_xrstor, stats.nr_xstate_live);
+		shell_puts(temp_str);
+	}
+
+	return 0;
+}
+
+/* duration between two boot phases, 0 if the later one was not reached */
+static uint64_t boot_phase_us(const struct vm_boot_timeline *timeline, enum vm_boot_phase from, enum vm_boot_phase to)
+{
+	return (timeline->tsc[to] != 0UL) ? ticks_to_us(timeline->tsc[to] - timeline->tsc[from]) : 0UL;
+}
+
+static int32_t shell_show_boot_timeline(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	const struct vm_boot_timeline *timeline;
+	uint16_t vm_id;
+
+	shell_puts("\r\nVM_ID PREPARE_AT(us) CREATE(us) LOAD(us)   START(us)  LOADED(KB) HELPERS"
+		   "\r\n===== ============== ========== ========== ========== ========== =======\r\n");
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		timeline = get_vm_boot_timeline(vm_id);
+		if (timeline->tsc[VM_BOOT_PREPARE] != 0UL) {
+			snprintf(temp_str, MAX_STR_SIZE, "  %-3hu %-14lu %-10lu %-10lu %-10lu %-10lu %-7hu\r\n", vm_id,
+				ticks_to_us(timeline->tsc[VM_BOOT_PREPARE]),
+				boot_phase_us(timeline, VM_BOOT_PREPARE, VM_BOOT_CREATED),
+				boot_phase_us(timeline, VM_BOOT_CREATED, VM_BOOT_LOADED),
+				boot_phase_us(timeline, VM_BOOT_LOADED, VM_BOOT_STARTED),
+				timeline->load_bytes >> 10U, timeline->nr_helpers);
+			shell_puts(temp_str);
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_show_asyncio(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct shared_buf *sbuf;
+	uint32_t slots, queued;
+	uint16_t vm_id;
+
+	shell_puts("\r\nVM_ID SLOTS    QUEUED   POSTED               FULL"
+		   "\r\n===== ======== ======== ==================== ====================\r\n");
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		sbuf = (struct shared_buf *)vm->sw.asyncio_sbuf;
+		if (!is_poweroff_vm(vm) && (sbuf != NULL)) {
+			/* the ring lives in Service VM memory, its indexes may move while read */
+			stac();
+			slots = sbuf->ele_num;
+			queued = 0U;
+			if ((sbuf->size != 0U) && (sbuf->ele_size != 0U)) {
+				queued = ((sbuf->tail + sbuf->size - sbuf->head) % sbuf->size) / sbuf->ele_size;
+			}
+			clac();
+
+			snprintf(temp_str, MAX_STR_SIZE, "  %-3hu %-8u %-8u %-20lu %-20lu\r\n", vm_id,
+				slots, queued, vm->asyncio_posted_cnt, vm->asyncio_full_cnt);
+			shell_puts(temp_str);
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_show_ept_stats(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct pgtable_stats stats;
+	uint16_t vm_id;
+
+	shell_puts("\r\nVM_ID 1G_PAGES   2M_PAGES   4K_PAGES   SPLITS     MERGES"
+		   "\r\n===== ========== ========== ========== ========== ==========\r\n");
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!is_poweroff_vm(vm)) {
+			spinlock_obtain(&vm->ept_lock);
+			stats = vm->arch_vm.ept_stats;
+			spinlock_release(&vm->ept_lock);
+
+			snprintf(temp_str, MAX_STR_SIZE, "  %-3hu %-10lu %-10lu %-10lu %-10lu %-10lu\r\n", vm_id,
+				stats.nr_leaf[IA32E_PDPT], stats.nr_leaf[IA32E_PD], stats.nr_leaf[IA32E_PT],
+				stats.nr_split, stats.nr_merge);
+			shell_puts(temp_str);
+		}
+	}
+
+	return 0;
+}
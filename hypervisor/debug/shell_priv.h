@@ -113,4 +113,46 @@ struct shell {
 #define SHELL_CMD_WRMSR_PARAM		"[-p<pcpu_id>]	<msr_index> <value>"
 #define SHELL_CMD_WRMSR_HELP		"Write value (in hexadecimal) to the MSR at msr_index (in hexadecimal) for CPU"\
 					" ID pcpu_id"
+
+#define SHELL_CMD_VM_MMIO		"vm_mmio"
+#define SHELL_CMD_VM_MMIO_PARAM		"<vm id>"
+#define SHELL_CMD_VM_MMIO_HELP		"Show the hypervisor emulated MMIO regions and per vCPU lookup statistics of a VM"
+
+#define SHELL_CMD_PAGE_POOL		"page_pool"
+#define SHELL_CMD_PAGE_POOL_PARAM	NULL
+#define SHELL_CMD_PAGE_POOL_HELP	"Show the usage of the hypervisor page pools, in number of 4K pages"
+
+#define SHELL_CMD_EPT_STATS		"ept_stats"
+#define SHELL_CMD_EPT_STATS_PARAM	NULL
+#define SHELL_CMD_EPT_STATS_HELP	"Show the number of 1G/2M/4K EPT leaf entries and large page splits/merges of each VM"
+
+#define SHELL_CMD_VMEXIT_LAT		"vmexit_lat"
+#define SHELL_CMD_VMEXIT_LAT_PARAM	"<vm id>"
+#define SHELL_CMD_VMEXIT_LAT_HELP	"Show the VM exit to VM entry latency percentiles per vCPU and exit reason of a VM"
+
+#define SHELL_CMD_TIMER_STRESS		"timer_stress"
+#define SHELL_CMD_TIMER_STRESS_PARAM	"[<number of timers> [expire]]"
+#define SHELL_CMD_TIMER_STRESS_HELP	"Add and delete timers repeatedly on this pCPU, check the nearest deadline and "\
+	"show the average cycles per add and delete. With expire, let the timers expire within about a second "\
+	"and check that each fires once, not before its deadline"
+
+#define SHELL_CMD_BVT_STATS		"bvt_stats"
+#define SHELL_CMD_BVT_STATS_PARAM	NULL
+#define SHELL_CMD_BVT_STATS_HELP	"Show the preemption timers of the BVT scheduler per pCPU and the timer interrupts "\
+	"saved compared with a periodic tick"
+
+#define SHELL_CMD_CTX_SWITCH		"ctx_switch"
+#define SHELL_CMD_CTX_SWITCH_PARAM	NULL
+#define SHELL_CMD_CTX_SWITCH_HELP	"Show the vCPU context switches per pCPU, their average cost in cycles and the "\
+	"XSAVE states saved, restored and found still in the registers"
+
+#define SHELL_CMD_BOOT_TIMELINE		"boot_timeline"
+#define SHELL_CMD_BOOT_TIMELINE_PARAM	NULL
+#define SHELL_CMD_BOOT_TIMELINE_HELP	"Show when the Service VM and pre-launched VMs were prepared at boot, and how long "\
+	"their creation, image loading and start took"
+
+#define SHELL_CMD_ASYNCIO		"asyncio"
+#define SHELL_CMD_ASYNCIO_PARAM		NULL
+#define SHELL_CMD_ASYNCIO_HELP		"Show the asyncio ring of each VM, the doorbells posted to it and those delivered "\
+	"as I/O requests because it was full"
 #endif /* SHELL_PRIV_H */
@@ -212,6 +212,13 @@ static struct asyncio_desc *get_asyncio_desc(struct acrn_vcpu *vcpu, const struc
 	return ret;
 
 }
+/**
+ * @brief Post the doorbell of an asyncio to the Service VM
+ *
+ * @retval 0 The doorbell is posted.
+ * @retval -EBUSY The asyncio ring is full, the caller shall deliver the access as an I/O request.
+ * @retval -ENODEV The VM has no asyncio ring.
+ */
 static int acrn_insert_asyncio(struct acrn_vcpu *vcpu, const uint64_t asyncio_fd)
 {
 	struct acrn_vm *vm = vcpu->vm;
@@ -220,23 +227,24 @@ static int acrn_insert_asyncio(struct acrn_vcpu *vcpu, const uint64_t asyncio_fd
 	int ret = -ENODEV;
 
 	if (sbuf != NULL) {
-		spinlock_obtain(&vm->asyncio_lock);
-		while (sbuf_put(sbuf, (uint8_t *)&asyncio_fd, sizeof(asyncio_fd)) == 0U) {
-			/* sbuf is full, try later.. */
-			spinlock_release(&vm->asyncio_lock);
-			asm_pause();
-			if (need_reschedule(pcpuid_from_vcpu(vcpu))) {
-				schedule();
-			}
-			spinlock_obtain(&vm->asyncio_lock);
+		spinlock_obtain(&vm->asyncio_sbuf_lock);
+		if (sbuf_put(sbuf, (uint8_t *)&asyncio_fd, sizeof(asyncio_fd)) == sizeof(asyncio_fd)) {
+			vm->asyncio_posted_cnt++;
+			ret = 0;
+		} else {
+			ret = -EBUSY;
 		}
+		spinlock_release(&vm->asyncio_sbuf_lock);
 
-		spinlock_release(&vm->asyncio_lock);
-		arch_fire_hsm_interrupt();
-		ret = 0;
+		if (ret == 0) {
+			arch_fire_hsm_interrupt();
+		} else {
+			atomic_inc64(&vm->asyncio_full_cnt);
+		}
 	}
 	return ret;
 }
+
 /**
  * @brief Deliver \p io_req to Service VM and suspend \p vcpu till its completion
  *
@@ -353,9 +361,18 @@ int init_asyncio(struct acrn_vm *vm, uint64_t *hva)
 	stac();
 	if (sbuf != NULL) {
 		if (sbuf->magic == SBUF_MAGIC) {
+			/*
+			 * Every element is a doorbell the DM is waiting for, so the ring must
+			 * never overwrite unconsumed entries: sbuf_put() has to fail on a full
+			 * ring so that emulate_io() falls back to an I/O request.
+			 */
+			sbuf->flags &= ~OVERWRITE_EN;
 			vm->sw.asyncio_sbuf = sbuf;
 			INIT_LIST_HEAD(&vm->aiodesc_queue);
 			spinlock_init(&vm->asyncio_lock);
+			spinlock_init(&vm->asyncio_sbuf_lock);
+			vm->asyncio_posted_cnt = 0UL;
+			vm->asyncio_full_cnt = 0UL;
 			ret = 0;
 		}
 	}
@@ -633,6 +650,109 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	return status;
 }
 
+/**
+ * @brief Find the MMIO node hit by an access
+ *
+ * Returns the node with the lowest emul_mmio[] slot among the registered nodes
+ * overlapping [address, address + size), as the former linear walk did. The
+ * vCPU cache is only used when no registered ranges overlap, so that the answer
+ * is unique.
+ *
+ * @pre spinlock emul_mmio_lock of vcpu->vm is held
+ */
+static struct mem_io_node *find_mmio_node(struct acrn_vcpu *vcpu, uint64_t address, uint64_t size)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct mem_io_index *index = &vm->emul_mmio_index;
+	struct mem_io_cache *cache = &vcpu->mmio_cache;
+	struct mem_io_node *node, *found = NULL;
+	uint16_t lo = 0U, hi = index->nr, mid, i;
+	uint16_t found_slot = CONFIG_MAX_EMULATED_MMIO_REGIONS;
+
+	cache->nr_lookup++;
+	if ((cache->gen != 0U) && (cache->gen == index->gen) && !index->overlap) {
+		node = &vm->emul_mmio[cache->slot];
+		if ((address >= node->range_start) && ((address + size) <= node->range_end)) {
+			cache->nr_hit++;
+			found = node;
+		}
+	}
+
+	if (found == NULL) {
+		/* hi: number of nodes starting before the end of the access */
+		while (lo < hi) {
+			mid = lo + ((hi - lo) >> 1U);
+			cache->nr_probe++;
+			if (vm->emul_mmio[index->slot[mid]].range_start < (address + size)) {
+				lo = mid + 1U;
+			} else {
+				hi = mid;
+			}
+		}
+
+		for (i = hi; (i > 0U) && (index->max_end[i - 1U] > address); i--) {
+			cache->nr_probe++;
+			if (vm->emul_mmio[index->slot[i - 1U]].range_end > address) {
+				if (index->slot[i - 1U] < found_slot) {
+					found_slot = index->slot[i - 1U];
+				}
+				if (!index->overlap) {
+					break;
+				}
+			}
+		}
+
+		if (found_slot < CONFIG_MAX_EMULATED_MMIO_REGIONS) {
+			found = &vm->emul_mmio[found_slot];
+			cache->gen = index->gen;
+			cache->slot = found_slot;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * @brief Rebuild the sorted index of the registered MMIO nodes
+ *
+ * @pre spinlock emul_mmio_lock of \p vm is held
+ */
+static void update_mmio_index(struct acrn_vm *vm)
+{
+	struct mem_io_index *index = &vm->emul_mmio_index;
+	uint16_t idx, i, nr = 0U;
+	uint64_t start;
+
+	for (idx = 0U; idx < CONFIG_MAX_EMULATED_MMIO_REGIONS; idx++) {
+		if (vm->emul_mmio[idx].read_write != NULL) {
+			/* insertion sort, the index holds a handful of entries */
+			start = vm->emul_mmio[idx].range_start;
+			for (i = nr; (i > 0U) && (vm->emul_mmio[index->slot[i - 1U]].range_start > start); i--) {
+				index->slot[i] = index->slot[i - 1U];
+			}
+			index->slot[i] = idx;
+			nr++;
+		}
+	}
+
+	index->nr = nr;
+	index->overlap = false;
+	for (i = 0U; i < nr; i++) {
+		index->max_end[i] = vm->emul_mmio[index->slot[i]].range_end;
+		if (i > 0U) {
+			if (vm->emul_mmio[index->slot[i]].range_start < index->max_end[i - 1U]) {
+				index->overlap = true;
+			}
+			index->max_end[i] = max(index->max_end[i], index->max_end[i - 1U]);
+		}
+	}
+
+	index->gen++;
+	if (index->gen == 0U) {
+		index->gen = 1U;
+	}
+}
+
 /**
  * Use registered MMIO handlers on the given request if it falls in the range of
  * any of them.
@@ -648,8 +768,7 @@ hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
 	int32_t status = -ENODEV;
 	bool hold_lock = true;
-	uint16_t idx;
-	uint64_t address, size, base, end;
+	uint64_t address, size;
 	struct acrn_mmio_request *mmio_req = &io_req->reqs.mmio_request;
 	struct mem_io_node *mmio_handler = NULL;
 	hv_mem_io_handler_t read_write = NULL;
@@ -663,25 +782,15 @@ hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	size = mmio_req->size;
 
 	spinlock_obtain(&vcpu->vm->emul_mmio_lock);
-	for (idx = 0U; idx <= vcpu->vm->nr_emul_mmio_regions; idx++) {
-		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
-		if (mmio_handler->read_write != NULL) {
-			base = mmio_handler->range_start;
-			end = mmio_handler->range_end;
-
-			if (((address + size) <= base) || (address >= end)) {
-				continue;
-			} else {
-				 if ((address >= base) && ((address + size) <= end)) {
-					hold_lock = mmio_handler->hold_lock;
-					read_write = mmio_handler->read_write;
-					handler_private_data = mmio_handler->handler_private_data;
-				} else {
-					pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
-					status = -EIO;
-				}
-				break;
-			}
+	mmio_handler = find_mmio_node(vcpu, address, size);
+	if (mmio_handler != NULL) {
+		if ((address >= mmio_handler->range_start) && ((address + size) <= mmio_handler->range_end)) {
+			hold_lock = mmio_handler->hold_lock;
+			read_write = mmio_handler->read_write;
+			handler_private_data = mmio_handler->handler_private_data;
+		} else {
+			pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
+			status = -EIO;
 		}
 	}
 
@@ -757,9 +866,14 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 		 * ACRN insert request to HSM and inject upcall.
 		 */
 		aio_desc = get_asyncio_desc(vcpu, io_req);
-		if (aio_desc) {
-			status = acrn_insert_asyncio(vcpu, aio_desc->asyncio_info.fd);
+		if ((aio_desc != NULL) && (acrn_insert_asyncio(vcpu, aio_desc->asyncio_info.fd) == 0)) {
+			status = 0;
 		} else {
+			/*
+			 * A full asyncio ring back-pressures the vCPU: the doorbell is delivered as a
+			 * synchronous I/O request, and the vCPU sleeps until the Service VM handled it
+			 * instead of spinning on the ring.
+			 */
 			status = acrn_insert_request(vcpu, io_req);
 			if (status == 0) {
 				dm_emulate_io_complete(vcpu);
@@ -888,6 +1002,7 @@ void register_mmio_emulation_handler(struct acrn_vm *vm,
 			mmio_node->handler_private_data = handler_private_data;
 			mmio_node->range_start = start;
 			mmio_node->range_end = end;
+			update_mmio_index(vm);
 		}
 		spinlock_release(&vm->emul_mmio_lock);
 	}
@@ -912,6 +1027,7 @@ void unregister_mmio_emulation_handler(struct acrn_vm *vm,
 	mmio_node = find_match_mmio_node(vm, start, end);
 	if (mmio_node != NULL) {
 		(void)memset(mmio_node, 0U, sizeof(struct mem_io_node));
+		update_mmio_index(vm);
 	}
 	spinlock_release(&vm->emul_mmio_lock);
 }
@@ -919,5 +1035,6 @@ void unregister_mmio_emulation_handler(struct acrn_vm *vm,
 void deinit_emul_io(struct acrn_vm *vm)
 {
 	(void)memset(vm->emul_mmio, 0U, sizeof(vm->emul_mmio));
+	(void)memset(&vm->emul_mmio_index, 0U, sizeof(vm->emul_mmio_index));
 	(void)memset(vm->emul_pio, 0U, sizeof(vm->emul_pio));
 }
@@ -49,6 +49,60 @@ static inline struct acrn_vioapics *vm_ioapics(const struct acrn_vm *vm)
 	return (struct acrn_vioapics *)&(vm->arch_vm.vioapics);
 }
 
+/**
+ * @brief Invalidate the cached pin destinations of all the vIOAPICs of the VM
+ *
+ * Called whenever a vLAPIC of the VM changes its LDR, DFR or x2APIC mode.
+ *
+ * @pre vm != NULL
+ */
+void vioapic_flush_dest_cache(const struct acrn_vm *vm)
+{
+	atomic_inc64(&vm_ioapics(vm)->dest_gen);
+}
+
+/**
+ * Decoded destination of a pin, recalculated only after the RTE or a vLAPIC of the VM changed.
+ * The generation is sampled before decoding, so a concurrent flush leaves the entry stale.
+ *
+ * @pre pin < vioapic->chipinfo.nr_pins
+ * @pre rte.bits.delivery_mode != IOAPIC_RTE_DELMODE_LOPRI
+ */
+static uint64_t
+vioapic_get_dest(struct acrn_single_vioapic *vioapic, uint32_t pin, union ioapic_rte rte)
+{
+	uint64_t gen = vm_ioapics(vioapic->vm)->dest_gen;
+
+	if (vioapic->dest_gen[pin] != gen) {
+		vioapic->dest_mask[pin] = vlapic_calc_dest_noshort(vioapic->vm, false, (uint32_t)rte.bits.dest_field,
+				(rte.bits.dest_mode == IOAPIC_RTE_DESTMODE_PHY), false);
+		vioapic->dest_gen[pin] = gen;
+	}
+
+	return vioapic->dest_mask[pin];
+}
+
+/**
+ * Keep the vector to level triggered pins index in sync with a RTE update.
+ *
+ * @pre pin < vioapic->chipinfo.nr_pins
+ */
+static void
+vioapic_update_vector_pins(struct acrn_single_vioapic *vioapic, uint32_t pin,
+		union ioapic_rte last, union ioapic_rte new)
+{
+	uint16_t bit = (uint16_t)(pin & 0x3FU);
+
+	if (last.bits.trigger_mode == IOAPIC_RTE_TRGRMODE_LEVEL) {
+		bitmap_clear_nolock(bit, &vioapic->vector_pins[last.bits.vector][pin >> 6U]);
+	}
+	if (new.bits.trigger_mode == IOAPIC_RTE_TRGRMODE_LEVEL) {
+		bitmap_set_nolock(bit, &vioapic->vector_pins[new.bits.vector][pin >> 6U]);
+	}
+	/* the destination may have changed as well */
+	vioapic->dest_gen[pin] = 0UL;
+}
+
 /**
  * @pre pin < vioapic->chipinfo.nr_pins
  */
@@ -76,8 +130,14 @@ vioapic_generate_intr(struct acrn_single_vioapic *vioapic, uint32_t pin)
 				vioapic->rtbl[pin].bits.remote_irr = IOAPIC_RTE_REM_IRR;
 			}
 			vector = rte.bits.vector;
-			dest = rte.bits.dest_field;
-			vlapic_receive_intr(vioapic->vm, level, dest, phys, delmode, vector, false);
+			if ((delmode == IOAPIC_RTE_DELMODE_FIXED) || (delmode == IOAPIC_RTE_DELMODE_EXINT)) {
+				vlapic_deliver_intr(vioapic->vm, level, vioapic_get_dest(vioapic, pin, rte),
+						delmode, vector);
+			} else {
+				/* the lowest priority target depends on the current vLAPIC PPRs */
+				dest = rte.bits.dest_field;
+				vlapic_receive_intr(vioapic->vm, level, dest, phys, delmode, vector, false);
+			}
 		}
 	}
 }
@@ -361,6 +421,7 @@ static void vioapic_indirect_write(struct acrn_single_vioapic *vioapic, uint32_t
 
 		if (wire_mode_valid) {
 			vioapic->rtbl[pin] = new;
+			vioapic_update_vector_pins(vioapic, pin, last, new);
 			dev_dbg(DBG_LEVEL_VIOAPIC, "ioapic pin%hhu: redir table entry %#lx",
 				pin, vioapic->rtbl[pin].full);
 
@@ -435,47 +496,56 @@ vioapic_mmio_rw(struct acrn_single_vioapic *vioapic, uint64_t gpa,
 static void
 vioapic_process_eoi(struct acrn_single_vioapic *vioapic, uint32_t vector)
 {
-	uint32_t pin, pincount = vioapic->chipinfo.nr_pins;
+	uint32_t pin, i;
+	uint16_t bit;
 	union ioapic_rte rte;
-	uint64_t rflags;
+	uint64_t rflags, pins;
+	bool has_pins = false;
 
 	if ((vector < VECTOR_DYNAMIC_START) || (vector > NR_MAX_VECTOR)) {
 		pr_err("vioapic_process_eoi: invalid vector %u", vector);
 	}
 
-	dev_dbg(DBG_LEVEL_VIOAPIC, "ioapic processing eoi for vector %u", vector);
-
-	/* notify device to ack if assigned pin */
-	for (pin = 0U; pin < pincount; pin++) {
-		rte = vioapic->rtbl[pin];
-		if ((rte.bits.vector != vector) ||
-			(rte.bits.remote_irr == 0U)) {
-			continue;
+	if (vector <= NR_MAX_VECTOR) {
+		dev_dbg(DBG_LEVEL_VIOAPIC, "ioapic processing eoi for vector %u", vector);
+
+		/* notify device to ack if assigned pin */
+		for (i = 0U; i < STATE_BITMAP_SIZE; i++) {
+			pins = vioapic->vector_pins[vector][i];
+			has_pins = has_pins || (pins != 0UL);
+			for (bit = ffs64(pins); bit != INVALID_BIT_INDEX; bit = ffs64(pins)) {
+				bitmap_clear_nolock(bit, &pins);
+				pin = (i << 6U) + bit;
+				rte = vioapic->rtbl[pin];
+				if ((rte.bits.vector == vector) && (rte.bits.remote_irr != 0U)) {
+					ptirq_intx_ack(vioapic->vm, vioapic->chipinfo.gsi_base + pin, INTX_CTLR_IOAPIC);
+				}
+			}
 		}
-
-		ptirq_intx_ack(vioapic->vm, vioapic->chipinfo.gsi_base + pin, INTX_CTLR_IOAPIC);
 	}
 
-	/*
-	 * XXX keep track of the pins associated with this vector instead
-	 * of iterating on every single pin each time.
-	 */
-	spinlock_irqsave_obtain(&(vioapic->lock), &rflags);
-	for (pin = 0U; pin < pincount; pin++) {
-		rte = vioapic->rtbl[pin];
-		if ((rte.bits.vector != vector) ||
-			(rte.bits.remote_irr == 0U)) {
-			continue;
-		}
+	/* only the level triggered pins programmed with this vector could have been waiting for it */
+	if (has_pins) {
+		spinlock_irqsave_obtain(&(vioapic->lock), &rflags);
+		for (i = 0U; i < STATE_BITMAP_SIZE; i++) {
+			pins = vioapic->vector_pins[vector][i];
+			for (bit = ffs64(pins); bit != INVALID_BIT_INDEX; bit = ffs64(pins)) {
+				bitmap_clear_nolock(bit, &pins);
+				pin = (i << 6U) + bit;
+				if (vioapic->rtbl[pin].bits.remote_irr == 0U) {
+					continue;
+				}
 
-		vioapic->rtbl[pin].bits.remote_irr = 0U;
-		if (vioapic_need_intr(vioapic, (uint16_t)pin)) {
-			dev_dbg(DBG_LEVEL_VIOAPIC,
-				"ioapic pin%hhu: asserted at eoi", pin);
-			vioapic_generate_intr(vioapic, pin);
+				vioapic->rtbl[pin].bits.remote_irr = 0U;
+				if (vioapic_need_intr(vioapic, (uint16_t)pin)) {
+					dev_dbg(DBG_LEVEL_VIOAPIC,
+						"ioapic pin%hhu: asserted at eoi", pin);
+					vioapic_generate_intr(vioapic, pin);
+				}
+			}
 		}
+		spinlock_irqrestore_release(&(vioapic->lock), rflags);
 	}
-	spinlock_irqrestore_release(&(vioapic->lock), rflags);
 }
 
 void vioapic_broadcast_eoi(const struct acrn_vm *vm, uint32_t vector)
@@ -503,6 +573,8 @@ static void reset_one_vioapic(struct acrn_single_vioapic *vioapic)
 	for (pin = 0U; pin < pincount; pin++) {
 		vioapic->rtbl[pin].full = MASK_ALL_INTERRUPTS;
 	}
+	(void)memset((void *)vioapic->vector_pins, 0U, sizeof(vioapic->vector_pins));
+	(void)memset((void *)vioapic->dest_gen, 0U, sizeof(vioapic->dest_gen));
 	vioapic->chipinfo.id = 0U;
 	vioapic->ioregsel = 0U;
 }
@@ -535,6 +607,8 @@ vioapic_init(struct acrn_vm *vm)
 		vm->arch_vm.vioapics.ioapic_num = 1U;
 		vioapic_info = &virt_ioapic_info;
 	}
+	/* a cached destination is valid only if its generation matches, keep 0 as never valid */
+	vioapic_flush_dest_cache(vm);
 
 	for (vioapic_index = 0U; vioapic_index < vm->arch_vm.vioapics.ioapic_num; vioapic_index++) {
 		vioapic = &vm->arch_vm.vioapics.vioapic_array[vioapic_index];
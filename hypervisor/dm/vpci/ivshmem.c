@@ -47,6 +47,8 @@
 #define	IVSHMEM_IRQ_STA_REG	0x4U
 #define	IVSHMEM_IV_POS_REG	0x8U
 #define	IVSHMEM_DOORBELL_REG	0xcU
+/* ACRN specific: notify all the vectors set in the low 16 bits with one write */
+#define	IVSHMEM_DOORBELL_BATCH_REG	0x10U
 
 static struct ivshmem_shm_region mem_regions[8] = {
 	IVSHMEM_SHM_REGIONS
@@ -60,10 +62,18 @@ union ivshmem_doorbell {
 	} reg;
 };
 
+union ivshmem_doorbell_batch {
+	uint32_t val;
+	struct {
+		uint16_t vector_mask;
+		uint16_t peer_id;
+	} reg;
+};
+
 struct ivshmem_device {
 	struct pci_vdev* pcidev;
 	union {
-		uint32_t data[4];
+		uint32_t data[5];
 		struct {
 			uint32_t irq_mask;
 			uint32_t irq_state;
@@ -75,6 +85,9 @@ struct ivshmem_device {
 
 			/* Writing doorbell register requests to interrupt a peer */
 			union ivshmem_doorbell doorbell;
+
+			/* Writing batched doorbell register requests to interrupt a peer with several vectors */
+			union ivshmem_doorbell_batch doorbell_batch;
 		} regs;
 	} mmio;
 	struct ivshmem_shm_region *region;
@@ -216,7 +229,7 @@ static void create_ivshmem_device(struct pci_vdev *vdev)
 	 * Clear ivshmem_device mmio to ensure the same initial
 	 * states after VM reboot.
 	 */
-	memset(&ivshmem_dev[i].mmio, 0U, sizeof(uint32_t) * 4);
+	memset(&ivshmem_dev[i].mmio, 0U, sizeof(ivshmem_dev[i].mmio));
 }
 
 /**
@@ -225,10 +238,10 @@ static void create_ivshmem_device(struct pci_vdev *vdev)
  * BAR0 is used for device registers. This function handles MMIO read and write operations to the ivshmem device BAR0.
  *
  * Per the specification, the access offset within should be 4-byte aligned, the access size should be 4 bytes, and the
- * access offset exceeds 16 bytes are reserved. So the request needs to meet these conditions, otherwise, it does
- * nothing and directly returns 0.
+ * access offset exceeds 16 bytes are reserved. ACRN uses the reserved offset 16 for the batched Doorbell register. So
+ * the request needs to meet these conditions, otherwise, it does nothing and directly returns 0.
  * - For a read operation, the read value is stored in the input mmio request structure:
- *   - Doorbell register is a write-only register, so it sets the read value to 0.
+ *   - Doorbell and batched Doorbell registers are write-only registers, so it sets the read value to 0.
  *   - Otherwise, it reads specified register value of the ivshmem device.
  * - For a write operation:
  *   - IVPosition register is a read-only register, so it does nothing if writing to IVPosition.
@@ -236,6 +249,8 @@ static void create_ivshmem_device(struct pci_vdev *vdev)
  *     input mmio value. If the peer is valid (peer ivshmem device exists, MSI-X is enabled, the MSI-X table entry
  *     corresponding to the vector index exists and is not masked), it injects an MSI to the peer VM. For more details
  *     about the MSI injection, refer to vlapic_inject_msi().
+ *   - Writing to the batched Doorbell register does the same for each vector index set in the low 16 bits of the
+ *     input mmio value, so that a VM notifies several vectors of a peer with one VM exit.
  *   - Otherwise, it writes the value to the specified register of the ivshmem device.
  * - Finally, it returns 0.
  *
@@ -253,22 +268,25 @@ static void create_ivshmem_device(struct pci_vdev *vdev)
 static int32_t ivshmem_mmio_handler(struct io_request *io_req, void *data)
 {
 	union ivshmem_doorbell doorbell;
+	union ivshmem_doorbell_batch batch;
+	uint16_t vector_index;
+	uint64_t vector_mask;
 	struct acrn_mmio_request *mmio = &io_req->reqs.mmio_request;
 	struct pci_vdev *vdev = (struct pci_vdev *) data;
 	struct ivshmem_device *ivs_dev = (struct ivshmem_device *) vdev->priv_data;
 	uint64_t offset = mmio->address - vdev->vbars[IVSHMEM_MMIO_BAR].base_gpa;
 
-	/* ivshmem spec define the BAR0 offset > 16 are reserved */
+	/* ivshmem spec define the BAR0 offset > 16 are reserved, ACRN uses offset 16 for batched doorbell */
 	if ((mmio->size == 4U) && ((offset & 0x3U) == 0U) &&
 		(offset < sizeof(ivs_dev->mmio))) {
 		/*
 		 * IVSHMEM_IRQ_MASK_REG and IVSHMEM_IRQ_STA_REG are R/W registers
 		 * they are useless for ivshmem Rev.1.
-		 * IVSHMEM_IV_POS_REG is Read-Only register and IVSHMEM_DOORBELL_REG
-		 * is Write-Only register, they are used for interrupt.
+		 * IVSHMEM_IV_POS_REG is Read-Only register, IVSHMEM_DOORBELL_REG and
+		 * IVSHMEM_DOORBELL_BATCH_REG are Write-Only registers, they are used for interrupt.
 		 */
 		if (mmio->direction == ACRN_IOREQ_DIR_READ) {
-			if (offset != IVSHMEM_DOORBELL_REG) {
+			if ((offset != IVSHMEM_DOORBELL_REG) && (offset != IVSHMEM_DOORBELL_BATCH_REG)) {
 				mmio->value = ivs_dev->mmio.data[offset >> 2U];
 			} else {
 				mmio->value = 0UL;
@@ -279,6 +297,14 @@ static int32_t ivshmem_mmio_handler(struct io_request *io_req, void *data)
 					doorbell.val = mmio->value;
 					ivshmem_server_notify_peer(ivs_dev, doorbell.reg.peer_id,
 						doorbell.reg.vector_index);
+				} else if (offset == IVSHMEM_DOORBELL_BATCH_REG) {
+					batch.val = mmio->value;
+					vector_mask = batch.reg.vector_mask;
+					for (vector_index = ffs64(vector_mask); vector_index != INVALID_BIT_INDEX;
+							vector_index = ffs64(vector_mask)) {
+						bitmap_clear_nolock(vector_index, &vector_mask);
+						ivshmem_server_notify_peer(ivs_dev, batch.reg.peer_id, vector_index);
+					}
 				} else {
 					ivs_dev->mmio.data[offset >> 2U] = mmio->value;
 				}
@@ -113,6 +113,27 @@ void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size);
 
+/**
+ * @brief Start deferring the EPT flush of a VM on the current pCPU
+ *
+ * Until ept_flush_batch_end() is called on the same pCPU, ept_add_mr(),
+ * ept_modify_mr() and ept_del_mr() issued from this pCPU on vm only record
+ * that a flush is needed instead of requesting one from every vCPU. EPT
+ * updates of vm from other pCPUs are flushed as usual.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ *
+ * @pre No batch is active on the current pCPU
+ */
+void ept_flush_batch_begin(struct acrn_vm *vm);
+
+/**
+ * @brief Stop deferring the EPT flush and issue the deferred flush, if any
+ *
+ * @param[in] vm the pointer that points to VM data structure passed to ept_flush_batch_begin()
+ */
+void ept_flush_batch_end(struct acrn_vm *vm);
+
 /**
  * @brief Flush address space from the page entry
  *
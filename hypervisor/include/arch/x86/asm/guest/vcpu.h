@@ -271,6 +271,11 @@ struct acrn_vcpu_arch {
 	bool emulating_lock;
 	bool xsave_enabled;
 
+	/* The VMCS was VMCLEARed to migrate the vCPU, it needs a VMLAUNCH and the new pCPU's host state */
+	bool vmcs_cleared;
+	/* The vLAPIC timer was disarmed to migrate the vCPU, re-arm it on the new pCPU */
+	bool vtimer_migrated;
+
 	/* VCPU context state information */
 	uint32_t exit_reason;
 	uint32_t idt_vectoring_info;
@@ -303,6 +308,12 @@ struct acrn_vcpu_arch {
 } __aligned(PAGE_SIZE);
 
 struct acrn_vm;
+/* Log2 histograms of the VM exit to VM entry latency, per basic exit reason */
+struct vmexit_latency {
+	uint64_t exit_tsc;	/* TSC of the last VM exit, 0 before the first one */
+	uint64_t count[NR_VMX_EXIT_REASONS][ACRN_VMEXIT_LAT_BUCKETS];
+};
+
 struct acrn_vcpu {
 	uint8_t stack[CONFIG_STACK_SIZE] __aligned(16);
 
@@ -318,6 +329,8 @@ struct acrn_vcpu {
 
 	struct instr_emul_ctxt inst_ctxt;
 	struct io_request req; /* used by io/ept emulation */
+	struct mem_io_cache mmio_cache; /* last MMIO handler hit */
+	struct vmexit_latency exit_lat;
 
 	uint64_t reg_cached;
 	uint64_t reg_updated;
@@ -605,6 +618,7 @@ struct acrn_vcpu *get_ever_run_vcpu(uint16_t pcpu_id);
 
 void save_xsave_area(struct acrn_vcpu *vcpu, struct ext_context *ectx);
 void rstore_xsave_area(const struct acrn_vcpu *vcpu, const struct ext_context *ectx);
+void flush_xsave_owner(void);
 void load_iwkey(struct acrn_vcpu *vcpu);
 
 /**
@@ -180,6 +180,7 @@ int32_t vlapic_inject_msi(struct acrn_vm *vm, uint64_t addr, uint64_t data);
 
 void vlapic_receive_intr(struct acrn_vm *vm, bool level, uint32_t dest,
 		bool phys, uint32_t delmode, uint32_t vec, bool rh);
+void vlapic_deliver_intr(struct acrn_vm *vm, bool level, uint64_t dmask, uint32_t delmode, uint32_t vec);
 
 /**
  *  @pre vlapic != NULL
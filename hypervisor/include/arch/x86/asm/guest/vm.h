@@ -113,6 +113,7 @@ struct vm_arch {
 	 */
 	void *sworld_eptp;
 	struct pgtable ept_pgtable;
+	struct pgtable_stats ept_stats;	/* Leaf entries mapped through ept_pgtable */
 
 	struct acrn_vioapics vioapics;	/* Virtual IOAPIC/s */
 	struct acrn_vpic vpic;      /* Virtual PIC */
@@ -148,6 +149,9 @@ struct acrn_vm {
 	struct asyncio_desc	aio_desc[ACRN_ASYNCIO_MAX];
 	struct list_head aiodesc_queue;
 	spinlock_t asyncio_lock; /* Spin-lock used to protect asyncio add/remove for a VM */
+	spinlock_t asyncio_sbuf_lock; /* Spin-lock serializing the asyncio ring producers */
+	uint64_t asyncio_posted_cnt; /* Doorbells posted to the asyncio ring */
+	uint64_t asyncio_full_cnt; /* Doorbells delivered as I/O requests as the asyncio ring was full */
 	spinlock_t vm_event_lock;
 
 	enum vpic_wire_mode wire_mode;
@@ -162,6 +166,7 @@ struct acrn_vm {
 	spinlock_t emul_mmio_lock;	/* Used to protect emulation mmio_node concurrent access for a VM */
 	uint16_t nr_emul_mmio_regions;	/* the emulated mmio_region number */
 	struct mem_io_node emul_mmio[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	struct mem_io_index emul_mmio_index;	/* emul_mmio sorted by range_start */
 
 	struct vm_io_handler_desc emul_pio[EMUL_PIO_IDX_MAX];
 
@@ -287,6 +292,7 @@ void update_vm_vlapic_state(struct acrn_vm *vm);
 enum vm_vlapic_mode check_vm_vlapic_mode(const struct acrn_vm *vm);
 bool is_vhwp_configured(const struct acrn_vm *vm);
 bool is_vtm_configured(const struct acrn_vm *vm);
+bool is_vcpu_balance_configured(const struct acrn_vm *vm);
 /*
  * @pre vm != NULL
  */
@@ -13,6 +13,8 @@ struct vm_exit_dispatch {
 };
 
 int32_t vmexit_handler(struct acrn_vcpu *vcpu);
+void vmexit_latency_start(struct acrn_vcpu *vcpu);
+void vmexit_latency_end(struct acrn_vcpu *vcpu);
 int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t cpuid_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu);
@@ -95,6 +95,41 @@ struct page {
 	uint8_t contents[PAGE_SIZE]; /**< A 4-KByte page in the memory. */
 } __aligned(PAGE_SIZE);
 
+/**
+ * @brief Number of free pages a pCPU can keep cached in a page pool without touching the pool bitmap.
+ */
+#define PAGE_MAGAZINE_SIZE	8U
+
+/**
+ * @brief Number of summary words required by a page pool whose bitmap has the specified number of words.
+ */
+#define PAGE_POOL_SUMMARY_SIZE(bitmap_size)	(((bitmap_size) + 63UL) >> 6U)
+
+/**
+ * @brief Maximum number of page pools that can be registered for statistics.
+ *
+ * One page pool for the hypervisor's MMU, one per VM for EPT and one for the shadow EPT of nested VMX.
+ */
+#define MAX_PAGE_POOL_NUM	(CONFIG_MAX_VM_NUM + 2U)
+
+/**
+ * @brief Per-pCPU cache of free pages of a page pool.
+ *
+ * A magazine is only refilled from or flushed to the pool bitmap in batches of (PAGE_MAGAZINE_SIZE / 2) pages, so
+ * most allocations and frees on a pCPU do not contend on the pool lock. Its own lock is only contended when another
+ * pCPU steals pages from it because the pool bitmap is exhausted.
+ *
+ * @consistency N/A
+ * @alignment N/A
+ *
+ * @remark N/A
+ */
+struct page_magazine {
+	spinlock_t lock; /**< The spinlock to protect the magazine against stealing from other pCPUs. */
+	uint32_t nr; /**< The number of pages cached in the magazine. */
+	struct page *pages[PAGE_MAGAZINE_SIZE]; /**< The cached pages, which are marked as allocated in the bitmap. */
+};
+
 /**
  * @brief Data structure that contains a pool of memory pages.
  *
@@ -104,6 +139,9 @@ struct page {
  * the overhead associated with frequent memory page allocations by maintaining a ready-to-use pool of pages.
  * It is used to support the memory management in hypervisor and the extended page-table mechanism for VMs.
  *
+ * The owner of a page pool sets up start_page, bitmap, bitmap_size, summary, dummy_page, name and use_magazine, then
+ * calls init_page_pool() before the first allocation.
+ *
  * @consistency N/A
  * @alignment N/A
  *
@@ -121,6 +159,13 @@ struct page_pool {
          */
         uint64_t *bitmap;
         uint64_t bitmap_size; /**< The number of bitmap. */
+        /**
+         * @brief A pointer to the summary bitmap of the pool, or NULL.
+         *
+         * Bit i of the summary is set when word i of the bitmap is full, so a free page is found by scanning
+         * PAGE_POOL_SUMMARY_SIZE(bitmap_size) words instead of bitmap_size words.
+         */
+        uint64_t *summary;
         uint64_t last_hint_id; /**< The last bitmap ID that is used to allocate a page. */
         /**
          * @brief A pointer to the dummy page
@@ -128,10 +173,34 @@ struct page_pool {
          * This is used when there's no page available in the pool.
          */
         struct page *dummy_page;
+        const char *name; /**< The name of the pool shown by the debug shell. */
+        bool use_magazine; /**< Whether each pCPU caches free pages of the pool in a magazine. */
+        struct page_magazine magazine[MAX_PCPU_NUM]; /**< The per-pCPU caches of free pages. */
+        int64_t nr_used; /**< The number of pages currently handed out to the users of the pool. */
+        uint64_t high_water; /**< The maximum of nr_used since the pool was initialized. */
+};
+
+/**
+ * @brief Statistics of a page pool, in number of pages.
+ *
+ * @consistency N/A
+ * @alignment N/A
+ *
+ * @remark N/A
+ */
+struct page_pool_stats {
+	uint64_t total; /**< The number of pages in the pool. */
+	uint64_t used; /**< The number of pages handed out to the users of the pool. */
+	uint64_t cached; /**< The number of free pages cached in the per-pCPU magazines. */
+	uint64_t free; /**< The number of free pages in the pool bitmap. */
+	uint64_t high_water; /**< The maximum of used pages since the pool was initialized. */
 };
 
+void init_page_pool(struct page_pool *pool);
 struct page *alloc_page(struct page_pool *pool);
 void free_page(struct page_pool *pool, struct page *page);
+struct page_pool *get_page_pool(uint16_t idx);
+void get_page_pool_stats(struct page_pool *pool, struct page_pool_stats *stats);
 #endif /* PAGE_H */
 
 /**
@@ -20,6 +20,15 @@
 #include <asm/security.h>
 #include <asm/vm_config.h>
 
+/* Cost of the vCPU context switches on a pCPU, see context_switch_in() */
+struct ctx_switch_stats {
+	uint64_t nr_switch;	/* vCPU switch-ins */
+	uint64_t cycles;	/* spent in the switch-out and switch-in callbacks */
+	uint64_t nr_xsave;	/* XSAVE states saved to memory */
+	uint64_t nr_xrstor;	/* XSAVE states restored from memory */
+	uint64_t nr_xstate_live;	/* switch-ins finding their XSAVE state still in the registers */
+};
+
 struct per_cpu_region {
 	/* vmxon_region MUST be 4KB-aligned */
 	uint8_t vmxon_region[PAGE_SIZE];
@@ -64,6 +73,9 @@ struct per_cpu_region {
 	uint64_t shutdown_vm_bitmap;
 	uint64_t tsc_suspend;
 	struct acrn_vcpu *whose_iwkey;
+	/* vCPU whose XSAVE managed state is in this pCPU's registers and not saved yet */
+	struct acrn_vcpu *xsave_owner;
+	struct ctx_switch_stats ctx_switch_stats;
 	/*
 	 * We maintain a per-pCPU array of vCPUs. vCPUs of a VM won't
 	 * share same pCPU. So the maximum possible # of vCPUs that can
@@ -169,6 +169,20 @@ enum _page_table_level {
 	IA32E_PT = 3,       /**< The Page-Table(PT) level in the page tables. */
 };
 
+/**
+ * @brief Statistics of the leaf entries of a page table hierarchy.
+ *
+ * @consistency N/A
+ * @alignment N/A
+ *
+ * @remark N/A
+ */
+struct pgtable_stats {
+	uint64_t nr_leaf[IA32E_PT + 1]; /**< The number of leaf entries per level: 1GB, 2MB and 4KB pages. */
+	uint64_t nr_split; /**< The number of large pages split into next level pages. */
+	uint64_t nr_merge; /**< The number of page tables collapsed back into a 2MB page. */
+};
+
 /**
  * @brief Data structure that contains the related operations and properties of page table.
  *
@@ -207,6 +221,15 @@ struct pgtable {
 	void (*clflush_pagewalk)(const void *p); /**< Function to flush a page table entry from the cache. */
 	void (*tweak_exe_right)(uint64_t *entry); /**< Function to tweak execution rights for an entry. */
 	void (*recover_exe_right)(uint64_t *entry); /**< Function to recover execution rights for an entry. */
+	/**
+	 * @brief Whether a page table is collapsed back into a 2MB page when a modification leaves its 512 entries
+	 *        mapping a contiguous, 2MB aligned range with identical properties.
+	 *
+	 * The caller of pgtable_modify_or_del_map() must flush the paging-structure caches afterwards, as the page
+	 * table is returned to the page pool.
+	 */
+	bool merge_large_page;
+	struct pgtable_stats *stats; /**< Pointer to the leaf entry statistics to maintain, or NULL. */
 };
 
 /**
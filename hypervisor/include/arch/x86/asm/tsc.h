@@ -39,6 +39,13 @@ uint32_t get_tsc_khz(void);
  */
 void calibrate_tsc(void);
 
+/**
+ * @brief Get the time spent by calibrate_tsc().
+ *
+ * @return the calibration time in microseconds
+ */
+uint32_t get_tsc_calibration_us(void);
+
 /**
  * @brief Initialize HPET.
  */
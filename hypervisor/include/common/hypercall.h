@@ -153,6 +153,22 @@ int32_t hcall_pause_vm(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64
  */
 int32_t hcall_set_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Get the VM exit latency histogram of a vCPU
+ *
+ * Copy the log2 histogram of the VM exit to VM entry latency of one basic
+ * exit reason of one vCPU of the target VM.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vmexit_latency
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_vmexit_latency(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief set or clear IRQ line
  *
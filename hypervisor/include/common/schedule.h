@@ -11,6 +11,7 @@
 #include <timer.h>
 
 #define	NEED_RESCHEDULE		(1U)
+#define	NEED_BALANCE		(2U)
 
 #define DEL_MODE_INIT		(1U)
 #define DEL_MODE_IPI		(2U)
@@ -53,9 +54,10 @@ struct sched_params {
 struct thread_object;
 typedef void (*thread_entry_t)(struct thread_object *obj);
 typedef void (*switch_t)(struct thread_object *obj);
+typedef bool (*migrate_t)(struct thread_object *obj, uint16_t dest_pcpu_id);
 struct thread_object {
 	char name[16];
-	uint16_t pcpu_id;
+	volatile uint16_t pcpu_id;
 	struct sched_control *sched_ctl;
 	thread_entry_t thread_entry;
 	volatile enum thread_object_state status;
@@ -64,6 +66,11 @@ struct thread_object {
 	uint64_t host_sp;
 	switch_t switch_out;
 	switch_t switch_in;
+	/*
+	 * Called on the source pCPU, with the schedule locks of both pCPUs held, to move
+	 * the thread to dest_pcpu_id; returns false to refuse. NULL if the thread is pinned.
+	 */
+	migrate_t migrate;
 
 	uint8_t data[THREAD_DATA_SIZE];
 };
@@ -75,6 +82,11 @@ struct sched_control {
 	spinlock_t scheduler_lock;	/* to protect sched_control and thread_object */
 	struct acrn_scheduler *scheduler;
 	void *priv;
+
+	/* a thread that an idle pCPU asked to pull from this pCPU, moved by the next schedule() here */
+	struct thread_object *migrate_obj;
+	uint16_t migrate_dest;
+	uint64_t balance_tsc;		/* last sched_balance_pull() of this idle pCPU */
 };
 
 #define SCHEDULER_MAX_NUMBER 4U
@@ -117,11 +129,23 @@ struct sched_iorr_control {
 };
 
 extern struct acrn_scheduler sched_bvt;
+/* minimum charging unit of the BVT scheduler */
+#define BVT_MCU_MS		1U
 struct sched_bvt_control {
 	struct list_head runqueue;
 	struct hv_timer tick_timer;
 	/* The minimum AVT of any runnable threads */
 	int64_t svt;
+
+	/* statistics of the one-shot preemption timer */
+	uint64_t stats_start_tsc;
+	uint64_t last_pick_tsc;
+	/* a preemption was armed by the last pick, even if its timer fired since */
+	bool preempt_armed;
+	/* time spent with a preemption armed, i.e. with more than one runnable thread */
+	uint64_t contended_tsc;
+	uint64_t nr_timer_armed;
+	uint64_t nr_timer_fired;
 };
 
 extern struct acrn_scheduler sched_prio;
@@ -145,6 +169,10 @@ void deinit_thread_data(struct thread_object *obj);
 
 void make_reschedule_request(uint16_t pcpu_id);
 bool need_reschedule(uint16_t pcpu_id);
+bool request_thread_migration(struct thread_object *obj, uint16_t dest_pcpu_id);
+bool need_balance(uint16_t pcpu_id);
+void sched_balance_pull(uint16_t pcpu_id);
+void sched_balance_kick(const struct thread_object *obj);
 
 void run_thread(struct thread_object *obj);
 void sleep_thread(struct thread_object *obj);
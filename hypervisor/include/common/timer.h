@@ -27,11 +27,30 @@ enum tick_mode {
 	TICK_MODE_PERIODIC,	/**< periodic mode */
 };
 
+/**
+ * @brief Timer wheel geometry
+ *
+ * A level 0 slot spans 2^TIMER_WHEEL_TICK_SHIFT TSC cycles, and each slot of level n spans all the
+ * TIMER_WHEEL_SLOTS slots of level n - 1. The timers beyond the last level are kept in an overflow list.
+ */
+#define TIMER_WHEEL_TICK_SHIFT	12U
+#define TIMER_WHEEL_SLOT_SHIFT	6U
+#define TIMER_WHEEL_SLOTS	(1U << TIMER_WHEEL_SLOT_SHIFT)
+#define TIMER_WHEEL_LEVELS	4U
+
 /**
  * @brief Definition of timers for per-cpu
+ *
+ * The slots are unsorted lists, so adding or deleting a timer is O(1). Only the first non-empty slot is
+ * scanned for the nearest deadline, and a slot of an upper level is cascaded to the lower levels once the
+ * wheel clock reaches it.
  */
 struct per_cpu_timers {
-	struct list_head timer_list;	/**< it's for runtime active timer list */
+	struct list_head wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];	/**< active timers by deadline */
+	uint64_t pending[TIMER_WHEEL_LEVELS];	/**< bitmap of the slots which may be non-empty */
+	struct list_head overflow;	/**< active timers beyond the last level */
+	uint64_t clk;			/**< wheel clock, in level 0 slots */
+	uint64_t deadline;		/**< TSC deadline programmed, 0 if none */
 };
 
 /**
@@ -114,6 +133,13 @@ int32_t add_timer(struct hv_timer *timer);
  */
 void del_timer(struct hv_timer *timer);
 
+/**
+ * @brief Get the nearest deadline of the active timers of the current pCPU.
+ *
+ * @retval TSC deadline of the nearest timer, 0 if no timer is active.
+ */
+uint64_t next_timer_deadline(void);
+
 /**
  * @brief Initialize timer.
  */
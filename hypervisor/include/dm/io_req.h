@@ -174,6 +174,53 @@ struct mem_io_node {
 	uint64_t range_end;
 };
 
+/**
+ * @brief Index of the registered MMIO handler nodes of a VM
+ *
+ * emul_mmio[] slots are kept sorted by range_start so that the node of an
+ * MMIO access can be found with a binary search instead of a linear walk.
+ */
+struct mem_io_index {
+	/**
+	 * @brief Slots of the registered nodes in emul_mmio[], sorted by range_start
+	 */
+	uint16_t slot[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+
+	/**
+	 * @brief max_end[i] is the largest range_end among slot[0..i]
+	 *
+	 * It bounds the backward walk needed when registered ranges overlap.
+	 */
+	uint64_t max_end[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+
+	/**
+	 * @brief Number of valid entries in \p slot
+	 */
+	uint16_t nr;
+
+	/**
+	 * @brief Whether any two registered ranges overlap
+	 */
+	bool overlap;
+
+	/**
+	 * @brief Generation, bumped on each register/unregister to invalidate
+	 * the per-vCPU caches
+	 */
+	uint32_t gen;
+};
+
+/**
+ * @brief Per-vCPU cache of the last MMIO node hit, with lookup statistics
+ */
+struct mem_io_cache {
+	uint32_t gen;		/**< mem_io_index gen when \p slot was cached, 0 if none */
+	uint16_t slot;		/**< emul_mmio[] slot of the last hit */
+	uint64_t nr_lookup;	/**< MMIO exits looked up in the handler index */
+	uint64_t nr_hit;	/**< Lookups served by the cached slot */
+	uint64_t nr_probe;	/**< Nodes compared by the index lookups */
+};
+
 /* External Interfaces */
 
 /**
@@ -38,6 +38,7 @@
 
 #include <asm/apicreg.h>
 #include <asm/ioapic.h>
+#include <asm/irq.h>
 #include <util.h>
 
 #define	VIOAPIC_BASE	0xFEC00000UL
@@ -60,15 +61,23 @@ struct acrn_single_vioapic {
 	union ioapic_rte rtbl[REDIR_ENTRIES_HW];
 	/* pin_state status bitmap: 1 - high, 0 - low */
 	uint64_t pin_state[STATE_BITMAP_SIZE];
+	/* level triggered pins of each vector, updated on RTE writes */
+	uint64_t vector_pins[NR_MAX_VECTOR + 1U][STATE_BITMAP_SIZE];
+	/* decoded destination of each pin, valid while dest_gen[pin] == acrn_vioapics.dest_gen */
+	uint64_t dest_mask[REDIR_ENTRIES_HW];
+	uint64_t dest_gen[REDIR_ENTRIES_HW];
 };
 
 /*
  * ioapic_num represents the number of IO-APICs emulated for the VM.
  * nr_gsi represents the maximum number of GSI emulated for the VM.
+ * dest_gen is bumped whenever a vLAPIC of the VM changes how a destination is decoded,
+ * which invalidates the cached destinations of all the pins.
  */
 struct acrn_vioapics {
 	uint8_t ioapic_num;
 	uint32_t nr_gsi;
+	uint64_t dest_gen;
 	struct acrn_single_vioapic vioapic_array[CONFIG_MAX_IOAPIC_NUM];
 };
 
@@ -113,6 +122,7 @@ void	vioapic_set_irqline_nolock(const struct acrn_vm *vm, uint32_t vgsi, uint32_
 
 uint32_t get_vm_gsicount(const struct acrn_vm *vm);
 void	vioapic_broadcast_eoi(const struct acrn_vm *vm, uint32_t vector);
+void	vioapic_flush_dest_cache(const struct acrn_vm *vm);
 void	vioapic_get_rte(const struct acrn_vm *vm, uint32_t vgsi, union ioapic_rte *rte);
 int32_t	vioapic_mmio_access_handler(struct io_request *io_req, void *handler_private_data);
 struct acrn_single_vioapic *vgsi_to_vioapic_and_vpin(const struct acrn_vm *vm, uint32_t vgsi, uint32_t *vpin);
@@ -39,6 +39,7 @@
 #define HC_CREATE_VCPU              BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x04UL)
 #define HC_RESET_VM                 BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x05UL)
 #define HC_SET_VCPU_REGS            BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x06UL)
+#define HC_GET_VMEXIT_LATENCY       BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x07UL)
 
 /* IRQ and Interrupts */
 #define HC_ID_IRQ_BASE              0x20UL
@@ -225,6 +226,38 @@ struct hv_npk_log_param {
 	uint64_t mmio_addr;
 } __aligned(8);
 
+/* Number of log2 buckets of struct acrn_vmexit_latency */
+#define ACRN_VMEXIT_LAT_BUCKETS		24U
+/* log2 of the upper bound, in TSC cycles, of the first bucket of struct acrn_vmexit_latency */
+#define ACRN_VMEXIT_LAT_MIN_SHIFT	9U
+
+/**
+ * @brief Info to get the VM exit latency histogram of a vCPU
+ *
+ * the parameter for HC_GET_VMEXIT_LATENCY hypercall
+ *
+ * The latency of a VM exit is the number of TSC cycles from the VM exit to
+ * the next VM entry of the vCPU, including the round trip to the device model
+ * for I/O requests and the time the vCPU was descheduled (e.g. for HLT).
+ * count[0] counts the exits shorter than 2^ACRN_VMEXIT_LAT_MIN_SHIFT cycles,
+ * count[i] the exits in [2^(i + ACRN_VMEXIT_LAT_MIN_SHIFT - 1),
+ * 2^(i + ACRN_VMEXIT_LAT_MIN_SHIFT)) cycles, and the last bucket every exit
+ * longer than that.
+ */
+struct acrn_vmexit_latency {
+	/** the vCPU to query, set by the caller */
+	uint16_t vcpu_id;
+
+	/** the basic VM exit reason to query, set by the caller */
+	uint16_t exit_reason;
+
+	/** the TSC frequency in kHz, to convert cycles to time */
+	uint32_t tsc_khz;
+
+	/** the number of VM exits in each latency bucket */
+	uint64_t count[ACRN_VMEXIT_LAT_BUCKETS];
+} __aligned(8);
+
 /**
  * the parameter for HC_GET_HW_INFO hypercall
  */
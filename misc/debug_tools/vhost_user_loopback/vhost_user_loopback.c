@@ -0,0 +1,601 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Minimal vhost-user virtio-net backend: every packet the guest transmits
+ * is received back by the guest. It serves as the peer to validate the
+ * vhost-user transport of the device model without any network setup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <linux/virtio_ring.h>
+#include <linux/virtio_net.h>
+#include <linux/virtio_config.h>
+
+#define VHOST_USER_GET_FEATURES		1
+#define VHOST_USER_SET_FEATURES		2
+#define VHOST_USER_SET_OWNER		3
+#define VHOST_USER_RESET_OWNER		4
+#define VHOST_USER_SET_MEM_TABLE	5
+#define VHOST_USER_SET_VRING_NUM	8
+#define VHOST_USER_SET_VRING_ADDR	9
+#define VHOST_USER_SET_VRING_BASE	10
+#define VHOST_USER_GET_VRING_BASE	11
+#define VHOST_USER_SET_VRING_KICK	12
+#define VHOST_USER_SET_VRING_CALL	13
+
+#define VHOST_USER_VERSION		0x1
+#define VHOST_USER_REPLY_MASK		(0x1 << 2)
+#define VHOST_USER_VRING_IDX_MASK	0xff
+#define VHOST_USER_VRING_NOFD_MASK	(0x1 << 8)
+#define VHOST_USER_MAX_REGIONS		8
+
+#define LOOPBACK_FEATURES	((1UL << VIRTIO_NET_F_MRG_RXBUF) | \
+				(1UL << VIRTIO_F_VERSION_1))
+
+#define RXQ		0
+#define TXQ		1
+#define NR_VRINGS	2
+#define MAX_PKT_LEN	(65536 + sizeof(struct virtio_net_hdr_mrg_rxbuf))
+#define MAX_CHAIN_LEN	64
+
+struct vhost_user_region {
+	uint64_t guest_phys_addr;
+	uint64_t memory_size;
+	uint64_t userspace_addr;
+	uint64_t mmap_offset;
+};
+
+struct vhost_user_memory {
+	uint32_t nregions;
+	uint32_t padding;
+	struct vhost_user_region regions[VHOST_USER_MAX_REGIONS];
+};
+
+struct vring_state {
+	unsigned int index;
+	unsigned int num;
+};
+
+struct vring_addr {
+	unsigned int index;
+	unsigned int flags;
+	uint64_t desc_user_addr;
+	uint64_t used_user_addr;
+	uint64_t avail_user_addr;
+	uint64_t log_guest_addr;
+};
+
+struct vhost_user_msg {
+	uint32_t request;
+	uint32_t flags;
+	uint32_t size;
+	union {
+		uint64_t u64;
+		struct vring_state state;
+		struct vring_addr addr;
+		struct vhost_user_memory memory;
+	} payload;
+} __attribute__((packed));
+
+#define VHOST_USER_HDR_SIZE	offsetof(struct vhost_user_msg, payload)
+
+struct mem_region {
+	uint64_t gpa;
+	uint64_t size;
+	uint64_t uaddr;
+	uint8_t *hva;
+	void *mmap_addr;
+	size_t mmap_size;
+};
+
+struct loop_vring {
+	unsigned int num;
+	struct vring_desc *desc;
+	struct vring_avail *avail;
+	struct vring_used *used;
+	uint16_t last_avail;
+	int kick_fd;
+	int call_fd;
+	bool started;
+};
+
+static struct mem_region regions[VHOST_USER_MAX_REGIONS];
+static int nregions;
+static struct loop_vring vrings[NR_VRINGS];
+static uint64_t features;
+static int hdr_len;
+static int verbose;
+
+static struct vhost_user_memory mem_table;
+static uint8_t pkt[MAX_PKT_LEN];
+
+static void
+unmap_regions(void)
+{
+	int i;
+
+	for (i = 0; i < nregions; i++)
+		munmap(regions[i].mmap_addr, regions[i].mmap_size);
+	nregions = 0;
+}
+
+static void *
+gpa_to_hva(uint64_t gpa, uint64_t len)
+{
+	int i;
+
+	for (i = 0; i < nregions; i++) {
+		if (gpa >= regions[i].gpa && len <= regions[i].size &&
+		    gpa - regions[i].gpa <= regions[i].size - len)
+			return regions[i].hva + (gpa - regions[i].gpa);
+	}
+	return NULL;
+}
+
+/* the ring addresses are given in the address space of the front end */
+static void *
+uaddr_to_hva(uint64_t uaddr)
+{
+	int i;
+
+	for (i = 0; i < nregions; i++) {
+		if (uaddr >= regions[i].uaddr &&
+		    uaddr - regions[i].uaddr < regions[i].size)
+			return regions[i].hva + (uaddr - regions[i].uaddr);
+	}
+	return NULL;
+}
+
+static void
+close_fd(int *fd)
+{
+	if (*fd >= 0) {
+		close(*fd);
+		*fd = -1;
+	}
+}
+
+static void
+vring_reset(struct loop_vring *vr)
+{
+	close_fd(&vr->kick_fd);
+	close_fd(&vr->call_fd);
+	vr->num = 0;
+	vr->desc = NULL;
+	vr->avail = NULL;
+	vr->used = NULL;
+	vr->last_avail = 0;
+	vr->started = false;
+}
+
+static void
+vring_signal(struct loop_vring *vr)
+{
+	uint64_t val = 1;
+
+	if (vr->call_fd < 0 || (vr->avail->flags & VRING_AVAIL_F_NO_INTERRUPT))
+		return;
+	if (write(vr->call_fd, &val, sizeof(val)) != sizeof(val))
+		fprintf(stderr, "call fd signal failed: %s\n", strerror(errno));
+}
+
+static bool
+vring_has_descs(struct loop_vring *vr)
+{
+	return vr->started &&
+		(uint16_t)(vr->avail->idx - vr->last_avail) != 0;
+}
+
+/*
+ * Map the descriptor chain of the next available buffer. Only direct
+ * descriptors are used, as VIRTIO_RING_F_INDIRECT_DESC is not offered.
+ */
+static int
+vring_getchain(struct loop_vring *vr, uint16_t *head, struct iovec *iov, int max)
+{
+	struct vring_desc *desc;
+	uint16_t idx;
+	int n = 0;
+
+	__sync_synchronize();
+	idx = vr->avail->ring[vr->last_avail % vr->num];
+	vr->last_avail++;
+	*head = idx;
+
+	do {
+		if (idx >= vr->num || n >= max)
+			return -1;
+		desc = &vr->desc[idx];
+		iov[n].iov_base = gpa_to_hva(desc->addr, desc->len);
+		iov[n].iov_len = desc->len;
+		if (iov[n].iov_base == NULL)
+			return -1;
+		n++;
+		idx = desc->next;
+	} while (desc->flags & VRING_DESC_F_NEXT);
+
+	return n;
+}
+
+static void
+vring_relchain(struct loop_vring *vr, uint16_t head, uint32_t len)
+{
+	struct vring_used_elem *elem;
+
+	elem = &vr->used->ring[vr->used->idx % vr->num];
+	elem->id = head;
+	elem->len = len;
+	__sync_synchronize();
+	vr->used->idx++;
+}
+
+/* Receive every transmitted packet back, as long as there are rx buffers */
+static void
+loopback(void)
+{
+	struct loop_vring *tx = &vrings[TXQ], *rx = &vrings[RXQ];
+	struct iovec iov[MAX_CHAIN_LEN];
+	struct virtio_net_hdr_mrg_rxbuf *hdr;
+	uint16_t head;
+	size_t len, off, n_copy;
+	int i, n, done = 0;
+
+	while (vring_has_descs(tx) && vring_has_descs(rx)) {
+		n = vring_getchain(tx, &head, iov, MAX_CHAIN_LEN);
+		if (n < 0) {
+			fprintf(stderr, "bad tx chain\n");
+			return;
+		}
+		len = 0;
+		for (i = 0; i < n && len < sizeof(pkt); i++) {
+			n_copy = iov[i].iov_len;
+			if (n_copy > sizeof(pkt) - len)
+				n_copy = sizeof(pkt) - len;
+			memcpy(pkt + len, iov[i].iov_base, n_copy);
+			len += n_copy;
+		}
+		vring_relchain(tx, head, 0);
+
+		n = vring_getchain(rx, &head, iov, MAX_CHAIN_LEN);
+		if (n < 0) {
+			fprintf(stderr, "bad rx chain\n");
+			return;
+		}
+		if (len < hdr_len || iov[0].iov_len < hdr_len) {
+			vring_relchain(rx, head, 0);
+			continue;
+		}
+		/* the whole packet goes to one rx buffer */
+		hdr = (struct virtio_net_hdr_mrg_rxbuf *)pkt;
+		if (hdr_len == sizeof(*hdr))
+			hdr->num_buffers = 1;
+		off = 0;
+		for (i = 0; i < n && off < len; i++) {
+			n_copy = iov[i].iov_len;
+			if (n_copy > len - off)
+				n_copy = len - off;
+			memcpy(iov[i].iov_base, pkt + off, n_copy);
+			off += n_copy;
+		}
+		vring_relchain(rx, head, off);
+		done++;
+		if (verbose)
+			printf("looped back %zu bytes\n", len - hdr_len);
+	}
+
+	if (done) {
+		vring_signal(tx);
+		vring_signal(rx);
+	}
+}
+
+static int
+send_reply(int conn, struct vhost_user_msg *msg, uint32_t size)
+{
+	msg->flags = VHOST_USER_VERSION | VHOST_USER_REPLY_MASK;
+	msg->size = size;
+	if (send(conn, msg, VHOST_USER_HDR_SIZE + size, MSG_NOSIGNAL) !=
+	    VHOST_USER_HDR_SIZE + size)
+		return -1;
+	return 0;
+}
+
+static int
+recv_msg(int conn, struct vhost_user_msg *msg, int *fds, int *nfds)
+{
+	char control[CMSG_SPACE(VHOST_USER_MAX_REGIONS * sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	ssize_t rc;
+
+	iov.iov_base = msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+
+	rc = recvmsg(conn, &mh, MSG_CMSG_CLOEXEC);
+	if (rc != VHOST_USER_HDR_SIZE || msg->size > sizeof(msg->payload))
+		return -1;
+
+	*nfds = 0;
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS) {
+			*nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+			break;
+		}
+	}
+
+	if (msg->size > 0 &&
+	    recv(conn, &msg->payload, msg->size, MSG_WAITALL) != msg->size)
+		return -1;
+	return 0;
+}
+
+static int
+set_mem_table(struct vhost_user_msg *msg, int *fds, int nfds)
+{
+	struct vhost_user_memory *mem = &mem_table;
+	struct vhost_user_region *r;
+	void *addr;
+	uint32_t i;
+
+	/* the payload of the packed message is not aligned */
+	memcpy(mem, (uint8_t *)msg + VHOST_USER_HDR_SIZE, sizeof(*mem));
+	unmap_regions();
+	if (mem->nregions > VHOST_USER_MAX_REGIONS || mem->nregions != nfds)
+		return -1;
+
+	for (i = 0; i < mem->nregions; i++) {
+		r = &mem->regions[i];
+		addr = mmap(NULL, r->memory_size + r->mmap_offset,
+			PROT_READ | PROT_WRITE, MAP_SHARED, fds[i], 0);
+		close(fds[i]);
+		if (addr == MAP_FAILED) {
+			fprintf(stderr, "mmap of region %u failed: %s\n",
+				i, strerror(errno));
+			return -1;
+		}
+		regions[i].gpa = r->guest_phys_addr;
+		regions[i].size = r->memory_size;
+		regions[i].uaddr = r->userspace_addr;
+		regions[i].mmap_addr = addr;
+		regions[i].mmap_size = r->memory_size + r->mmap_offset;
+		regions[i].hva = (uint8_t *)addr + r->mmap_offset;
+		nregions++;
+		if (verbose)
+			printf("region %u: gpa 0x%lx size 0x%lx\n", i,
+				r->guest_phys_addr, r->memory_size);
+	}
+	return 0;
+}
+
+/* Handle one request; return -1 to drop the connection */
+static int
+handle_msg(int conn)
+{
+	struct vhost_user_msg msg;
+	struct loop_vring *vr;
+	int fds[VHOST_USER_MAX_REGIONS];
+	int i, nfds;
+
+	if (recv_msg(conn, &msg, fds, &nfds) < 0)
+		return -1;
+
+	switch (msg.request) {
+	case VHOST_USER_GET_FEATURES:
+		msg.payload.u64 = LOOPBACK_FEATURES;
+		return send_reply(conn, &msg, sizeof(msg.payload.u64));
+	case VHOST_USER_SET_FEATURES:
+		features = msg.payload.u64 & LOOPBACK_FEATURES;
+		hdr_len = (features & ((1UL << VIRTIO_NET_F_MRG_RXBUF) |
+			(1UL << VIRTIO_F_VERSION_1))) ?
+			sizeof(struct virtio_net_hdr_mrg_rxbuf) :
+			sizeof(struct virtio_net_hdr);
+		break;
+	case VHOST_USER_SET_OWNER:
+		break;
+	case VHOST_USER_RESET_OWNER:
+		for (i = 0; i < NR_VRINGS; i++)
+			vring_reset(&vrings[i]);
+		break;
+	case VHOST_USER_SET_MEM_TABLE:
+		if (set_mem_table(&msg, fds, nfds) < 0)
+			return -1;
+		nfds = 0;
+		break;
+	case VHOST_USER_SET_VRING_NUM:
+	case VHOST_USER_SET_VRING_BASE:
+	case VHOST_USER_GET_VRING_BASE:
+		if (msg.payload.state.index >= NR_VRINGS)
+			return -1;
+		vr = &vrings[msg.payload.state.index];
+		if (msg.request == VHOST_USER_SET_VRING_NUM) {
+			vr->num = msg.payload.state.num;
+		} else if (msg.request == VHOST_USER_SET_VRING_BASE) {
+			vr->last_avail = msg.payload.state.num;
+		} else {
+			vr->started = false;
+			close_fd(&vr->kick_fd);
+			msg.payload.state.num = vr->last_avail;
+			return send_reply(conn, &msg, sizeof(msg.payload.state));
+		}
+		break;
+	case VHOST_USER_SET_VRING_ADDR:
+		if (msg.payload.addr.index >= NR_VRINGS)
+			return -1;
+		vr = &vrings[msg.payload.addr.index];
+		vr->desc = uaddr_to_hva(msg.payload.addr.desc_user_addr);
+		vr->avail = uaddr_to_hva(msg.payload.addr.avail_user_addr);
+		vr->used = uaddr_to_hva(msg.payload.addr.used_user_addr);
+		if (!vr->desc || !vr->avail || !vr->used)
+			return -1;
+		break;
+	case VHOST_USER_SET_VRING_KICK:
+	case VHOST_USER_SET_VRING_CALL:
+		i = msg.payload.u64 & VHOST_USER_VRING_IDX_MASK;
+		if (i >= NR_VRINGS)
+			return -1;
+		vr = &vrings[i];
+		if (msg.request == VHOST_USER_SET_VRING_CALL) {
+			close_fd(&vr->call_fd);
+			if (!(msg.payload.u64 & VHOST_USER_VRING_NOFD_MASK) &&
+			    nfds == 1) {
+				vr->call_fd = fds[0];
+				nfds = 0;
+			}
+		} else {
+			close_fd(&vr->kick_fd);
+			vr->started = false;
+			if (!(msg.payload.u64 & VHOST_USER_VRING_NOFD_MASK) &&
+			    nfds == 1) {
+				vr->kick_fd = fds[0];
+				nfds = 0;
+				vr->started = vr->num && vr->desc;
+			}
+		}
+		break;
+	default:
+		fprintf(stderr, "unsupported request %u\n", msg.request);
+		break;
+	}
+
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+	return 0;
+}
+
+static void
+serve(int conn)
+{
+	struct pollfd pfds[1 + NR_VRINGS];
+	uint64_t val;
+	int i, n;
+
+	while (1) {
+		pfds[0].fd = conn;
+		pfds[0].events = POLLIN;
+		n = 1;
+		for (i = 0; i < NR_VRINGS; i++) {
+			if (vrings[i].started) {
+				pfds[n].fd = vrings[i].kick_fd;
+				pfds[n].events = POLLIN;
+				n++;
+			}
+		}
+
+		if (poll(pfds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 1; i < n; i++) {
+			if (pfds[i].revents & POLLIN) {
+				if (read(pfds[i].fd, &val, sizeof(val)) < 0)
+					fprintf(stderr, "kick fd read failed\n");
+			}
+		}
+		/* a kick of either ring may let more packets through */
+		if (n > 1)
+			loopback();
+
+		if (pfds[0].revents & (POLLIN | POLLHUP)) {
+			if (handle_msg(conn) < 0)
+				break;
+			loopback();
+		}
+	}
+
+	for (i = 0; i < NR_VRINGS; i++)
+		vring_reset(&vrings[i]);
+	unmap_regions();
+}
+
+static void
+usage(const char *prog)
+{
+	printf("Usage: %s [-v] <socket path>\n"
+		"  Serve a virtio-net device started with\n"
+		"  'virtio-net,vhost_user=<socket path>', looping back every\n"
+		"  transmitted packet to the receive queue.\n"
+		"  -v  print each looped back packet\n", prog);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un addr;
+	int opt, fd, conn, i;
+
+	while ((opt = getopt(argc, argv, "vh")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1 ||
+	    strlen(argv[optind]) >= sizeof(addr.sun_path)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < NR_VRINGS; i++) {
+		vrings[i].kick_fd = -1;
+		vrings[i].call_fd = -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, argv[optind], sizeof(addr.sun_path) - 1);
+	unlink(addr.sun_path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 1) < 0) {
+		perror("bind");
+		close(fd);
+		return 1;
+	}
+
+	/* one front end at a time, the next one may connect after it quits */
+	while ((conn = accept(fd, NULL, NULL)) >= 0) {
+		printf("front end connected\n");
+		serve(conn);
+		close(conn);
+		printf("front end disconnected\n");
+	}
+
+	close(fd);
+	unlink(addr.sun_path);
+	return 0;
+}
@@ -0,0 +1,357 @@
+/*
+* Copyright (C) 2022 Intel Corporation.
+*
+* SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ivshmem_ring.h"
+
+#define HDR_SIZE	((sizeof(struct ivshm_ring_hdr) + IVSHM_CACHE_LINE - 1U) & ~(size_t)(IVSHM_CACHE_LINE - 1U))
+#define LEN_SIZE	sizeof(uint32_t)
+
+static inline void cpu_relax(void)
+{
+	__asm__ __volatile__("pause" ::: "memory");
+}
+
+/*
+void *ivshm_map(const char *path, size_t *size)
+input: const char *path - The pci resource file, e.g. /sys/bus/pci/devices/<BDF>/resource2
+output: size_t *size - The size of the mapping
+output: void * - The mapping, or NULL on failure
+
+This function maps a whole pci resource file, its size is taken from the file
+*/
+void *ivshm_map(const char *path, size_t *size)
+{
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = open(path, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		perror("Failed to open the resource file");
+		return NULL;
+	}
+
+	if ((fstat(fd, &st) < 0) || (st.st_size <= 0)) {
+		perror("Failed to get the size of the resource file");
+		close(fd);
+		return NULL;
+	}
+
+	/* sysfs allows to map a small BAR0 with a whole page */
+	*size = ((size_t)st.st_size + (size_t)sysconf(_SC_PAGESIZE) - 1U) & ~((size_t)sysconf(_SC_PAGESIZE) - 1U);
+	addr = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		perror("Failed to map the resource file");
+		return NULL;
+	}
+
+	return addr;
+}
+
+void ivshm_unmap(void *addr, size_t size)
+{
+	if (addr != NULL)
+		munmap(addr, size);
+}
+
+/* The geometry is passed in: the header may be rewritten by the peer once it is validated */
+static void ring_setup(struct ivshm_ring *ring, void *shm, uint32_t nr_slots, uint32_t slot_size)
+{
+	ring->hdr = (struct ivshm_ring_hdr *)shm;
+	ring->slots = (uint8_t *)shm + HDR_SIZE;
+	ring->mask = nr_slots - 1U;
+	ring->slot_size = slot_size;
+	ring->head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+	ring->tail = __atomic_load_n(&ring->hdr->tail, __ATOMIC_ACQUIRE);
+	ring->cached_head = ring->head;
+	ring->cached_tail = ring->tail;
+	ring->always_notify = false;
+	ring->wait_fd = -1;
+	ring->nr_kick = 0UL;
+	ring->nr_notify = 0UL;
+	ring->nr_sleep = 0UL;
+}
+
+/*
+int ivshm_ring_create(struct ivshm_ring *ring, void *shm, size_t size, uint32_t slot_size)
+input: void *shm, size_t size - The shared memory region
+input: uint32_t slot_size - Bytes per slot, the payload is 4 bytes smaller
+
+This function formats the region as an empty ring, it is called by the producer.
+The magic is written last, so a consumer attaching concurrently never sees a partial header.
+On success it returns 0
+On failure it returns -1
+*/
+int ivshm_ring_create(struct ivshm_ring *ring, void *shm, size_t size, uint32_t slot_size)
+{
+	struct ivshm_ring_hdr *hdr = (struct ivshm_ring_hdr *)shm;
+	uint32_t nr_slots = 1U;
+
+	slot_size = (slot_size + 7U) & ~7U;
+	if ((slot_size <= LEN_SIZE) || (size < HDR_SIZE + 2U * slot_size)) {
+		fprintf(stderr, "The region is too small for slots of %u bytes\n", slot_size);
+		return -1;
+	}
+
+	while (((size_t)nr_slots * 2U * slot_size) <= (size - HDR_SIZE))
+		nr_slots *= 2U;
+
+	__atomic_store_n(&hdr->magic, 0U, __ATOMIC_RELEASE);
+	hdr->version = IVSHM_RING_VERSION;
+	hdr->nr_slots = nr_slots;
+	hdr->slot_size = slot_size;
+	hdr->head = 0U;
+	hdr->tail = 0U;
+	hdr->consumer_sleeping = 0U;
+	__atomic_store_n(&hdr->magic, IVSHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+	ring_setup(ring, shm, nr_slots, slot_size);
+	return 0;
+}
+
+/*
+int ivshm_ring_attach(struct ivshm_ring *ring, void *shm, size_t size)
+input: void *shm, size_t size - The shared memory region
+
+This function attaches to a ring created by the peer, it is called by the consumer.
+The header comes from another VM, so it is checked against the region size.
+On success it returns 0
+On failure (no ring yet or bad header) it returns -1
+*/
+int ivshm_ring_attach(struct ivshm_ring *ring, void *shm, size_t size)
+{
+	struct ivshm_ring_hdr *hdr = (struct ivshm_ring_hdr *)shm;
+	uint32_t nr_slots, slot_size;
+
+	if ((size < HDR_SIZE) || (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != IVSHM_RING_MAGIC))
+		return -1;
+
+	nr_slots = __atomic_load_n(&hdr->nr_slots, __ATOMIC_RELAXED);
+	slot_size = __atomic_load_n(&hdr->slot_size, __ATOMIC_RELAXED);
+	if ((hdr->version != IVSHM_RING_VERSION) || (nr_slots == 0U) || ((nr_slots & (nr_slots - 1U)) != 0U)
+			|| (slot_size <= LEN_SIZE) || ((size_t)nr_slots * slot_size > size - HDR_SIZE)) {
+		fprintf(stderr, "Invalid ring header\n");
+		return -1;
+	}
+
+	ring_setup(ring, shm, nr_slots, slot_size);
+	return 0;
+}
+
+/*
+int ivshm_ring_enqueue(struct ivshm_ring *ring, const void *buf, uint32_t len)
+
+This function copies one message into the next slot and publishes it.
+The consumer is not notified, call ivshm_ring_kick() after a batch of messages.
+On success it returns 0
+On failure (ring full or message too big) it returns -1
+*/
+int ivshm_ring_enqueue(struct ivshm_ring *ring, const void *buf, uint32_t len)
+{
+	uint32_t head = ring->head;
+	uint8_t *slot;
+
+	if (len > ring->slot_size - LEN_SIZE)
+		return -1;
+
+	if ((head - ring->cached_tail) > ring->mask) {
+		ring->cached_tail = __atomic_load_n(&ring->hdr->tail, __ATOMIC_ACQUIRE);
+		if ((head - ring->cached_tail) > ring->mask)
+			return -1;
+	}
+
+	slot = ring->slots + (size_t)(head & ring->mask) * ring->slot_size;
+	memcpy(slot, &len, LEN_SIZE);
+	memcpy(slot + LEN_SIZE, buf, len);
+
+	ring->head = head + 1U;
+	__atomic_store_n(&ring->hdr->head, ring->head, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+int ivshm_ring_dequeue(struct ivshm_ring *ring, void *buf, uint32_t size)
+
+This function copies the oldest message into buf, truncated to size bytes.
+On success it returns the length of the message
+On failure (ring empty) it returns -1
+*/
+int ivshm_ring_dequeue(struct ivshm_ring *ring, void *buf, uint32_t size)
+{
+	uint32_t tail = ring->tail, len;
+	uint8_t *slot;
+
+	if (tail == ring->cached_head) {
+		ring->cached_head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+		if (tail == ring->cached_head)
+			return -1;
+	}
+
+	slot = ring->slots + (size_t)(tail & ring->mask) * ring->slot_size;
+	memcpy(&len, slot, LEN_SIZE);
+	/* never trust the length written by the peer */
+	if (len > ring->slot_size - LEN_SIZE)
+		len = ring->slot_size - LEN_SIZE;
+	memcpy(buf, slot + LEN_SIZE, (len < size) ? len : size);
+
+	ring->tail = tail + 1U;
+	__atomic_store_n(&ring->hdr->tail, ring->tail, __ATOMIC_RELEASE);
+	return (int)len;
+}
+
+bool ivshm_ring_empty(struct ivshm_ring *ring)
+{
+	if (ring->tail == ring->cached_head)
+		ring->cached_head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+
+	return (ring->tail == ring->cached_head);
+}
+
+/*
+bool ivshm_ring_kick(struct ivshm_ring *ring, struct ivshm_doorbell *db, uint16_t vector)
+
+This function tells the consumer that new messages were enqueued.
+The vector is only added to the pending doorbell vectors when the consumer is asleep,
+the caller writes them with ivshm_doorbell_flush().
+It returns whether a doorbell is needed
+*/
+bool ivshm_ring_kick(struct ivshm_ring *ring, struct ivshm_doorbell *db, uint16_t vector)
+{
+	bool notify = ring->always_notify;
+
+	ring->nr_kick++;
+	if (!notify) {
+		/* order the head store before the flag load, pairs with ivshm_ring_wait() */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		notify = (__atomic_load_n(&ring->hdr->consumer_sleeping, __ATOMIC_RELAXED) != 0U)
+			&& (__atomic_exchange_n(&ring->hdr->consumer_sleeping, 0U, __ATOMIC_SEQ_CST) != 0U);
+	}
+
+	if (notify) {
+		ring->nr_notify++;
+		db->pending |= (uint16_t)(1U << (vector & 0xfU));
+	}
+
+	return notify;
+}
+
+/*
+int ivshm_ring_wait(struct ivshm_ring *ring, unsigned int spin)
+input: unsigned int spin - Number of polls before going to sleep
+
+This function waits until the ring is not empty. It polls first, then publishes
+consumer_sleeping and blocks on wait_fd. Without wait_fd it yields the CPU instead,
+and the producer never needs to ring the doorbell.
+On success it returns 0
+On failure it returns -1 with errno set
+*/
+int ivshm_ring_wait(struct ivshm_ring *ring, unsigned int spin)
+{
+	uint64_t cnt;
+	unsigned int i;
+
+	while (true) {
+		for (i = 0U; i < spin; i++) {
+			if (!ivshm_ring_empty(ring))
+				return 0;
+			cpu_relax();
+		}
+
+		if (ring->wait_fd < 0) {
+			if (!ivshm_ring_empty(ring))
+				return 0;
+			sched_yield();
+			continue;
+		}
+
+		__atomic_store_n(&ring->hdr->consumer_sleeping, 1U, __ATOMIC_SEQ_CST);
+		if (!ivshm_ring_empty(ring)) {
+			/* if the producer already cleared it, its doorbell only leaves a stale count */
+			(void)__atomic_exchange_n(&ring->hdr->consumer_sleeping, 0U, __ATOMIC_SEQ_CST);
+			return 0;
+		}
+
+		ring->nr_sleep++;
+		if ((read(ring->wait_fd, &cnt, sizeof(cnt)) < 0) && (errno != EINTR))
+			return -1;
+	}
+}
+
+/*
+int ivshm_doorbell_open(struct ivshm_doorbell *db, const char *bar0_path, uint16_t peer_id, bool batch)
+input: const char *bar0_path - The pci resource0 file of the ivshmem device, or NULL
+input: uint16_t peer_id - The VM ID of the peer
+input: bool batch - Whether to use the batched doorbell register of the hv-land ivshmem
+
+Without bar0_path, the doorbell writes db->notify_fd, which the caller sets up (loopback).
+On success it returns 0
+On failure it returns -1
+*/
+int ivshm_doorbell_open(struct ivshm_doorbell *db, const char *bar0_path, uint16_t peer_id, bool batch)
+{
+	memset(db, 0, sizeof(*db));
+	db->notify_fd = -1;
+	db->peer_id = peer_id;
+	db->batch = batch;
+
+	if (bar0_path != NULL) {
+		db->regs = (volatile uint32_t *)ivshm_map(bar0_path, &db->regs_size);
+		if (db->regs == NULL)
+			return -1;
+	}
+
+	return 0;
+}
+
+void ivshm_doorbell_close(struct ivshm_doorbell *db)
+{
+	ivshm_unmap((void *)db->regs, db->regs_size);
+	db->regs = NULL;
+}
+
+/*
+void ivshm_doorbell_flush(struct ivshm_doorbell *db)
+
+This function signals all the pending vectors to the peer: one write to the batched doorbell
+register when several vectors are pending, or one write to the doorbell register per vector.
+*/
+void ivshm_doorbell_flush(struct ivshm_doorbell *db)
+{
+	uint32_t peer = (uint32_t)db->peer_id << 16U;
+	uint16_t vectors = db->pending;
+	uint64_t one = 1UL;
+
+	if (vectors == 0U)
+		return;
+	db->pending = 0U;
+
+	if (db->regs == NULL) {
+		if (db->notify_fd >= 0) {
+			(void)write(db->notify_fd, &one, sizeof(one));
+			db->nr_writes++;
+		}
+	} else if (db->batch && ((vectors & (vectors - 1U)) != 0U)) {
+		db->regs[IVSHM_DOORBELL_BATCH_REG >> 2U] = peer | vectors;
+		db->nr_writes++;
+	} else {
+		while (vectors != 0U) {
+			db->regs[IVSHM_DOORBELL_REG >> 2U] = peer | (uint32_t)__builtin_ctz(vectors);
+			vectors &= (uint16_t)(vectors - 1U);
+			db->nr_writes++;
+		}
+	}
+}
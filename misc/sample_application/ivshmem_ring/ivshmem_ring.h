@@ -0,0 +1,93 @@
+/*
+* Copyright (C) 2022 Intel Corporation.
+*
+* SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef IVSHMEM_RING_H
+#define IVSHMEM_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Single producer / single consumer ring laid out in an hv-land ivshmem region.
+ *
+ * The producer only rings the doorbell when the consumer has published that it is
+ * going to sleep, so a busy consumer is fed without any VM exit on the producer side.
+ * Vectors of several rings towards the same peer can be accumulated in an
+ * ivshm_doorbell and signaled with one write to the batched doorbell register.
+ */
+
+#define IVSHM_RING_MAGIC	0x474e4952U	/* "RING" */
+#define IVSHM_RING_VERSION	1U
+#define IVSHM_CACHE_LINE	64U
+
+/* The device-specific registers of the hv-land ivshmem device (BAR0) */
+#define IVSHM_DOORBELL_REG		0xcU
+#define IVSHM_DOORBELL_BATCH_REG	0x10U
+
+/* Layout of the ring header at the beginning of the shared memory region */
+struct ivshm_ring_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_slots;		/* power of 2 */
+	uint32_t slot_size;		/* bytes, including the length word */
+
+	/* written by the producer only */
+	uint32_t head __attribute__((aligned(IVSHM_CACHE_LINE)));
+
+	/* written by the consumer, and cleared by the producer when it notifies */
+	uint32_t tail __attribute__((aligned(IVSHM_CACHE_LINE)));
+	uint32_t consumer_sleeping;
+} __attribute__((aligned(IVSHM_CACHE_LINE)));
+
+/* Local view of a ring, one per side */
+struct ivshm_ring {
+	struct ivshm_ring_hdr *hdr;
+	uint8_t *slots;
+	uint32_t mask;
+	uint32_t slot_size;
+
+	uint32_t head;			/* producer: next slot to fill */
+	uint32_t tail;			/* consumer: next slot to drain */
+	uint32_t cached_head;		/* consumer: last head read from the peer */
+	uint32_t cached_tail;		/* producer: last tail read from the peer */
+
+	bool always_notify;		/* producer: ignore consumer_sleeping */
+	int wait_fd;			/* consumer: eventfd signaled by the ring vector, or -1 */
+
+	unsigned long nr_kick;		/* producer: kicks requested */
+	unsigned long nr_notify;	/* producer: kicks that needed a doorbell */
+	unsigned long nr_sleep;		/* consumer: times it blocked on wait_fd */
+};
+
+/* Doorbell towards one peer */
+struct ivshm_doorbell {
+	volatile uint32_t *regs;	/* mapped BAR0, or NULL */
+	size_t regs_size;
+	int notify_fd;			/* eventfd written instead of BAR0, or -1 */
+	uint16_t peer_id;
+	uint16_t pending;		/* vectors to signal on the next flush */
+	bool batch;			/* the batched doorbell register is available */
+	unsigned long nr_writes;
+};
+
+void *ivshm_map(const char *path, size_t *size);
+void ivshm_unmap(void *addr, size_t size);
+
+int ivshm_ring_create(struct ivshm_ring *ring, void *shm, size_t size, uint32_t slot_size);
+int ivshm_ring_attach(struct ivshm_ring *ring, void *shm, size_t size);
+
+int ivshm_ring_enqueue(struct ivshm_ring *ring, const void *buf, uint32_t len);
+int ivshm_ring_dequeue(struct ivshm_ring *ring, void *buf, uint32_t size);
+bool ivshm_ring_empty(struct ivshm_ring *ring);
+bool ivshm_ring_kick(struct ivshm_ring *ring, struct ivshm_doorbell *db, uint16_t vector);
+int ivshm_ring_wait(struct ivshm_ring *ring, unsigned int spin);
+
+int ivshm_doorbell_open(struct ivshm_doorbell *db, const char *bar0_path, uint16_t peer_id, bool batch);
+void ivshm_doorbell_close(struct ivshm_doorbell *db);
+void ivshm_doorbell_flush(struct ivshm_doorbell *db);
+
+#endif /* IVSHMEM_RING_H */
@@ -0,0 +1,308 @@
+/*
+* Copyright (C) 2022 Intel Corporation.
+*
+* SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include "ivshmem_ring.h"
+
+#define MAX_RINGS		16U
+#define LOOPBACK_REGION_SIZE	(1UL << 20U)
+#define MAX_MSG_SIZE		4096U
+
+struct bench_opts {
+	unsigned long count;		/* messages per ring */
+	uint32_t slot_size;
+	uint32_t msg_size;
+	unsigned int burst;		/* messages enqueued per kick */
+	unsigned int spin;		/* consumer polls before sleeping */
+	unsigned int nr_rings;
+	bool always_notify;
+	bool batch;
+};
+
+static struct bench_opts opts = {
+	.count = 1000000UL,
+	.slot_size = 128U,
+	.msg_size = 64U,
+	.burst = 32U,
+	.spin = 1000U,
+	.nr_rings = 1U,
+	.always_notify = false,
+	.batch = true,
+};
+
+static struct ivshm_ring rings[MAX_RINGS];
+static struct ivshm_doorbell doorbell;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] loopback\n"
+		"       %s [options] producer <resource2> <resource0> <peer VM ID>\n"
+		"       %s [options] consumer <resource2>\n"
+		"Options:\n"
+		"  -n <count>  messages per ring (default %lu)\n"
+		"  -s <bytes>  slot size (default %u)\n"
+		"  -m <bytes>  message size (default %u)\n"
+		"  -b <count>  messages per kick (default %u)\n"
+		"  -w <count>  consumer polls before sleeping (default %u)\n"
+		"  -r <count>  rings, ring i is notified with vector i (default %u, max %u)\n"
+		"  -a          always ring the doorbell, even if the consumer is polling\n"
+		"  -B          do not use the batched doorbell register\n",
+		prog, prog, prog, opts.count, opts.slot_size, opts.msg_size, opts.burst,
+		opts.spin, opts.nr_rings, MAX_RINGS);
+}
+
+/*
+ * Split the region into nr_rings equal parts, each part holds one ring.
+ */
+static int setup_rings(uint8_t *shm, size_t size, bool create)
+{
+	size_t part = (size / opts.nr_rings) & ~(size_t)(IVSHM_CACHE_LINE - 1U);
+	unsigned int i;
+	int ret;
+
+	for (i = 0U; i < opts.nr_rings; i++) {
+		if (create) {
+			ret = ivshm_ring_create(&rings[i], shm + i * part, part, opts.slot_size);
+		} else {
+			/* wait for the producer to format the ring */
+			while ((ret = ivshm_ring_attach(&rings[i], shm + i * part, part)) != 0)
+				usleep(1000U);
+		}
+		if (ret != 0)
+			return ret;
+		rings[i].always_notify = opts.always_notify;
+	}
+
+	return 0;
+}
+
+static void *producer(void *arg)
+{
+	unsigned long sent[MAX_RINGS] = { 0UL }, kicks = 0UL, notifies = 0UL;
+	uint8_t msg[MAX_MSG_SIZE];
+	unsigned int i, n;
+	bool done = false;
+	double start, elapsed;
+
+	(void)arg;
+	memset(msg, 0xa5, sizeof(msg));
+	start = now_sec();
+
+	while (!done) {
+		done = true;
+		for (i = 0U; i < opts.nr_rings; i++) {
+			for (n = 0U; (n < opts.burst) && (sent[i] < opts.count); n++) {
+				memcpy(msg, &sent[i], sizeof(sent[i]));
+				if (ivshm_ring_enqueue(&rings[i], msg, opts.msg_size) != 0)
+					break;
+				sent[i]++;
+			}
+
+			/* a zero length message ends the ring */
+			if ((sent[i] == opts.count) && (ivshm_ring_enqueue(&rings[i], msg, 0U) == 0))
+				sent[i]++;
+
+			if (n != 0U)
+				(void)ivshm_ring_kick(&rings[i], &doorbell, (uint16_t)i);
+			done = done && (sent[i] > opts.count);
+		}
+
+		/* one doorbell write for all the rings kicked in this round */
+		ivshm_doorbell_flush(&doorbell);
+	}
+
+	/* make sure the consumer sees the end markers even if it went to sleep */
+	for (i = 0U; i < opts.nr_rings; i++)
+		(void)ivshm_ring_kick(&rings[i], &doorbell, (uint16_t)i);
+	ivshm_doorbell_flush(&doorbell);
+
+	elapsed = now_sec() - start;
+	for (i = 0U; i < opts.nr_rings; i++) {
+		kicks += rings[i].nr_kick;
+		notifies += rings[i].nr_notify;
+	}
+	printf("producer: %lu messages in %.3f s, %.0f msg/s, %.1f MB/s\n",
+		opts.count * opts.nr_rings, elapsed, (double)(opts.count * opts.nr_rings) / elapsed,
+		(double)(opts.count * opts.nr_rings) * opts.msg_size / elapsed / 1e6);
+	printf("producer: %lu kicks, %lu needed a doorbell, %lu doorbell writes\n",
+		kicks, notifies, doorbell.nr_writes);
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	unsigned long received[MAX_RINGS] = { 0UL }, total = 0UL, errors = 0UL, sleeps = 0UL, seq;
+	uint8_t msg[MAX_MSG_SIZE];
+	unsigned int i, nr_done = 0U;
+	bool done[MAX_RINGS] = { false }, progress;
+	double start = 0.0, elapsed;
+	int len;
+
+	(void)arg;
+	while (nr_done < opts.nr_rings) {
+		progress = false;
+		for (i = 0U; i < opts.nr_rings; i++) {
+			while (!done[i] && ((len = ivshm_ring_dequeue(&rings[i], msg, sizeof(msg))) >= 0)) {
+				if (total == 0UL)
+					start = now_sec();
+				progress = true;
+				if (len == 0) {
+					done[i] = true;
+					nr_done++;
+					break;
+				}
+				memcpy(&seq, msg, sizeof(seq));
+				if (seq != received[i])
+					errors++;
+				received[i]++;
+				total++;
+			}
+		}
+
+		/* several rings cannot sleep on one of them, poll instead */
+		if (!progress && (nr_done < opts.nr_rings)) {
+			if (opts.nr_rings == 1U) {
+				if (ivshm_ring_wait(&rings[0], opts.spin) != 0) {
+					perror("Failed to wait for the ring");
+					break;
+				}
+			} else {
+				sched_yield();
+			}
+		}
+	}
+
+	elapsed = now_sec() - start;
+	for (i = 0U; i < opts.nr_rings; i++)
+		sleeps += rings[i].nr_sleep;
+	printf("consumer: %lu messages in %.3f s, %.0f msg/s, %.1f MB/s, %lu out of order, %lu sleeps\n",
+		total, elapsed, (double)total / elapsed, (double)total * opts.msg_size / elapsed / 1e6,
+		errors, sleeps);
+	return NULL;
+}
+
+/*
+ * Producer and consumer threads in one process, on an anonymous shared mapping.
+ * The doorbell is an eventfd, which exercises the same notification protocol
+ * without an ivshmem device.
+ */
+static int run_loopback(void)
+{
+	pthread_t prod, cons;
+	void *shm;
+	int efd;
+
+	shm = mmap(NULL, LOOPBACK_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	efd = eventfd(0U, 0);
+	if ((shm == MAP_FAILED) || (efd < 0)) {
+		perror("Failed to set up the loopback region");
+		return -1;
+	}
+
+	if ((setup_rings((uint8_t *)shm, LOOPBACK_REGION_SIZE, true) != 0)
+			|| (ivshm_doorbell_open(&doorbell, NULL, 0U, opts.batch) != 0))
+		return -1;
+	doorbell.notify_fd = efd;
+	rings[0].wait_fd = efd;
+
+	pthread_create(&cons, NULL, consumer, NULL);
+	pthread_create(&prod, NULL, producer, NULL);
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+
+	close(efd);
+	munmap(shm, LOOPBACK_REGION_SIZE);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size;
+	void *shm;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "n:s:m:b:w:r:aB")) != -1) {
+		switch (opt) {
+		case 'n':
+			opts.count = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			opts.slot_size = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			opts.msg_size = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			opts.burst = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			opts.spin = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opts.nr_rings = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			opts.always_notify = true;
+			break;
+		case 'B':
+			opts.batch = false;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((optind >= argc) || (opts.nr_rings == 0U) || (opts.nr_rings > MAX_RINGS) || (opts.burst == 0U)
+			|| (opts.msg_size < sizeof(unsigned long)) || (opts.msg_size > MAX_MSG_SIZE)
+			|| (opts.msg_size + sizeof(uint32_t) > opts.slot_size)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (strcmp(argv[optind], "loopback") == 0) {
+		ret = run_loopback();
+	} else if ((strcmp(argv[optind], "producer") == 0) && (argc - optind == 4)) {
+		shm = ivshm_map(argv[optind + 1], &size);
+		if ((shm == NULL) || (setup_rings((uint8_t *)shm, size, true) != 0)
+				|| (ivshm_doorbell_open(&doorbell, argv[optind + 2],
+					(uint16_t)strtoul(argv[optind + 3], NULL, 0), opts.batch) != 0))
+			return 1;
+		producer(NULL);
+		ivshm_doorbell_close(&doorbell);
+		ivshm_unmap(shm, size);
+	} else if ((strcmp(argv[optind], "consumer") == 0) && (argc - optind == 2)) {
+		shm = ivshm_map(argv[optind + 1], &size);
+		if ((shm == NULL) || (setup_rings((uint8_t *)shm, size, false) != 0))
+			return 1;
+		consumer(NULL);
+		ivshm_unmap(shm, size);
+	} else {
+		usage(argv[0]);
+		ret = 1;
+	}
+
+	return (ret == 0) ? 0 : 1;
+}